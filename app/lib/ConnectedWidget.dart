@@ -1,5 +1,6 @@
 import 'dart:async';
 import 'dart:io';
+import 'dart:math';
 import 'dart:typed_data';
 
 import 'package:flutter/services.dart';
@@ -101,6 +102,25 @@ ImagePrepareResult? prepareImageSync(
   return ImagePrepareResult.make(image: image, preview: imageRender);
 }
 
+// Index of each gamma corrected 0xRRGGBB colour of the image, null if it has
+// too many for PixelFormat.palette8
+Map<int, int>? paletteOf(img.Image image) {
+  final palette = <int, int>{};
+  for (int x = 0; x < image.width; x++) {
+    for (int y = 0; y < image.height; y++) {
+      final p = image.getPixel(x, y);
+      final colour = gamma[p & 0xff] << 16 |
+          gamma[(p >> 8) & 0xff] << 8 |
+          gamma[(p >> 16) & 0xff];
+      palette.putIfAbsent(colour, () => palette.length);
+      if (palette.length > PixelPalette.maxColours) {
+        return null;
+      }
+    }
+  }
+  return palette;
+}
+
 Future<ImagePrepareResult?> prepareImage(PlatformFile file,
     {required double widthFactor,
     required int pixels,
@@ -118,15 +138,27 @@ Future<ImagePrepareResult?> prepareImage(PlatformFile file,
   return (await receivePort.first) as ImagePrepareResult?;
 }
 
+// The columns of an image as sent to the stick
+class PackedImage {
+  final PixelFormat format;
+  // Colours of PixelFormat.palette8 as RGB triplets
+  final Uint8List? palette;
+  final List<Uint8List> columns;
+  final int hash;
+
+  PackedImage(this.format, this.palette, this.columns)
+      : hash = imageHash(format, palette, columns);
+}
+
 class ConnectedWidget extends StatefulWidget {
   const ConnectedWidget(
       {super.key,
       required this.connection,
-      required this.pixels,
+      required this.capabilities,
       required this.input});
 
   final BluetoothConnection connection;
-  final int pixels;
+  final Capabilities capabilities;
   final StreamIteratorCustom<ByteData> input;
 
   @override
@@ -154,7 +186,7 @@ class _ConnectedWidget extends State<ConnectedWidget> {
           SingleChildScrollView(
             scrollDirection: Axis.horizontal,
             child: SizedBox(
-              height: widget.pixels.toDouble(),
+              height: widget.capabilities.ledCount.toDouble(),
               width: _image!.preview.width.toDouble(),
               child: Image.memory(_image!.previewJpg, fit: BoxFit.cover),
             ),
@@ -179,12 +211,37 @@ class _ConnectedWidget extends State<ConnectedWidget> {
       double expectedDurationS = _image!.image.width / _speed;
       double distance = _image!.image.width / _image!.image.height;
 
-      streamingControl = ElevatedButton(
+      final start = ElevatedButton(
           onPressed: () {
-            streamImage();
+            start();
           },
           child: Text(
               'Start (${expectedDurationS.toStringAsFixed(2)}s, ${distance.toStringAsFixed(2)}m)'));
+
+      if (widget.capabilities.hasMessage(StoreBegin().id())) {
+        // Stored images play from the stick's flash, without streaming
+        streamingControl = Row(
+          mainAxisAlignment: MainAxisAlignment.spaceEvenly,
+          children: [
+            start,
+            ElevatedButton(
+                onPressed:
+                    _image!.image.width <= widget.capabilities.storeColumns
+                        ? () {
+                            streamImage(packImage(), store: true);
+                          }
+                        : null,
+                child: Text('Store')),
+            ElevatedButton(
+                onPressed: () {
+                  playStored();
+                },
+                child: Text('Play stored')),
+          ],
+        );
+      } else {
+        streamingControl = start;
+      }
     } else {
       streamingControl = Row(
         mainAxisAlignment: MainAxisAlignment.spaceEvenly,
@@ -223,7 +280,7 @@ class _ConnectedWidget extends State<ConnectedWidget> {
                     setState(() => _imageRendering = true);
                     prepareImage(file,
                             widthFactor: 1,
-                            pixels: widget.pixels,
+                            pixels: widget.capabilities.ledCount,
                             brightness: 1)
                         .then((image) {
                       if (image != null) {
@@ -271,9 +328,9 @@ class _ConnectedWidget extends State<ConnectedWidget> {
             Text("speed: " + _speed.toInt().toString() + "px/s"),
             Expanded(
               child: Slider(
-                  value: _speed,
+                  value: min(_speed, maxSpeed().toDouble()),
                   min: 1,
-                  max: 200,
+                  max: maxSpeed().toDouble(),
                   label: "Speed",
                   onChanged: (v) {
                     setState(() => {_speed = v});
@@ -300,7 +357,7 @@ class _ConnectedWidget extends State<ConnectedWidget> {
                         setState(() => _imageRendering = true);
                         prepareImage(_file as PlatformFile,
                                 widthFactor: v,
-                                pixels: widget.pixels,
+                                pixels: widget.capabilities.ledCount,
                                 brightness: _brightness)
                             .then((image) {
                           if (image != null) {
@@ -334,7 +391,7 @@ class _ConnectedWidget extends State<ConnectedWidget> {
                       setState(() => _imageRendering = true);
                       prepareImage(_file as PlatformFile,
                               widthFactor: _widthFactor,
-                              pixels: widget.pixels,
+                              pixels: widget.capabilities.ledCount,
                               brightness: v)
                           .then((image) {
                         if (image != null) {
@@ -357,6 +414,15 @@ class _ConnectedWidget extends State<ConnectedWidget> {
     );
   }
 
+  // BEGIN carries the speed in one byte for sticks of version 0, and the
+  // strip can only refresh so fast
+  int maxSpeed() {
+    final capabilities = widget.capabilities;
+    return capabilities.version >= 1
+        ? capabilities.maxColumnRate
+        : min(255, capabilities.maxColumnRate);
+  }
+
   Future<int> waitAck() async {
     var ok = await widget.input.moveNext();
     if (ok) {
@@ -367,23 +433,133 @@ class _ConnectedWidget extends State<ConnectedWidget> {
     }
   }
 
-  void streamImage() async {
-    PixelBegin().write(widget.connection.output, _speed.toInt());
+  Future<StoreEntryReply> query(StoreQueryParams params) async {
+    StoreQuery().write(widget.connection.output, params);
+    if (!await widget.input.moveNext()) {
+      throw Exception("Connection closed");
+    }
+    return StoreEntry().expect(widget.input.current);
+  }
+
+  // Plays the newest image of the stick's library
+  void playStored() async {
+    await Future.delayed(Duration(milliseconds: (_delay * 1000).toInt()));
+    StorePlay().write(widget.connection.output,
+        StorePlayParams(
+            speed: min(_speed.toInt(), maxSpeed()),
+            version: widget.capabilities.version));
+  }
+
+  // Plays the image from the stick's library when it has it, else streams it
+  void start() async {
+    final packed = packImage();
+    if (widget.capabilities.hasMessage(StoreQuery().id())) {
+      final reply = await query(StoreQueryParams.hash(packed.hash));
+      if (reply.image != null) {
+        debugPrint("Image found in the library");
+        await Future.delayed(Duration(milliseconds: (_delay * 1000).toInt()));
+        StorePlay().write(
+            widget.connection.output,
+            StorePlayParams(
+                speed: min(_speed.toInt(), maxSpeed()),
+                hash: packed.hash,
+                version: widget.capabilities.version));
+        return;
+      }
+    }
+    streamImage(packed);
+  }
+
+  PackedImage packImage() {
+    final capabilities = widget.capabilities;
+    // A palette when the image has few enough colours, else 16 bits per
+    // pixel, as far as the stick supports them
+    final palette = capabilities.hasFormat(PixelFormat.palette8) &&
+            capabilities.hasMessage(PixelPalette().id())
+        ? paletteOf(_image!.image)
+        : null;
+    final format = palette != null
+        ? PixelFormat.palette8
+        : capabilities.hasFormat(PixelFormat.rgb565)
+            ? PixelFormat.rgb565
+            : PixelFormat.rgb888;
+    Uint8List? colours;
+    if (palette != null) {
+      final rgb = Uint8List(palette.length * 3);
+      palette.forEach((colour, i) {
+        rgb[i * 3] = colour >> 16;
+        rgb[i * 3 + 1] = (colour >> 8) & 0xff;
+        rgb[i * 3 + 2] = colour & 0xff;
+      });
+      colours = rgb;
+    }
+
+    final columnBytes = format.columnBytes(capabilities.ledCount);
+    final columns = List.generate(_image!.image.width, (x) {
+      final column = Uint8List(columnBytes);
+      for (int y = 0; y < widget.capabilities.ledCount; y++) {
+        final p = _image!.image.getPixel(x, y);
+        int r = p & 0xff;
+        int g = (p >> 8) & 0xff;
+        int b = (p >> 16) & 0xff;
+        format.pack(column, y, r, g, b, gamma, palette);
+      }
+      return column;
+    });
+    return PackedImage(format, colours, columns);
+  }
+
+  // Plays the image, or with store uploads it to the stick's library
+  void streamImage(PackedImage image, {bool store = false}) async {
+    final capabilities = widget.capabilities;
+    final format = image.format;
+    final packed = image.columns;
+    final coded = capabilities.hasMessage(PixelCoded().id());
+    final compressed = coded && capabilities.hasMessage(PixelLz().id());
+    final cached = capabilities.hasMessage(PixelCached().id());
+    if (image.palette != null) {
+      PixelPalette().write(widget.connection.output, image.palette!);
+    }
+
+    final width = packed.length;
+    final columnBytes = format.columnBytes(capabilities.ledCount);
+    // Columns the ESP already has are replayed instead of sent again
+    final steps = cached
+        ? PixelCached.plan(packed)
+        : List.generate(width, (_) => ColumnStep.sent(null));
+    final columnsPerFrame = capabilities.columnsPerFrame(columnBytes);
+
+    final speed = min(_speed.toInt(), maxSpeed());
+    if (store) {
+      StoreBegin().write(widget.connection.output,
+          StoreBeginParams(speed, format, image.hash, width,
+              version: capabilities.version));
+    } else {
+      PixelBegin().write(widget.connection.output,
+          PixelBeginParams(speed, format, version: capabilities.version));
+    }
     debugPrint("ESP is ready");
 
     setState(() {
       _streaming = 0;
     });
 
-    await Future.delayed(Duration(milliseconds: (_delay * 1000).toInt()));
+    if (!store) {
+      await Future.delayed(Duration(milliseconds: (_delay * 1000).toInt()));
+    }
 
-    var pixelMessage = Uint8List(widget.pixels * 3);
+    // New columns are coded against the previous new one, zeros at first
+    var previous = Uint8List(columnBytes);
+    final pixelMessage = BytesBuilder(copy: false);
+    final compressor = PixelLz();
 
-    var todo = await waitAck();
+    // Total number of columns the ESP allows us to have sent
+    var limit = await waitAck();
 
     var aborted = Abort.no;
 
-    for (var x = 0; x < _image!.image.width; x++) {
+    var x = 0;
+    while (x < width) {
       if (_streaming == null) {
         // Cancelled
         debugPrint("Cancelled");
@@ -391,28 +567,63 @@ class _ConnectedWidget extends State<ConnectedWidget> {
         break;
       }
 
-      for (int y = 0; y < widget.pixels; y++) {
-        final p = _image!.image.getPixel(x, y);
-        int r = p & 0xff;
-        int g = (p >> 8) & 0xff;
-        int b = (p >> 16) & 0xff;
-        pixelMessage[y * 3] = gamma[r];
-        pixelMessage[y * 3 + 1] = gamma[g];
-        pixelMessage[y * 3 + 2] = gamma[b];
+      if (x >= limit) {
+        // Out of credit: wait for the ESP to play some columns
+        try {
+          limit = max(limit, await waitAck());
+        } on Exception catch (_) {
+          aborted = Abort.yes;
+          break;
+        }
+        continue;
       }
 
-      PixelData().write(widget.connection.output, pixelMessage);
-      todo--;
+      // As many columns as we have credit for, in one frame: either new
+      // columns, or columns replayed by the ESP
+      final budget = min(limit, width) - x;
+      final isNew = steps[x].isNew;
+      var columns = 1;
+      while (columns < budget &&
+          steps[x + columns].isNew == isNew &&
+          (!isNew || columns < columnsPerFrame)) {
+        columns++;
+      }
+      final run = steps.sublist(x, x + columns);
+
+      if (isNew) {
+        for (var c = 0; c < columns; c++) {
+          if (coded) {
+            PixelCoded.encodeColumn(
+                packed[x + c], previous, pixelMessage, format.unitBytes);
+          } else {
+            pixelMessage.add(packed[x + c]);
+          }
+          previous = packed[x + c];
+        }
+        if (compressed) {
+          compressor.write(widget.connection.output,
+              compressor.encode(pixelMessage.takeBytes()));
+        } else if (coded) {
+          PixelCoded()
+              .write(widget.connection.output, pixelMessage.takeBytes());
+        } else {
+          PixelData()
+              .write(widget.connection.output, pixelMessage.takeBytes());
+        }
 
-      if (todo == 0) {
-        try {
-          todo = await waitAck();
-        } on Exception catch (_) {}
+        final stores = PixelCached.encodeStores(run);
+        if (stores.isNotEmpty) {
+          PixelCached().write(widget.connection.output, stores);
+        }
+      } else {
+        PixelCached()
+            .write(widget.connection.output, PixelCached.encodeOps(run));
       }
+      x += columns;
 
       setState(() {
         if (_streaming != null) {
-          _streaming = x;
+          _streaming = x - 1;
         }
       });
     }
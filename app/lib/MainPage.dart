@@ -32,7 +32,7 @@ class _MainPage extends State<MainPage> {
   BluetoothConnection? _connection;
   StreamIteratorCustom<ByteData>? _input;
   bool _connecting = false;
-  int? _pixels;
+  Capabilities? _capabilities;
 
   @override
   void initState() {
@@ -118,7 +118,7 @@ class _MainPage extends State<MainPage> {
   }
 
   Widget connectedPage(BluetoothConnection c) {
-    if (_pixels == null) {
+    if (_capabilities == null) {
       return ListView(children: [
         ListTile(title: const Text('Connected to pixel stick')),
         Divider(),
@@ -128,7 +128,8 @@ class _MainPage extends State<MainPage> {
       return ListView(children: [
         ListTile(title: const Text('Connected to pixel stick')),
         Divider(),
-        ConnectedWidget(connection: c, pixels: _pixels!, input: _input!)
+        ConnectedWidget(
+            connection: c, capabilities: _capabilities!, input: _input!)
       ]);
     }
   }
@@ -181,9 +182,10 @@ class _MainPage extends State<MainPage> {
                     if (hasNext) {
                       final response = _input!.current;
 
-                      int pixels = PixelCount().expect(response);
-                      debugPrint("Got pixels: $pixels");
-                      setState(() => {_pixels = pixels});
+                      final capabilities = PixelCount().expect(response);
+                      debugPrint(
+                          "Got pixels: ${capabilities.ledCount}, protocol ${capabilities.version}");
+                      setState(() => {_capabilities = capabilities});
                       return;
                     }
 
@@ -1,4 +1,6 @@
 import 'dart:async';
+import 'dart:math';
+import 'dart:typed_data';
 
 import 'package:flutter/foundation.dart';
 
@@ -33,27 +35,90 @@ abstract class Send<T> {
   }
 }
 
+// Carries the protocol version of the app, so the stick answers with its
+// capabilities
 class Hello extends Send<Null> {
+  static const int version = 1;
+
   int id() {
     return 0;
   }
 
   Uint8List serialize(Null _) {
-    return Uint8List(0);
+    return Uint8List.fromList([version]);
+  }
+}
+
+// What the stick accepts. Firmware from before capabilities only sends the
+// LED count, and only takes RGB888 PixelData.
+class Capabilities {
+  final int ledCount;
+  final int version;
+  final int formats;
+  final int messages;
+  final int ringColumns;
+  final int maxColumnRate;
+  final int maxFrameBytes;
+  // Columns the stick can keep in flash, see StoreBegin
+  final int storeColumns;
+
+  Capabilities(
+      {required this.ledCount,
+      this.version = 0,
+      this.formats = 1 << 0,
+      this.messages = 1 << 0 | 1 << 2 | 1 << 3 | 1 << 5,
+      this.ringColumns = 4 * PixelData.maxColumns,
+      this.maxColumnRate = 200,
+      this.maxFrameBytes = 1 << 16,
+      this.storeColumns = 0});
+
+  bool hasFormat(PixelFormat format) {
+    return formats & (1 << format.index) != 0;
+  }
+
+  bool hasMessage(int id) {
+    return messages & (1 << id) != 0;
+  }
+
+  // Columns to send per frame: few enough to keep several frames in flight
+  // in the ring, and within the frame size limit
+  int columnsPerFrame(int columnBytes) {
+    return max(
+        1,
+        min(PixelData.maxColumns,
+            min(ringColumns ~/ 4, maxFrameBytes ~/ columnBytes)));
   }
 }
 
-class PixelCount extends Parse<int> {
+class PixelCount extends Parse<Capabilities> {
   int id() {
     return 1;
   }
 
-  int parse(ByteData data) {
-    return ByteData.sublistView(data).getUint32(0, Endian.little);
+  Capabilities parse(ByteData data) {
+    final d = ByteData.sublistView(data);
+    final ledCount = d.getUint32(0, Endian.little);
+    if (d.lengthInBytes < 16) {
+      return Capabilities(ledCount: ledCount);
+    }
+    return Capabilities(
+        ledCount: ledCount,
+        version: d.getUint8(4),
+        formats: d.getUint8(5),
+        messages: d.getUint16(6, Endian.little),
+        ringColumns: d.getUint16(8, Endian.little),
+        maxColumnRate: d.getUint16(10, Endian.little),
+        maxFrameBytes: d.getUint32(12, Endian.little),
+        storeColumns:
+            d.lengthInBytes >= 20 ? d.getUint32(16, Endian.little) : 0);
   }
 }
 
+// One or more columns back to back, each of pixelCount RGB triplets.
+// Every column uses one credit granted by PixelAck.
 class PixelData extends Send<Uint8List> {
+  static const int maxColumns = 8;
+
   int id() {
     return 2;
   }
@@ -63,16 +128,552 @@ class PixelData extends Send<Uint8List> {
   }
 }
 
-class PixelBegin extends Send<int> {
+// Same columns as PixelData, each coded against the previous column of the
+// animation (zeros before the first one) as ops of 1 to 64 units: unchanged
+// units, a run of one unit, or literal units. A unit is one pixel, or two
+// in RGB444.
+class PixelCoded extends Send<Uint8List> {
+  static const int skip = 0x00;
+  static const int run = 0x40;
+  static const int literal = 0x80;
+  static const int maxPixels = 64;
+
+  int id() {
+    return 6;
+  }
+
+  Uint8List serialize(Uint8List v) {
+    return v;
+  }
+
+  static bool _samePixel(
+      Uint8List a, int i, Uint8List b, int j, int unitBytes) {
+    for (var k = 0; k < unitBytes; k++) {
+      if (a[i * unitBytes + k] != b[j * unitBytes + k]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static int _runLength(Uint8List column, int pixels, int i, int unitBytes) {
+    var n = 1;
+    while (i + n < pixels &&
+        n < maxPixels &&
+        _samePixel(column, i + n, column, i, unitBytes)) {
+      n++;
+    }
+    return n;
+  }
+
+  // Appends the coded column to out, in ops of units of unitBytes
+  static void encodeColumn(Uint8List column, Uint8List previous,
+      BytesBuilder out, int unitBytes) {
+    final pixels = column.length ~/ unitBytes;
+    var i = 0;
+    while (i < pixels) {
+      var n = 1;
+      if (_samePixel(column, i, previous, i, unitBytes)) {
+        while (i + n < pixels &&
+            n < maxPixels &&
+            _samePixel(column, i + n, previous, i + n, unitBytes)) {
+          n++;
+        }
+        out.addByte(skip | (n - 1));
+      } else if ((n = _runLength(column, pixels, i, unitBytes)) >= 2) {
+        out.addByte(run | (n - 1));
+        out.add(Uint8List.sublistView(
+            column, i * unitBytes, (i + 1) * unitBytes));
+      } else {
+        // Literal pixels until something cheaper starts
+        while (i + n < pixels &&
+            n < maxPixels &&
+            !_samePixel(column, i + n, previous, i + n, unitBytes) &&
+            _runLength(column, pixels, i + n, unitBytes) < 2) {
+          n++;
+        }
+        out.addByte(literal | (n - 1));
+        out.add(Uint8List.sublistView(
+            column, i * unitBytes, (i + n) * unitBytes));
+      }
+      i += n;
+    }
+  }
+}
+
+// PixelCoded columns, LZSS compressed (see main/lzss.h). Each frame ends on
+// a whole token, but the 4 KB window is kept from one frame to the next: use
+// one instance per animation.
+class PixelLz extends Send<Uint8List> {
+  static const int windowBits = 12;
+  static const int lengthBits = 4;
+  static const int window = 1 << windowBits;
+  static const int minMatch = 3;
+  static const int maxMatch = minMatch + (1 << lengthBits) - 1;
+  // Candidates tried per position, most recent first
+  static const int maxChain = 16;
+  static const int _hashBits = 14;
+
+  var _history = Uint8List(1 << 16);
+  var _length = 0;
+  // Positions before this one are in the hash chains
+  var _indexed = 0;
+  final _head = Int32List(1 << _hashBits)..fillRange(0, 1 << _hashBits, -1);
+  final _previous = Int32List(window);
+
+  int id() {
+    return 7;
+  }
+
+  Uint8List serialize(Uint8List v) {
+    return v;
+  }
+
+  int _hash(int i) {
+    final key = _history[i] << 16 | _history[i + 1] << 8 | _history[i + 2];
+    return (key * 2654435761) >> (32 - _hashBits) & ((1 << _hashBits) - 1);
+  }
+
+  void _insert(int i) {
+    final h = _hash(i);
+    _previous[i & (window - 1)] = _head[h];
+    _head[h] = i;
+  }
+
+  Uint8List encode(Uint8List data) {
+    if (_length + data.length > _history.length) {
+      final grown = Uint8List(2 * (_length + data.length));
+      grown.setRange(0, _length, _history);
+      _history = grown;
+    }
+    _history.setRange(_length, _length + data.length, data);
+    _length += data.length;
+
+    final out = Uint8List(data.length + data.length ~/ 8 + 1);
+    var o = 0;
+    var flagsAt = 0;
+    var tokens = 8;
+
+    var i = _length - data.length;
+    while (i < _length) {
+      if (tokens == 8) {
+        flagsAt = o++;
+        tokens = 0;
+      }
+
+      while (_indexed < i && _indexed + minMatch <= _length) {
+        _insert(_indexed++);
+      }
+
+      var best = 0;
+      var distance = 0;
+      if (i + minMatch <= _length) {
+        var j = _head[_hash(i)];
+        for (var chain = 0;
+            j >= 0 && i - j <= window && chain < maxChain;
+            chain++) {
+          var n = 0;
+          while (n < maxMatch &&
+              i + n < _length &&
+              _history[j + n] == _history[i + n]) {
+            n++;
+          }
+          if (n > best) {
+            best = n;
+            distance = i - j;
+          }
+          // Slots are reused every window, a newer position ends the chain
+          final next = _previous[j & (window - 1)];
+          if (next >= j) {
+            break;
+          }
+          j = next;
+        }
+      }
+
+      if (best >= minMatch) {
+        out[flagsAt] |= 1 << tokens;
+        final token = (distance - 1) << lengthBits | (best - minMatch);
+        out[o++] = token >> 8;
+        out[o++] = token & 0xff;
+      } else {
+        best = 1;
+        out[o++] = _history[i];
+      }
+      i += best;
+      tokens++;
+    }
+
+    return Uint8List.sublistView(out, 0, o);
+  }
+}
+
+// How a column gets to the ESP
+class ColumnStep {
+  final bool isNew;
+  // Copied from the column this far back in the ESP's ring, 0 for the last
+  final int? back;
+  // Played from this dictionary entry, or for new columns the entry to keep
+  // them in
+  final int? entry;
+
+  ColumnStep.sent(this.entry)
+      : isNew = true,
+        back = null;
+  ColumnStep.copy(this.back)
+      : isNew = false,
+        entry = null;
+  ColumnStep.play(this.entry)
+      : isNew = false,
+        back = null;
+}
+
+// Columns the ESP already has, replayed from its ring or from a dictionary
+// of 16 columns (see main/column_cache.h). Each replayed column uses one
+// credit like any other.
+class PixelCached extends Send<Uint8List> {
+  static const int copy = 0x00;
+  static const int play = 0x40;
+  static const int store = 0x80;
+  static const int repeat = 0xc0;
+  static const int entries = 16;
+  static const int maxBack = 62;
+  static const int maxRepeat = 64;
+
+  int id() {
+    return 9;
+  }
+
+  Uint8List serialize(Uint8List v) {
+    return v;
+  }
+
+  // FNV-1a
+  static int _hash(Uint8List column) {
+    var h = 0x811c9dc5;
+    for (final b in column) {
+      h = ((h ^ b) * 0x01000193) & 0xffffffff;
+    }
+    return h;
+  }
+
+  static List<ColumnStep> plan(List<Uint8List> columns) {
+    final hashes = columns.map(_hash).toList();
+
+    // Next occurrence of each column
+    final next = List<int?>.filled(columns.length, null);
+    final last = <int, int>{};
+    for (var x = columns.length - 1; x >= 0; x--) {
+      final q = last[hashes[x]];
+      if (q != null && listEquals(columns[q], columns[x])) {
+        next[x] = q;
+      }
+      last[hashes[x]] = x;
+    }
+
+    final seen = <int, int>{};
+    final dictionary = <int, int>{};
+    final owners = List<int?>.filled(entries, null);
+    var victim = 0;
+    final steps = <ColumnStep>[];
+    for (var x = 0; x < columns.length; x++) {
+      final h = hashes[x];
+      final p = seen[h];
+      final entry = dictionary[h];
+      if (x > 0 && listEquals(columns[x - 1], columns[x])) {
+        steps.add(ColumnStep.copy(0));
+      } else if (p != null &&
+          x - 1 - p <= maxBack &&
+          listEquals(columns[p], columns[x])) {
+        steps.add(ColumnStep.copy(x - 1 - p));
+      } else if (entry != null &&
+          listEquals(columns[owners[entry]!], columns[x])) {
+        steps.add(ColumnStep.play(entry));
+      } else {
+        // Keep it if it comes back too late to be copied from the ring
+        int? store;
+        final q = next[x];
+        if (q != null && q - 1 - x > maxBack) {
+          store = victim;
+          victim = (victim + 1) % entries;
+          final old = owners[store];
+          if (old != null) {
+            dictionary.remove(hashes[old]);
+          }
+          owners[store] = x;
+          dictionary[h] = store;
+        }
+        steps.add(ColumnStep.sent(store));
+      }
+      seen[h] = x;
+    }
+    return steps;
+  }
+
+  // Replays a run of columns that are not new
+  static Uint8List encodeOps(List<ColumnStep> steps) {
+    final out = BytesBuilder();
+    var i = 0;
+    while (i < steps.length) {
+      if (steps[i].back == 0) {
+        var n = 1;
+        while (i + n < steps.length &&
+            steps[i + n].back == 0 &&
+            n < maxRepeat) {
+          n++;
+        }
+        out.addByte(repeat | (n - 1));
+        i += n;
+      } else {
+        final step = steps[i++];
+        out.addByte(step.back != null ? copy | step.back! : play | step.entry!);
+      }
+    }
+    return out.takeBytes();
+  }
+
+  // Stores the new columns just sent, the last of steps being the last one
+  static Uint8List encodeStores(List<ColumnStep> steps) {
+    final out = BytesBuilder();
+    for (var i = 0; i < steps.length; i++) {
+      if (steps[i].isNew && steps[i].entry != null) {
+        out.addByte(store | steps[i].entry!);
+        out.addByte(steps.length - 1 - i);
+      }
+    }
+    return out.takeBytes();
+  }
+}
+
+// Packing of the columns of an animation (see main/pixel_format.h). RGB888
+// and palette colours are gamma corrected, the reduced formats carry levels
+// before gamma correction, which the ESP applies.
+enum PixelFormat {
+  rgb888(3),
+  palette8(1),
+  rgb565(2),
+  rgb444(3);
+
+  const PixelFormat(this.unitBytes);
+
+  // Bytes covered by one PixelCoded op: one pixel, or two in RGB444
+  final int unitBytes;
+
+  int columnBytes(int pixels) {
+    return this == rgb444 ? pixels * 3 ~/ 2 : pixels * unitBytes;
+  }
+
+  static int _level(int v, int bits) {
+    return (v * ((1 << bits) - 1) + 127) ~/ 255;
+  }
+
+  // Stores pixel y of a column; palette maps gamma corrected 0xRRGGBB
+  // colours to their index
+  void pack(Uint8List column, int y, int r, int g, int b, Uint8List gamma,
+      Map<int, int>? palette) {
+    switch (this) {
+      case rgb888:
+        column[y * 3] = gamma[r];
+        column[y * 3 + 1] = gamma[g];
+        column[y * 3 + 2] = gamma[b];
+        break;
+      case palette8:
+        column[y] = palette![gamma[r] << 16 | gamma[g] << 8 | gamma[b]]!;
+        break;
+      case rgb565:
+        final v = _level(r, 5) << 11 | _level(g, 6) << 5 | _level(b, 5);
+        column[y * 2] = v >> 8;
+        column[y * 2 + 1] = v & 0xff;
+        break;
+      case rgb444:
+        // Pairs of pixels in RRRRGGGG BBBBRRRR GGGGBBBB
+        final o = y ~/ 2 * 3;
+        if (y % 2 == 0) {
+          column[o] = _level(r, 4) << 4 | _level(g, 4);
+          column[o + 1] = _level(b, 4) << 4 | (column[o + 1] & 0x0f);
+        } else {
+          column[o + 1] = (column[o + 1] & 0xf0) | _level(r, 4);
+          column[o + 2] = _level(g, 4) << 4 | _level(b, 4);
+        }
+        break;
+    }
+  }
+}
+
+// Speeds are a u16 for sticks of protocol version 1 or later, a u8 before
+List<int> speedBytes(int speed, int version) {
+  return version >= 1 ? [speed & 0xff, speed >> 8] : [min(speed, 255)];
+}
+
+class PixelBeginParams {
+  final int speed;
+  final PixelFormat format;
+  // Protocol version of the stick, see Capabilities
+  final int version;
+
+  PixelBeginParams(this.speed, this.format, {this.version = 0});
+}
+
+class PixelBegin extends Send<PixelBeginParams> {
   int id() {
     return 3;
   }
 
-  Uint8List serialize(int v) {
-    return Uint8List.fromList([v]);
+  // RGB888 is the default, which keeps BEGIN readable by older firmware
+  Uint8List serialize(PixelBeginParams v) {
+    final speed = speedBytes(v.speed, v.version);
+    if (v.format == PixelFormat.rgb888) {
+      return Uint8List.fromList(speed);
+    }
+    return Uint8List.fromList([...speed, v.format.index]);
+  }
+}
+
+// 64-bit FNV-1a of the palette and packed columns of an image: the name of
+// the image in the stick's library
+int imageHash(PixelFormat format, Uint8List? palette, List<Uint8List> columns) {
+  var h = 0xcbf29ce484222325;
+  void add(int b) {
+    // Wraps around at 64 bits
+    h = (h ^ b) * 0x100000001b3;
+  }
+
+  add(format.index);
+  palette?.forEach(add);
+  for (final column in columns) {
+    column.forEach(add);
+  }
+  return h;
+}
+
+class StoreBeginParams extends PixelBeginParams {
+  final int hash;
+  final int columns;
+
+  StoreBeginParams(int speed, PixelFormat format, this.hash, this.columns,
+      {int version = 0})
+      : super(speed, format, version: version);
+}
+
+// Same as PixelBegin, but the columns that follow are added to the library
+// of images in the stick's flash instead of being played, and kept unless
+// PixelEnd aborts. The upload replaces any image of the same hash.
+class StoreBegin extends Send<StoreBeginParams> {
+  int id() {
+    return 10;
+  }
+
+  Uint8List serialize(StoreBeginParams v) {
+    final speed = speedBytes(v.speed, v.version);
+    final d = ByteData(speed.length + 13);
+    d.buffer.asUint8List().setAll(0, speed);
+    d.setUint8(speed.length, v.format.index);
+    d.setUint64(speed.length + 1, v.hash, Endian.little);
+    d.setUint32(speed.length + 9, v.columns, Endian.little);
+    return d.buffer.asUint8List();
+  }
+}
+
+class StorePlayParams {
+  // Null for the speed the image was uploaded with
+  final int? speed;
+  // Null for the newest image
+  final int? hash;
+  // Protocol version of the stick, see Capabilities
+  final int version;
+
+  StorePlayParams({this.speed, this.hash, this.version = 0});
+}
+
+// Plays an image of the library
+class StorePlay extends Send<StorePlayParams> {
+  int id() {
+    return 11;
+  }
+
+  Uint8List serialize(StorePlayParams v) {
+    if (v.hash == null) {
+      return v.speed == null
+          ? Uint8List(0)
+          : Uint8List.fromList(speedBytes(v.speed!, v.version));
+    }
+    final speed = speedBytes(v.speed ?? 0, v.version);
+    final d = ByteData(speed.length + 8);
+    d.buffer.asUint8List().setAll(0, speed);
+    d.setUint64(speed.length, v.hash!, Endian.little);
+    return d.buffer.asUint8List();
+  }
+}
+
+class StoreQueryParams {
+  final int index;
+  final int? hash;
+
+  // From 0, the newest image
+  StoreQueryParams.index(this.index) : hash = null;
+  StoreQueryParams.hash(int this.hash) : index = 0;
+}
+
+// Looks up an image of the library, answered by StoreEntry
+class StoreQuery extends Send<StoreQueryParams> {
+  int id() {
+    return 12;
+  }
+
+  Uint8List serialize(StoreQueryParams v) {
+    if (v.hash == null) {
+      return Uint8List.fromList([v.index]);
+    }
+    final d = ByteData(8);
+    d.setUint64(0, v.hash!, Endian.little);
+    return d.buffer.asUint8List();
   }
 }
 
+class StoredImage {
+  final int index;
+  final int hash;
+  final int columns;
+  final int speed;
+  final int format;
+
+  StoredImage(this.index, this.hash, this.columns, this.speed, this.format);
+}
+
+class StoreEntryReply {
+  // Number of images in the library
+  final int count;
+  // Null when the library has no such image
+  final StoredImage? image;
+
+  StoreEntryReply(this.count, this.image);
+}
+
+class StoreEntry extends Parse<StoreEntryReply> {
+  int id() {
+    return 13;
+  }
+
+  StoreEntryReply parse(ByteData data) {
+    final d = ByteData.sublistView(data);
+    final index = d.getUint8(1);
+    // The speed is a u16 from sticks of version 1 or later
+    final wide = d.lengthInBytes >= 17;
+    return StoreEntryReply(
+        d.getUint8(0),
+        index == 0xff
+            ? null
+            : StoredImage(
+                index,
+                d.getUint64(2, Endian.little),
+                d.getUint32(10, Endian.little),
+                wide ? d.getUint16(14, Endian.little) : d.getUint8(14),
+                d.getUint8(wide ? 16 : 15)));
+  }
+}
+
+// Column limit: how many columns of the animation the app may have sent in
+// total. Limits only grow, a later one supersedes any that was missed.
 class PixelAck extends Parse<int> {
   int id() {
     return 4;
@@ -83,6 +684,20 @@ class PixelAck extends Parse<int> {
   }
 }
 
+// Colours of PixelFormat.palette8 as RGB triplets, from entry 0, sent
+// before PixelBegin
+class PixelPalette extends Send<Uint8List> {
+  static const int maxColours = 256;
+
+  int id() {
+    return 8;
+  }
+
+  Uint8List serialize(Uint8List v) {
+    return v;
+  }
+}
+
 enum Abort {
   yes,
   no,
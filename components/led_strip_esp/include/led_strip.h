@@ -7,7 +7,20 @@
 
 #include <stdint.h>
 #include "esp_err.h"
+#include "sdkconfig.h"
+#include "led_strip_types.h"
+#if CONFIG_SOC_RMT_SUPPORTED
 #include "led_strip_rmt.h"
+#endif
+#if CONFIG_SOC_LCD_I80_SUPPORTED
+#include "led_strip_lcd.h"
+#endif
+#if CONFIG_SOC_GPSPI_SUPPORTED
+#include "led_strip_spi.h"
+#endif
+#if CONFIG_IDF_TARGET_LINUX
+#include "led_strip_virtual.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -49,6 +62,24 @@ esp_err_t led_strip_set_pixel(led_strip_handle_t strip, uint32_t index, uint32_t
  */
 esp_err_t led_strip_set_pixel_rgbw(led_strip_handle_t strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue, uint32_t white);
 
+/**
+ * @brief Set a span of consecutive pixels at once
+ *
+ * @note Much cheaper than one `led_strip_set_pixel` call per pixel when a whole column is updated
+ *
+ * @param strip: LED strip
+ * @param start: index of the first pixel to set
+ * @param count: number of pixels to set
+ * @param pixels: pixel data, laid out as described by `order`
+ * @param order: byte layout of `pixels`
+ *
+ * @return
+ *      - ESP_OK: Set pixels successfully
+ *      - ESP_ERR_INVALID_ARG: Set pixels failed because of invalid parameters
+ *      - ESP_FAIL: Set pixels failed because other error occurred
+ */
+esp_err_t led_strip_set_pixels(led_strip_handle_t strip, uint32_t start, uint32_t count, const uint8_t *pixels, led_strip_color_order_t order);
+
 /**
  * @brief Refresh memory colors to LEDs
  *
@@ -63,6 +94,52 @@ esp_err_t led_strip_set_pixel_rgbw(led_strip_handle_t strip, uint32_t index, uin
  */
 esp_err_t led_strip_refresh(led_strip_handle_t strip);
 
+/**
+ * @brief Flush a caller-owned buffer to LEDs, bypassing the strip's own pixel memory
+ *
+ * @param strip: LED strip
+ * @param pixels: all pixels of the strip, already in its wire order (GRB or GRBW)
+ *
+ * @return
+ *      - ESP_OK: Refresh successfully
+ *      - ESP_ERR_NOT_SUPPORTED: The strip backend cannot transmit from an external buffer
+ *      - ESP_FAIL: Refresh failed because some other error occurred
+ *
+ * @note:
+ *      No copy is made: `pixels` must not be modified until the function returns.
+ */
+esp_err_t led_strip_refresh_from(led_strip_handle_t strip, const uint8_t *pixels);
+
+/**
+ * @brief Start flushing pixels to LEDs and return without waiting for the transmission to end
+ *
+ * @param strip: LED strip
+ * @param pixels: caller-owned buffer in wire order, or NULL to send the strip's own pixel memory
+ *
+ * @return
+ *      - ESP_OK: Transmission started
+ *      - ESP_FAIL: Refresh failed because some other error occurred
+ *
+ * @note:
+ *      Waits for the previous transmission, if any, before starting. When `pixels` is NULL the strip
+ *      switches to a second pixel memory holding the same colors, so `led_strip_set_pixel` can prepare
+ *      the next frame during the transmission. A caller-owned buffer must not be modified until
+ *      `led_strip_wait_refresh_done` returns.
+ */
+esp_err_t led_strip_refresh_async(led_strip_handle_t strip, const uint8_t *pixels);
+
+/**
+ * @brief Wait for the transmission started by `led_strip_refresh_async` to end
+ *
+ * @param strip: LED strip
+ * @param timeout_ms: maximum time to wait, negative to wait forever
+ *
+ * @return
+ *      - ESP_OK: No transmission in flight anymore
+ *      - ESP_ERR_TIMEOUT: The transmission did not end in time
+ */
+esp_err_t led_strip_wait_refresh_done(led_strip_handle_t strip, int32_t timeout_ms);
+
 /**
  * @brief Clear LED strip (turn off all LEDs)
  *
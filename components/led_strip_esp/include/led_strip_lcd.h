@@ -0,0 +1,47 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "led_strip_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LED_STRIP_LCD_MAX_LANES 16 /*!< Widest parallel bus supported */
+
+/**
+ * @brief LED Strip parallel LCD (I2S on ESP32) specific configuration
+ */
+typedef struct {
+    int data_gpio_nums[LED_STRIP_LCD_MAX_LANES]; /*!< GPIO connected to the data line of each lane, in pixel order */
+    uint32_t lane_count;                          /*!< Number of lanes, 1 to 16; up to 8 lanes use an 8-bit bus */
+    int wr_gpio_num;                              /*!< Word clock output required by the peripheral, leave it unconnected */
+    int dc_gpio_num;                              /*!< Data/command output required by the peripheral, leave it unconnected */
+} led_strip_lcd_config_t;
+
+/**
+ * @brief Create LED strip made of up to 16 segments driven at once through the parallel LCD peripheral and DMA
+ *
+ * @note Pixels 0..max_leds-1 are split into `lane_count` consecutive segments of (almost) equal length, like
+ *       `led_strip_new_rmt_multi_device`. Only WS2812-compatible timing is generated, `led_config->strip_gpio_num` is ignored.
+ *
+ * @param led_config LED strip configuration
+ * @param lcd_config LCD specific configuration
+ * @param ret_strip Returned LED strip handle
+ * @return
+ *      - ESP_OK: create LED strip handle successfully
+ *      - ESP_ERR_INVALID_ARG: create LED strip handle failed because of invalid argument
+ *      - ESP_ERR_NO_MEM: create LED strip handle failed because of out of memory
+ *      - ESP_FAIL: create LED strip handle failed because some other error
+ */
+esp_err_t led_strip_new_lcd_device(const led_strip_config_t *led_config, const led_strip_lcd_config_t *lcd_config, led_strip_handle_t *ret_strip);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include "esp_err.h"
 #include "driver/rmt_types.h"
 #include "led_strip_types.h"
@@ -21,11 +22,28 @@ extern "C" {
 typedef struct {
     rmt_clock_source_t clk_src; /*!< RMT clock source */
     uint32_t resolution_hz;     /*!< RMT tick resolution, if set to zero, a default resolution (10MHz) will be applied */
+    size_t mem_block_symbols;   /*!< Symbols buffered per channel (RMT memory, or DMA buffer with `with_dma`), if set to zero,
+                                     an equal share of the RMT memory, or 1024 symbols with DMA, will be applied */
     struct {
-        uint32_t with_dma: 1;   /*!< Use DMA to transmit data */
+        uint32_t with_dma: 1;   /*!< Use DMA to transmit data, only on chips whose RMT has DMA support */
     } flags;
 } led_strip_rmt_config_t;
 
+/**
+ * @brief Encoder work of an RMT LED strip
+ *
+ * @note These count calls into the strip's encoders, not RMT interrupts: a frame takes one call in `rmt_transmit`
+ *       and one per memory block refill after it, on each segment. Cycles are measured around the encoding only,
+ *       not the driver's interrupt entry and exit.
+ */
+typedef struct {
+    uint32_t frames;            /*!< Number of frames transmitted since creation */
+    uint32_t encoder_calls;     /*!< Encoder calls made for the last frame, summed over segments */
+    uint32_t max_encoder_calls; /*!< Most encoder calls made for a single frame */
+    uint32_t encode_cycles;     /*!< CPU cycles spent in the encoders for the last frame, summed over segments */
+    uint32_t max_encode_cycles; /*!< Longest single encoder call, in CPU cycles */
+} led_strip_rmt_stats_t;
+
 /**
  * @brief Create LED strip based on RMT TX channel
  *
@@ -36,10 +54,46 @@ typedef struct {
  *      - ESP_OK: create LED strip handle successfully
  *      - ESP_ERR_INVALID_ARG: create LED strip handle failed because of invalid argument
  *      - ESP_ERR_NO_MEM: create LED strip handle failed because of out of memory
+ *      - ESP_ERR_NOT_SUPPORTED: DMA was requested but the RMT of this chip has none
  *      - ESP_FAIL: create LED strip handle failed because some other error
  */
 esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const led_strip_rmt_config_t *rmt_config, led_strip_handle_t *ret_strip);
 
+/**
+ * @brief Create LED strip made of several segments, each driven by its own RMT TX channel and GPIO
+ *
+ * @note Pixels 0..max_leds-1 are split into `segment_count` consecutive segments of (almost) equal length,
+ *       segment i starting at pixel `i * max_leds / segment_count`. All segments are transmitted in parallel,
+ *       dividing the refresh time by `segment_count`. `led_config->strip_gpio_num` is ignored.
+ *
+ * @param led_config LED strip configuration
+ * @param rmt_config RMT specific configuration, shared by all segments
+ * @param segment_gpio_nums GPIO connected to the data line of each segment
+ * @param segment_count Number of segments, at most 8
+ * @param ret_strip Returned LED strip handle
+ * @return
+ *      - ESP_OK: create LED strip handle successfully
+ *      - ESP_ERR_INVALID_ARG: create LED strip handle failed because of invalid argument
+ *      - ESP_ERR_NO_MEM: create LED strip handle failed because of out of memory
+ *      - ESP_ERR_NOT_SUPPORTED: DMA was requested but the RMT of this chip has none
+ *      - ESP_FAIL: create LED strip handle failed because some other error
+ */
+esp_err_t led_strip_new_rmt_multi_device(const led_strip_config_t *led_config, const led_strip_rmt_config_t *rmt_config,
+                                         const uint32_t *segment_gpio_nums, uint32_t segment_count, led_strip_handle_t *ret_strip);
+
+/**
+ * @brief Get encoder statistics of an RMT LED strip
+ *
+ * @note Counters of a frame are updated when it has been waited for, by a later refresh or `led_strip_wait_refresh_done`.
+ *
+ * @param strip LED strip created by `led_strip_new_rmt_device` or `led_strip_new_rmt_multi_device`
+ * @param stats Returned statistics
+ * @return
+ *      - ESP_OK: statistics returned successfully
+ *      - ESP_ERR_INVALID_ARG: invalid argument
+ */
+esp_err_t led_strip_rmt_get_stats(led_strip_handle_t strip, led_strip_rmt_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,50 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/spi_common.h"
+#include "led_strip_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief LED Strip SPI specific configuration
+ */
+typedef struct {
+    spi_host_device_t spi_bus;  /*!< SPI host, the bus is initialized by the strip and freed when it is deleted */
+    int clk_gpio_num;           /*!< GPIO connected to the clock input of the strip */
+    uint32_t clk_speed_hz;      /*!< SPI clock, if set to zero, a default clock (10MHz) will be applied */
+    uint8_t global_brightness;  /*!< 5-bit brightness field sent with every pixel, if set to zero, the maximum (31) will be applied */
+    struct {
+        uint32_t with_dma: 1;   /*!< Use DMA to transmit data, required unless the whole frame fits the SPI data buffer
+                                     (SOC_SPI_MAXIMUM_BUFFER_SIZE bytes, 13 LEDs for 64 bytes) */
+    } flags;
+} led_strip_spi_config_t;
+
+/**
+ * @brief Create LED strip of clocked LEDs (APA102, SK9822) based on an SPI bus
+ *
+ * @note `led_config->strip_gpio_num` is the data (MOSI) line. Pixels are kept in GRB order like on
+ *       the other backends, and converted to the strip's frame format when refreshing.
+ *
+ * @param led_config LED strip configuration, the model must be `LED_MODEL_APA102` and the format `LED_PIXEL_FORMAT_GRB`
+ * @param spi_config SPI specific configuration
+ * @param ret_strip Returned LED strip handle
+ * @return
+ *      - ESP_OK: create LED strip handle successfully
+ *      - ESP_ERR_INVALID_ARG: create LED strip handle failed because of invalid argument, or a frame too long without DMA
+ *      - ESP_ERR_NO_MEM: create LED strip handle failed because of out of memory
+ *      - ESP_FAIL: create LED strip handle failed because some other error
+ */
+esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const led_strip_spi_config_t *spi_config, led_strip_handle_t *ret_strip);
+
+#ifdef __cplusplus
+}
+#endif
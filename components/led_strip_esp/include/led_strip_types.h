@@ -20,6 +20,14 @@ typedef enum {
     LED_PIXEL_FORMAT_INVALID /*!< Invalid pixel format */
 } led_pixel_format_t;
 
+/**
+ * @brief Byte layout of a pixel span passed to `led_strip_set_pixels`
+ */
+typedef enum {
+    LED_STRIP_COLOR_ORDER_RGB,  /*!< Three bytes per pixel: R, G, B */
+    LED_STRIP_COLOR_ORDER_WIRE, /*!< Already in the strip's wire order and size (GRB or GRBW), copied as is */
+} led_strip_color_order_t;
+
 /**
  * @brief LED strip model
  * @note Different led model may have different timing parameters, so we need to distinguish them.
@@ -27,6 +35,7 @@ typedef enum {
 typedef enum {
     LED_MODEL_WS2812, /*!< LED strip model: WS2812 */
     LED_MODEL_SK6812, /*!< LED strip model: SK6812 */
+    LED_MODEL_APA102, /*!< LED strip model: APA102 or SK9822, clocked, driven by SPI */
     LED_MODEL_INVALID /*!< Invalid LED strip model */
 } led_model_t;
 
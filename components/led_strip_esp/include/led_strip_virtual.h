@@ -0,0 +1,89 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "led_strip_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief LED Strip virtual (host simulator) specific configuration
+ */
+typedef struct {
+    uint32_t max_frames;        /*!< Number of most recent frames kept in the recording ring, if set to zero, a default (4096) will be applied */
+    uint32_t segment_count;     /*!< Number of segments refreshed in parallel, as with `led_strip_new_rmt_multi_device`, zero means one */
+    struct {
+        uint32_t simulate_timing: 1; /*!< Keep the strip busy for as long as the real strip would take to latch each frame */
+    } flags;
+} led_strip_virtual_config_t;
+
+/**
+ * @brief Statistics of a virtual LED strip
+ */
+typedef struct {
+    uint32_t frames;            /*!< Number of refreshes since creation */
+    int64_t first_refresh_us;   /*!< Monotonic time of the first refresh, in microseconds */
+    int64_t last_refresh_us;    /*!< Monotonic time of the last refresh, in microseconds */
+} led_strip_virtual_stats_t;
+
+/**
+ * @brief Create LED strip that records every refreshed frame in memory instead of driving hardware
+ *
+ * @param led_config LED strip configuration
+ * @param virtual_config Virtual strip specific configuration
+ * @param ret_strip Returned LED strip handle
+ * @return
+ *      - ESP_OK: create LED strip handle successfully
+ *      - ESP_ERR_INVALID_ARG: create LED strip handle failed because of invalid argument
+ *      - ESP_ERR_NO_MEM: create LED strip handle failed because of out of memory
+ */
+esp_err_t led_strip_new_virtual_device(const led_strip_config_t *led_config, const led_strip_virtual_config_t *virtual_config, led_strip_handle_t *ret_strip);
+
+/**
+ * @brief Get refresh statistics of a virtual LED strip
+ *
+ * @param strip LED strip created by `led_strip_new_virtual_device`
+ * @param stats Returned statistics
+ * @return
+ *      - ESP_OK: statistics returned successfully
+ *      - ESP_ERR_INVALID_ARG: invalid argument
+ */
+esp_err_t led_strip_virtual_get_stats(led_strip_handle_t strip, led_strip_virtual_stats_t *stats);
+
+/**
+ * @brief Copy a recorded frame
+ *
+ * @param strip LED strip created by `led_strip_new_virtual_device`
+ * @param frame Index (as counted by `frames` in the statistics) of the frame
+ * @param pixels Returned pixels of the whole strip, in wire order
+ * @return
+ *      - ESP_OK: frame copied successfully
+ *      - ESP_ERR_INVALID_ARG: invalid argument, or the frame is no longer recorded
+ */
+esp_err_t led_strip_virtual_get_frame(led_strip_handle_t strip, uint32_t frame, uint8_t *pixels);
+
+/**
+ * @brief Dump recorded frames as a light-painting PNG, one frame per image column
+ *
+ * @param strip LED strip created by `led_strip_new_virtual_device`
+ * @param path Output file
+ * @param first_frame Index (as counted by `frames` in the statistics) of the first frame to dump
+ * @param frame_count Number of frames to dump
+ * @return
+ *      - ESP_OK: image written successfully
+ *      - ESP_ERR_INVALID_ARG: invalid argument, or the requested frames are no longer recorded
+ *      - ESP_FAIL: the file could not be written
+ */
+esp_err_t led_strip_virtual_dump_png(led_strip_handle_t strip, const char *path, uint32_t first_frame, uint32_t frame_count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include "esp_err.h"
+#include "led_strip_types.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -51,6 +52,22 @@ struct led_strip_t {
      */
     esp_err_t (*set_pixel_rgbw)(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue, uint32_t white);
 
+    /**
+     * @brief Set a span of consecutive pixels. Optional, `set_pixel` is called for each pixel when NULL
+     *
+     * @param strip: LED strip
+     * @param start: index of the first pixel to set
+     * @param count: number of pixels to set
+     * @param pixels: pixel data, laid out as described by `order`
+     * @param order: byte layout of `pixels`
+     *
+     * @return
+     *      - ESP_OK: Set pixels successfully
+     *      - ESP_ERR_INVALID_ARG: Set pixels failed because of invalid parameters
+     *      - ESP_FAIL: Set pixels failed because other error occurred
+     */
+    esp_err_t (*set_pixels)(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *pixels, led_strip_color_order_t order);
+
     /**
      * @brief Refresh memory colors to LEDs
      *
@@ -66,6 +83,42 @@ struct led_strip_t {
      */
     esp_err_t (*refresh)(led_strip_t *strip);
 
+    /**
+     * @brief Flush a caller-owned buffer in wire order to LEDs, without copying it. Optional
+     *
+     * @param strip: LED strip
+     * @param pixels: all pixels of the strip, in wire order
+     *
+     * @return
+     *      - ESP_OK: Refresh successfully
+     *      - ESP_FAIL: Refresh failed because some other error occurred
+     */
+    esp_err_t (*refresh_from)(led_strip_t *strip, const uint8_t *pixels);
+
+    /**
+     * @brief Start flushing pixels to LEDs without waiting for the end of the transmission. Optional
+     *
+     * @param strip: LED strip
+     * @param pixels: caller-owned buffer in wire order, or NULL for the strip's own pixel memory
+     *
+     * @return
+     *      - ESP_OK: Transmission started
+     *      - ESP_FAIL: Refresh failed because some other error occurred
+     */
+    esp_err_t (*refresh_async)(led_strip_t *strip, const uint8_t *pixels);
+
+    /**
+     * @brief Wait for the transmission started by `refresh_async`. Optional, together with `refresh_async`
+     *
+     * @param strip: LED strip
+     * @param timeout_ms: maximum time to wait, negative to wait forever
+     *
+     * @return
+     *      - ESP_OK: No transmission in flight
+     *      - ESP_ERR_TIMEOUT: The transmission did not end in time
+     */
+    esp_err_t (*wait_refresh_done)(led_strip_t *strip, int32_t timeout_ms);
+
     /**
      * @brief Clear LED strip (turn off all LEDs)
      *
@@ -90,6 +143,42 @@ struct led_strip_t {
     esp_err_t (*del)(led_strip_t *strip);
 };
 
+/**
+ * @brief Copy a span of pixels into a backend's pixel memory, for `set_pixels` implementations
+ *
+ * @param pixel_buf: pixel memory of the whole strip, in wire order (GRB or GRBW)
+ * @param strip_len: number of pixels of the strip
+ * @param bytes_per_pixel: 3 for GRB, 4 for GRBW; the white component of RGB pixels is cleared
+ * @param start: index of the first pixel to set
+ * @param count: number of pixels to set
+ * @param pixels: pixel data, laid out as described by `order`
+ * @param order: byte layout of `pixels`
+ *
+ * @return
+ *      - ESP_OK: Set pixels successfully
+ *      - ESP_ERR_INVALID_ARG: Set pixels failed because the span is out of the strip
+ */
+esp_err_t led_strip_copy_pixels(uint8_t *pixel_buf, uint32_t strip_len, uint8_t bytes_per_pixel, uint32_t start, uint32_t count,
+                                const uint8_t *pixels, led_strip_color_order_t order);
+
+/**
+ * @brief First pixel of a segment, for strips driven as several segments in parallel
+ *
+ * @note Segments take consecutive pixels and their lengths differ by at most one pixel;
+ *       segment `segment_count` starts at `strip_len`.
+ *
+ * @param strip_len: number of pixels of the strip
+ * @param segment_count: number of segments
+ * @param segment: segment index, 0 to `segment_count`
+ *
+ * @return
+ *      - Index of the first pixel of the segment
+ */
+static inline uint32_t led_strip_segment_start(uint32_t strip_len, uint32_t segment_count, uint32_t segment)
+{
+    return (uint32_t)((uint64_t)strip_len * segment / segment_count);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,6 +3,7 @@
  *
  * SPDX-License-Identifier: Apache-2.0
  */
+#include <string.h>
 #include "esp_log.h"
 #include "esp_check.h"
 #include "led_strip.h"
@@ -22,12 +23,76 @@ esp_err_t led_strip_set_pixel_rgbw(led_strip_handle_t strip, uint32_t index, uin
     return strip->set_pixel_rgbw(strip, index, red, green, blue, white);
 }
 
+esp_err_t led_strip_set_pixels(led_strip_handle_t strip, uint32_t start, uint32_t count, const uint8_t *pixels, led_strip_color_order_t order)
+{
+    ESP_RETURN_ON_FALSE(strip && pixels, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    if (strip->set_pixels) {
+        return strip->set_pixels(strip, start, count, pixels, order);
+    }
+    ESP_RETURN_ON_FALSE(order == LED_STRIP_COLOR_ORDER_RGB, ESP_ERR_INVALID_ARG, TAG, "wire order not supported by this strip");
+    for (uint32_t i = 0; i < count; i++) {
+        ESP_RETURN_ON_ERROR(strip->set_pixel(strip, start + i, pixels[0], pixels[1], pixels[2]), TAG, "set pixel failed");
+        pixels += 3;
+    }
+    return ESP_OK;
+}
+
+esp_err_t led_strip_copy_pixels(uint8_t *pixel_buf, uint32_t strip_len, uint8_t bytes_per_pixel, uint32_t start, uint32_t count,
+                                const uint8_t *pixels, led_strip_color_order_t order)
+{
+    ESP_RETURN_ON_FALSE(start <= strip_len && count <= strip_len - start, ESP_ERR_INVALID_ARG, TAG, "span out of maximum number of LEDs");
+    uint8_t *buf = pixel_buf + start * bytes_per_pixel;
+    if (order == LED_STRIP_COLOR_ORDER_WIRE) {
+        memcpy(buf, pixels, count * bytes_per_pixel);
+    } else if (bytes_per_pixel == 3) {
+        for (const uint8_t *end = pixels + count * 3; pixels < end; pixels += 3, buf += 3) {
+            buf[0] = pixels[1];
+            buf[1] = pixels[0];
+            buf[2] = pixels[2];
+        }
+    } else {
+        for (const uint8_t *end = pixels + count * 3; pixels < end; pixels += 3, buf += 4) {
+            buf[0] = pixels[1];
+            buf[1] = pixels[0];
+            buf[2] = pixels[2];
+            buf[3] = 0;
+        }
+    }
+    return ESP_OK;
+}
+
 esp_err_t led_strip_refresh(led_strip_handle_t strip)
 {
     ESP_RETURN_ON_FALSE(strip, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
     return strip->refresh(strip);
 }
 
+esp_err_t led_strip_refresh_from(led_strip_handle_t strip, const uint8_t *pixels)
+{
+    ESP_RETURN_ON_FALSE(strip && pixels, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(strip->refresh_from, ESP_ERR_NOT_SUPPORTED, TAG, "refresh from external buffer not supported");
+    return strip->refresh_from(strip, pixels);
+}
+
+esp_err_t led_strip_refresh_async(led_strip_handle_t strip, const uint8_t *pixels)
+{
+    ESP_RETURN_ON_FALSE(strip, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    if (strip->refresh_async) {
+        return strip->refresh_async(strip, pixels);
+    }
+    // Backends without asynchronous support just refresh synchronously
+    return pixels ? led_strip_refresh_from(strip, pixels) : strip->refresh(strip);
+}
+
+esp_err_t led_strip_wait_refresh_done(led_strip_handle_t strip, int32_t timeout_ms)
+{
+    ESP_RETURN_ON_FALSE(strip, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    if (strip->wait_refresh_done) {
+        return strip->wait_refresh_done(strip, timeout_ms);
+    }
+    return ESP_OK;
+}
+
 esp_err_t led_strip_clear(led_strip_handle_t strip)
 {
     ESP_RETURN_ON_FALSE(strip, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
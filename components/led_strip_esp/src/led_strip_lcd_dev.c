@@ -0,0 +1,249 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/cdefs.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_lcd_panel_io.h"
+#include "led_strip.h"
+#include "led_strip_interface.h"
+#include "led_strip_lcd_encoder.h"
+
+#define LED_STRIP_LCD_PCLK_HZ 2400000 // three words per 1.25us WS2812 bit
+#define LED_STRIP_LCD_RESET_WORDS 120 // 50us of low level latches the frame
+
+static const char *TAG = "led_strip_lcd";
+
+typedef struct {
+    led_strip_t base;
+    esp_lcd_i80_bus_handle_t bus;
+    esp_lcd_panel_io_handle_t io;
+    SemaphoreHandle_t done_sem; // given by the LCD done callback
+    bool busy;                  // a transmission is in flight
+    uint32_t lane_count;
+    uint32_t lane_start[LED_STRIP_LCD_MAX_LANES + 1]; // first pixel of each lane, plus the strip length
+    size_t lane_bytes;          // bytes of the longest lane
+    size_t dma_size;            // bytes of one encoded frame, including the reset tail
+    uint8_t *dma_buf[2];        // encoded frames, one may be in flight while the other is filled
+    uint32_t next_dma;          // index of the buffer not in flight
+    uint32_t strip_len;
+    uint8_t bytes_per_pixel;
+    uint8_t pixel_buf[];
+} led_strip_lcd_obj;
+
+static esp_err_t led_strip_lcd_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
+{
+    led_strip_lcd_obj *lcd_strip = __containerof(strip, led_strip_lcd_obj, base);
+    ESP_RETURN_ON_FALSE(index < lcd_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    uint32_t start = index * lcd_strip->bytes_per_pixel;
+    // In the order of GRB, as LED strip like WS2812 sends out pixels in this order
+    lcd_strip->pixel_buf[start + 0] = green & 0xFF;
+    lcd_strip->pixel_buf[start + 1] = red & 0xFF;
+    lcd_strip->pixel_buf[start + 2] = blue & 0xFF;
+    if (lcd_strip->bytes_per_pixel > 3) {
+        lcd_strip->pixel_buf[start + 3] = 0;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_lcd_set_pixel_rgbw(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue, uint32_t white)
+{
+    led_strip_lcd_obj *lcd_strip = __containerof(strip, led_strip_lcd_obj, base);
+    ESP_RETURN_ON_FALSE(index < lcd_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    ESP_RETURN_ON_FALSE(lcd_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    uint8_t *buf_start = lcd_strip->pixel_buf + index * 4;
+    // SK6812 component order is GRBW
+    *buf_start = green & 0xFF;
+    *++buf_start = red & 0xFF;
+    *++buf_start = blue & 0xFF;
+    *++buf_start = white & 0xFF;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_lcd_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *pixels, led_strip_color_order_t order)
+{
+    led_strip_lcd_obj *lcd_strip = __containerof(strip, led_strip_lcd_obj, base);
+    return led_strip_copy_pixels(lcd_strip->pixel_buf, lcd_strip->strip_len, lcd_strip->bytes_per_pixel, start, count, pixels, order);
+}
+
+static bool IRAM_ATTR led_strip_lcd_on_trans_done(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_io_event_data_t *edata, void *user_ctx)
+{
+    led_strip_lcd_obj *lcd_strip = (led_strip_lcd_obj *)user_ctx;
+    BaseType_t high_task_wakeup = pdFALSE;
+    xSemaphoreGiveFromISR(lcd_strip->done_sem, &high_task_wakeup);
+    return high_task_wakeup == pdTRUE;
+}
+
+static esp_err_t led_strip_lcd_wait_refresh_done(led_strip_t *strip, int32_t timeout_ms)
+{
+    led_strip_lcd_obj *lcd_strip = __containerof(strip, led_strip_lcd_obj, base);
+    if (!lcd_strip->busy) {
+        return ESP_OK;
+    }
+    TickType_t ticks = timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(lcd_strip->done_sem, ticks) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "wait for refresh timed out");
+    lcd_strip->busy = false;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_lcd_refresh_async(led_strip_t *strip, const uint8_t *pixels)
+{
+    led_strip_lcd_obj *lcd_strip = __containerof(strip, led_strip_lcd_obj, base);
+    const uint8_t *lanes[LED_STRIP_LCD_MAX_LANES];
+    size_t lane_len[LED_STRIP_LCD_MAX_LANES];
+    uint8_t *words = lcd_strip->dma_buf[lcd_strip->next_dma];
+
+    if (!pixels) {
+        pixels = lcd_strip->pixel_buf;
+    }
+    for (uint32_t i = 0; i < lcd_strip->lane_count; i++) {
+        lanes[i] = pixels + lcd_strip->lane_start[i] * lcd_strip->bytes_per_pixel;
+        lane_len[i] = (lcd_strip->lane_start[i + 1] - lcd_strip->lane_start[i]) * lcd_strip->bytes_per_pixel;
+    }
+    // Encode while the previous frame is still on the wire, the reset tail past the data stays zero
+    if (lcd_strip->lane_count <= 8) {
+        led_strip_lcd_encode8(lanes, lane_len, lcd_strip->lane_count, lcd_strip->lane_bytes, words);
+    } else {
+        led_strip_lcd_encode16(lanes, lane_len, lcd_strip->lane_count, lcd_strip->lane_bytes, (uint16_t *)words);
+    }
+
+    ESP_RETURN_ON_ERROR(led_strip_lcd_wait_refresh_done(strip, -1), TAG, "wait for previous refresh failed");
+    ESP_RETURN_ON_ERROR(esp_lcd_panel_io_tx_color(lcd_strip->io, -1, words, lcd_strip->dma_size), TAG, "transmit pixels by LCD failed");
+    lcd_strip->busy = true;
+    lcd_strip->next_dma ^= 1;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_lcd_refresh_from(led_strip_t *strip, const uint8_t *pixels)
+{
+    ESP_RETURN_ON_ERROR(led_strip_lcd_refresh_async(strip, pixels), TAG, "refresh failed");
+    return led_strip_lcd_wait_refresh_done(strip, -1);
+}
+
+static esp_err_t led_strip_lcd_refresh(led_strip_t *strip)
+{
+    return led_strip_lcd_refresh_from(strip, NULL);
+}
+
+static esp_err_t led_strip_lcd_clear(led_strip_t *strip)
+{
+    led_strip_lcd_obj *lcd_strip = __containerof(strip, led_strip_lcd_obj, base);
+    // Write zero to turn off all leds
+    memset(lcd_strip->pixel_buf, 0, lcd_strip->strip_len * lcd_strip->bytes_per_pixel);
+    return led_strip_lcd_refresh(strip);
+}
+
+static esp_err_t led_strip_lcd_del(led_strip_t *strip)
+{
+    led_strip_lcd_obj *lcd_strip = __containerof(strip, led_strip_lcd_obj, base);
+    ESP_RETURN_ON_ERROR(led_strip_lcd_wait_refresh_done(strip, -1), TAG, "wait for refresh failed");
+    ESP_RETURN_ON_ERROR(esp_lcd_panel_io_del(lcd_strip->io), TAG, "delete LCD panel IO failed");
+    ESP_RETURN_ON_ERROR(esp_lcd_del_i80_bus(lcd_strip->bus), TAG, "delete LCD bus failed");
+    free(lcd_strip->dma_buf[0]);
+    free(lcd_strip->dma_buf[1]);
+    vSemaphoreDelete(lcd_strip->done_sem);
+    free(lcd_strip);
+    return ESP_OK;
+}
+
+esp_err_t led_strip_new_lcd_device(const led_strip_config_t *led_config, const led_strip_lcd_config_t *lcd_config, led_strip_handle_t *ret_strip)
+{
+    led_strip_lcd_obj *lcd_strip = NULL;
+    esp_err_t ret = ESP_OK;
+    ESP_GOTO_ON_FALSE(led_config && lcd_config && ret_strip, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
+    ESP_GOTO_ON_FALSE(led_config->led_pixel_format < LED_PIXEL_FORMAT_INVALID, ESP_ERR_INVALID_ARG, err, TAG, "invalid led_pixel_format");
+    ESP_GOTO_ON_FALSE(led_config->led_model == LED_MODEL_WS2812 || led_config->led_model == LED_MODEL_SK6812, ESP_ERR_INVALID_ARG, err, TAG, "invalid led model");
+    ESP_GOTO_ON_FALSE(lcd_config->lane_count > 0 && lcd_config->lane_count <= LED_STRIP_LCD_MAX_LANES && lcd_config->lane_count <= led_config->max_leds,
+                      ESP_ERR_INVALID_ARG, err, TAG, "invalid lane count");
+    uint8_t bytes_per_pixel;
+    if (led_config->led_pixel_format == LED_PIXEL_FORMAT_GRBW) {
+        bytes_per_pixel = 4;
+    } else if (led_config->led_pixel_format == LED_PIXEL_FORMAT_GRB) {
+        bytes_per_pixel = 3;
+    } else {
+        assert(false);
+    }
+    lcd_strip = calloc(1, sizeof(led_strip_lcd_obj) + led_config->max_leds * bytes_per_pixel);
+    ESP_GOTO_ON_FALSE(lcd_strip, ESP_ERR_NO_MEM, err, TAG, "no mem for lcd strip");
+    lcd_strip->done_sem = xSemaphoreCreateBinary();
+    ESP_GOTO_ON_FALSE(lcd_strip->done_sem, ESP_ERR_NO_MEM, err, TAG, "no mem for done semaphore");
+
+    // Lanes take consecutive pixels, like the segments of the RMT backend
+    lcd_strip->lane_count = lcd_config->lane_count;
+    for (uint32_t i = 0; i <= lcd_config->lane_count; i++) {
+        lcd_strip->lane_start[i] = led_strip_segment_start(led_config->max_leds, lcd_config->lane_count, i);
+    }
+    uint32_t lane_pixels = (led_config->max_leds + lcd_config->lane_count - 1) / lcd_config->lane_count;
+    size_t word_size = lcd_config->lane_count > 8 ? 2 : 1;
+    lcd_strip->lane_bytes = lane_pixels * bytes_per_pixel;
+    lcd_strip->dma_size = (lcd_strip->lane_bytes * 8 * LED_STRIP_LCD_WORDS_PER_BIT + LED_STRIP_LCD_RESET_WORDS) * word_size;
+    for (int i = 0; i < 2; i++) {
+        lcd_strip->dma_buf[i] = heap_caps_calloc(1, lcd_strip->dma_size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        ESP_GOTO_ON_FALSE(lcd_strip->dma_buf[i], ESP_ERR_NO_MEM, err, TAG, "no mem for DMA buffer");
+    }
+
+    esp_lcd_i80_bus_config_t bus_config = {
+        .dc_gpio_num = lcd_config->dc_gpio_num,
+        .wr_gpio_num = lcd_config->wr_gpio_num,
+        .clk_src = LCD_CLK_SRC_DEFAULT,
+        .bus_width = word_size * 8,
+        .max_transfer_bytes = lcd_strip->dma_size,
+    };
+    // Unused bits of the bus are left unconnected
+    for (uint32_t i = 0; i < word_size * 8; i++) {
+        bus_config.data_gpio_nums[i] = i < lcd_config->lane_count ? lcd_config->data_gpio_nums[i] : -1;
+    }
+    ESP_GOTO_ON_ERROR(esp_lcd_new_i80_bus(&bus_config, &lcd_strip->bus), err, TAG, "create LCD bus failed");
+    esp_lcd_panel_io_i80_config_t io_config = {
+        .cs_gpio_num = -1,
+        .pclk_hz = LED_STRIP_LCD_PCLK_HZ,
+        .trans_queue_depth = 2,
+        .on_color_trans_done = led_strip_lcd_on_trans_done,
+        .user_ctx = lcd_strip,
+        .lcd_cmd_bits = 8,
+        .lcd_param_bits = 8,
+        .dc_levels = {
+            .dc_data_level = 1,
+        },
+    };
+    ESP_GOTO_ON_ERROR(esp_lcd_new_panel_io_i80(lcd_strip->bus, &io_config, &lcd_strip->io), err, TAG, "create LCD panel IO failed");
+
+    lcd_strip->bytes_per_pixel = bytes_per_pixel;
+    lcd_strip->strip_len = led_config->max_leds;
+    lcd_strip->base.set_pixel = led_strip_lcd_set_pixel;
+    lcd_strip->base.set_pixel_rgbw = led_strip_lcd_set_pixel_rgbw;
+    lcd_strip->base.set_pixels = led_strip_lcd_set_pixels;
+    lcd_strip->base.refresh = led_strip_lcd_refresh;
+    lcd_strip->base.refresh_from = led_strip_lcd_refresh_from;
+    lcd_strip->base.refresh_async = led_strip_lcd_refresh_async;
+    lcd_strip->base.wait_refresh_done = led_strip_lcd_wait_refresh_done;
+    lcd_strip->base.clear = led_strip_lcd_clear;
+    lcd_strip->base.del = led_strip_lcd_del;
+
+    *ret_strip = &lcd_strip->base;
+    return ESP_OK;
+err:
+    if (lcd_strip) {
+        if (lcd_strip->io) {
+            esp_lcd_panel_io_del(lcd_strip->io);
+        }
+        if (lcd_strip->bus) {
+            esp_lcd_del_i80_bus(lcd_strip->bus);
+        }
+        free(lcd_strip->dma_buf[0]);
+        free(lcd_strip->dma_buf[1]);
+        if (lcd_strip->done_sem) {
+            vSemaphoreDelete(lcd_strip->done_sem);
+        }
+        free(lcd_strip);
+    }
+    return ret;
+}
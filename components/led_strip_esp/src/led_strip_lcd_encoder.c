@@ -0,0 +1,62 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "led_strip_lcd_encoder.h"
+
+/*
+ * Transpose an 8x8 bit matrix held one row per byte: on return, byte b holds
+ * bit b of every input byte, input byte l landing on bit l.
+ */
+static inline uint64_t transpose8x8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// Gather byte j of lanes [first, first + 8) into one 64-bit row matrix
+static inline uint64_t gather8(const uint8_t *const lanes[], const size_t lane_len[], size_t first, size_t lane_count, size_t j)
+{
+    uint64_t x = 0;
+    for (size_t l = first; l < lane_count && l < first + 8; l++) {
+        if (j < lane_len[l]) {
+            x |= (uint64_t)lanes[l][j] << (8 * (l - first));
+        }
+    }
+    return x;
+}
+
+void led_strip_lcd_encode8(const uint8_t *const lanes[], const size_t lane_len[], size_t lane_count, size_t len, uint8_t *words)
+{
+    uint8_t high = (uint8_t)((1u << lane_count) - 1);
+    for (size_t j = 0; j < len; j++) {
+        uint64_t t = transpose8x8(gather8(lanes, lane_len, 0, lane_count, j));
+        for (int k = 0; k < 8; k++) {
+            *words++ = high;
+            *words++ = (uint8_t)(t >> (8 * (7 - k)));
+            *words++ = 0;
+        }
+    }
+}
+
+void led_strip_lcd_encode16(const uint8_t *const lanes[], const size_t lane_len[], size_t lane_count, size_t len, uint16_t *words)
+{
+    uint16_t high = (uint16_t)((1u << lane_count) - 1);
+    for (size_t j = 0; j < len; j++) {
+        uint64_t lo = transpose8x8(gather8(lanes, lane_len, 0, lane_count, j));
+        uint64_t hi = lane_count > 8 ? transpose8x8(gather8(lanes, lane_len, 8, lane_count, j)) : 0;
+        for (int k = 0; k < 8; k++) {
+            int shift = 8 * (7 - k);
+            *words++ = high;
+            *words++ = (uint16_t)(((lo >> shift) & 0xFF) | (((hi >> shift) & 0xFF) << 8));
+            *words++ = 0;
+        }
+    }
+}
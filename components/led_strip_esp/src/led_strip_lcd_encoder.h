@@ -0,0 +1,46 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of parallel words emitted per data bit: high, data, low
+ *
+ * @note At a 2.4 MHz word clock this gives the 1.25 us WS2812 bit period, with a high time of
+ *       0.42 us for a 0 and 0.83 us for a 1.
+ */
+#define LED_STRIP_LCD_WORDS_PER_BIT 3
+
+/**
+ * @brief Encode bytes of up to 8 lanes into 8-bit parallel words
+ *
+ * @note Bit l of every word drives lane l. Byte j of all lanes is expanded into
+ *       8 * LED_STRIP_LCD_WORDS_PER_BIT words, MSB first. Lanes shorter than `len` are padded with zeros.
+ *
+ * @param[in] lanes Start of each lane's bytes, already in wire order
+ * @param[in] lane_len Number of bytes of each lane
+ * @param[in] lane_count Number of lanes, 1 to 8
+ * @param[in] len Number of bytes to encode per lane, at least the longest lane
+ * @param[out] words Output, `len * 8 * LED_STRIP_LCD_WORDS_PER_BIT` words
+ */
+void led_strip_lcd_encode8(const uint8_t *const lanes[], const size_t lane_len[], size_t lane_count, size_t len, uint8_t *words);
+
+/**
+ * @brief Encode bytes of up to 16 lanes into 16-bit parallel words
+ *
+ * @note Same layout as `led_strip_lcd_encode8`, with 1 to 16 lanes.
+ */
+void led_strip_lcd_encode16(const uint8_t *const lanes[], const size_t lane_len[], size_t lane_count, size_t len, uint16_t *words);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,6 +6,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/cdefs.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "soc/soc_caps.h"
 #include "esp_log.h"
 #include "esp_check.h"
 #include "driver/rmt_tx.h"
@@ -14,18 +18,44 @@
 #include "led_strip_rmt_encoder.h"
 
 #define LED_STRIP_RMT_DEFAULT_RESOLUTION 10000000 // 10MHz resolution
+#define LED_STRIP_RMT_MAX_SEGMENTS 8
+#define LED_STRIP_RMT_DEFAULT_DMA_SYMBOLS 1024
 
 static const char *TAG = "led_strip_rmt";
 
 typedef struct {
-    led_strip_t base;
     rmt_channel_handle_t rmt_chan;
     rmt_encoder_handle_t strip_encoder;
+    uint32_t start;             // first pixel sent on this channel
+    uint32_t len;               // number of pixels sent on this channel
+} led_strip_rmt_segment_t;
+
+typedef struct {
+    led_strip_t base;
+    led_strip_rmt_segment_t segments[LED_STRIP_RMT_MAX_SEGMENTS];
+    uint32_t segment_count;
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    rmt_sync_manager_handle_t sync_manager; // starts all segments at once
+#endif
+    SemaphoreHandle_t done_sem; // given once per segment by the RMT done callback
+    bool busy;                  // a transmission is in flight
+    uint32_t pending_segments;  // segments of the transmission in flight not waited for yet
+    led_strip_rmt_stats_t stats;
+    led_strip_encoder_stats_t encoder_totals; // encoder counters summed over segments, when the last frame completed
+    led_strip_byte_symbols_t *byte_symbols;   // symbol table shared by the segment encoders
     uint32_t strip_len;
     uint8_t bytes_per_pixel;
-    uint8_t pixel_buf[];
+    uint8_t *pixel_buf;         // buffer written by set_pixel, never the one being transmitted
+    uint8_t pixel_mem[];        // two frames, used alternately as pixel_buf
 } led_strip_rmt_obj;
 
+// Share the RMT memory between the segments: the larger a channel's block, the fewer refill interrupts per frame
+static size_t led_strip_rmt_mem_block_symbols(uint32_t segment_count)
+{
+    uint32_t blocks = SOC_RMT_TX_CANDIDATES_PER_GROUP / segment_count;
+    return SOC_RMT_MEM_WORDS_PER_CHANNEL * (blocks ? blocks : 1);
+}
+
 static esp_err_t led_strip_rmt_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
@@ -55,21 +85,94 @@ static esp_err_t led_strip_rmt_set_pixel_rgbw(led_strip_t *strip, uint32_t index
     return ESP_OK;
 }
 
-static esp_err_t led_strip_rmt_refresh(led_strip_t *strip)
+static esp_err_t led_strip_rmt_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *pixels, led_strip_color_order_t order)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    return led_strip_copy_pixels(rmt_strip->pixel_buf, rmt_strip->strip_len, rmt_strip->bytes_per_pixel, start, count, pixels, order);
+}
+
+static bool IRAM_ATTR led_strip_rmt_on_trans_done(rmt_channel_handle_t tx_chan, const rmt_tx_done_event_data_t *edata, void *user_ctx)
+{
+    led_strip_rmt_obj *rmt_strip = (led_strip_rmt_obj *)user_ctx;
+    BaseType_t high_task_wakeup = pdFALSE;
+    xSemaphoreGiveFromISR(rmt_strip->done_sem, &high_task_wakeup);
+    return high_task_wakeup == pdTRUE;
+}
+
+static esp_err_t led_strip_rmt_wait_refresh_done(led_strip_t *strip, int32_t timeout_ms)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    if (!rmt_strip->busy) {
+        return ESP_OK;
+    }
+    TickType_t ticks = timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    while (rmt_strip->pending_segments > 0) {
+        ESP_RETURN_ON_FALSE(xSemaphoreTake(rmt_strip->done_sem, ticks) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "wait for refresh timed out");
+        rmt_strip->pending_segments--;
+    }
+    rmt_strip->busy = false;
+
+    // The work of this frame is what the encoders of all segments did since the last one
+    led_strip_encoder_stats_t totals = {};
+    for (uint32_t i = 0; i < rmt_strip->segment_count; i++) {
+        led_strip_encoder_stats_t segment_stats;
+        rmt_led_strip_encoder_get_stats(rmt_strip->segments[i].strip_encoder, &segment_stats);
+        totals.calls += segment_stats.calls;
+        totals.cycles += segment_stats.cycles;
+        if (segment_stats.max_cycles > totals.max_cycles) {
+            totals.max_cycles = segment_stats.max_cycles;
+        }
+    }
+    led_strip_rmt_stats_t *stats = &rmt_strip->stats;
+    stats->frames++;
+    stats->encoder_calls = totals.calls - rmt_strip->encoder_totals.calls;
+    stats->encode_cycles = totals.cycles - rmt_strip->encoder_totals.cycles;
+    stats->max_encode_cycles = totals.max_cycles;
+    if (stats->encoder_calls > stats->max_encoder_calls) {
+        stats->max_encoder_calls = stats->encoder_calls;
+    }
+    rmt_strip->encoder_totals = totals;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_rmt_refresh_async(led_strip_t *strip, const uint8_t *pixels)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    size_t frame_size = rmt_strip->strip_len * rmt_strip->bytes_per_pixel;
     rmt_transmit_config_t tx_conf = {
         .loop_count = 0,
     };
 
-    ESP_RETURN_ON_ERROR(rmt_enable(rmt_strip->rmt_chan), TAG, "enable RMT channel failed");
-    ESP_RETURN_ON_ERROR(rmt_transmit(rmt_strip->rmt_chan, rmt_strip->strip_encoder, rmt_strip->pixel_buf,
-                                     rmt_strip->strip_len * rmt_strip->bytes_per_pixel, &tx_conf), TAG, "transmit pixels by RMT failed");
-    ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rmt_strip->rmt_chan, -1), TAG, "flush RMT channel failed");
-    ESP_RETURN_ON_ERROR(rmt_disable(rmt_strip->rmt_chan), TAG, "disable RMT channel failed");
+    // Only one frame in flight: the encoder works on a single buffer at a time
+    ESP_RETURN_ON_ERROR(led_strip_rmt_wait_refresh_done(strip, -1), TAG, "wait for previous refresh failed");
+    if (!pixels) {
+        // Send the current buffer, set_pixel carries on with the other one from the same content
+        pixels = rmt_strip->pixel_buf;
+        rmt_strip->pixel_buf = pixels == rmt_strip->pixel_mem ? rmt_strip->pixel_mem + frame_size : rmt_strip->pixel_mem;
+        memcpy(rmt_strip->pixel_buf, pixels, frame_size);
+    }
+    // Segments are shifted out in parallel, started together by the sync manager when the chip has one
+    rmt_strip->busy = true;
+    for (uint32_t i = 0; i < rmt_strip->segment_count; i++) {
+        led_strip_rmt_segment_t *segment = &rmt_strip->segments[i];
+        ESP_RETURN_ON_ERROR(rmt_transmit(segment->rmt_chan, segment->strip_encoder, pixels + segment->start * rmt_strip->bytes_per_pixel,
+                                         segment->len * rmt_strip->bytes_per_pixel, &tx_conf), TAG, "transmit pixels by RMT failed");
+        rmt_strip->pending_segments++;
+    }
     return ESP_OK;
 }
 
+static esp_err_t led_strip_rmt_refresh_from(led_strip_t *strip, const uint8_t *pixels)
+{
+    ESP_RETURN_ON_ERROR(led_strip_rmt_refresh_async(strip, pixels), TAG, "refresh failed");
+    return led_strip_rmt_wait_refresh_done(strip, -1);
+}
+
+static esp_err_t led_strip_rmt_refresh(led_strip_t *strip)
+{
+    return led_strip_rmt_refresh_from(strip, NULL);
+}
+
 static esp_err_t led_strip_rmt_clear(led_strip_t *strip)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
@@ -81,18 +184,36 @@ static esp_err_t led_strip_rmt_clear(led_strip_t *strip)
 static esp_err_t led_strip_rmt_del(led_strip_t *strip)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
-    ESP_RETURN_ON_ERROR(rmt_del_channel(rmt_strip->rmt_chan), TAG, "delete RMT channel failed");
-    ESP_RETURN_ON_ERROR(rmt_del_encoder(rmt_strip->strip_encoder), TAG, "delete strip encoder failed");
+    ESP_RETURN_ON_ERROR(led_strip_rmt_wait_refresh_done(strip, -1), TAG, "wait for refresh failed");
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    if (rmt_strip->sync_manager) {
+        ESP_RETURN_ON_ERROR(rmt_del_sync_manager(rmt_strip->sync_manager), TAG, "delete sync manager failed");
+    }
+#endif
+    for (uint32_t i = 0; i < rmt_strip->segment_count; i++) {
+        led_strip_rmt_segment_t *segment = &rmt_strip->segments[i];
+        ESP_RETURN_ON_ERROR(rmt_disable(segment->rmt_chan), TAG, "disable RMT channel failed");
+        ESP_RETURN_ON_ERROR(rmt_del_channel(segment->rmt_chan), TAG, "delete RMT channel failed");
+        ESP_RETURN_ON_ERROR(rmt_del_encoder(segment->strip_encoder), TAG, "delete strip encoder failed");
+    }
+    free(rmt_strip->byte_symbols);
+    vSemaphoreDelete(rmt_strip->done_sem);
     free(rmt_strip);
     return ESP_OK;
 }
 
-esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const led_strip_rmt_config_t *rmt_config, led_strip_handle_t *ret_strip)
+esp_err_t led_strip_new_rmt_multi_device(const led_strip_config_t *led_config, const led_strip_rmt_config_t *rmt_config,
+                                         const uint32_t *segment_gpio_nums, uint32_t segment_count, led_strip_handle_t *ret_strip)
 {
     led_strip_rmt_obj *rmt_strip = NULL;
     esp_err_t ret = ESP_OK;
-    ESP_GOTO_ON_FALSE(led_config && rmt_config && ret_strip, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
+    ESP_GOTO_ON_FALSE(led_config && rmt_config && segment_gpio_nums && ret_strip, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
     ESP_GOTO_ON_FALSE(led_config->led_pixel_format < LED_PIXEL_FORMAT_INVALID, ESP_ERR_INVALID_ARG, err, TAG, "invalid led_pixel_format");
+#if !SOC_RMT_SUPPORT_DMA
+    ESP_GOTO_ON_FALSE(!rmt_config->flags.with_dma, ESP_ERR_NOT_SUPPORTED, err, TAG, "DMA not supported by this RMT");
+#endif
+    ESP_GOTO_ON_FALSE(segment_count > 0 && segment_count <= LED_STRIP_RMT_MAX_SEGMENTS && segment_count <= led_config->max_leds,
+                      ESP_ERR_INVALID_ARG, err, TAG, "invalid segment count");
     uint8_t bytes_per_pixel;
     if (led_config->led_pixel_format == LED_PIXEL_FORMAT_GRBW) {
         bytes_per_pixel = 4;
@@ -101,8 +222,11 @@ esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const l
     } else {
         assert(false);
     }
-    rmt_strip = calloc(1, sizeof(led_strip_rmt_obj) + led_config->max_leds * bytes_per_pixel);
+    rmt_strip = calloc(1, sizeof(led_strip_rmt_obj) + 2 * led_config->max_leds * bytes_per_pixel);
     ESP_GOTO_ON_FALSE(rmt_strip, ESP_ERR_NO_MEM, err, TAG, "no mem for rmt strip");
+    rmt_strip->pixel_buf = rmt_strip->pixel_mem;
+    rmt_strip->done_sem = xSemaphoreCreateCounting(segment_count, 0);
+    ESP_GOTO_ON_FALSE(rmt_strip->done_sem, ESP_ERR_NO_MEM, err, TAG, "no mem for done semaphore");
     uint32_t resolution = rmt_config->resolution_hz ? rmt_config->resolution_hz : LED_STRIP_RMT_DEFAULT_RESOLUTION;
 
     // for backward compatibility, if the user does not set the clk_src, use the default value
@@ -110,29 +234,69 @@ esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const l
     if (rmt_config->clk_src) {
         clk_src = rmt_config->clk_src;
     }
-    rmt_tx_channel_config_t rmt_chan_config = {
-        .clk_src = clk_src,
-        .gpio_num = led_config->strip_gpio_num,
-        .mem_block_symbols = 64,
-        .resolution_hz = resolution,
-        .trans_queue_depth = 4,
-        .flags.with_dma = rmt_config->flags.with_dma,
-        .flags.invert_out = led_config->flags.invert_out,
-    };
-    ESP_GOTO_ON_ERROR(rmt_new_tx_channel(&rmt_chan_config, &rmt_strip->rmt_chan), err, TAG, "create RMT TX channel failed");
-
     led_strip_encoder_config_t strip_encoder_conf = {
         .resolution = resolution,
         .led_model = led_config->led_model
     };
-    ESP_GOTO_ON_ERROR(rmt_new_led_strip_encoder(&strip_encoder_conf, &rmt_strip->strip_encoder), err, TAG, "create LED strip encoder failed");
+    // The table only depends on the bit timing, 8 KB are enough for all segments
+    ESP_GOTO_ON_ERROR(rmt_new_led_strip_byte_symbols(&strip_encoder_conf, &rmt_strip->byte_symbols), err, TAG, "create byte symbols failed");
+    strip_encoder_conf.byte_symbols = rmt_strip->byte_symbols;
+    rmt_tx_event_callbacks_t cbs = {
+        .on_trans_done = led_strip_rmt_on_trans_done,
+    };
+    rmt_channel_handle_t channels[LED_STRIP_RMT_MAX_SEGMENTS];
+    size_t mem_block_symbols = rmt_config->mem_block_symbols;
+    if (!mem_block_symbols) {
+        mem_block_symbols = rmt_config->flags.with_dma ? LED_STRIP_RMT_DEFAULT_DMA_SYMBOLS : led_strip_rmt_mem_block_symbols(segment_count);
+    }
+
+    for (uint32_t i = 0; i < segment_count; i++) {
+        led_strip_rmt_segment_t *segment = &rmt_strip->segments[i];
+        rmt_tx_channel_config_t rmt_chan_config = {
+            .clk_src = clk_src,
+            .gpio_num = segment_gpio_nums[i],
+            .mem_block_symbols = mem_block_symbols,
+            .resolution_hz = resolution,
+            .trans_queue_depth = 4,
+            .flags.with_dma = rmt_config->flags.with_dma,
+            .flags.invert_out = led_config->flags.invert_out,
+        };
+        ESP_GOTO_ON_ERROR(rmt_new_tx_channel(&rmt_chan_config, &segment->rmt_chan), err, TAG, "create RMT TX channel failed");
+        rmt_strip->segment_count = i + 1;
+        // Encoders keep per-transmission state, so every channel needs its own, the symbol table is read only
+        ESP_GOTO_ON_ERROR(rmt_new_led_strip_encoder(&strip_encoder_conf, &segment->strip_encoder), err, TAG, "create LED strip encoder failed");
+        ESP_GOTO_ON_ERROR(rmt_tx_register_event_callbacks(segment->rmt_chan, &cbs, rmt_strip), err, TAG, "register RMT callbacks failed");
+        segment->start = led_strip_segment_start(led_config->max_leds, segment_count, i);
+        segment->len = led_strip_segment_start(led_config->max_leds, segment_count, i + 1) - segment->start;
+        channels[i] = segment->rmt_chan;
+    }
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    if (segment_count > 1) {
+        rmt_sync_manager_config_t sync_config = {
+            .tx_channel_array = channels,
+            .array_size = segment_count,
+        };
+        ESP_GOTO_ON_ERROR(rmt_new_sync_manager(&sync_config, &rmt_strip->sync_manager), err, TAG, "create sync manager failed");
+    }
+#else
+    (void)channels;
+#endif
 
+    // The channels stay enabled for the lifetime of the strip, so that refreshes can be queued back to back
+    for (uint32_t i = 0; i < segment_count; i++) {
+        ESP_GOTO_ON_ERROR(rmt_enable(rmt_strip->segments[i].rmt_chan), err, TAG, "enable RMT channel failed");
+    }
 
     rmt_strip->bytes_per_pixel = bytes_per_pixel;
     rmt_strip->strip_len = led_config->max_leds;
     rmt_strip->base.set_pixel = led_strip_rmt_set_pixel;
     rmt_strip->base.set_pixel_rgbw = led_strip_rmt_set_pixel_rgbw;
+    rmt_strip->base.set_pixels = led_strip_rmt_set_pixels;
     rmt_strip->base.refresh = led_strip_rmt_refresh;
+    rmt_strip->base.refresh_from = led_strip_rmt_refresh_from;
+    rmt_strip->base.refresh_async = led_strip_rmt_refresh_async;
+    rmt_strip->base.wait_refresh_done = led_strip_rmt_wait_refresh_done;
     rmt_strip->base.clear = led_strip_rmt_clear;
     rmt_strip->base.del = led_strip_rmt_del;
 
@@ -140,13 +304,38 @@ esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const l
     return ESP_OK;
 err:
     if (rmt_strip) {
-        if (rmt_strip->rmt_chan) {
-            rmt_del_channel(rmt_strip->rmt_chan);
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+        if (rmt_strip->sync_manager) {
+            rmt_del_sync_manager(rmt_strip->sync_manager);
         }
-        if (rmt_strip->strip_encoder) {
-            rmt_del_encoder(rmt_strip->strip_encoder);
+#endif
+        for (uint32_t i = 0; i < rmt_strip->segment_count; i++) {
+            led_strip_rmt_segment_t *segment = &rmt_strip->segments[i];
+            rmt_disable(segment->rmt_chan);
+            rmt_del_channel(segment->rmt_chan);
+            if (segment->strip_encoder) {
+                rmt_del_encoder(segment->strip_encoder);
+            }
+        }
+        free(rmt_strip->byte_symbols);
+        if (rmt_strip->done_sem) {
+            vSemaphoreDelete(rmt_strip->done_sem);
         }
         free(rmt_strip);
     }
     return ret;
 }
+
+esp_err_t led_strip_rmt_get_stats(led_strip_handle_t strip, led_strip_rmt_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(strip && stats, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    *stats = rmt_strip->stats;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const led_strip_rmt_config_t *rmt_config, led_strip_handle_t *ret_strip)
+{
+    ESP_RETURN_ON_FALSE(led_config, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    return led_strip_new_rmt_multi_device(led_config, rmt_config, &led_config->strip_gpio_num, 1, ret_strip);
+}
@@ -4,37 +4,48 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include "esp_attr.h"
 #include "esp_check.h"
+#include "esp_cpu.h"
 #include "led_strip_rmt_encoder.h"
 
 static const char *TAG = "led_rmt_encoder";
 
 typedef struct {
     rmt_encoder_t base;
-    rmt_encoder_t *bytes_encoder;
     rmt_encoder_t *copy_encoder;
     int state;
+    size_t byte_index;                      // next byte of the pixel data to encode
+    led_strip_encoder_stats_t stats;
     rmt_symbol_word_t reset_code;
+    const led_strip_byte_symbols_t *byte_symbols; // every byte value expanded into its 8 bit symbols, shared with the strip's other encoders
 } rmt_led_strip_encoder_t;
 
-static size_t rmt_encode_led_strip(rmt_encoder_t *encoder, rmt_channel_handle_t channel, const void *primary_data, size_t data_size, rmt_encode_state_t *ret_state)
+static size_t IRAM_ATTR rmt_encode_led_strip(rmt_encoder_t *encoder, rmt_channel_handle_t channel, const void *primary_data, size_t data_size, rmt_encode_state_t *ret_state)
 {
     rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
-    rmt_encoder_handle_t bytes_encoder = led_encoder->bytes_encoder;
     rmt_encoder_handle_t copy_encoder = led_encoder->copy_encoder;
+    const uint8_t *data = (const uint8_t *)primary_data;
     rmt_encode_state_t session_state = 0;
     rmt_encode_state_t state = 0;
     size_t encoded_symbols = 0;
+    uint32_t start_cycles = esp_cpu_get_cycle_count();
     switch (led_encoder->state) {
     case 0: // send RGB data
-        encoded_symbols += bytes_encoder->encode(bytes_encoder, channel, primary_data, data_size, &session_state);
-        if (session_state & RMT_ENCODING_COMPLETE) {
-            led_encoder->state = 1; // switch to next state when current encoding session finished
-        }
-        if (session_state & RMT_ENCODING_MEM_FULL) {
-            state |= RMT_ENCODING_MEM_FULL;
-            goto out; // yield if there's no free space for encoding artifacts
+        // Symbols are copied straight from the table, a byte may be split across two refills of the RMT memory
+        while (led_encoder->byte_index < data_size) {
+            encoded_symbols += copy_encoder->encode(copy_encoder, channel, (*led_encoder->byte_symbols)[data[led_encoder->byte_index]],
+                                                    sizeof((*led_encoder->byte_symbols)[0]), &session_state);
+            if (session_state & RMT_ENCODING_COMPLETE) {
+                led_encoder->byte_index++;
+            }
+            if (session_state & RMT_ENCODING_MEM_FULL) {
+                state |= RMT_ENCODING_MEM_FULL;
+                goto out; // yield if there's no free space for encoding artifacts
+            }
         }
+        led_encoder->byte_index = 0;
+        led_encoder->state = 1; // switch to next state when current encoding session finished
     // fall-through
     case 1: // send reset code
         encoded_symbols += copy_encoder->encode(copy_encoder, channel, &led_encoder->reset_code,
@@ -50,13 +61,18 @@ static size_t rmt_encode_led_strip(rmt_encoder_t *encoder, rmt_channel_handle_t
     }
 out:
     *ret_state = state;
+    uint32_t cycles = esp_cpu_get_cycle_count() - start_cycles;
+    led_encoder->stats.calls++;
+    led_encoder->stats.cycles += cycles;
+    if (cycles > led_encoder->stats.max_cycles) {
+        led_encoder->stats.max_cycles = cycles;
+    }
     return encoded_symbols;
 }
 
 static esp_err_t rmt_del_led_strip_encoder(rmt_encoder_t *encoder)
 {
     rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
-    rmt_del_encoder(led_encoder->bytes_encoder);
     rmt_del_encoder(led_encoder->copy_encoder);
     free(led_encoder);
     return ESP_OK;
@@ -65,61 +81,72 @@ static esp_err_t rmt_del_led_strip_encoder(rmt_encoder_t *encoder)
 static esp_err_t rmt_led_strip_encoder_reset(rmt_encoder_t *encoder)
 {
     rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
-    rmt_encoder_reset(led_encoder->bytes_encoder);
     rmt_encoder_reset(led_encoder->copy_encoder);
     led_encoder->state = 0;
+    led_encoder->byte_index = 0;
     return ESP_OK;
 }
 
-esp_err_t rmt_new_led_strip_encoder(const led_strip_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder)
+esp_err_t rmt_new_led_strip_byte_symbols(const led_strip_encoder_config_t *config, led_strip_byte_symbols_t **ret_symbols)
 {
-    esp_err_t ret = ESP_OK;
-    rmt_led_strip_encoder_t *led_encoder = NULL;
-    ESP_GOTO_ON_FALSE(config && ret_encoder, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
-    ESP_GOTO_ON_FALSE(config->led_model < LED_MODEL_INVALID, ESP_ERR_INVALID_ARG, err, TAG, "invalid led model");
-    led_encoder = calloc(1, sizeof(rmt_led_strip_encoder_t));
-    ESP_GOTO_ON_FALSE(led_encoder, ESP_ERR_NO_MEM, err, TAG, "no mem for led strip encoder");
-    led_encoder->base.encode = rmt_encode_led_strip;
-    led_encoder->base.del = rmt_del_led_strip_encoder;
-    led_encoder->base.reset = rmt_led_strip_encoder_reset;
-    rmt_bytes_encoder_config_t bytes_encoder_config;
+    ESP_RETURN_ON_FALSE(config && ret_symbols, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->led_model == LED_MODEL_WS2812 || config->led_model == LED_MODEL_SK6812, ESP_ERR_INVALID_ARG, TAG, "invalid led model");
+    rmt_symbol_word_t bit0, bit1;
     if (config->led_model == LED_MODEL_SK6812) {
-        bytes_encoder_config = (rmt_bytes_encoder_config_t) {
-            .bit0 = {
-                .level0 = 1,
-                .duration0 = 0.3 * config->resolution / 1000000, // T0H=0.3us
-                .level1 = 0,
-                .duration1 = 0.9 * config->resolution / 1000000, // T0L=0.9us
-            },
-            .bit1 = {
-                .level0 = 1,
-                .duration0 = 0.6 * config->resolution / 1000000, // T1H=0.6us
-                .level1 = 0,
-                .duration1 = 0.6 * config->resolution / 1000000, // T1L=0.6us
-            },
-            .flags.msb_first = 1 // SK6812 transfer bit order: G7...G0R7...R0B7...B0(W7...W0)
+        // SK6812 transfer bit order: G7...G0R7...R0B7...B0(W7...W0)
+        bit0 = (rmt_symbol_word_t) {
+            .level0 = 1,
+            .duration0 = 0.3 * config->resolution / 1000000, // T0H=0.3us
+            .level1 = 0,
+            .duration1 = 0.9 * config->resolution / 1000000, // T0L=0.9us
+        };
+        bit1 = (rmt_symbol_word_t) {
+            .level0 = 1,
+            .duration0 = 0.6 * config->resolution / 1000000, // T1H=0.6us
+            .level1 = 0,
+            .duration1 = 0.6 * config->resolution / 1000000, // T1L=0.6us
         };
     } else if (config->led_model == LED_MODEL_WS2812) {
         // different led strip might have its own timing requirements, following parameter is for WS2812
-        bytes_encoder_config = (rmt_bytes_encoder_config_t) {
-            .bit0 = {
-                .level0 = 1,
-                .duration0 = 0.3 * config->resolution / 1000000, // T0H=0.3us
-                .level1 = 0,
-                .duration1 = 0.9 * config->resolution / 1000000, // T0L=0.9us
-            },
-            .bit1 = {
-                .level0 = 1,
-                .duration0 = 0.9 * config->resolution / 1000000, // T1H=0.9us
-                .level1 = 0,
-                .duration1 = 0.3 * config->resolution / 1000000, // T1L=0.3us
-            },
-            .flags.msb_first = 1 // WS2812 transfer bit order: G7...G0R7...R0B7...B0
+        // WS2812 transfer bit order: G7...G0R7...R0B7...B0
+        bit0 = (rmt_symbol_word_t) {
+            .level0 = 1,
+            .duration0 = 0.3 * config->resolution / 1000000, // T0H=0.3us
+            .level1 = 0,
+            .duration1 = 0.9 * config->resolution / 1000000, // T0L=0.9us
+        };
+        bit1 = (rmt_symbol_word_t) {
+            .level0 = 1,
+            .duration0 = 0.9 * config->resolution / 1000000, // T1H=0.9us
+            .level1 = 0,
+            .duration1 = 0.3 * config->resolution / 1000000, // T1L=0.3us
         };
     } else {
         assert(false);
     }
-    ESP_GOTO_ON_ERROR(rmt_new_bytes_encoder(&bytes_encoder_config, &led_encoder->bytes_encoder), err, TAG, "create bytes encoder failed");
+    led_strip_byte_symbols_t *byte_symbols = malloc(sizeof(led_strip_byte_symbols_t));
+    ESP_RETURN_ON_FALSE(byte_symbols, ESP_ERR_NO_MEM, TAG, "no mem for byte symbols");
+    for (int value = 0; value < 256; value++) {
+        for (int bit = 0; bit < 8; bit++) {
+            (*byte_symbols)[value][bit] = value & (0x80 >> bit) ? bit1 : bit0;
+        }
+    }
+    *ret_symbols = byte_symbols;
+    return ESP_OK;
+}
+
+esp_err_t rmt_new_led_strip_encoder(const led_strip_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder)
+{
+    esp_err_t ret = ESP_OK;
+    rmt_led_strip_encoder_t *led_encoder = NULL;
+    ESP_GOTO_ON_FALSE(config && config->byte_symbols && ret_encoder, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
+    ESP_GOTO_ON_FALSE(config->led_model == LED_MODEL_WS2812 || config->led_model == LED_MODEL_SK6812, ESP_ERR_INVALID_ARG, err, TAG, "invalid led model");
+    led_encoder = calloc(1, sizeof(rmt_led_strip_encoder_t));
+    ESP_GOTO_ON_FALSE(led_encoder, ESP_ERR_NO_MEM, err, TAG, "no mem for led strip encoder");
+    led_encoder->base.encode = rmt_encode_led_strip;
+    led_encoder->base.del = rmt_del_led_strip_encoder;
+    led_encoder->base.reset = rmt_led_strip_encoder_reset;
+    led_encoder->byte_symbols = config->byte_symbols;
     rmt_copy_encoder_config_t copy_encoder_config = {};
     ESP_GOTO_ON_ERROR(rmt_new_copy_encoder(&copy_encoder_config, &led_encoder->copy_encoder), err, TAG, "create copy encoder failed");
 
@@ -134,9 +161,6 @@ esp_err_t rmt_new_led_strip_encoder(const led_strip_encoder_config_t *config, rm
     return ESP_OK;
 err:
     if (led_encoder) {
-        if (led_encoder->bytes_encoder) {
-            rmt_del_encoder(led_encoder->bytes_encoder);
-        }
         if (led_encoder->copy_encoder) {
             rmt_del_encoder(led_encoder->copy_encoder);
         }
@@ -144,3 +168,9 @@ err:
     }
     return ret;
 }
+
+void rmt_led_strip_encoder_get_stats(rmt_encoder_handle_t encoder, led_strip_encoder_stats_t *stats)
+{
+    rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
+    *stats = led_encoder->stats;
+}
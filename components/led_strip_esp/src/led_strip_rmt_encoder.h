@@ -13,14 +13,44 @@
 extern "C" {
 #endif
 
+/**
+ * @brief RMT symbols of every byte value, its 8 bits MSB first
+ */
+typedef rmt_symbol_word_t led_strip_byte_symbols_t[256][8];
+
 /**
  * @brief Type of led strip encoder configuration
  */
 typedef struct {
     uint32_t resolution;   /*!< Encoder resolution, in Hz */
     led_model_t led_model; /*!< LED model */
+    const led_strip_byte_symbols_t *byte_symbols; /*!< Table made by `rmt_new_led_strip_byte_symbols` with the same resolution and model,
+                                                       encoders of the same strip share one */
 } led_strip_encoder_config_t;
 
+/**
+ * @brief Work done by a led strip encoder since its creation
+ */
+typedef struct {
+    uint32_t calls;        /*!< Number of encoding steps, the first step of a frame runs in rmt_transmit, the others in the RMT interrupt */
+    uint32_t cycles;       /*!< CPU cycles spent in all steps */
+    uint32_t max_cycles;   /*!< Longest single step, in CPU cycles */
+} led_strip_encoder_stats_t;
+
+/**
+ * @brief Expand every byte value into the bit symbols of an LED model, for `led_strip_encoder_config_t`
+ *
+ * @note `byte_symbols` of the configuration is not used. The table is freed with `free` once no encoder uses it.
+ *
+ * @param[in] config Encoder configuration
+ * @param[out] ret_symbols Returned table
+ * @return
+ *      - ESP_ERR_INVALID_ARG for any invalid arguments
+ *      - ESP_ERR_NO_MEM out of memory when creating the table
+ *      - ESP_OK if creating the table successfully
+ */
+esp_err_t rmt_new_led_strip_byte_symbols(const led_strip_encoder_config_t *config, led_strip_byte_symbols_t **ret_symbols);
+
 /**
  * @brief Create RMT encoder for encoding LED strip pixels into RMT symbols
  *
@@ -33,6 +63,14 @@ typedef struct {
  */
 esp_err_t rmt_new_led_strip_encoder(const led_strip_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder);
 
+/**
+ * @brief Get the work counters of an encoder created by `rmt_new_led_strip_encoder`
+ *
+ * @param[in] encoder Encoder handle
+ * @param[out] stats Returned counters
+ */
+void rmt_led_strip_encoder_get_stats(rmt_encoder_handle_t encoder, led_strip_encoder_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,200 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/cdefs.h>
+#include "esp_heap_caps.h"
+#include "soc/soc_caps.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "driver/spi_master.h"
+#include "led_strip.h"
+#include "led_strip_interface.h"
+
+#define LED_STRIP_SPI_DEFAULT_CLK_HZ 10000000 // 10MHz
+#define LED_STRIP_SPI_MAX_BRIGHTNESS 31
+#define LED_STRIP_SPI_START_BYTES 4           // 32 zero bits start a frame
+
+static const char *TAG = "led_strip_spi";
+
+typedef struct {
+    led_strip_t base;
+    spi_host_device_t spi_bus;
+    spi_device_handle_t spi_device;
+    spi_transaction_t trans;    // transaction in flight, when busy
+    bool busy;                  // a transmission is in flight
+    size_t dma_size;            // bytes of one encoded frame
+    uint8_t *dma_buf[2];        // encoded frames, one may be in flight while the other is filled
+    uint32_t next_dma;          // index of the buffer not in flight
+    uint8_t brightness_byte;    // first byte of every pixel: 0b111 then the 5-bit brightness
+    uint32_t strip_len;
+    uint8_t pixel_buf[];        // GRB, like the other backends
+} led_strip_spi_obj;
+
+static esp_err_t led_strip_spi_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    ESP_RETURN_ON_FALSE(index < spi_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    uint8_t *buf_start = spi_strip->pixel_buf + index * 3;
+    *buf_start = green & 0xFF;
+    *++buf_start = red & 0xFF;
+    *++buf_start = blue & 0xFF;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_spi_set_pixel_rgbw(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue, uint32_t white)
+{
+    ESP_LOGE(TAG, "wrong LED pixel format, APA102 has no white channel");
+    return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t led_strip_spi_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *pixels, led_strip_color_order_t order)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    return led_strip_copy_pixels(spi_strip->pixel_buf, spi_strip->strip_len, 3, start, count, pixels, order);
+}
+
+static esp_err_t led_strip_spi_wait_refresh_done(led_strip_t *strip, int32_t timeout_ms)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    spi_transaction_t *done_trans;
+    if (!spi_strip->busy) {
+        return ESP_OK;
+    }
+    TickType_t ticks = timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    ESP_RETURN_ON_ERROR(spi_device_get_trans_result(spi_strip->spi_device, &done_trans, ticks), TAG, "wait for refresh timed out");
+    spi_strip->busy = false;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_spi_refresh_async(led_strip_t *strip, const uint8_t *pixels)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    uint8_t *frame = spi_strip->dma_buf[spi_strip->next_dma];
+
+    if (!pixels) {
+        pixels = spi_strip->pixel_buf;
+    }
+    // Every pixel is sent as brightness, B, G, R; the start and end frames around them stay as allocated
+    uint8_t *out = frame + LED_STRIP_SPI_START_BYTES;
+    for (const uint8_t *end = pixels + spi_strip->strip_len * 3; pixels < end; pixels += 3, out += 4) {
+        out[0] = spi_strip->brightness_byte;
+        out[1] = pixels[2];
+        out[2] = pixels[0];
+        out[3] = pixels[1];
+    }
+
+    ESP_RETURN_ON_ERROR(led_strip_spi_wait_refresh_done(strip, -1), TAG, "wait for previous refresh failed");
+    spi_strip->trans = (spi_transaction_t) {
+        .length = spi_strip->dma_size * 8,
+        .tx_buffer = frame,
+    };
+    ESP_RETURN_ON_ERROR(spi_device_queue_trans(spi_strip->spi_device, &spi_strip->trans, portMAX_DELAY), TAG, "transmit pixels by SPI failed");
+    spi_strip->busy = true;
+    spi_strip->next_dma ^= 1;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_spi_refresh_from(led_strip_t *strip, const uint8_t *pixels)
+{
+    ESP_RETURN_ON_ERROR(led_strip_spi_refresh_async(strip, pixels), TAG, "refresh failed");
+    return led_strip_spi_wait_refresh_done(strip, -1);
+}
+
+static esp_err_t led_strip_spi_refresh(led_strip_t *strip)
+{
+    return led_strip_spi_refresh_from(strip, NULL);
+}
+
+static esp_err_t led_strip_spi_clear(led_strip_t *strip)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    // Write zero to turn off all leds
+    memset(spi_strip->pixel_buf, 0, spi_strip->strip_len * 3);
+    return led_strip_spi_refresh(strip);
+}
+
+static esp_err_t led_strip_spi_del(led_strip_t *strip)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    ESP_RETURN_ON_ERROR(led_strip_spi_wait_refresh_done(strip, -1), TAG, "wait for refresh failed");
+    ESP_RETURN_ON_ERROR(spi_bus_remove_device(spi_strip->spi_device), TAG, "remove SPI device failed");
+    ESP_RETURN_ON_ERROR(spi_bus_free(spi_strip->spi_bus), TAG, "free SPI bus failed");
+    free(spi_strip->dma_buf[0]);
+    free(spi_strip->dma_buf[1]);
+    free(spi_strip);
+    return ESP_OK;
+}
+
+esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const led_strip_spi_config_t *spi_config, led_strip_handle_t *ret_strip)
+{
+    led_strip_spi_obj *spi_strip = NULL;
+    bool bus_initialized = false;
+    esp_err_t ret = ESP_OK;
+    ESP_GOTO_ON_FALSE(led_config && spi_config && ret_strip, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
+    ESP_GOTO_ON_FALSE(led_config->led_model == LED_MODEL_APA102, ESP_ERR_INVALID_ARG, err, TAG, "invalid led model, expected APA102");
+    ESP_GOTO_ON_FALSE(led_config->led_pixel_format == LED_PIXEL_FORMAT_GRB, ESP_ERR_INVALID_ARG, err, TAG, "invalid led_pixel_format, expected GRB");
+    ESP_GOTO_ON_FALSE(spi_config->global_brightness <= LED_STRIP_SPI_MAX_BRIGHTNESS, ESP_ERR_INVALID_ARG, err, TAG, "invalid global brightness");
+    spi_strip = calloc(1, sizeof(led_strip_spi_obj) + led_config->max_leds * 3);
+    ESP_GOTO_ON_FALSE(spi_strip, ESP_ERR_NO_MEM, err, TAG, "no mem for spi strip");
+
+    // The end frame clocks the data through the chain, one edge per LED: 32 zero bits for SK9822,
+    // then at least max_leds / 2 more bits
+    spi_strip->dma_size = LED_STRIP_SPI_START_BYTES + led_config->max_leds * 4 + 4 + (led_config->max_leds + 15) / 16;
+    // Without DMA a transaction is limited to the SPI data buffer
+    ESP_GOTO_ON_FALSE(spi_config->flags.with_dma || spi_strip->dma_size <= SOC_SPI_MAXIMUM_BUFFER_SIZE, ESP_ERR_INVALID_ARG, err, TAG,
+                      "%u byte frame too long without DMA", (unsigned int)spi_strip->dma_size);
+    uint32_t caps = spi_config->flags.with_dma ? MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL : MALLOC_CAP_INTERNAL;
+    for (int i = 0; i < 2; i++) {
+        spi_strip->dma_buf[i] = heap_caps_calloc(1, spi_strip->dma_size, caps);
+        ESP_GOTO_ON_FALSE(spi_strip->dma_buf[i], ESP_ERR_NO_MEM, err, TAG, "no mem for frame buffer");
+    }
+
+    spi_bus_config_t bus_config = {
+        .mosi_io_num = led_config->strip_gpio_num,
+        .miso_io_num = -1,
+        .sclk_io_num = spi_config->clk_gpio_num,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = spi_strip->dma_size,
+    };
+    ESP_GOTO_ON_ERROR(spi_bus_initialize(spi_config->spi_bus, &bus_config, spi_config->flags.with_dma ? SPI_DMA_CH_AUTO : SPI_DMA_DISABLED),
+                      err, TAG, "initialize SPI bus failed");
+    spi_strip->spi_bus = spi_config->spi_bus;
+    bus_initialized = true;
+    spi_device_interface_config_t dev_config = {
+        .clock_speed_hz = spi_config->clk_speed_hz ? spi_config->clk_speed_hz : LED_STRIP_SPI_DEFAULT_CLK_HZ,
+        .mode = 0,              // data sampled on the rising edge
+        .spics_io_num = -1,
+        .queue_size = 1,
+    };
+    ESP_GOTO_ON_ERROR(spi_bus_add_device(spi_strip->spi_bus, &dev_config, &spi_strip->spi_device), err, TAG, "add SPI device failed");
+
+    spi_strip->brightness_byte = 0xE0 | (spi_config->global_brightness ? spi_config->global_brightness : LED_STRIP_SPI_MAX_BRIGHTNESS);
+    spi_strip->strip_len = led_config->max_leds;
+    spi_strip->base.set_pixel = led_strip_spi_set_pixel;
+    spi_strip->base.set_pixel_rgbw = led_strip_spi_set_pixel_rgbw;
+    spi_strip->base.set_pixels = led_strip_spi_set_pixels;
+    spi_strip->base.refresh = led_strip_spi_refresh;
+    spi_strip->base.refresh_from = led_strip_spi_refresh_from;
+    spi_strip->base.refresh_async = led_strip_spi_refresh_async;
+    spi_strip->base.wait_refresh_done = led_strip_spi_wait_refresh_done;
+    spi_strip->base.clear = led_strip_spi_clear;
+    spi_strip->base.del = led_strip_spi_del;
+
+    *ret_strip = &spi_strip->base;
+    return ESP_OK;
+err:
+    if (spi_strip) {
+        if (bus_initialized) {
+            spi_bus_free(spi_strip->spi_bus);
+        }
+        free(spi_strip->dma_buf[0]);
+        free(spi_strip->dma_buf[1]);
+        free(spi_strip);
+    }
+    return ret;
+}
@@ -0,0 +1,341 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/cdefs.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "led_strip.h"
+#include "led_strip_interface.h"
+#include "led_strip_virtual.h"
+
+// glibc's <sys/cdefs.h> has no __containerof
+#ifndef __containerof
+#define __containerof(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+#define LED_STRIP_VIRTUAL_DEFAULT_MAX_FRAMES 4096
+#define LED_STRIP_VIRTUAL_BIT_NS 1250   // WS2812/SK6812 bit period
+#define LED_STRIP_VIRTUAL_RESET_US 50   // latch time after the last bit
+
+static const char *TAG = "led_strip_virtual";
+
+typedef struct {
+    led_strip_t base;
+    uint32_t strip_len;
+    uint8_t bytes_per_pixel;
+    bool simulate_timing;
+    uint32_t longest_segment;   // pixels in the longest segment, which sets the refresh time
+    int64_t busy_until_us;      // end of the simulated transmission in flight
+    uint32_t max_frames;
+    led_strip_virtual_stats_t stats;
+    uint8_t *frames;    // ring of `max_frames` recorded frames, in wire order
+    uint8_t pixel_buf[];
+} led_strip_virtual_obj;
+
+static int64_t led_strip_virtual_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static esp_err_t led_strip_virtual_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
+{
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    ESP_RETURN_ON_FALSE(index < virtual_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    uint32_t start = index * virtual_strip->bytes_per_pixel;
+    virtual_strip->pixel_buf[start + 0] = green & 0xFF;
+    virtual_strip->pixel_buf[start + 1] = red & 0xFF;
+    virtual_strip->pixel_buf[start + 2] = blue & 0xFF;
+    if (virtual_strip->bytes_per_pixel > 3) {
+        virtual_strip->pixel_buf[start + 3] = 0;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_virtual_set_pixel_rgbw(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue, uint32_t white)
+{
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    ESP_RETURN_ON_FALSE(index < virtual_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    ESP_RETURN_ON_FALSE(virtual_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    uint8_t *buf_start = virtual_strip->pixel_buf + index * 4;
+    *buf_start = green & 0xFF;
+    *++buf_start = red & 0xFF;
+    *++buf_start = blue & 0xFF;
+    *++buf_start = white & 0xFF;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_virtual_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *pixels, led_strip_color_order_t order)
+{
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    return led_strip_copy_pixels(virtual_strip->pixel_buf, virtual_strip->strip_len, virtual_strip->bytes_per_pixel, start, count, pixels, order);
+}
+
+static esp_err_t led_strip_virtual_wait_refresh_done(led_strip_t *strip, int32_t timeout_ms)
+{
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    int64_t remaining_us = virtual_strip->busy_until_us - led_strip_virtual_now_us();
+    if (remaining_us <= 0) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_FALSE(timeout_ms < 0 || remaining_us <= (int64_t)timeout_ms * 1000, ESP_ERR_TIMEOUT, TAG, "wait for refresh timed out");
+    struct timespec ts = {
+        .tv_sec = remaining_us / 1000000,
+        .tv_nsec = (remaining_us % 1000000) * 1000,
+    };
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_virtual_refresh_async(led_strip_t *strip, const uint8_t *pixels)
+{
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    size_t frame_size = virtual_strip->strip_len * virtual_strip->bytes_per_pixel;
+
+    led_strip_virtual_wait_refresh_done(strip, -1);
+    int64_t now = led_strip_virtual_now_us();
+    if (virtual_strip->simulate_timing) {
+        // Busy for as long as the longest segment takes to be shifted out and latched
+        int64_t segment_size = (int64_t)virtual_strip->longest_segment * virtual_strip->bytes_per_pixel;
+        virtual_strip->busy_until_us = now + segment_size * 8 * LED_STRIP_VIRTUAL_BIT_NS / 1000 + LED_STRIP_VIRTUAL_RESET_US;
+    }
+
+    // The frame is recorded right away, so set_pixel can keep using a single pixel memory
+    uint32_t slot = virtual_strip->stats.frames % virtual_strip->max_frames;
+    memcpy(virtual_strip->frames + slot * frame_size, pixels ? pixels : virtual_strip->pixel_buf, frame_size);
+
+    if (virtual_strip->stats.frames == 0) {
+        virtual_strip->stats.first_refresh_us = now;
+    }
+    virtual_strip->stats.last_refresh_us = now;
+    virtual_strip->stats.frames++;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_virtual_refresh_from(led_strip_t *strip, const uint8_t *pixels)
+{
+    led_strip_virtual_refresh_async(strip, pixels);
+    return led_strip_virtual_wait_refresh_done(strip, -1);
+}
+
+static esp_err_t led_strip_virtual_refresh(led_strip_t *strip)
+{
+    return led_strip_virtual_refresh_from(strip, NULL);
+}
+
+static esp_err_t led_strip_virtual_clear(led_strip_t *strip)
+{
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    memset(virtual_strip->pixel_buf, 0, virtual_strip->strip_len * virtual_strip->bytes_per_pixel);
+    return led_strip_virtual_refresh(strip);
+}
+
+static esp_err_t led_strip_virtual_del(led_strip_t *strip)
+{
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    free(virtual_strip->frames);
+    free(virtual_strip);
+    return ESP_OK;
+}
+
+esp_err_t led_strip_new_virtual_device(const led_strip_config_t *led_config, const led_strip_virtual_config_t *virtual_config, led_strip_handle_t *ret_strip)
+{
+    led_strip_virtual_obj *virtual_strip = NULL;
+    esp_err_t ret = ESP_OK;
+    ESP_GOTO_ON_FALSE(led_config && virtual_config && ret_strip, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
+    ESP_GOTO_ON_FALSE(led_config->led_pixel_format < LED_PIXEL_FORMAT_INVALID, ESP_ERR_INVALID_ARG, err, TAG, "invalid led_pixel_format");
+    uint8_t bytes_per_pixel = led_config->led_pixel_format == LED_PIXEL_FORMAT_GRBW ? 4 : 3;
+    uint32_t max_frames = virtual_config->max_frames ? virtual_config->max_frames : LED_STRIP_VIRTUAL_DEFAULT_MAX_FRAMES;
+    uint32_t segment_count = virtual_config->segment_count ? virtual_config->segment_count : 1;
+    ESP_GOTO_ON_FALSE(segment_count <= led_config->max_leds, ESP_ERR_INVALID_ARG, err, TAG, "invalid segment count");
+
+    virtual_strip = calloc(1, sizeof(led_strip_virtual_obj) + led_config->max_leds * bytes_per_pixel);
+    ESP_GOTO_ON_FALSE(virtual_strip, ESP_ERR_NO_MEM, err, TAG, "no mem for virtual strip");
+    virtual_strip->frames = calloc(max_frames, led_config->max_leds * bytes_per_pixel);
+    ESP_GOTO_ON_FALSE(virtual_strip->frames, ESP_ERR_NO_MEM, err, TAG, "no mem for frame recording");
+
+    virtual_strip->bytes_per_pixel = bytes_per_pixel;
+    virtual_strip->strip_len = led_config->max_leds;
+    virtual_strip->max_frames = max_frames;
+    virtual_strip->simulate_timing = virtual_config->flags.simulate_timing;
+    for (uint32_t i = 0; i < segment_count; i++) {
+        uint32_t len = led_strip_segment_start(led_config->max_leds, segment_count, i + 1) -
+                       led_strip_segment_start(led_config->max_leds, segment_count, i);
+        if (len > virtual_strip->longest_segment) {
+            virtual_strip->longest_segment = len;
+        }
+    }
+    virtual_strip->base.set_pixel = led_strip_virtual_set_pixel;
+    virtual_strip->base.set_pixel_rgbw = led_strip_virtual_set_pixel_rgbw;
+    virtual_strip->base.set_pixels = led_strip_virtual_set_pixels;
+    virtual_strip->base.refresh = led_strip_virtual_refresh;
+    virtual_strip->base.refresh_from = led_strip_virtual_refresh_from;
+    virtual_strip->base.refresh_async = led_strip_virtual_refresh_async;
+    virtual_strip->base.wait_refresh_done = led_strip_virtual_wait_refresh_done;
+    virtual_strip->base.clear = led_strip_virtual_clear;
+    virtual_strip->base.del = led_strip_virtual_del;
+
+    *ret_strip = &virtual_strip->base;
+    return ESP_OK;
+err:
+    if (virtual_strip) {
+        free(virtual_strip->frames);
+        free(virtual_strip);
+    }
+    return ret;
+}
+
+esp_err_t led_strip_virtual_get_stats(led_strip_handle_t strip, led_strip_virtual_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(strip && stats, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    *stats = virtual_strip->stats;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_virtual_get_frame(led_strip_handle_t strip, uint32_t frame, uint8_t *pixels)
+{
+    ESP_RETURN_ON_FALSE(strip && pixels, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    uint32_t recorded = virtual_strip->stats.frames;
+    uint32_t oldest = recorded > virtual_strip->max_frames ? recorded - virtual_strip->max_frames : 0;
+    ESP_RETURN_ON_FALSE(frame >= oldest && frame < recorded, ESP_ERR_INVALID_ARG, TAG, "frame %u not recorded", frame);
+    size_t frame_size = virtual_strip->strip_len * virtual_strip->bytes_per_pixel;
+    memcpy(pixels, virtual_strip->frames + (frame % virtual_strip->max_frames) * frame_size, frame_size);
+    return ESP_OK;
+}
+
+static uint32_t png_crc(uint32_t crc, const uint8_t *data, size_t len)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void png_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void png_write_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len)
+{
+    uint8_t hdr[8];
+    png_put_u32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    uint32_t crc = png_crc(0, hdr + 4, 4);
+    crc = png_crc(crc, data, len);
+    uint8_t trailer[4];
+    png_put_u32(trailer, crc);
+    fwrite(hdr, 1, 8, f);
+    fwrite(data, 1, len, f);
+    fwrite(trailer, 1, 4, f);
+}
+
+esp_err_t led_strip_virtual_dump_png(led_strip_handle_t strip, const char *path, uint32_t first_frame, uint32_t frame_count)
+{
+    ESP_RETURN_ON_FALSE(strip && path && frame_count, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    led_strip_virtual_obj *virtual_strip = __containerof(strip, led_strip_virtual_obj, base);
+    uint32_t recorded = virtual_strip->stats.frames;
+    uint32_t oldest = recorded > virtual_strip->max_frames ? recorded - virtual_strip->max_frames : 0;
+    ESP_RETURN_ON_FALSE(first_frame >= oldest && first_frame + frame_count <= recorded, ESP_ERR_INVALID_ARG, TAG,
+                        "frames %u..%u not recorded", first_frame, first_frame + frame_count);
+
+    // Raw scanlines: one row per LED, one pixel per frame, filter type 0
+    uint32_t width = frame_count;
+    uint32_t height = virtual_strip->strip_len;
+    size_t row_len = 1 + width * 3;
+    size_t raw_len = row_len * height;
+    size_t frame_size = virtual_strip->strip_len * virtual_strip->bytes_per_pixel;
+    uint8_t *raw = malloc(raw_len);
+    ESP_RETURN_ON_FALSE(raw, ESP_ERR_NO_MEM, TAG, "no mem for image");
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t *row = raw + y * row_len;
+        row[0] = 0;
+        for (uint32_t x = 0; x < width; x++) {
+            const uint8_t *px = virtual_strip->frames + ((first_frame + x) % virtual_strip->max_frames) * frame_size
+                                + y * virtual_strip->bytes_per_pixel;
+            row[1 + x * 3 + 0] = px[1];
+            row[1 + x * 3 + 1] = px[0];
+            row[1 + x * 3 + 2] = px[2];
+        }
+    }
+
+    // zlib stream made of stored (uncompressed) deflate blocks
+    size_t n_blocks = (raw_len + 65534) / 65535;
+    size_t zlib_len = 2 + n_blocks * 5 + raw_len + 4;
+    uint8_t *zlib = malloc(zlib_len);
+    if (!zlib) {
+        free(raw);
+        ESP_LOGE(TAG, "no mem for image");
+        return ESP_ERR_NO_MEM;
+    }
+    uint8_t *z = zlib;
+    *z++ = 0x78;
+    *z++ = 0x01;
+    uint32_t adler_a = 1, adler_b = 0;
+    for (size_t pos = 0; pos < raw_len; pos += 65535) {
+        uint16_t len = raw_len - pos > 65535 ? 65535 : raw_len - pos;
+        *z++ = pos + len == raw_len ? 1 : 0;
+        *z++ = len & 0xFF;
+        *z++ = len >> 8;
+        *z++ = ~len & 0xFF;
+        *z++ = (~len >> 8) & 0xFF;
+        memcpy(z, raw + pos, len);
+        z += len;
+        for (size_t i = pos; i < pos + len; i++) {
+            adler_a = (adler_a + raw[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+    }
+    png_put_u32(z, (adler_b << 16) | adler_a);
+    free(raw);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        free(zlib);
+        ESP_LOGE(TAG, "cannot open %s", path);
+        return ESP_FAIL;
+    }
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t ihdr[13];
+    png_put_u32(ihdr, width);
+    png_put_u32(ihdr + 4, height);
+    ihdr[8] = 8;  // bit depth
+    ihdr[9] = 2;  // truecolor
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // no interlace
+    fwrite(signature, 1, sizeof(signature), f);
+    png_write_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    png_write_chunk(f, "IDAT", zlib, zlib_len);
+    png_write_chunk(f, "IEND", NULL, 0);
+    free(zlib);
+
+    esp_err_t ret = ferror(f) ? ESP_FAIL : ESP_OK;
+    fclose(f);
+    return ret;
+}
@@ -0,0 +1,29 @@
+/*
+ * The few RMT driver types used by the LED strip encoder, which the linux
+ * target has no driver for. Laid out like the ESP32's.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+// The ESP32's newlib has it in <sys/cdefs.h>, glibc does not
+#ifndef __containerof
+#define __containerof(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+typedef struct rmt_channel_t *rmt_channel_handle_t;
+typedef struct rmt_encoder_t *rmt_encoder_handle_t;
+
+typedef union
+{
+  struct
+  {
+    uint16_t duration0 : 15;
+    uint16_t level0 : 1;
+    uint16_t duration1 : 15;
+    uint16_t level1 : 1;
+  };
+  uint32_t val;
+} rmt_symbol_word_t;
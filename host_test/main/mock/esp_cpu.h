@@ -0,0 +1,11 @@
+/*
+ * The cycle counter read by the LED strip encoder, which has no meaning on
+ * the linux target. test_rmt_encoder.c counts nanoseconds instead.
+ */
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
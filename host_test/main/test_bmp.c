@@ -0,0 +1,235 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "unity.h"
+#include "bmp.h"
+#include "column_store.h"
+#include "esp_timer.h"
+
+/*
+ * bmp.c's banded, tiled transpose against a naive one that looks every LED
+ * of every column up in the file on its own. Files are uploaded to the
+ * simulated flash (store_sim.c) like STORE_FILE frames would.
+ */
+
+#define TEST_FLASH "host_test_flash.bin"
+#define TEST_MELUCHE PIXELSTICK_IMAGES_DIR "/meluche.bmp"
+#define TEST_BENCHMARK_RUNS 20
+
+static uint8_t naive_gamma[256];
+static uint64_t next_hash = 1;
+
+static void test_bmp_setup(void)
+{
+  static bool ready;
+  if (ready)
+  {
+    return;
+  }
+
+  setenv("PIXELSTICK_SIM_FLASH", TEST_FLASH, 1);
+  remove(TEST_FLASH);
+  TEST_ASSERT_TRUE(column_store_init());
+  // The app's gamma table
+  for (unsigned int i = 0; i < 256; i++)
+  {
+    naive_gamma[i] = pow(i / 255.0, 2.8) * 255 + 0.5;
+  }
+  ready = true;
+}
+
+// A file of pseudo-random pixels, bottom-up for a positive height
+static uint8_t *test_bmp_make(int width, int height, unsigned int bits, size_t *size)
+{
+  unsigned int rows = height > 0 ? height : -height;
+  size_t stride = ((size_t)width * bits / 8 + 3) / 4 * 4;
+  size_t offset = sizeof(FILEHEADER) + sizeof(INFOHEADER);
+  FILEHEADER file = {
+      .fileMarker1 = 'B',
+      .fileMarker2 = 'M',
+      .bfSize = offset + rows * stride,
+      .imageDataOffset = offset,
+  };
+  INFOHEADER info = {
+      .biSize = sizeof(INFOHEADER),
+      .width = width,
+      .height = height,
+      .planes = 1,
+      .bitPix = bits,
+      .biSizeImage = rows * stride,
+  };
+
+  *size = file.bfSize;
+  uint8_t *data = malloc(*size);
+  memcpy(data, &file, sizeof(file));
+  memcpy(data + sizeof(file), &info, sizeof(info));
+  for (size_t i = offset; i < *size; i++)
+  {
+    data[i] = rand();
+  }
+  return data;
+}
+
+// Every column of the file, each LED looked up on its own
+static void test_bmp_naive(const uint8_t *data, unsigned int x, uint8_t *column)
+{
+  FILEHEADER file;
+  INFOHEADER info;
+  memcpy(&file, data, sizeof(file));
+  memcpy(&info, data + sizeof(file), sizeof(info));
+
+  unsigned int height = info.height > 0 ? info.height : -info.height;
+  unsigned int pixel_bytes = info.bitPix / 8;
+  size_t stride = ((size_t)info.width * pixel_bytes + 3) / 4 * 4;
+
+  for (unsigned int y = 0; y < LED_COUNT; y++)
+  {
+    // Nearest row, counted from the top
+    unsigned int row = (uint64_t)y * height / LED_COUNT;
+    if (info.height > 0)
+    {
+      row = height - 1 - row;
+    }
+    const uint8_t *bgr = data + file.imageDataOffset + row * stride + x * pixel_bytes;
+    column[y * 3] = naive_gamma[bgr[1]];
+    column[y * 3 + 1] = naive_gamma[bgr[2]];
+    column[y * 3 + 2] = naive_gamma[bgr[0]];
+  }
+}
+
+// Uploads the file in pieces of chunk bytes, or in one piece for 0
+static bool test_bmp_upload(const uint8_t *data, size_t size, size_t chunk, struct column_store_image *image)
+{
+  *image = (struct column_store_image){.hash = next_hash++, .speed = 30};
+  bmp_reader_begin(image);
+
+  for (size_t offset = 0; offset < size; offset += chunk)
+  {
+    if (chunk == 0 || chunk > size - offset)
+    {
+      chunk = size - offset;
+    }
+    if (!bmp_reader_feed(data + offset, chunk))
+    {
+      return false;
+    }
+  }
+  return bmp_reader_end() && column_store_commit();
+}
+
+static void test_bmp_check(int width, int height, unsigned int bits)
+{
+  static const size_t chunks[] = {0, COLUMN_BYTES, 7};
+  static uint8_t expected[COLUMN_BYTES];
+  size_t size;
+  uint8_t *data = test_bmp_make(width, height, bits, &size);
+
+  test_bmp_setup();
+  for (unsigned int i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+  {
+    struct column_store_image image;
+    char message[64];
+    snprintf(message, sizeof(message), "%dx%d, %u bits, chunks of %u bytes",
+             width, height, bits, (unsigned int)chunks[i]);
+
+    TEST_ASSERT_TRUE_MESSAGE(test_bmp_upload(data, size, chunks[i], &image), message);
+    TEST_ASSERT_TRUE(column_store_open(&image.hash, &image));
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(width, image.columns, message);
+    for (int x = 0; x < width; x++)
+    {
+      test_bmp_naive(data, x, expected);
+      TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, column_store_column(x), COLUMN_BYTES, message);
+    }
+    column_store_close();
+  }
+  free(data);
+}
+
+TEST_CASE("bmp transpose of bottom-up files matches a naive one", "[bmp]")
+{
+  // Fewer rows than LEDs, as many, and more in several bands
+  test_bmp_check(17, 100, 24);
+  test_bmp_check(33, LED_COUNT, 24);
+  test_bmp_check(5, 1000, 24);
+  test_bmp_check(61, 701, 32);
+  test_bmp_check(1, 1, 24);
+}
+
+TEST_CASE("bmp transpose of top-down files matches a naive one", "[bmp]")
+{
+  test_bmp_check(17, -100, 24);
+  test_bmp_check(33, -LED_COUNT, 32);
+  test_bmp_check(5, -1000, 24);
+  test_bmp_check(61, -701, 24);
+  test_bmp_check(3, -7, 32);
+}
+
+TEST_CASE("bmp reader rejects rows wider than a band", "[bmp]")
+{
+  size_t size;
+  uint8_t *data = test_bmp_make(1, 1, 24, &size);
+  struct column_store_image image;
+
+  test_bmp_setup();
+  // The stride of 0x40000000 pixels of 4 bytes wraps around in 32 bits
+  ((INFOHEADER *)(data + sizeof(FILEHEADER)))->width = 0x40000000;
+  ((INFOHEADER *)(data + sizeof(FILEHEADER)))->bitPix = 32;
+  TEST_ASSERT_FALSE(test_bmp_upload(data, size, 0, &image));
+  free(data);
+}
+
+TEST_CASE("bmp transpose speed against a naive one", "[bmp][benchmark]")
+{
+  FILE *f = fopen(TEST_MELUCHE, "rb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(f, TEST_MELUCHE);
+  fseek(f, 0, SEEK_END);
+  size_t size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(size);
+  TEST_ASSERT_EQUAL(size, fread(data, 1, size, f));
+  fclose(f);
+
+  test_bmp_setup();
+  INFOHEADER info;
+  memcpy(&info, data + sizeof(FILEHEADER), sizeof(info));
+  static uint8_t column[COLUMN_BYTES];
+  struct column_store_image image;
+  struct column_store_stats store;
+  int64_t naive_us = 0, tiled_us = 0, chunked_us = 0, flash_us = 0;
+
+  // Both write the same columns to the store, the naive one a whole column
+  // at a time; the time spent writing the simulated flash is left out
+  for (unsigned int run = 0; run < TEST_BENCHMARK_RUNS; run++)
+  {
+    image = (struct column_store_image){.hash = next_hash++, .speed = 30, .columns = info.width};
+    TEST_ASSERT_TRUE(column_store_begin(&image));
+    int64_t t_begin = esp_timer_get_time();
+    for (int x = 0; x < info.width; x++)
+    {
+      test_bmp_naive(data, x, column);
+      TEST_ASSERT_TRUE(column_store_put(x, 0, column, LED_COUNT));
+    }
+    column_store_get_stats(&store);
+    naive_us += esp_timer_get_time() - t_begin - store.write_us - store.erase_us;
+    flash_us += store.write_us + store.erase_us;
+    TEST_ASSERT_TRUE(column_store_commit());
+
+    struct bmp_stats bmp;
+    TEST_ASSERT_TRUE(test_bmp_upload(data, size, 0, &image));
+    bmp_get_stats(&bmp);
+    column_store_get_stats(&store);
+    tiled_us += bmp.transpose_us - store.write_us - store.erase_us;
+
+    TEST_ASSERT_TRUE(test_bmp_upload(data, size, COLUMN_BYTES, &image));
+    bmp_get_stats(&bmp);
+    column_store_get_stats(&store);
+    chunked_us += bmp.transpose_us - store.write_us - store.erase_us;
+  }
+
+  printf("%s, %dx%d: naive %lld us, tiled in place %lld us, tiled from %u-byte chunks %lld us "
+         "(and about %lld us writing flash)\n",
+         TEST_MELUCHE, info.width, info.height, (long long)naive_us / TEST_BENCHMARK_RUNS,
+         (long long)tiled_us / TEST_BENCHMARK_RUNS, COLUMN_BYTES, (long long)chunked_us / TEST_BENCHMARK_RUNS,
+         (long long)flash_us / TEST_BENCHMARK_RUNS);
+  free(data);
+}
@@ -0,0 +1,650 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "unity.h"
+#include "bt.h"
+#include "bt_transport.h"
+#include "column_ring.h"
+#include "column_codec.h"
+#include "column_cache.h"
+#include "lzss.h"
+#include "pixel_format.h"
+#include "esp_timer.h"
+
+/*
+ * bt.c's incremental frame parser. A stream of frames cut in packets of any
+ * size must give the same events and columns as its frames fed one at a
+ * time, and garbage must neither overrun anything nor keep the next
+ * connection from being parsed. The columns are taken out of the ring after
+ * every packet, like the LED task would.
+ */
+
+#define TEST_STREAM_BYTES (1024 * 1024)
+#define TEST_STREAM_FRAMES 4096
+#define TEST_OUTPUT_EVENTS 256
+#define TEST_SPLITS 20
+// Packets of at most this size never carry more columns than the ring holds
+#define TEST_MAX_PACKET 1024
+// Largest payload of an SPP packet
+#define TEST_SPP_MTU 990
+#define TEST_BENCHMARK_BYTES (32 * 1024 * 1024)
+
+struct test_stream
+{
+  uint8_t *data;
+  size_t len;
+  size_t frame_end[TEST_STREAM_FRAMES];
+  unsigned int frames;
+  // Coded bytes of the animation so far, the window of the LZSS encoder
+  uint8_t *coded;
+  size_t coded_len;
+};
+
+struct test_event
+{
+  enum message_type type;
+  unsigned int a;
+  unsigned int b;
+  uint64_t c;
+};
+
+struct test_output
+{
+  uint8_t *columns;
+  unsigned int column_count;
+  struct test_event events[TEST_OUTPUT_EVENTS];
+  unsigned int event_count;
+  unsigned int dropped;
+};
+
+static QueueHandle_t test_queue;
+// Columns taken out of the ring so far, and when the output began
+static unsigned int consumed;
+static unsigned int base;
+
+void bt_transport_write(int handle, int len, uint8_t *data)
+{
+  bt_write_done();
+}
+
+unsigned int led_max_column_rate(void)
+{
+  return 100;
+}
+
+static void test_bt_setup(void)
+{
+  if (test_queue == NULL)
+  {
+    test_queue = xQueueCreate(TEST_OUTPUT_EVENTS, sizeof(struct message));
+    bt_protocol_init(test_queue);
+    consumed = column_ring_count();
+  }
+}
+
+static void test_bt_drain(struct test_output *out)
+{
+  for (; consumed != column_ring_count(); consumed++)
+  {
+    if (out->columns)
+    {
+      TEST_ASSERT_LESS_THAN(TEST_STREAM_BYTES / COLUMN_BYTES, out->column_count);
+      memcpy(out->columns + out->column_count * COLUMN_BYTES, column_ring_slot(consumed), COLUMN_BYTES);
+    }
+    out->column_count++;
+    column_ring_release(consumed + 1);
+  }
+
+  struct message m;
+  while (xQueueReceive(test_queue, &m, 0) == pdTRUE)
+  {
+    struct test_event event = {.type = m.type};
+    switch (m.type)
+    {
+    case ANIMATE_BEGIN:
+      event.a = m.animate_begin.animation_speed;
+      event.b = m.animate_begin.first_column - base;
+      break;
+    case ANIMATE_END:
+      event.a = m.animate_end.aborted;
+      event.b = m.animate_end.source;
+      break;
+    case STORE_BEGIN:
+      event.a = m.store_begin.begin.animation_speed | m.store_begin.format << 16;
+      event.b = m.store_begin.columns;
+      event.c = m.store_begin.hash;
+      break;
+    case STORE_PLAY:
+      event.a = m.store_play.animation_speed;
+      event.b = m.store_play.by_hash;
+      event.c = m.store_play.hash;
+      break;
+    default:
+      break;
+    }
+    if (out->event_count < TEST_OUTPUT_EVENTS)
+    {
+      out->events[out->event_count++] = event;
+    }
+  }
+}
+
+static void test_bt_output_begin(struct test_output *out, bool keep_columns)
+{
+  memset(out, 0, sizeof(*out));
+  out->columns = keep_columns ? malloc(TEST_STREAM_BYTES) : NULL;
+  bt_open(0);
+  struct column_ring_stats stats;
+  column_ring_get_stats(&stats);
+  out->dropped = stats.dropped;
+  base = consumed;
+  test_bt_drain(out);
+}
+
+static void test_bt_output_end(struct test_output *out)
+{
+  test_bt_drain(out);
+  bt_close();
+  test_bt_drain(out);
+  struct column_ring_stats stats;
+  column_ring_get_stats(&stats);
+  out->dropped = stats.dropped - out->dropped;
+}
+
+static void test_bt_output_compare(const struct test_output *expected, const struct test_output *actual,
+                                   const char *message)
+{
+  TEST_ASSERT_EQUAL_UINT_MESSAGE(0, actual->dropped, message);
+  TEST_ASSERT_EQUAL_UINT_MESSAGE(expected->event_count, actual->event_count, message);
+  for (unsigned int i = 0; i < expected->event_count; i++)
+  {
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&expected->events[i], &actual->events[i], sizeof(struct test_event), message);
+  }
+  TEST_ASSERT_EQUAL_UINT_MESSAGE(expected->column_count, actual->column_count, message);
+  TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected->columns, actual->columns, expected->column_count * COLUMN_BYTES,
+                                   message);
+}
+
+static void test_bt_output_free(struct test_output *out)
+{
+  free(out->columns);
+  out->columns = NULL;
+}
+
+static void test_bt_frame(struct test_stream *s, uint8_t header, const uint8_t *payload, uint32_t len)
+{
+  TEST_ASSERT_LESS_THAN(TEST_STREAM_FRAMES, s->frames);
+  TEST_ASSERT_LESS_OR_EQUAL(TEST_STREAM_BYTES, s->len + 5 + len);
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    s->data[s->len++] = len >> (8 * i);
+  }
+  s->data[s->len++] = header;
+  memcpy(s->data + s->len, payload, len);
+  s->len += len;
+  s->frame_end[s->frames++] = s->len;
+}
+
+static void test_bt_random(uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    data[i] = rand();
+  }
+}
+
+// Random ops making up one coded column: literals, runs and unchanged units
+static size_t test_bt_code_column(uint8_t *out)
+{
+  const struct pixel_format_info *info = pixel_format_info();
+  unsigned int units = info->column_bytes / info->unit_bytes;
+  size_t len = 0;
+
+  // A long literal first, so columns never get so short that a packet overflows the ring
+  for (unsigned int unit = 0, n = 16; unit < units; unit += n, n = 1 + rand() % COLUMN_CODEC_MAX_PIXELS)
+  {
+    n = n < units - unit ? n : units - unit;
+    unsigned int op = unit == 0 ? COLUMN_CODEC_LITERAL : (unsigned int)(rand() % 3) << 6;
+    out[len++] = op | (n - 1);
+    unsigned int bytes = op == COLUMN_CODEC_LITERAL ? n * info->unit_bytes
+                         : op == COLUMN_CODEC_RUN   ? info->unit_bytes
+                                                    : 0;
+    test_bt_random(out + len, bytes);
+    len += bytes;
+  }
+  return len;
+}
+
+// Greedy LZSS of the coded bytes from offset on, matching within the animation's coded bytes
+static size_t test_bt_compress(const struct test_stream *s, size_t offset, uint8_t *out)
+{
+  size_t len = 0;
+  size_t flags = 0;
+  unsigned int token = 8;
+
+  for (size_t pos = offset; pos < s->coded_len;)
+  {
+    if (token == 8)
+    {
+      flags = len++;
+      out[flags] = 0;
+      token = 0;
+    }
+
+    size_t best = 0, distance = 0;
+    for (size_t d = 1; d <= pos && d <= 64; d++)
+    {
+      size_t n = 0;
+      while (n < LZSS_MAX_MATCH && pos + n < s->coded_len && s->coded[pos + n] == s->coded[pos + n - d])
+      {
+        n++;
+      }
+      if (n > best)
+      {
+        best = n;
+        distance = d;
+      }
+    }
+
+    if (best >= LZSS_MIN_MATCH)
+    {
+      unsigned int code = (distance - 1) << LZSS_LENGTH_BITS | (best - LZSS_MIN_MATCH);
+      out[flags] |= 1 << token;
+      out[len++] = code >> 8;
+      out[len++] = code;
+      pos += best;
+    }
+    else
+    {
+      out[len++] = s->coded[pos++];
+    }
+    token++;
+  }
+  return len;
+}
+
+// One streamed animation, its columns in frames of 1 to 5 in every kind of column frame
+static void test_bt_animation(struct test_stream *s, enum pixel_format format, unsigned int columns)
+{
+  static uint8_t payload[6 * COLUMN_BYTES * 2];
+  uint8_t begin[] = {60, format};
+
+  test_bt_frame(s, MSG_HEADER_PIXEL_BEGIN, begin, sizeof(begin));
+  pixel_format_set(format);
+  if (format == PIXEL_FORMAT_PALETTE8)
+  {
+    test_bt_random(payload, PIXEL_PALETTE_SIZE * 3);
+    test_bt_frame(s, MSG_HEADER_PIXEL_PALETTE, payload, PIXEL_PALETTE_SIZE * 3);
+  }
+  s->coded_len = 0;
+
+  unsigned int column_bytes = pixel_format_info()->column_bytes;
+  for (unsigned int sent = 0; sent < columns;)
+  {
+    // Cached columns refer to earlier ones of the animation
+    unsigned int n = sent == 0 ? 5 : 1 + rand() % 5;
+    n = n < columns - sent ? n : columns - sent;
+    size_t len = 0;
+    uint8_t header;
+
+    switch (sent == 0 ? 7 : rand() % 8)
+    {
+    case 0:
+      // Copies of recent columns, and repeats of the last one
+      header = MSG_HEADER_PIXEL_CACHED;
+      for (unsigned int i = 0; i < n; i++)
+      {
+        payload[len++] = i % 2 ? COLUMN_CACHE_REPEAT : COLUMN_CACHE_COPY | rand() % 4;
+      }
+      n += n / 2;
+      break;
+
+    case 1:
+    case 2:
+      header = MSG_HEADER_PIXEL_CODED;
+      for (unsigned int i = 0; i < n; i++)
+      {
+        len += test_bt_code_column(payload + len);
+      }
+      memcpy(s->coded + s->coded_len, payload, len);
+      s->coded_len += len;
+      break;
+
+    case 3:
+    case 4:
+    {
+      header = MSG_HEADER_PIXEL_LZ;
+      size_t offset = s->coded_len;
+      for (unsigned int i = 0; i < n; i++)
+      {
+        s->coded_len += test_bt_code_column(s->coded + s->coded_len);
+      }
+      len = test_bt_compress(s, offset, payload);
+      break;
+    }
+
+    default:
+      header = MSG_HEADER_PIXEL_DATA;
+      len = n * column_bytes;
+      test_bt_random(payload, len);
+      break;
+    }
+    test_bt_frame(s, header, payload, len);
+    sent += n;
+  }
+
+  uint8_t end[] = {0};
+  test_bt_frame(s, MSG_HEADER_PIXEL_END, end, sizeof(end));
+}
+
+// Animations in every pixel format, with control frames in between
+static void test_bt_stream(struct test_stream *s)
+{
+  memset(s, 0, sizeof(*s));
+  s->data = malloc(TEST_STREAM_BYTES);
+  s->coded = malloc(TEST_STREAM_BYTES);
+
+  for (enum pixel_format format = 0; format < PIXEL_FORMAT_COUNT; format++)
+  {
+    test_bt_animation(s, format, 40 + rand() % 40);
+
+    uint8_t play[] = {30, 1, 2, 3, 4, 5, 6, 7, 8};
+    test_bt_frame(s, MSG_HEADER_STORE_PLAY, play, 1 + (format % 2) * 8);
+    // Columns of no animation are dropped
+    uint8_t stray[COLUMN_BYTES] = {0};
+    test_bt_frame(s, MSG_HEADER_PIXEL_DATA, stray, sizeof(stray));
+  }
+}
+
+static void test_bt_stream_free(struct test_stream *s)
+{
+  free(s->data);
+  free(s->coded);
+}
+
+static void test_bt_feed(uint8_t *data, size_t len, struct test_output *out)
+{
+  bt_handle(0, len, data);
+  test_bt_drain(out);
+}
+
+static void test_bt_feed_frames(const struct test_stream *s, struct test_output *out)
+{
+  for (unsigned int i = 0; i < s->frames; i++)
+  {
+    size_t begin = i > 0 ? s->frame_end[i - 1] : 0;
+    test_bt_feed(s->data + begin, s->frame_end[i] - begin, out);
+  }
+}
+
+// Packets of random sizes, one byte long a quarter of the time
+static void test_bt_feed_split(uint8_t *data, size_t len, struct test_output *out)
+{
+  for (size_t offset = 0; offset < len;)
+  {
+    size_t n = rand() % 4 == 0 ? 1 : 1 + rand() % TEST_MAX_PACKET;
+    n = n < len - offset ? n : len - offset;
+    test_bt_feed(data + offset, n, out);
+    offset += n;
+  }
+}
+
+TEST_CASE("bt parser output does not depend on how frames are split in packets", "[bt]")
+{
+  struct test_stream s;
+  struct test_output expected, actual;
+
+  test_bt_setup();
+  srand(12);
+  test_bt_stream(&s);
+
+  test_bt_output_begin(&expected, true);
+  test_bt_feed_frames(&s, &expected);
+  test_bt_output_end(&expected);
+  TEST_ASSERT_EQUAL_UINT(0, expected.dropped);
+  // Connected, each animation's begin, end and STORE_PLAY, disconnected
+  TEST_ASSERT_EQUAL_UINT(2 + 3 * PIXEL_FORMAT_COUNT, expected.event_count);
+  TEST_ASSERT_GREATER_THAN(40 * PIXEL_FORMAT_COUNT, expected.column_count);
+
+  for (unsigned int split = 0; split < TEST_SPLITS; split++)
+  {
+    char message[32];
+    snprintf(message, sizeof(message), "split %u", split);
+    test_bt_output_begin(&actual, true);
+    test_bt_feed_split(s.data, s.len, &actual);
+    test_bt_output_end(&actual);
+    test_bt_output_compare(&expected, &actual, message);
+    test_bt_output_free(&actual);
+  }
+
+  test_bt_output_free(&expected);
+  test_bt_stream_free(&s);
+}
+
+TEST_CASE("bt parser drops the rest of a packet after a corrupt length", "[bt]")
+{
+  struct test_stream s;
+  struct test_output expected, actual;
+
+  test_bt_setup();
+  srand(34);
+  test_bt_stream(&s);
+
+  test_bt_output_begin(&expected, true);
+  test_bt_feed_frames(&s, &expected);
+  test_bt_output_end(&expected);
+
+  // A length beyond BT_MAX_FRAME_BYTES, then what looks like frames
+  test_bt_output_begin(&actual, true);
+  uint8_t garbage[TEST_MAX_PACKET];
+  test_bt_random(garbage, sizeof(garbage));
+  uint32_t length = BT_MAX_FRAME_BYTES + 1 + rand();
+  memcpy(garbage, &length, sizeof(length));
+  memcpy(garbage + 4, s.data, sizeof(garbage) - 4);
+  test_bt_feed(garbage, sizeof(garbage), &actual);
+  test_bt_feed_split(s.data, s.len, &actual);
+  test_bt_output_end(&actual);
+  test_bt_output_compare(&expected, &actual, "after a corrupt length");
+
+  test_bt_output_free(&actual);
+  test_bt_output_free(&expected);
+  test_bt_stream_free(&s);
+}
+
+TEST_CASE("bt parser survives corrupt streams and parses the next connection", "[bt]")
+{
+  struct test_stream s;
+  struct test_output expected, actual;
+
+  test_bt_setup();
+  srand(56);
+  test_bt_stream(&s);
+
+  test_bt_output_begin(&expected, true);
+  test_bt_feed_frames(&s, &expected);
+  test_bt_output_end(&expected);
+
+  uint8_t *corrupt = malloc(s.len);
+  for (unsigned int run = 0; run < TEST_SPLITS; run++)
+  {
+    // Lengths and headers are hit as often as payload bytes
+    memcpy(corrupt, s.data, s.len);
+    for (unsigned int i = 0; i < 16; i++)
+    {
+      size_t frame_begin = s.frame_end[rand() % s.frames];
+      size_t offset = rand() % 2 ? rand() % s.len : frame_begin + rand() % 5;
+      if (offset < s.len)
+      {
+        corrupt[offset] = rand();
+      }
+    }
+
+    test_bt_output_begin(&actual, false);
+    test_bt_feed_split(corrupt, s.len, &actual);
+    test_bt_output_end(&actual);
+
+    char message[32];
+    snprintf(message, sizeof(message), "after corrupt stream %u", run);
+    test_bt_output_begin(&actual, true);
+    test_bt_feed_split(s.data, s.len, &actual);
+    test_bt_output_end(&actual);
+    test_bt_output_compare(&expected, &actual, message);
+    test_bt_output_free(&actual);
+  }
+
+  free(corrupt);
+  test_bt_output_free(&expected);
+  test_bt_stream_free(&s);
+}
+
+// The first event of a type, which must be there
+static const struct test_event *test_bt_event(const struct test_output *out, enum message_type type)
+{
+  for (unsigned int i = 0; i < out->event_count; i++)
+  {
+    if (out->events[i].type == type)
+    {
+      return &out->events[i];
+    }
+  }
+  TEST_FAIL_MESSAGE("missing event");
+  return NULL;
+}
+
+TEST_CASE("bt speeds are 16 bits from apps of version 1", "[bt]")
+{
+  static const uint8_t hello[] = {1};
+  static const uint8_t end[] = {1};
+  struct
+  {
+    bool hello;
+    uint8_t begin[3];
+    uint8_t store_begin[15];
+    uint8_t play[10];
+    unsigned int begin_len, store_begin_len, play_len;
+    unsigned int speed, store_speed, play_speed;
+  } apps[] = {
+      // Before capabilities: one byte, the rest of the fields one byte earlier
+      {false,
+       {200, PIXEL_FORMAT_RGB565},
+       {250, PIXEL_FORMAT_RGB888, 1, 2, 3, 4, 5, 6, 7, 8, 40},
+       {30, 1, 2, 3, 4, 5, 6, 7, 8},
+       2, 14, 9, 200, 250, 30},
+      {true,
+       {0xf4, 0x01, PIXEL_FORMAT_RGB565},
+       {0x58, 0x02, PIXEL_FORMAT_RGB888, 1, 2, 3, 4, 5, 6, 7, 8, 40},
+       {0x20, 0x03, 1, 2, 3, 4, 5, 6, 7, 8},
+       3, 15, 10, 500, 600, 800},
+  };
+
+  test_bt_setup();
+  for (unsigned int i = 0; i < sizeof(apps) / sizeof(apps[0]); i++)
+  {
+    struct test_stream s;
+    struct test_output out;
+    memset(&s, 0, sizeof(s));
+    s.data = malloc(TEST_STREAM_BYTES);
+    s.coded = malloc(TEST_STREAM_BYTES);
+    if (apps[i].hello)
+    {
+      test_bt_frame(&s, MSG_HEADER_HELLO, hello, sizeof(hello));
+    }
+    test_bt_frame(&s, MSG_HEADER_PIXEL_BEGIN, apps[i].begin, apps[i].begin_len);
+    test_bt_frame(&s, MSG_HEADER_PIXEL_END, end, sizeof(end));
+    test_bt_frame(&s, MSG_HEADER_STORE_BEGIN, apps[i].store_begin, apps[i].store_begin_len);
+    test_bt_frame(&s, MSG_HEADER_PIXEL_END, end, sizeof(end));
+    test_bt_frame(&s, MSG_HEADER_STORE_PLAY, apps[i].play, apps[i].play_len);
+
+    // A new connection forgets the version of the previous app
+    test_bt_output_begin(&out, false);
+    test_bt_feed_frames(&s, &out);
+    test_bt_output_end(&out);
+    TEST_ASSERT_EQUAL_UINT(apps[i].speed, test_bt_event(&out, ANIMATE_BEGIN)->a);
+    const struct test_event *store_begin = test_bt_event(&out, STORE_BEGIN);
+    TEST_ASSERT_EQUAL_UINT(apps[i].store_speed | PIXEL_FORMAT_RGB888 << 16, store_begin->a);
+    TEST_ASSERT_EQUAL_UINT(40, store_begin->b);
+    TEST_ASSERT_TRUE(store_begin->c == 0x0807060504030201);
+    const struct test_event *play = test_bt_event(&out, STORE_PLAY);
+    TEST_ASSERT_EQUAL_UINT(apps[i].play_speed, play->a);
+    TEST_ASSERT_EQUAL_UINT(1, play->b);
+    TEST_ASSERT_TRUE(play->c == 0x0807060504030201);
+    test_bt_stream_free(&s);
+  }
+}
+
+static void test_bt_throughput(enum pixel_format format, uint8_t header)
+{
+  struct test_stream s;
+  struct test_output out;
+  memset(&s, 0, sizeof(s));
+  s.data = malloc(TEST_STREAM_BYTES);
+  s.coded = malloc(TEST_STREAM_BYTES);
+
+  // Five columns to a frame, as the app sends them
+  uint8_t begin[] = {60, format};
+  test_bt_frame(&s, MSG_HEADER_PIXEL_BEGIN, begin, sizeof(begin));
+  pixel_format_set(format);
+  size_t first = s.len;
+  static uint8_t payload[5 * COLUMN_BYTES * 2];
+  while (s.len + sizeof(payload) + 16 < TEST_STREAM_BYTES && s.coded_len + sizeof(payload) < TEST_STREAM_BYTES)
+  {
+    size_t len = 0;
+    size_t offset = s.coded_len;
+    for (unsigned int i = 0; i < 5; i++)
+    {
+      if (header == MSG_HEADER_PIXEL_CODED)
+      {
+        len += test_bt_code_column(payload + len);
+      }
+      else if (header == MSG_HEADER_PIXEL_LZ)
+      {
+        s.coded_len += test_bt_code_column(s.coded + s.coded_len);
+      }
+      else
+      {
+        test_bt_random(payload + len, pixel_format_info()->column_bytes);
+        len += pixel_format_info()->column_bytes;
+      }
+    }
+    if (header == MSG_HEADER_PIXEL_LZ)
+    {
+      len = test_bt_compress(&s, offset, payload);
+    }
+    test_bt_frame(&s, header, payload, len);
+  }
+
+  test_bt_output_begin(&out, false);
+  test_bt_feed(s.data, first, &out);
+  size_t bytes = 0;
+  int64_t t_begin = esp_timer_get_time();
+  while (bytes < TEST_BENCHMARK_BYTES)
+  {
+    // Packets of the SPP MTU, cutting frames anywhere
+    for (size_t offset = first; offset < s.len; offset += TEST_SPP_MTU)
+    {
+      size_t n = s.len - offset < TEST_SPP_MTU ? s.len - offset : TEST_SPP_MTU;
+      test_bt_feed(s.data + offset, n, &out);
+    }
+    bytes += s.len - first;
+  }
+  int64_t elapsed_us = esp_timer_get_time() - t_begin;
+  test_bt_output_end(&out);
+
+  // The ratio against 24-bit columns, like tools/column_codec.py prints them
+  printf("bt parser, %s, format %d: %.2fx, %.1f MB/s of frames decoded, %.0f columns/s\n",
+         header == MSG_HEADER_PIXEL_LZ      ? "PIXEL_LZ"
+         : header == MSG_HEADER_PIXEL_CODED ? "PIXEL_CODED"
+                                            : "PIXEL_DATA",
+         format, (double)out.column_count * COLUMN_BYTES / bytes, (double)bytes / elapsed_us,
+         out.column_count * 1e6 / elapsed_us);
+  TEST_ASSERT_EQUAL_UINT(0, out.dropped);
+  test_bt_stream_free(&s);
+}
+
+TEST_CASE("bt parser throughput", "[bt][benchmark]")
+{
+  test_bt_setup();
+  test_bt_throughput(PIXEL_FORMAT_RGB888, MSG_HEADER_PIXEL_DATA);
+  test_bt_throughput(PIXEL_FORMAT_RGB565, MSG_HEADER_PIXEL_DATA);
+  test_bt_throughput(PIXEL_FORMAT_RGB565, MSG_HEADER_PIXEL_CODED);
+  test_bt_throughput(PIXEL_FORMAT_RGB565, MSG_HEADER_PIXEL_LZ);
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "column_ring.h"
+
+/*
+ * The column ring's counters and slot bounds, driven from a single thread:
+ * the producer and consumer calls are interleaved by hand. The host build
+ * numbers the first column COLUMN_RING_FIRST_COLUMN, so that the counters
+ * can be taken across their wraparound in a fraction of a second.
+ */
+
+// Columns published and released before the counters wrap around, in the wraparound test
+#define TEST_WRAP_MARGIN (3 * COLUMN_RING_SLOTS / 2)
+
+// Publishes and releases columns up to this one, as fast as possible
+static void test_column_ring_skip_to(unsigned int column)
+{
+  TEST_ASSERT_TRUE_MESSAGE(column - column_ring_count() <= column - (unsigned int)COLUMN_RING_FIRST_COLUMN,
+                           "the counters are past the column already");
+  while (column_ring_count() != column)
+  {
+    TEST_ASSERT_NOT_NULL(column_ring_acquire());
+    column_ring_commit();
+    column_ring_release(column_ring_count());
+  }
+}
+
+// A column whose bytes all tell its number
+static void test_column_ring_fill(uint8_t *slot, unsigned int column)
+{
+  memset(slot, column * 7 + 1, COLUMN_BYTES);
+}
+
+static void test_column_ring_check(const uint8_t *slot, unsigned int column, const char *message)
+{
+  static uint8_t expected[COLUMN_BYTES];
+  test_column_ring_fill(expected, column);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, slot, COLUMN_BYTES, message);
+}
+
+TEST_CASE("column ring counters wrap around", "[column_ring]")
+{
+  test_column_ring_skip_to(0u - TEST_WRAP_MARGIN);
+
+  // The consumer lags a few columns behind, holding them as the LED task does
+  unsigned int released = column_ring_count();
+  for (unsigned int i = 0; i < 2 * TEST_WRAP_MARGIN; i++)
+  {
+    char message[48];
+    unsigned int column = column_ring_count();
+    snprintf(message, sizeof(message), "column %u", column);
+
+    uint8_t *slot = column_ring_acquire();
+    TEST_ASSERT_NOT_NULL_MESSAGE(slot, message);
+    test_column_ring_fill(slot, column);
+    column_ring_commit();
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(column + 1, column_ring_count(), message);
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(slot, column_ring_slot(column), message);
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(slot, column_ring_recent(0), message);
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(column_ring_slot(column - COLUMN_RING_MAX_BACK), column_ring_recent(COLUMN_RING_MAX_BACK),
+                                  message);
+
+    // Every column the consumer holds is intact, the new one included
+    for (unsigned int held = released; held != column + 1; held++)
+    {
+      test_column_ring_check(column_ring_slot(held), held, message);
+    }
+    if (column + 1 - released > COLUMN_RING_SLOTS / 2)
+    {
+      released += 3;
+      column_ring_release(released);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT(TEST_WRAP_MARGIN, column_ring_count());
+  column_ring_release(column_ring_count());
+}
+
+TEST_CASE("column ring reserve never hands out a slot column_ring_recent may return", "[column_ring]")
+{
+  test_column_ring_skip_to(column_ring_count() + COLUMN_RING_SLOTS);
+
+  // The next slot is not one of the recent columns, however far back
+  uint8_t *next = column_ring_reserve(0);
+  TEST_ASSERT_NOT_NULL(next);
+  for (unsigned int back = 0; back <= COLUMN_RING_MAX_BACK; back++)
+  {
+    TEST_ASSERT_NOT_NULL(column_ring_recent(back));
+    TEST_ASSERT_TRUE_MESSAGE(column_ring_recent(back) != next, "recent column in the next slot");
+  }
+  TEST_ASSERT_NULL(column_ring_recent(COLUMN_RING_MAX_BACK + 1));
+
+  // Further ahead, never the last published column, which the out-of-order producer keeps
+  for (unsigned int ahead = 0; ahead <= COLUMN_RING_SLOTS - 2; ahead++)
+  {
+    uint8_t *slot = column_ring_reserve(ahead);
+    TEST_ASSERT_NOT_NULL(slot);
+    TEST_ASSERT_TRUE_MESSAGE(slot != column_ring_recent(0), "last column reserved");
+    // The reserved column is only clear of recent columns up to here
+    for (unsigned int back = 0; back + ahead < COLUMN_RING_SLOTS - 1; back++)
+    {
+      TEST_ASSERT_TRUE_MESSAGE(slot != column_ring_recent(back), "recent column reserved");
+    }
+  }
+  TEST_ASSERT_NULL(column_ring_reserve(COLUMN_RING_SLOTS - 1));
+
+  // Nor one of the columns the consumer holds
+  for (unsigned int held = 1; held <= COLUMN_RING_SLOTS; held++)
+  {
+    char message[32];
+    snprintf(message, sizeof(message), "%u columns held", held);
+    unsigned int first = column_ring_count();
+    for (unsigned int i = 0; i < held; i++)
+    {
+      TEST_ASSERT_NOT_NULL(column_ring_acquire());
+      column_ring_commit();
+    }
+    for (unsigned int ahead = 0; ahead < COLUMN_RING_SLOTS; ahead++)
+    {
+      uint8_t *slot = column_ring_reserve(ahead);
+      bool room = ahead <= COLUMN_RING_SLOTS - 2 && held + ahead < COLUMN_RING_SLOTS;
+      TEST_ASSERT_EQUAL_MESSAGE(room, slot != NULL, message);
+      for (unsigned int column = first; slot && column != first + held; column++)
+      {
+        TEST_ASSERT_TRUE_MESSAGE(slot != column_ring_slot(column), message);
+      }
+    }
+    column_ring_release(first + held);
+  }
+}
+
+TEST_CASE("column ring reserved columns are published in order", "[column_ring]")
+{
+  unsigned int head = column_ring_count();
+
+  // Columns 2 and 1 come before column 0
+  test_column_ring_fill(column_ring_reserve(2), head + 2);
+  test_column_ring_fill(column_ring_reserve(1), head + 1);
+  test_column_ring_fill(column_ring_acquire(), head);
+  for (unsigned int i = 0; i < 3; i++)
+  {
+    column_ring_commit();
+  }
+  TEST_ASSERT_EQUAL_UINT(head + 3, column_ring_count());
+  for (unsigned int column = head; column != head + 3; column++)
+  {
+    test_column_ring_check(column_ring_slot(column), column, "reserved");
+  }
+  column_ring_release(head + 3);
+}
+
+TEST_CASE("column ring release only moves forward", "[column_ring]")
+{
+  unsigned int head = column_ring_count();
+
+  for (unsigned int i = 0; i < COLUMN_RING_SLOTS; i++)
+  {
+    TEST_ASSERT_NOT_NULL(column_ring_acquire());
+    column_ring_commit();
+  }
+  TEST_ASSERT_NULL(column_ring_acquire());
+
+  // Releasing older columns again gives nothing back, and takes nothing back
+  column_ring_release(head + 4);
+  column_ring_release(head + 2);
+  column_ring_release(head);
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    TEST_ASSERT_NOT_NULL(column_ring_acquire());
+    column_ring_commit();
+  }
+  TEST_ASSERT_NULL(column_ring_acquire());
+  column_ring_release(head + 3);
+  TEST_ASSERT_NULL(column_ring_acquire());
+
+  // A column half the counter range behind is older, however the counters have wrapped
+  column_ring_release(column_ring_count());
+  column_ring_release(column_ring_count() + 0x80000000u);
+  for (unsigned int i = 0; i < COLUMN_RING_SLOTS; i++)
+  {
+    TEST_ASSERT_NOT_NULL(column_ring_acquire());
+    column_ring_commit();
+  }
+  column_ring_release(column_ring_count());
+}
+
+TEST_CASE("column ring is claimed by one transport at a time", "[column_ring]")
+{
+  TEST_ASSERT_TRUE(column_ring_claim(SOURCE_HTTP));
+  // The owner may claim it again, as for each of its animations
+  TEST_ASSERT_TRUE(column_ring_claim(SOURCE_HTTP));
+  TEST_ASSERT_FALSE(column_ring_claim(SOURCE_UDP));
+
+  // Only the owner gives it back
+  column_ring_unclaim(SOURCE_UDP);
+  TEST_ASSERT_FALSE(column_ring_claim(SOURCE_UDP));
+  column_ring_unclaim(SOURCE_HTTP);
+  TEST_ASSERT_TRUE(column_ring_claim(SOURCE_UDP));
+  TEST_ASSERT_FALSE(column_ring_claim(SOURCE_HTTP));
+
+  column_ring_unclaim(SOURCE_HTTP);
+  TEST_ASSERT_FALSE(column_ring_claim(SOURCE_HTTP));
+  column_ring_unclaim(SOURCE_UDP);
+  column_ring_unclaim(SOURCE_UDP);
+  TEST_ASSERT_TRUE(column_ring_claim(SOURCE_HTTP));
+  column_ring_unclaim(SOURCE_HTTP);
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "flow.h"
+
+/*
+ * flow.c on a simulated link, stepped a millisecond at a time. The app
+ * sends columns within the limit of the latest ACK it got, as fast as the
+ * link takes them; they arrive in order after a jittery latency. ACKs take
+ * the same latency back, some are lost, and some arrive late, after later
+ * ones. The device plays like led.c: once a window is buffered, then one
+ * column per period as long as one is buffered.
+ */
+
+// Columns the ring buffers, as given by led.c
+#define TEST_CAPACITY 62
+#define TEST_COLUMNS 3000
+#define TEST_MAX_ACKS 20000
+// No bound on underruns, only on stalls and overflows
+#define TEST_ANY_UNDERRUNS UINT_MAX
+// Longest time the device may leave an app that is out of credit without an ACK
+#define TEST_MAX_SILENCE_US 1000000
+
+struct test_link
+{
+  unsigned int rate;       // playback, columns/s
+  unsigned int throughput; // columns/s the link carries
+  unsigned int latency_us; // one way
+  unsigned int jitter_us;  // added to the latency, up to
+  unsigned int loss;       // percent of ACKs lost
+  unsigned int late;       // percent of ACKs delayed by late_us more
+  unsigned int late_us;
+  unsigned int outage_us; // every ACK is lost for this long
+  unsigned int outage_period_us;
+};
+
+struct test_result
+{
+  unsigned int underruns;
+  unsigned int acks;
+  unsigned int max_buffered;
+  int64_t max_wait_us;    // without a column to play
+  int64_t max_silence_us; // without an ACK while the app is out of credit
+  int64_t duration_us;
+};
+
+static unsigned int test_flow_delay(const struct test_link *link)
+{
+  return link->latency_us + (link->jitter_us ? rand() % link->jitter_us : 0);
+}
+
+static void test_flow_run(const struct test_link *link, struct test_result *result)
+{
+  static int64_t arrival[TEST_COLUMNS];
+  static struct
+  {
+    int64_t t;
+    unsigned int limit;
+  } acks[TEST_MAX_ACKS];
+  unsigned int ack_count = 0;
+  struct flow_control flow;
+
+  // App side
+  unsigned int sent = 0, app_limit = 0;
+  int64_t t_link_free = 0;
+  // Device side
+  unsigned int received = 0, played = 0;
+  bool started = false;
+  int64_t t_next_play = 0;
+  int64_t t_played = 0;
+  int64_t t_silent = 0;
+  int64_t period_us = 1000000 / link->rate;
+
+  memset(result, 0, sizeof(*result));
+  acks[ack_count].t = test_flow_delay(link);
+  acks[ack_count++].limit = flow_begin(&flow, TEST_CAPACITY, link->rate, 0);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT(TEST_CAPACITY, acks[0].limit);
+
+  int64_t t;
+  for (t = 0; played < TEST_COLUMNS; t += 1000)
+  {
+    // The app takes the highest limit it got, ACKs may come out of order
+    for (unsigned int i = 0; i < ack_count; i++)
+    {
+      if (acks[i].t <= t && acks[i].limit > app_limit)
+      {
+        app_limit = acks[i].limit;
+      }
+    }
+    while (sent < app_limit && sent < TEST_COLUMNS && t_link_free <= t)
+    {
+      t_link_free = (t_link_free > t - 1000 ? t_link_free : t - 1000) + 1000000 / link->throughput;
+      int64_t t_arrival = t_link_free + test_flow_delay(link);
+      arrival[sent] = sent > 0 && arrival[sent - 1] > t_arrival ? arrival[sent - 1] : t_arrival;
+      sent++;
+    }
+
+    while (received < sent && arrival[received] <= t)
+    {
+      received++;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL_UINT_MESSAGE(played + TEST_CAPACITY, received, "ring overflow");
+    if (received - played > result->max_buffered)
+    {
+      result->max_buffered = received - played;
+    }
+
+    // Every column the app could send arrived: only a new ACK gets the stream going again
+    if (sent < TEST_COLUMNS && sent == app_limit && received == sent)
+    {
+      if (t - t_silent > result->max_silence_us)
+      {
+        result->max_silence_us = t - t_silent;
+        TEST_ASSERT_TRUE_MESSAGE(result->max_silence_us <= TEST_MAX_SILENCE_US, "stalled");
+      }
+    }
+    else
+    {
+      t_silent = t;
+    }
+
+    if (received < TEST_COLUMNS)
+    {
+      unsigned int limit = flow_update(&flow, received, played, t);
+      if (limit > 0)
+      {
+        TEST_ASSERT_LESS_OR_EQUAL_UINT_MESSAGE(played + TEST_CAPACITY, limit, "limit beyond the ring");
+        TEST_ASSERT_LESS_THAN(TEST_MAX_ACKS, ack_count);
+        unsigned int r = rand() % 100;
+        bool outage = link->outage_period_us && t % link->outage_period_us < link->outage_us;
+        acks[ack_count].limit = limit;
+        acks[ack_count].t = r < link->loss || outage ? INT64_MAX
+                          : r < link->loss + link->late ? t + test_flow_delay(link) + link->late_us
+                                                        : t + test_flow_delay(link);
+        ack_count++;
+        t_silent = t;
+      }
+    }
+
+    if (!started)
+    {
+      if (received < flow.window && received < TEST_COLUMNS)
+      {
+        continue;
+      }
+      started = true;
+      t_next_play = t;
+    }
+    if (t >= t_next_play)
+    {
+      t_next_play += period_us;
+      if (played < received)
+      {
+        played++;
+        t_played = t;
+      }
+      else if (t - t_played > result->max_wait_us)
+      {
+        result->max_wait_us = t - t_played;
+      }
+      else
+      {
+        result->underruns++;
+      }
+    }
+  }
+
+  result->acks = ack_count;
+  result->duration_us = t;
+}
+
+// Returns how long the animation took
+static int64_t test_flow_check(const char *name, const struct test_link *link, unsigned int max_underruns)
+{
+  struct test_result result;
+
+  srand(78);
+  test_flow_run(link, &result);
+  printf("flow, %s: %u columns at %u/s over %u/s, %u+%u ms, %u%% ACKs lost, %u%% %u ms late: "
+         "%u underruns, %u ACKs, at most %u buffered, %.2f s, longest waits %lld ms for a column, "
+         "%lld ms for an ACK\n",
+         name, TEST_COLUMNS, link->rate, link->throughput, link->latency_us / 1000, link->jitter_us / 1000,
+         link->loss, link->late, link->late_us / 1000, result.underruns, result.acks, result.max_buffered,
+         result.duration_us / 1e6, (long long)result.max_wait_us / 1000,
+         (long long)result.max_silence_us / 1000);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT_MESSAGE(max_underruns, result.underruns, name);
+  return result.duration_us;
+}
+
+TEST_CASE("flow control fills the ring without underruns on a clean link", "[flow]")
+{
+  test_flow_check("clean", &(struct test_link){.rate = 100, .throughput = 400, .latency_us = 20000}, 0);
+  test_flow_check("jittery", &(struct test_link){
+      .rate = 200, .throughput = 400, .latency_us = 20000, .jitter_us = 30000}, 0);
+}
+
+TEST_CASE("flow control recovers from lost and late ACKs", "[flow]")
+{
+  test_flow_check("lossy", &(struct test_link){
+      .rate = 100, .throughput = 400, .latency_us = 20000, .jitter_us = 20000, .loss = 10}, 0);
+  test_flow_check("late", &(struct test_link){
+      .rate = 150, .throughput = 400, .latency_us = 20000, .jitter_us = 20000, .late = 10, .late_us = 200000},
+                  TEST_ANY_UNDERRUNS);
+  test_flow_check("lossy and late", &(struct test_link){
+      .rate = 60, .throughput = 120, .latency_us = 50000, .jitter_us = 40000, .loss = 30, .late = 10,
+      .late_us = 300000}, TEST_ANY_UNDERRUNS);
+  // Most ACKs lost: the limit only moves on when a resend gets through
+  test_flow_check("mostly lost", &(struct test_link){
+      .rate = 100, .throughput = 400, .latency_us = 20000, .jitter_us = 20000, .loss = 60}, TEST_ANY_UNDERRUNS);
+  test_flow_check("nearly all lost", &(struct test_link){
+      .rate = 100, .throughput = 400, .latency_us = 20000, .jitter_us = 20000, .loss = 90}, TEST_ANY_UNDERRUNS);
+  // A second without any ACK every four
+  test_flow_check("outages", &(struct test_link){
+      .rate = 100, .throughput = 400, .latency_us = 20000, .jitter_us = 20000, .outage_us = 1000000,
+      .outage_period_us = 4000000}, TEST_ANY_UNDERRUNS);
+}
+
+TEST_CASE("flow control keeps a link slower than playback busy", "[flow]")
+{
+  int64_t duration_us = test_flow_check("slow link", &(struct test_link){
+      .rate = 200, .throughput = 100, .latency_us = 20000, .jitter_us = 10000, .loss = 5}, TEST_ANY_UNDERRUNS);
+  // Within 10% of the time the link takes to carry the columns
+  TEST_ASSERT_TRUE(duration_us < TEST_COLUMNS * 11000LL);
+}
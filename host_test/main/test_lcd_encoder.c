@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "led_strip_lcd.h"
+#include "led_strip_lcd_encoder.h"
+
+/*
+ * The LCD backend's transposing encoder against a naive one that picks
+ * every bit of every lane on its own, and its speed on a whole stick.
+ */
+
+#define TEST_LEDS 332
+#define TEST_BYTES_PER_PIXEL 3
+#define TEST_WORD_CLOCK_HZ 2400000
+#define TEST_BENCHMARK_RUNS 2000
+
+static uint8_t pixels[TEST_LEDS * TEST_BYTES_PER_PIXEL];
+// Words of the longest lane, a lane per LED at most
+static uint16_t expected[TEST_LEDS * TEST_BYTES_PER_PIXEL * 8 * LED_STRIP_LCD_WORDS_PER_BIT];
+static uint16_t words16[sizeof(expected) / sizeof(expected[0])];
+static uint8_t words8[sizeof(expected) / sizeof(expected[0])];
+
+// Lanes of consecutive pixels, like the backend splits the strip
+static size_t test_lcd_lanes(size_t lane_count, const uint8_t *lanes[], size_t lane_len[])
+{
+  size_t longest = 0;
+  for (size_t l = 0; l < lane_count; l++)
+  {
+    size_t start = TEST_LEDS * l / lane_count;
+    lanes[l] = pixels + start * TEST_BYTES_PER_PIXEL;
+    lane_len[l] = (TEST_LEDS * (l + 1) / lane_count - start) * TEST_BYTES_PER_PIXEL;
+    longest = lane_len[l] > longest ? lane_len[l] : longest;
+  }
+  return longest;
+}
+
+static void test_lcd_naive(const uint8_t *const lanes[], const size_t lane_len[], size_t lane_count, size_t len,
+                           uint16_t *words)
+{
+  for (size_t j = 0; j < len; j++)
+  {
+    for (int bit = 7; bit >= 0; bit--)
+    {
+      uint16_t data = 0;
+      for (size_t l = 0; l < lane_count; l++)
+      {
+        if (j < lane_len[l] && lanes[l][j] >> bit & 1)
+        {
+          data |= 1 << l;
+        }
+      }
+      *words++ = (1 << lane_count) - 1;
+      *words++ = data;
+      *words++ = 0;
+    }
+  }
+}
+
+TEST_CASE("lcd encoder matches a naive one for every lane count", "[lcd]")
+{
+  const uint8_t *lanes[LED_STRIP_LCD_MAX_LANES];
+  size_t lane_len[LED_STRIP_LCD_MAX_LANES];
+
+  srand(6);
+  for (size_t i = 0; i < sizeof(pixels); i++)
+  {
+    pixels[i] = rand();
+  }
+  for (size_t lane_count = 1; lane_count <= LED_STRIP_LCD_MAX_LANES; lane_count++)
+  {
+    char message[32];
+    snprintf(message, sizeof(message), "%u lanes", (unsigned int)lane_count);
+    size_t len = test_lcd_lanes(lane_count, lanes, lane_len);
+    size_t word_count = len * 8 * LED_STRIP_LCD_WORDS_PER_BIT;
+    test_lcd_naive(lanes, lane_len, lane_count, len, expected);
+
+    led_strip_lcd_encode16(lanes, lane_len, lane_count, len, words16);
+    TEST_ASSERT_EQUAL_HEX16_ARRAY_MESSAGE(expected, words16, word_count, message);
+    if (lane_count <= 8)
+    {
+      led_strip_lcd_encode8(lanes, lane_len, lane_count, len, words8);
+      for (size_t i = 0; i < word_count; i++)
+      {
+        TEST_ASSERT_EQUAL_HEX8_MESSAGE(expected[i], words8[i], message);
+      }
+    }
+  }
+}
+
+TEST_CASE("lcd encoder speed on a whole stick", "[lcd][benchmark]")
+{
+  static const size_t lane_counts[] = {8, 16};
+  const uint8_t *lanes[LED_STRIP_LCD_MAX_LANES];
+  size_t lane_len[LED_STRIP_LCD_MAX_LANES];
+
+  for (unsigned int i = 0; i < sizeof(lane_counts) / sizeof(lane_counts[0]); i++)
+  {
+    size_t lane_count = lane_counts[i];
+    size_t len = test_lcd_lanes(lane_count, lanes, lane_len);
+
+    int64_t t_begin = esp_timer_get_time();
+    for (unsigned int run = 0; run < TEST_BENCHMARK_RUNS; run++)
+    {
+      test_lcd_naive(lanes, lane_len, lane_count, len, expected);
+    }
+    int64_t naive_ns = (esp_timer_get_time() - t_begin) * 1000 / TEST_BENCHMARK_RUNS;
+
+    t_begin = esp_timer_get_time();
+    for (unsigned int run = 0; run < TEST_BENCHMARK_RUNS; run++)
+    {
+      if (lane_count <= 8)
+      {
+        led_strip_lcd_encode8(lanes, lane_len, lane_count, len, words8);
+      }
+      else
+      {
+        led_strip_lcd_encode16(lanes, lane_len, lane_count, len, words16);
+      }
+    }
+    int64_t encode_ns = (esp_timer_get_time() - t_begin) * 1000 / TEST_BENCHMARK_RUNS;
+
+    // The words are shifted out at the word clock, whatever the encoder
+    int64_t wire_us = (int64_t)len * 8 * LED_STRIP_LCD_WORDS_PER_BIT * 1000000 / TEST_WORD_CLOCK_HZ;
+    printf("lcd encoder, %u LEDs on %u lanes: naive %lld ns, transposed %lld ns per frame, %lld us on the wire\n",
+           TEST_LEDS, (unsigned int)lane_count, (long long)naive_ns, (long long)encode_ns, (long long)wire_us);
+  }
+}
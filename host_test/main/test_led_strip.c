@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "led_strip.h"
+#include "led_strip_interface.h"
+#include "led_strip_virtual.h"
+
+/*
+ * Segments of a strip driven in parallel, as split by the RMT and LCD
+ * backends, and the virtual strip which refreshes with the same segments.
+ * Pixels are still addressed 0..max_leds-1 whatever the segments, a pixel
+ * or a span of them at a time.
+ */
+
+#define TEST_LEDS 332
+#define TEST_MAX_SEGMENTS 16
+#define TEST_BIT_NS 1250
+#define TEST_RESET_US 50
+#define TEST_BENCHMARK_RUNS 20000
+
+TEST_CASE("led strip segments take consecutive spans of even length", "[led_strip]")
+{
+  for (uint32_t len = 1; len <= 400; len++)
+  {
+    for (uint32_t count = 1; count <= TEST_MAX_SEGMENTS && count <= len; count++)
+    {
+      char message[64];
+      snprintf(message, sizeof(message), "%u pixels in %u segments", (unsigned int)len, (unsigned int)count);
+
+      TEST_ASSERT_EQUAL_UINT_MESSAGE(0, led_strip_segment_start(len, count, 0), message);
+      TEST_ASSERT_EQUAL_UINT_MESSAGE(len, led_strip_segment_start(len, count, count), message);
+      for (uint32_t i = 0; i < count; i++)
+      {
+        uint32_t segment_len = led_strip_segment_start(len, count, i + 1) - led_strip_segment_start(len, count, i);
+        TEST_ASSERT_TRUE_MESSAGE(segment_len >= len / count, message);
+        TEST_ASSERT_TRUE_MESSAGE(segment_len <= (len + count - 1) / count, message);
+      }
+    }
+  }
+}
+
+// Random pixels in RGB, and the wire order (GRB) the strip should record
+static void test_led_strip_pixels(uint8_t *rgb, uint8_t *grb)
+{
+  for (unsigned int i = 0; i < TEST_LEDS; i++)
+  {
+    for (unsigned int c = 0; c < 3; c++)
+    {
+      rgb[i * 3 + c] = rand();
+    }
+    grb[i * 3] = rgb[i * 3 + 1];
+    grb[i * 3 + 1] = rgb[i * 3];
+    grb[i * 3 + 2] = rgb[i * 3 + 2];
+  }
+}
+
+static void test_led_strip_check_frame(led_strip_handle_t strip, const uint8_t *expected, const char *message)
+{
+  static uint8_t frame[TEST_LEDS * 3];
+  led_strip_virtual_stats_t stats;
+
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_virtual_get_stats(strip, &stats));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_virtual_get_frame(strip, stats.frames - 1, frame));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(expected, frame, sizeof(frame), message);
+}
+
+TEST_CASE("virtual strip keeps pixel order whatever the segments", "[led_strip]")
+{
+  static const uint32_t segment_counts[] = {1, 2, 3, 5, 8, 16};
+  static uint8_t rgb[TEST_LEDS * 3], grb[TEST_LEDS * 3];
+  led_strip_config_t config = {.max_leds = TEST_LEDS, .led_pixel_format = LED_PIXEL_FORMAT_GRB};
+
+  srand(5);
+  for (unsigned int s = 0; s < sizeof(segment_counts) / sizeof(segment_counts[0]); s++)
+  {
+    led_strip_virtual_config_t virtual_config = {.max_frames = 4, .segment_count = segment_counts[s]};
+    led_strip_handle_t strip;
+    char message[64];
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_new_virtual_device(&config, &virtual_config, &strip));
+
+    // One pixel at a time
+    snprintf(message, sizeof(message), "%u segments, set_pixel", (unsigned int)segment_counts[s]);
+    test_led_strip_pixels(rgb, grb);
+    for (unsigned int i = 0; i < TEST_LEDS; i++)
+    {
+      TEST_ASSERT_EQUAL(ESP_OK, led_strip_set_pixel(strip, i, rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_refresh(strip));
+    test_led_strip_check_frame(strip, grb, message);
+
+    // Spans of random lengths, across segment boundaries
+    snprintf(message, sizeof(message), "%u segments, set_pixels", (unsigned int)segment_counts[s]);
+    test_led_strip_pixels(rgb, grb);
+    for (uint32_t start = 0, count; start < TEST_LEDS; start += count)
+    {
+      count = 1 + rand() % 100;
+      count = count < TEST_LEDS - start ? count : TEST_LEDS - start;
+      TEST_ASSERT_EQUAL(ESP_OK, led_strip_set_pixels(strip, start, count, rgb + start * 3, LED_STRIP_COLOR_ORDER_RGB));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_refresh(strip));
+    test_led_strip_check_frame(strip, grb, message);
+
+    // A whole frame in wire order
+    snprintf(message, sizeof(message), "%u segments, refresh_from", (unsigned int)segment_counts[s]);
+    test_led_strip_pixels(rgb, grb);
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_refresh_from(strip, grb));
+    test_led_strip_check_frame(strip, grb, message);
+
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_del(strip));
+  }
+}
+
+TEST_CASE("virtual strip clears the white of RGB pixels on GRBW strips", "[led_strip]")
+{
+  static const uint8_t rgb[] = {1, 2, 3, 4, 5, 6};
+  static const uint8_t grbw[] = {0x11, 0x12, 0x13, 0x14, 0x21, 0x22, 0x23, 0x24, 0x31, 0x32, 0x33, 0x34};
+  static const uint8_t expected[] = {0x11, 0x12, 0x13, 0x14, 2, 1, 3, 0, 5, 4, 6, 0};
+  uint8_t frame[sizeof(expected)];
+  led_strip_config_t config = {.max_leds = 3, .led_pixel_format = LED_PIXEL_FORMAT_GRBW};
+  led_strip_virtual_config_t virtual_config = {.max_frames = 1};
+  led_strip_handle_t strip;
+
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_new_virtual_device(&config, &virtual_config, &strip));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_set_pixels(strip, 0, 3, grbw, LED_STRIP_COLOR_ORDER_WIRE));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_set_pixels(strip, 1, 2, rgb, LED_STRIP_COLOR_ORDER_RGB));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, led_strip_set_pixels(strip, 2, 2, rgb, LED_STRIP_COLOR_ORDER_RGB));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_refresh(strip));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_virtual_get_frame(strip, 0, frame));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, frame, sizeof(expected));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_del(strip));
+}
+
+TEST_CASE("virtual strip refreshes as fast as its longest segment", "[led_strip]")
+{
+  static const uint32_t segment_counts[] = {1, 2, 3, 8};
+  static uint8_t grb[TEST_LEDS * 3];
+  led_strip_config_t config = {.max_leds = TEST_LEDS, .led_pixel_format = LED_PIXEL_FORMAT_GRB};
+
+  for (unsigned int s = 0; s < sizeof(segment_counts) / sizeof(segment_counts[0]); s++)
+  {
+    uint32_t count = segment_counts[s];
+    led_strip_virtual_config_t virtual_config = {.max_frames = 4, .segment_count = count,
+                                                 .flags.simulate_timing = true};
+    led_strip_handle_t strip;
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_new_virtual_device(&config, &virtual_config, &strip));
+
+    uint32_t longest = (TEST_LEDS + count - 1) / count;
+    int64_t expected_us = longest * 3 * 8 * TEST_BIT_NS / 1000 + TEST_RESET_US;
+    int64_t t_begin = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_refresh_from(strip, grb));
+    int64_t refresh_us = esp_timer_get_time() - t_begin;
+    printf("virtual strip, %u LEDs in %u segments: refresh in %lld us, %lld us expected\n", TEST_LEDS,
+           (unsigned int)count, (long long)refresh_us, (long long)expected_us);
+    TEST_ASSERT_TRUE(refresh_us >= expected_us);
+    // Sleeping may overshoot, but not by another segment
+    TEST_ASSERT_TRUE(refresh_us < expected_us + longest * 3 * 8 * TEST_BIT_NS / 1000);
+
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_del(strip));
+  }
+}
+
+TEST_CASE("virtual strip only returns recorded frames", "[led_strip]")
+{
+  static uint8_t frame[TEST_LEDS * 3];
+  led_strip_config_t config = {.max_leds = TEST_LEDS, .led_pixel_format = LED_PIXEL_FORMAT_GRB};
+  led_strip_virtual_config_t virtual_config = {.max_frames = 2, .segment_count = 2};
+  led_strip_handle_t strip;
+
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_new_virtual_device(&config, &virtual_config, &strip));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, led_strip_virtual_get_frame(strip, 0, frame));
+  for (unsigned int i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_EQUAL(ESP_OK, led_strip_refresh(strip));
+  }
+  // Two frames kept, the first one is gone
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, led_strip_virtual_get_frame(strip, 0, frame));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_virtual_get_frame(strip, 1, frame));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_virtual_get_frame(strip, 2, frame));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, led_strip_virtual_get_frame(strip, 3, frame));
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_del(strip));
+}
+
+TEST_CASE("virtual strip column write speed", "[led_strip][benchmark]")
+{
+  static uint8_t rgb[TEST_LEDS * 3], grb[TEST_LEDS * 3];
+  led_strip_config_t config = {.max_leds = TEST_LEDS, .led_pixel_format = LED_PIXEL_FORMAT_GRB};
+  led_strip_virtual_config_t virtual_config = {.max_frames = 1};
+  led_strip_handle_t strip;
+
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_new_virtual_device(&config, &virtual_config, &strip));
+  test_led_strip_pixels(rgb, grb);
+
+  // A pixel at a time, as render() used to for its patterns, against a whole column at once
+  int64_t t_begin = esp_timer_get_time();
+  for (unsigned int run = 0; run < TEST_BENCHMARK_RUNS; run++)
+  {
+    for (unsigned int i = 0; i < TEST_LEDS; i++)
+    {
+      led_strip_set_pixel(strip, i, rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+    }
+  }
+  int64_t pixel_ns = (esp_timer_get_time() - t_begin) * 1000 / TEST_BENCHMARK_RUNS;
+
+  t_begin = esp_timer_get_time();
+  for (unsigned int run = 0; run < TEST_BENCHMARK_RUNS; run++)
+  {
+    led_strip_set_pixels(strip, 0, TEST_LEDS, rgb, LED_STRIP_COLOR_ORDER_RGB);
+  }
+  int64_t rgb_ns = (esp_timer_get_time() - t_begin) * 1000 / TEST_BENCHMARK_RUNS;
+
+  t_begin = esp_timer_get_time();
+  for (unsigned int run = 0; run < TEST_BENCHMARK_RUNS; run++)
+  {
+    led_strip_set_pixels(strip, 0, TEST_LEDS, grb, LED_STRIP_COLOR_ORDER_WIRE);
+  }
+  int64_t wire_ns = (esp_timer_get_time() - t_begin) * 1000 / TEST_BENCHMARK_RUNS;
+
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_refresh(strip));
+  test_led_strip_check_frame(strip, grb, "after the benchmark");
+  printf("virtual strip, %u LEDs: set_pixel %lld ns, set_pixels from RGB %lld ns, in wire order %lld ns per column\n",
+         TEST_LEDS, (long long)pixel_ns, (long long)rgb_ns, (long long)wire_ns);
+  TEST_ASSERT_EQUAL(ESP_OK, led_strip_del(strip));
+}
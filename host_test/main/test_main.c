@@ -0,0 +1,14 @@
+#include <stdlib.h>
+#include "unity.h"
+
+/*
+ * Runs every TEST_CASE of the host tests; benchmarks print their figures.
+ * The process exits with the number of failures.
+ */
+
+void app_main(void)
+{
+  UNITY_BEGIN();
+  unity_run_all_tests();
+  exit(UNITY_END());
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "unity.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "led_strip_rmt_encoder.h"
+
+/*
+ * The RMT backend's table-driven encoder, run against a copy encoder that
+ * fills a mock channel memory a block at a time. A block is what the driver
+ * lets the encoder fill in one step: the first in rmt_transmit, the next
+ * ones in the RMT interrupt, each one a refill.
+ */
+
+#define TEST_LEDS 332
+#define TEST_BYTES_PER_PIXEL 3
+#define TEST_RESOLUTION_HZ 10000000
+#define TEST_RESET_US 50
+#define TEST_FRAME_SYMBOLS (TEST_LEDS * TEST_BYTES_PER_PIXEL * 8 + 1)
+#define TEST_BENCHMARK_RUNS 2000
+
+struct rmt_channel_t
+{
+  size_t block_symbols; // symbols the encoder may write before it must yield
+  size_t used;          // symbols written into the current block
+  rmt_symbol_word_t *sent;
+  size_t sent_count;
+};
+
+typedef struct
+{
+  rmt_encoder_t base;
+  size_t symbol_index; // next symbol of the data, when the memory got full in the middle of it
+} test_copy_encoder_t;
+
+static uint8_t pixels[TEST_LEDS * TEST_BYTES_PER_PIXEL];
+static rmt_symbol_word_t sent[TEST_FRAME_SYMBOLS];
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Like the driver's copy encoder: as many symbols as fit, the rest at the next call
+static size_t test_copy_encode(rmt_encoder_t *encoder, rmt_channel_handle_t channel, const void *primary_data,
+                               size_t data_size, rmt_encode_state_t *ret_state)
+{
+  test_copy_encoder_t *copy_encoder = __containerof(encoder, test_copy_encoder_t, base);
+  const rmt_symbol_word_t *symbols = primary_data;
+  size_t count = data_size / sizeof(rmt_symbol_word_t) - copy_encoder->symbol_index;
+  size_t room = channel->block_symbols - channel->used;
+  rmt_encode_state_t state = RMT_ENCODING_RESET;
+
+  if (count > room)
+  {
+    count = room;
+  }
+  if (channel->sent)
+  {
+    memcpy(channel->sent + channel->sent_count, symbols + copy_encoder->symbol_index, count * sizeof(rmt_symbol_word_t));
+  }
+  channel->used += count;
+  channel->sent_count += count;
+  copy_encoder->symbol_index += count;
+  if (copy_encoder->symbol_index == data_size / sizeof(rmt_symbol_word_t))
+  {
+    copy_encoder->symbol_index = 0;
+    state |= RMT_ENCODING_COMPLETE;
+  }
+  if (channel->used == channel->block_symbols)
+  {
+    state |= RMT_ENCODING_MEM_FULL;
+  }
+  *ret_state = state;
+  return count;
+}
+
+static esp_err_t test_copy_reset(rmt_encoder_t *encoder)
+{
+  __containerof(encoder, test_copy_encoder_t, base)->symbol_index = 0;
+  return ESP_OK;
+}
+
+static esp_err_t test_copy_del(rmt_encoder_t *encoder)
+{
+  free(__containerof(encoder, test_copy_encoder_t, base));
+  return ESP_OK;
+}
+
+esp_err_t rmt_new_copy_encoder(const rmt_copy_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder)
+{
+  test_copy_encoder_t *copy_encoder = calloc(1, sizeof(test_copy_encoder_t));
+  if (!copy_encoder)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  copy_encoder->base.encode = test_copy_encode;
+  copy_encoder->base.reset = test_copy_reset;
+  copy_encoder->base.del = test_copy_del;
+  *ret_encoder = &copy_encoder->base;
+  return ESP_OK;
+}
+
+esp_err_t rmt_del_encoder(rmt_encoder_handle_t encoder)
+{
+  return encoder->del(encoder);
+}
+
+esp_err_t rmt_encoder_reset(rmt_encoder_handle_t encoder)
+{
+  return encoder->reset(encoder);
+}
+
+// Encodes a whole frame like the driver, emptying the block whenever it is full; returns the refills
+static unsigned int test_rmt_frame(rmt_encoder_handle_t encoder, struct rmt_channel_t *channel)
+{
+  unsigned int refills = 0;
+  rmt_encode_state_t state = RMT_ENCODING_RESET;
+
+  channel->used = 0;
+  channel->sent_count = 0;
+  for (;;)
+  {
+    encoder->encode(encoder, channel, pixels, sizeof(pixels), &state);
+    if (state & RMT_ENCODING_COMPLETE)
+    {
+      return refills;
+    }
+    TEST_ASSERT_TRUE(state & RMT_ENCODING_MEM_FULL);
+    channel->used = 0;
+    refills++;
+  }
+}
+
+static void test_rmt_create(led_strip_byte_symbols_t **byte_symbols, rmt_encoder_handle_t *encoder)
+{
+  led_strip_encoder_config_t config = {
+      .resolution = TEST_RESOLUTION_HZ,
+      .led_model = LED_MODEL_WS2812,
+  };
+  TEST_ASSERT_EQUAL(ESP_OK, rmt_new_led_strip_byte_symbols(&config, byte_symbols));
+  config.byte_symbols = *byte_symbols;
+  TEST_ASSERT_EQUAL(ESP_OK, rmt_new_led_strip_encoder(&config, encoder));
+}
+
+static void test_rmt_destroy(led_strip_byte_symbols_t *byte_symbols, rmt_encoder_handle_t encoder)
+{
+  rmt_del_encoder(encoder);
+  free(byte_symbols);
+}
+
+TEST_CASE("rmt encoder sends every bit and the reset whatever the block size", "[rmt]")
+{
+  static const size_t block_sizes[] = {1, 7, 8, 48, 64, 512, 1024, TEST_FRAME_SYMBOLS};
+  led_strip_byte_symbols_t *byte_symbols;
+  rmt_encoder_handle_t encoder;
+  struct rmt_channel_t channel = {.sent = sent};
+  led_strip_encoder_stats_t stats;
+
+  srand(8);
+  for (size_t i = 0; i < sizeof(pixels); i++)
+  {
+    pixels[i] = rand();
+  }
+  test_rmt_create(&byte_symbols, &encoder);
+  for (unsigned int i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++)
+  {
+    char message[32];
+    snprintf(message, sizeof(message), "%u symbol blocks", (unsigned int)block_sizes[i]);
+    channel.block_symbols = block_sizes[i];
+    rmt_encoder_reset(encoder);
+
+    // Twice, the second frame must start over from the first pixel
+    for (int frame = 0; frame < 2; frame++)
+    {
+      unsigned int refills = test_rmt_frame(encoder, &channel);
+      TEST_ASSERT_EQUAL_UINT_MESSAGE((TEST_FRAME_SYMBOLS - 1) / block_sizes[i], refills, message);
+      TEST_ASSERT_EQUAL_UINT_MESSAGE(TEST_FRAME_SYMBOLS, channel.sent_count, message);
+      for (size_t j = 0; j < sizeof(pixels) * 8; j++)
+      {
+        // WS2812 at 10 MHz: 0.3 us high for a 0, 0.9 us for a 1, 1.2 us per bit
+        unsigned int high = pixels[j / 8] & (0x80 >> j % 8) ? 9 : 3;
+        TEST_ASSERT_EQUAL_UINT_MESSAGE(1, sent[j].level0, message);
+        TEST_ASSERT_EQUAL_UINT_MESSAGE(high, sent[j].duration0, message);
+        TEST_ASSERT_EQUAL_UINT_MESSAGE(0, sent[j].level1, message);
+        TEST_ASSERT_EQUAL_UINT_MESSAGE(12 - high, sent[j].duration1, message);
+      }
+      rmt_symbol_word_t reset = sent[TEST_FRAME_SYMBOLS - 1];
+      TEST_ASSERT_EQUAL_UINT_MESSAGE(0, reset.level0 | reset.level1, message);
+      TEST_ASSERT_EQUAL_UINT_MESSAGE(TEST_RESET_US * TEST_RESOLUTION_HZ / 1000000, reset.duration0 + reset.duration1,
+                                     message);
+    }
+  }
+  // A step per block, and the last one
+  rmt_led_strip_encoder_get_stats(encoder, &stats);
+  unsigned int calls = 0;
+  for (unsigned int i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++)
+  {
+    calls += 2 * ((TEST_FRAME_SYMBOLS - 1) / block_sizes[i] + 1);
+  }
+  TEST_ASSERT_EQUAL_UINT(calls, stats.calls);
+  test_rmt_destroy(byte_symbols, encoder);
+}
+
+TEST_CASE("rmt encoder speed on a whole stick", "[rmt][benchmark]")
+{
+  static const size_t block_sizes[] = {64, 512, 1024};
+  led_strip_byte_symbols_t *byte_symbols;
+  rmt_encoder_handle_t encoder;
+  struct rmt_channel_t channel = {};
+
+  test_rmt_create(&byte_symbols, &encoder);
+  for (unsigned int i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++)
+  {
+    channel.block_symbols = block_sizes[i];
+    unsigned int refills = 0;
+
+    int64_t t_begin = esp_timer_get_time();
+    for (unsigned int run = 0; run < TEST_BENCHMARK_RUNS; run++)
+    {
+      refills = test_rmt_frame(encoder, &channel);
+    }
+    int64_t elapsed_us = esp_timer_get_time() - t_begin;
+
+    printf("rmt encoder, %u LEDs in %u symbol blocks: %u refills and %lld ns per frame, %.1f symbols/us\n",
+           TEST_LEDS, (unsigned int)block_sizes[i], refills, (long long)(elapsed_us * 1000 / TEST_BENCHMARK_RUNS),
+           (double)TEST_FRAME_SYMBOLS * TEST_BENCHMARK_RUNS / (elapsed_us ? elapsed_us : 1));
+  }
+  test_rmt_destroy(byte_symbols, encoder);
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "scheduler.h"
+
+/*
+ * The column scheduler on the host, where it sleeps whole ticks and spins
+ * the rest. Each column does some work after the scheduler returns, like
+ * led.c preparing the next frame, which must not push the grid back.
+ */
+
+#define TEST_PERIOD_US 2000
+#define TEST_WORK_US 600
+#define TEST_COLUMNS 250
+// Long enough that the host preempting the test does not make a column late on its own
+#define TEST_LATE_PERIOD_US 20000
+
+static const int64_t jitter_bounds[] = SCHEDULER_JITTER_BUCKET_BOUNDS;
+
+static void test_scheduler_spin_until(int64_t t)
+{
+  while (esp_timer_get_time() < t)
+  {
+  }
+}
+
+static unsigned int test_scheduler_bucket(int64_t jitter_us)
+{
+  unsigned int bucket = 0;
+  while (bucket < SCHEDULER_JITTER_BUCKETS - 1 && jitter_us > jitter_bounds[bucket])
+  {
+    bucket++;
+  }
+  return bucket;
+}
+
+TEST_CASE("scheduler keeps columns on the grid", "[scheduler]")
+{
+  struct column_scheduler scheduler;
+  unsigned int histogram[SCHEDULER_JITTER_BUCKETS] = {};
+  int64_t total_jitter_us = 0;
+  int64_t max_jitter_us = 0;
+  unsigned int columns = 0;
+  unsigned int resyncs = 0;
+
+  scheduler_init();
+  scheduler_start(&scheduler, TEST_PERIOD_US);
+  int64_t t_grid = scheduler.t_start;
+  unsigned int column = 0;
+  for (unsigned int i = 0; i < TEST_COLUMNS; i++)
+  {
+    char message[32];
+    snprintf(message, sizeof(message), "column %u", i);
+
+    int64_t t = scheduler_wait(&scheduler);
+    if (scheduler.stats.resyncs != resyncs)
+    {
+      // The host preempted the test for a whole column: the grid starts over from here
+      resyncs = scheduler.stats.resyncs;
+      t_grid = t;
+      column = 0;
+    }
+    else
+    {
+      // Never early
+      int64_t deadline = t_grid + (int64_t)++column * TEST_PERIOD_US;
+      TEST_ASSERT_TRUE_MESSAGE(t >= deadline, message);
+      histogram[test_scheduler_bucket(t - deadline)]++;
+      total_jitter_us += t - deadline;
+      max_jitter_us = t - deadline > max_jitter_us ? t - deadline : max_jitter_us;
+      columns++;
+    }
+    TEST_ASSERT_TRUE_MESSAGE(scheduler.t_start == t_grid, message);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(column, scheduler.column, message);
+
+    test_scheduler_spin_until(t + TEST_WORK_US);
+  }
+
+  // Every column played on the grid is counted once, in the bucket of its lateness
+  TEST_ASSERT_EQUAL_UINT(columns, scheduler.stats.columns);
+  TEST_ASSERT_EQUAL_UINT_ARRAY(histogram, scheduler.stats.histogram, SCHEDULER_JITTER_BUCKETS);
+  TEST_ASSERT_TRUE(scheduler.stats.total_jitter_us == total_jitter_us);
+  TEST_ASSERT_TRUE(scheduler.stats.max_jitter_us == max_jitter_us);
+
+  // The work done after each column has not pushed the grid back: a scheduler waiting a period from the end
+  // of the work would be TEST_WORK_US late on every column, and resync every few columns
+  TEST_ASSERT_TRUE(resyncs <= TEST_COLUMNS / 50);
+  TEST_ASSERT_TRUE(total_jitter_us / columns < TEST_WORK_US / 4);
+  printf("scheduler, %u columns of %u us: mean lateness %lld us, max %lld us, %u resyncs\n", TEST_COLUMNS,
+         TEST_PERIOD_US, (long long)(total_jitter_us / columns), (long long)max_jitter_us, resyncs);
+}
+
+TEST_CASE("scheduler plays a late column at once and catches up with the grid", "[scheduler]")
+{
+  struct column_scheduler scheduler;
+
+  scheduler_start(&scheduler, TEST_LATE_PERIOD_US);
+  int64_t t_start = scheduler.t_start;
+
+  // Half a column late: played at once, counted as late as it is
+  test_scheduler_spin_until(t_start + TEST_LATE_PERIOD_US * 3 / 2);
+  int64_t t = scheduler_wait(&scheduler);
+  TEST_ASSERT_TRUE(t - t_start >= TEST_LATE_PERIOD_US * 3 / 2);
+  TEST_ASSERT_EQUAL_UINT(1, scheduler.stats.columns);
+  TEST_ASSERT_EQUAL_UINT(1, scheduler.stats.histogram[test_scheduler_bucket(t - t_start - TEST_LATE_PERIOD_US)]);
+  TEST_ASSERT_TRUE(scheduler.stats.max_jitter_us >= TEST_LATE_PERIOD_US / 2);
+
+  // The next one is due on the grid still, not a period after the late one
+  t = scheduler_wait(&scheduler);
+  TEST_ASSERT_TRUE(t >= t_start + 2 * TEST_LATE_PERIOD_US);
+  TEST_ASSERT_TRUE(t < t_start + 3 * TEST_LATE_PERIOD_US);
+  TEST_ASSERT_EQUAL_UINT(0, scheduler.stats.resyncs);
+  TEST_ASSERT_EQUAL_UINT(2, scheduler.stats.columns);
+}
+
+TEST_CASE("scheduler restarts the grid a whole column late", "[scheduler]")
+{
+  struct column_scheduler scheduler;
+
+  scheduler_start(&scheduler, TEST_LATE_PERIOD_US);
+  int64_t t_start = scheduler.t_start;
+
+  // Three columns missed: not played back to back, the grid starts over
+  test_scheduler_spin_until(t_start + 4 * TEST_LATE_PERIOD_US);
+  int64_t t = scheduler_wait(&scheduler);
+  TEST_ASSERT_EQUAL_UINT(1, scheduler.stats.resyncs);
+  TEST_ASSERT_EQUAL_UINT(0, scheduler.stats.columns);
+  TEST_ASSERT_TRUE(scheduler.t_start == t);
+  TEST_ASSERT_EQUAL_UINT(0, scheduler.column);
+
+  // Then a column per period from there
+  for (unsigned int column = 1; column <= 3; column++)
+  {
+    int64_t deadline = t + (int64_t)column * TEST_LATE_PERIOD_US;
+    int64_t t_column = scheduler_wait(&scheduler);
+    TEST_ASSERT_TRUE(t_column >= deadline);
+    TEST_ASSERT_TRUE(t_column < deadline + TEST_LATE_PERIOD_US);
+  }
+  TEST_ASSERT_EQUAL_UINT(1, scheduler.stats.resyncs);
+  TEST_ASSERT_EQUAL_UINT(3, scheduler.stats.columns);
+}
@@ -0,0 +1,284 @@
+#include "bmp.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define BMP_BI_RGB 0
+#define BMP_BI_BITFIELDS 3
+// Colour masks follow the info header of BI_BITFIELDS files
+#define BMP_MASKS_BYTES 12
+#define BMP_HEADER_BYTES (sizeof(FILEHEADER) + sizeof(INFOHEADER))
+
+enum bmp_reader_state
+{
+  BMP_HEADER,
+  BMP_GAP, // up to the pixels
+  BMP_PIXELS,
+  BMP_DONE,
+  BMP_FAILED
+};
+
+static const char *TAG = "pixelstick-bmp";
+
+// Gamma corrected level of each 8-bit value, as in the app
+static const uint8_t gamma8[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2,
+  2, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 5, 5, 5,
+  5, 6, 6, 6, 6, 7, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10,
+  10, 10, 11, 11, 11, 12, 12, 13, 13, 13, 14, 14, 15, 15, 16, 16,
+  17, 17, 18, 18, 19, 19, 20, 20, 21, 21, 22, 22, 23, 24, 24, 25,
+  25, 26, 27, 27, 28, 29, 29, 30, 31, 32, 32, 33, 34, 35, 35, 36,
+  37, 38, 39, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 50,
+  51, 52, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 66, 67, 68,
+  69, 70, 72, 73, 74, 75, 77, 78, 79, 81, 82, 83, 85, 86, 87, 89,
+  90, 92, 93, 95, 96, 98, 99, 101, 102, 104, 105, 107, 109, 110, 112, 114,
+  115, 117, 119, 120, 122, 124, 126, 127, 129, 131, 133, 135, 137, 138, 140, 142,
+  144, 146, 148, 150, 152, 154, 156, 158, 160, 162, 164, 167, 169, 171, 173, 175,
+  177, 180, 182, 184, 186, 189, 191, 193, 196, 198, 200, 203, 205, 208, 210, 213,
+  215, 218, 220, 223, 225, 228, 231, 233, 236, 239, 241, 244, 247, 249, 252, 255,
+};
+
+static struct
+{
+  enum bmp_reader_state state;
+  struct column_store_image image;
+  uint8_t header[BMP_HEADER_BYTES + BMP_MASKS_BYTES];
+  size_t header_bytes; // needed before the state can move on
+  size_t received;     // bytes of the file so far
+  size_t data_offset;
+  unsigned int width;
+  unsigned int height;
+  unsigned int pixel_bytes;
+  size_t stride; // rows are padded to 4 bytes
+  bool bottom_up;
+  unsigned int band_rows;
+  unsigned int row; // first row of the band, in file order
+  size_t band_fill;
+} reader;
+
+// The band being received, and the pieces of the columns of a tile
+static uint8_t band[BMP_BAND_BYTES];
+static uint8_t tile[BMP_TILE_COLUMNS][COLUMN_BYTES];
+
+static struct bmp_stats stats;
+
+// First LED showing a row of the image, counted from the top
+static unsigned int first_pixel(unsigned int top_row)
+{
+  return ((uint64_t)top_row * LED_COUNT + reader.height - 1) / reader.height;
+}
+
+static bool bmp_parse_header(void)
+{
+  FILEHEADER file;
+  INFOHEADER info;
+  memcpy(&file, reader.header, sizeof(file));
+  memcpy(&info, reader.header + sizeof(file), sizeof(info));
+
+  if (file.fileMarker1 != 'B' || file.fileMarker2 != 'M' || info.biSize < sizeof(info) || info.planes != 1 ||
+      info.width <= 0 || info.height == 0 || info.height == INT32_MIN)
+  {
+    ESP_LOGE(TAG, "not a BMP file");
+    return false;
+  }
+  if (!(info.bitPix == 24 && info.biCompression == BMP_BI_RGB) &&
+      !(info.bitPix == 32 && (info.biCompression == BMP_BI_RGB || info.biCompression == BMP_BI_BITFIELDS)))
+  {
+    ESP_LOGE(TAG, "%u bits per pixel, compression %u: only 24 and 32-bit BGR files are taken",
+             info.bitPix, info.biCompression);
+    return false;
+  }
+  if (info.biCompression == BMP_BI_BITFIELDS)
+  {
+    uint32_t masks[3];
+    memcpy(masks, reader.header + BMP_HEADER_BYTES, sizeof(masks));
+    if (masks[0] != 0xff0000 || masks[1] != 0xff00 || masks[2] != 0xff)
+    {
+      ESP_LOGE(TAG, "only BGR bit fields are taken");
+      return false;
+    }
+  }
+
+  reader.data_offset = file.imageDataOffset;
+  reader.width = info.width;
+  reader.bottom_up = info.height > 0;
+  reader.height = reader.bottom_up ? info.height : -info.height;
+  reader.pixel_bytes = info.bitPix / 8;
+  // A band holds at least one row; the stride of wider ones may not even fit in a size_t
+  if (reader.width > BMP_BAND_BYTES / reader.pixel_bytes)
+  {
+    ESP_LOGE(TAG, "a %u pixels wide file does not fit in a band", reader.width);
+    return false;
+  }
+  reader.stride = ((size_t)reader.width * reader.pixel_bytes + 3) / 4 * 4;
+  reader.band_rows = BMP_BAND_BYTES / reader.stride;
+  if (reader.data_offset < reader.header_bytes || reader.band_rows == 0)
+  {
+    ESP_LOGE(TAG, "cannot read a %ux%u file", reader.width, reader.height);
+    return false;
+  }
+
+  stats.width = reader.width;
+  stats.height = reader.height;
+  reader.image.columns = reader.width;
+  return column_store_begin(&reader.image);
+}
+
+// Writes the pieces of every column shown by rows [reader.row, reader.row + rows) of the file
+static bool bmp_transpose(const uint8_t *rows_data, unsigned int rows)
+{
+  int64_t t_begin = esp_timer_get_time();
+
+  // Rows of the band counted from the top of the image
+  unsigned int top = reader.bottom_up ? reader.height - reader.row - rows : reader.row;
+  unsigned int y_begin = first_pixel(top);
+  unsigned int y_end = first_pixel(top + rows);
+
+  for (unsigned int x_begin = 0; x_begin < reader.width && y_begin < y_end; x_begin += BMP_TILE_COLUMNS)
+  {
+    unsigned int columns = reader.width - x_begin < BMP_TILE_COLUMNS ? reader.width - x_begin : BMP_TILE_COLUMNS;
+
+    // Along each row, into the tile's columns
+    for (unsigned int y = y_begin; y < y_end; y++)
+    {
+      unsigned int row = (unsigned int)((uint64_t)y * reader.height / LED_COUNT) - top;
+      if (reader.bottom_up)
+      {
+        row = rows - 1 - row;
+      }
+      const uint8_t *bgr = rows_data + row * reader.stride + x_begin * reader.pixel_bytes;
+      unsigned int offset = (y - y_begin) * 3;
+
+      for (unsigned int c = 0; c < columns; c++, bgr += reader.pixel_bytes)
+      {
+        tile[c][offset] = gamma8[bgr[1]];
+        tile[c][offset + 1] = gamma8[bgr[2]];
+        tile[c][offset + 2] = gamma8[bgr[0]];
+      }
+    }
+
+    for (unsigned int c = 0; c < columns; c++)
+    {
+      if (!column_store_put(x_begin + c, y_begin, tile[c], y_end - y_begin))
+      {
+        ESP_LOGE(TAG, "cannot store column %u", x_begin + c);
+        return false;
+      }
+    }
+  }
+
+  reader.row += rows;
+  stats.bands++;
+  stats.transpose_us += esp_timer_get_time() - t_begin;
+  return true;
+}
+
+void bmp_reader_begin(const struct column_store_image *image)
+{
+  memset(&reader, 0, sizeof(reader));
+  memset(&stats, 0, sizeof(stats));
+  reader.image = *image;
+  reader.image.format = BMP_UPLOAD_FORMAT;
+  reader.header_bytes = BMP_HEADER_BYTES;
+  reader.state = BMP_HEADER;
+}
+
+bool bmp_reader_feed(const uint8_t *data, size_t len)
+{
+  while (len > 0 && reader.state != BMP_DONE && reader.state != BMP_FAILED)
+  {
+    size_t n;
+
+    switch (reader.state)
+    {
+    case BMP_HEADER:
+      n = reader.header_bytes - reader.received;
+      n = n < len ? n : len;
+      memcpy(reader.header + reader.received, data, n);
+      reader.received += n;
+      if (reader.received == reader.header_bytes)
+      {
+        INFOHEADER info;
+        memcpy(&info, reader.header + sizeof(FILEHEADER), sizeof(info));
+        if (reader.header_bytes == BMP_HEADER_BYTES && info.biCompression == BMP_BI_BITFIELDS)
+        {
+          reader.header_bytes += BMP_MASKS_BYTES;
+        }
+        else
+        {
+          reader.state = bmp_parse_header() ? BMP_GAP : BMP_FAILED;
+        }
+      }
+      break;
+
+    case BMP_GAP:
+      n = reader.data_offset - reader.received;
+      n = n < len ? n : len;
+      reader.received += n;
+      if (reader.received == reader.data_offset)
+      {
+        reader.state = BMP_PIXELS;
+      }
+      break;
+
+    default:
+    {
+      unsigned int rows = reader.height - reader.row < reader.band_rows ? reader.height - reader.row : reader.band_rows;
+      size_t band_bytes = rows * reader.stride;
+
+      if (reader.band_fill == 0 && len >= band_bytes)
+      {
+        // A whole band is there already
+        n = band_bytes;
+        if (!bmp_transpose(data, rows))
+        {
+          reader.state = BMP_FAILED;
+        }
+      }
+      else
+      {
+        n = band_bytes - reader.band_fill;
+        n = n < len ? n : len;
+        memcpy(band + reader.band_fill, data, n);
+        reader.band_fill += n;
+        if (reader.band_fill == band_bytes)
+        {
+          reader.band_fill = 0;
+          if (!bmp_transpose(band, rows))
+          {
+            reader.state = BMP_FAILED;
+          }
+        }
+      }
+      reader.received += n;
+      if (reader.state != BMP_FAILED && reader.row == reader.height)
+      {
+        reader.state = BMP_DONE;
+      }
+      break;
+    }
+    }
+
+    data += n;
+    len -= n;
+  }
+  return reader.state != BMP_FAILED;
+}
+
+bool bmp_reader_end(void)
+{
+  if (reader.state != BMP_DONE)
+  {
+    ESP_LOGE(TAG, "file ended at row %u of %u", reader.row, reader.height);
+    return false;
+  }
+  return true;
+}
+
+void bmp_get_stats(struct bmp_stats *s)
+{
+  *s = stats;
+}
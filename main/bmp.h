@@ -1,3 +1,31 @@
+#ifndef __BMP_H_
+#define __BMP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "column_store.h"
+
+/*
+ * Uploads of BMP files to the library (see column_store.h), for images
+ * that were not prepared by the app. The file is row-major and usually
+ * bottom-up, the strip wants columns, so rows are collected in bands that
+ * fit in internal RAM and each band is transposed a tile of columns at a
+ * time, then written to the upload's columns in flash. Rows are scaled to
+ * the strip by picking the nearest one, top row on the first LED, and
+ * colours are gamma corrected like the app does.
+ *
+ * Takes 24-bit files, and 32-bit ones whose fourth byte is ignored.
+ */
+
+// STORE_BEGIN format of an upload of a BMP file rather than columns
+#define BMP_UPLOAD_FORMAT 0x80
+// Rows transposed together, at least one whole row
+#define BMP_BAND_BYTES (16 * 1024)
+// Columns transposed together: one source pixel is read after the other
+// along the row, and each lands in one of these columns
+#define BMP_TILE_COLUMNS 16
+
 typedef struct __attribute__((__packed__))
 {
   unsigned char fileMarker1;
@@ -28,4 +56,25 @@ typedef struct __attribute__((__packed__))
   unsigned char b;
   unsigned char g;
   unsigned char r;
-} IMAGE;
\ No newline at end of file
+} IMAGE;
+
+struct bmp_stats
+{
+  unsigned int width;
+  unsigned int height;
+  unsigned int bands;
+  unsigned int transpose_us;
+};
+
+// Starts the upload of a file as image, whose columns are the file's width
+void bmp_reader_begin(const struct column_store_image *image);
+// Takes the next bytes of the file. A file already in memory, e.g. mapped
+// from flash, can be given in one call: whole bands are then transposed in
+// place. Returns false once the upload failed.
+bool bmp_reader_feed(const uint8_t *data, size_t len);
+// Whether every row was stored, the upload is then ready to be committed
+bool bmp_reader_end(void);
+
+void bmp_get_stats(struct bmp_stats *stats);
+
+#endif
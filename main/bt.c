@@ -1,364 +1,643 @@
 #include "bt.h"
-
-#include "nvs.h"
-#include "nvs_flash.h"
-
-#include "esp_bt.h"
-#include "esp_bt_main.h"
-#include "esp_gap_bt_api.h"
-#include "esp_bt_device.h"
-#include "esp_spp_api.h"
-
-#include "time.h"
-#include "sys/time.h"
+#include "bt_transport.h"
 #include "led.h"
+#include "column_ring.h"
+#include "column_codec.h"
+#include "lzss.h"
+#include "pixel_format.h"
+#include "column_cache.h"
+#include "column_store.h"
+#include "bmp.h"
+
+#include <stdatomic.h>
+#include <freertos/task.h>
+#include "esp_timer.h"
 
 #define SPP_TAG "SPP"
-#define SPP_SERVER_NAME "SPP_PIXELSTICK_SERVER"
-#define EXAMPLE_DEVICE_NAME "🚥 Pixelstick 🚥"
 
-static const esp_spp_mode_t esp_spp_mode = ESP_SPP_MODE_CB;
-
-static const esp_spp_sec_t sec_mask = ESP_SPP_SEC_AUTHENTICATE;
-static const esp_spp_role_t role_slave = ESP_SPP_ROLE_SLAVE;
+static QueueHandle_t led_event_queue;
+static int conn_handle;
+// Protocol version of the app, from its HELLO; speeds are a u16 from version 1 on, a u8 before
+static unsigned int app_version;
+// The column ring is claimed for our animation, whose columns are taken
+static bool streaming;
+
+/*
+ * Outbound messages are sent by bt_tx_task, one write at a time, and held
+ * back while the transport reports congestion, so neither the LED task nor
+ * the stack's callbacks ever wait on the link. Since ACKs carry a cumulative
+ * column limit, pending ACKs coalesce into a single slot holding the latest
+ * limit; other replies go through a short queue.
+ */
+
+#define TX_QUEUE_LENGTH 4
+#define TX_FRAME_MAX (5 + BT_CAPABILITIES_LEN)
+
+struct bt_tx_frame
+{
+    unsigned int len;
+    uint8_t data[TX_FRAME_MAX];
+};
+
+static TaskHandle_t tx_task;
+static QueueHandle_t tx_queue;
+static atomic_uint ack_pending;      // Latest unsent limit, 0 if none
+static atomic_uint ack_requested_us; // When the oldest unsent limit was requested
+static volatile bool tx_connected;
+static volatile bool tx_in_flight;
+static volatile bool tx_congested;
+static bool tx_in_flight_ack;
+static uint32_t tx_in_flight_requested_us;
+static struct bt_tx_stats tx_stats;
+
+static void bt_frame_start(struct bt_tx_frame *frame, uint8_t header)
+{
+    memset(frame->data, 0, 4);
+    frame->data[4] = header;
+    frame->len = 5;
+}
 
-static char *bda2str(uint8_t *bda, char *str, size_t size)
+// Appends a little-endian field to the payload
+static void bt_frame_put(struct bt_tx_frame *frame, uint32_t value, unsigned int bytes)
 {
-    if (bda == NULL || str == NULL || size < 18)
+    for (unsigned int i = 0; i < bytes; i++)
     {
-        return NULL;
+        frame->data[frame->len++] = value >> (8 * i);
     }
 
-    uint8_t *p = bda;
-    sprintf(str, "%02x:%02x:%02x:%02x:%02x:%02x",
-            p[0], p[1], p[2], p[3], p[4], p[5]);
-    return str;
+    uint32_t length = frame->len - 5;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        frame->data[i] = length >> (8 * i);
+    }
 }
 
-static QueueHandle_t led_event_queue;
-static int conn_handle;
+// Reads a little-endian field of a frame
+static uint64_t bt_get(const unsigned char *p, unsigned int bytes)
+{
+    uint64_t value = 0;
 
-void bt_ack(unsigned int v)
+    for (unsigned int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+// Reply to a HELLO from an app that speaks BT_PROTOCOL_VERSION or later
+static void bt_capabilities(struct bt_tx_frame *frame)
 {
-    uint8_t response_ack[9];
-    unsigned int length = 4;
-    memcpy(response_ack, &length, sizeof(unsigned int));
-    response_ack[4] = MSG_HEADER_PIXEL_ACK;
-    unsigned int *ptr = (void *)&response_ack[5];
-    *ptr = v;
-    ESP_LOGI(SPP_TAG, "ACK %d", v);
-    esp_spp_write(conn_handle, 9, response_ack);
+    bt_frame_start(frame, MSG_HEADER_PIXEL_COUNT);
+    bt_frame_put(frame, LED_COUNT, 4);
+    bt_frame_put(frame, BT_PROTOCOL_VERSION, 1);
+    bt_frame_put(frame, (1 << PIXEL_FORMAT_COUNT) - 1, 1);
+    bt_frame_put(frame,
+                 1 << MSG_HEADER_HELLO | 1 << MSG_HEADER_PIXEL_DATA | 1 << MSG_HEADER_PIXEL_BEGIN |
+                     1 << MSG_HEADER_PIXEL_END | 1 << MSG_HEADER_PIXEL_CODED | 1 << MSG_HEADER_PIXEL_LZ |
+                     1 << MSG_HEADER_PIXEL_PALETTE | 1 << MSG_HEADER_PIXEL_CACHED |
+                     (column_store_capacity() > 0
+                          ? 1 << MSG_HEADER_STORE_BEGIN | 1 << MSG_HEADER_STORE_PLAY | 1 << MSG_HEADER_STORE_QUERY |
+                                1 << MSG_HEADER_STORE_FILE
+                          : 0),
+                 2);
+    bt_frame_put(frame, COLUMN_RING_SLOTS, 2);
+    bt_frame_put(frame, led_max_column_rate(), 2);
+    bt_frame_put(frame, BT_MAX_FRAME_BYTES, 4);
+    bt_frame_put(frame, column_store_capacity(), 4);
 }
 
-void bt_recv(int bt_handle, int frame_len, unsigned char *frame)
+static void bt_tx_kick(void)
 {
-    struct message led_event;
+    if (tx_task)
+    {
+        xTaskNotifyGive(tx_task);
+    }
+}
 
-    if (frame[0] == MSG_HEADER_HELLO)
+static void bt_tx_flush(void)
+{
+    struct bt_tx_frame frame;
+
+    if (!tx_connected || tx_in_flight || tx_congested)
     {
-        uint8_t response[9];
-        unsigned int length = 4;
-        memcpy(response, &length, sizeof(unsigned int));
-        response[4] = MSG_HEADER_PIXEL_COUNT;
-        unsigned int n_leds = LED_COUNT;
-        memcpy(&response[5], &n_leds, sizeof(unsigned int));
-        esp_spp_write(bt_handle, 9, response);
+        return;
     }
-    else if (frame[0] == MSG_HEADER_PIXEL_BEGIN)
+
+    if (xQueueReceive(tx_queue, &frame, 0) == pdTRUE)
     {
-        led_event.type = ANIMATE_BEGIN;
-        led_event.animation_speed = frame[1];
-        xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
+        tx_in_flight_ack = false;
     }
-    else if (frame[0] == MSG_HEADER_PIXEL_DATA)
+    else
     {
-        led_event.type = ANIMATE;
-        int len = frame_len - 1;
-        led_event.http_animation.buffer = malloc(len);
-        led_event.http_animation.width = len / (LED_COUNT * 3);
+        unsigned int limit = atomic_exchange(&ack_pending, 0);
+        if (limit == 0)
+        {
+            return;
+        }
+        bt_frame_start(&frame, MSG_HEADER_PIXEL_ACK);
+        bt_frame_put(&frame, limit, 4);
+        tx_in_flight_ack = true;
+        tx_in_flight_requested_us = atomic_load(&ack_requested_us);
+        tx_stats.acks_sent++;
+        ESP_LOGD(SPP_TAG, "ACK %u", limit);
+    }
 
-        memcpy(led_event.http_animation.buffer, (char *)&frame[1], len);
+    tx_in_flight = true;
+    bt_transport_write(conn_handle, frame.len, frame.data);
+}
 
-        xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
-    }
-    else if (frame[0] == MSG_HEADER_PIXEL_END)
+static void bt_tx_task(void *arg)
+{
+    while (true)
     {
-        led_event.type = ANIMATE_END,
-        led_event.animate_end_aborted = frame[1];
-        xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bt_tx_flush();
     }
 }
 
-#define MAX_RECV_BUFFER 4000
-
-static unsigned char receive_buffer[MAX_RECV_BUFFER];
-static int receive_buffer_position = 0;
-
-void bt_loop_frames(int bt_handle) {
-    int position = 0;
-
-    while (position + 4 <= receive_buffer_position) {
-        unsigned int frame_length = *((unsigned int*) &receive_buffer[position]);
-
-        if (position + 4 + 1 + frame_length <= receive_buffer_position) {
-            /* printf("FRAME: %d\n", frame_length); */
-            bt_recv(bt_handle, 1 + frame_length, &receive_buffer[position + 4]);
-            position = position + 4 + 1 + frame_length;
-        } else {
-            /* printf("WAITING: %d => %d (%d)\n", position, position + 4 + 1 + frame_length, receive_buffer_position); */
-            break;
+void bt_write_done(void)
+{
+    if (tx_in_flight_ack)
+    {
+        int64_t latency_us = (uint32_t)esp_timer_get_time() - tx_in_flight_requested_us;
+        tx_stats.total_ack_latency_us += latency_us;
+        if (latency_us > tx_stats.max_ack_latency_us)
+        {
+            tx_stats.max_ack_latency_us = latency_us;
         }
+        tx_in_flight_ack = false;
     }
+    tx_in_flight = false;
+    bt_tx_kick();
+}
 
-    if (position > 0) {
-        memmove(receive_buffer, &receive_buffer[position], receive_buffer_position - position);
-        receive_buffer_position = receive_buffer_position - position;
+void bt_congestion(bool congested)
+{
+    if (congested && !tx_congested)
+    {
+        tx_stats.congestions++;
+    }
+    tx_congested = congested;
+    if (!congested)
+    {
+        bt_tx_kick();
     }
 }
 
-void bt_handle(int bt_handle, int packet_len, unsigned char *packet) {
+void bt_ack(unsigned int v)
+{
+    tx_stats.acks_requested++;
+    if (atomic_exchange(&ack_pending, v) == 0)
+    {
+        atomic_store(&ack_requested_us, (uint32_t)esp_timer_get_time());
+    }
+    bt_tx_kick();
+}
 
-    if (receive_buffer_position + packet_len > MAX_RECV_BUFFER) {
-        ESP_LOGE(SPP_TAG, "receive buffer overrun %d", receive_buffer_position);
-        return;
-    } 
-    
-    memcpy(&receive_buffer[receive_buffer_position], packet, packet_len);
-    receive_buffer_position += packet_len;
-    
-    bt_loop_frames(bt_handle);
+void bt_get_tx_stats(struct bt_tx_stats *stats)
+{
+    *stats = tx_stats;
 }
 
-static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+void bt_recv(int bt_handle, int frame_len, unsigned char *frame)
 {
-    char bda_str[18] = {0};
     struct message led_event;
 
-    switch (event)
+    if (frame[0] == MSG_HEADER_HELLO)
     {
-    case ESP_SPP_INIT_EVT:
-        if (param->init.status == ESP_SPP_SUCCESS)
+        struct bt_tx_frame response;
+        // Older apps send an empty HELLO and only expect the LED count
+        app_version = frame_len > 1 ? frame[1] : 0;
+        if (app_version >= BT_PROTOCOL_VERSION)
         {
-            ESP_LOGI(SPP_TAG, "ESP_SPP_INIT_EVT");
-            esp_spp_start_srv(sec_mask, role_slave, 0, SPP_SERVER_NAME);
+            bt_capabilities(&response);
         }
         else
         {
-            ESP_LOGE(SPP_TAG, "ESP_SPP_INIT_EVT status:%d", param->init.status);
+            bt_frame_start(&response, MSG_HEADER_PIXEL_COUNT);
+            bt_frame_put(&response, LED_COUNT, 4);
         }
-        break;
-    case ESP_SPP_DISCOVERY_COMP_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_DISCOVERY_COMP_EVT");
-        break;
-    case ESP_SPP_OPEN_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_OPEN_EVT");
-        break;
-    case ESP_SPP_CLOSE_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_CLOSE_EVT status:%d handle:%d close_by_remote:%d", param->close.status,
-                 (int)param->close.handle, param->close.async);
-
-        led_event.type = WIFI_DISCONNECTED;
-        xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
+        xQueueSend(tx_queue, &response, 0);
+        bt_tx_kick();
+    }
+    else if (frame[0] == MSG_HEADER_PIXEL_BEGIN || frame[0] == MSG_HEADER_STORE_BEGIN)
+    {
+        int speed_bytes = app_version >= 1 ? 2 : 1;
+        int format_at = 1 + speed_bytes;
 
-        break;
-    case ESP_SPP_START_EVT:
-        if (param->start.status == ESP_SPP_SUCCESS)
+        // The pixel format and the ring are the streaming transport's
+        streaming = column_ring_claim(SOURCE_BT);
+        if (!streaming)
         {
-            ESP_LOGI(SPP_TAG, "ESP_SPP_START_EVT handle:%d sec_id:%d scn:%d", (int)param->start.handle, param->start.sec_id,
-                     param->start.scn);
-            esp_bt_dev_set_device_name(EXAMPLE_DEVICE_NAME);
-            esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
+            ESP_LOGW(SPP_TAG, "another transport is streaming, animation ignored");
+            return;
+        }
+
+        struct animate_begin_block begin = {
+            .animation_speed = frame_len > speed_bytes ? bt_get(&frame[1], speed_bytes) : 0,
+            .first_column = column_ring_count(),
+            .source = SOURCE_BT,
+        };
+        if (frame[0] == MSG_HEADER_STORE_BEGIN)
+        {
+            led_event.type = STORE_BEGIN;
+            led_event.store_begin.begin = begin;
+            led_event.store_begin.format = frame_len > format_at ? frame[format_at] : PIXEL_FORMAT_RGB888;
+            led_event.store_begin.hash = frame_len >= format_at + 9 ? bt_get(&frame[format_at + 1], 8) : 0;
+            led_event.store_begin.columns = frame_len >= format_at + 13 ? bt_get(&frame[format_at + 9], 4) : 0;
         }
         else
         {
-            ESP_LOGE(SPP_TAG, "ESP_SPP_START_EVT status:%d", param->start.status);
+            led_event.type = ANIMATE_BEGIN;
+            led_event.animate_begin = begin;
         }
-        break;
-    case ESP_SPP_CL_INIT_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_CL_INIT_EVT");
-        break;
-    case ESP_SPP_DATA_IND_EVT:
-        /*
-         * We only show the data in which the data length is less than 128 here. If you want to print the data and
-         * the data rate is high, it is strongly recommended to process them in other lower priority application task
-         * rather than in this callback directly. Since the printing takes too much time, it may stuck the Bluetooth
-         * stack and also have a effect on the throughput!
-         */
-        ESP_LOGI(SPP_TAG, "ESP_SPP_DATA_IND_EVT len:%d handle:%d",
-                 param->data_ind.len, (int)param->data_ind.handle);
-        if (param->data_ind.len < 128)
+        if (led_event.type == STORE_BEGIN && led_event.store_begin.format == BMP_UPLOAD_FORMAT)
         {
-            esp_log_buffer_hex("", param->data_ind.data, param->data_ind.len);
+            // The file comes in STORE_FILE chunks, read by the LED task
         }
-
-        bt_handle(param->data_ind.handle, param->data_ind.len, param->data_ind.data);
-        break;
-    case ESP_SPP_CONG_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_CONG_EVT");
-        break;
-    case ESP_SPP_WRITE_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_WRITE_EVT");
-        break;
-    case ESP_SPP_SRV_OPEN_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_SRV_OPEN_EVT status:%d handle:%d, rem_bda:[%s]", (int)param->srv_open.status,
-                 (int)param->srv_open.handle, bda2str(param->srv_open.rem_bda, bda_str, sizeof(bda_str)));
-
-        conn_handle = param->srv_open.handle;
-
-        led_event.type = WIFI_CONNECTED;
+        else if (!pixel_format_set(frame_len > format_at ? frame[format_at] : PIXEL_FORMAT_RGB888))
+        {
+            ESP_LOGE(SPP_TAG, "unknown pixel format %d", frame[format_at]);
+        }
+        column_decoder_reset();
+        lzss_reset(column_decoder_feed);
+        column_cache_reset();
+        memset(&tx_stats, 0, sizeof(tx_stats));
         xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
+    }
+    else if (frame[0] == MSG_HEADER_STORE_PLAY)
+    {
+        int speed_bytes = app_version >= 1 ? 2 : 1;
+        led_event.type = STORE_PLAY;
+        led_event.store_play.animation_speed = frame_len > speed_bytes ? bt_get(&frame[1], speed_bytes) : 0;
+        led_event.store_play.by_hash = frame_len >= 1 + speed_bytes + 8;
+        led_event.store_play.hash = led_event.store_play.by_hash ? bt_get(&frame[1 + speed_bytes], 8) : 0;
+        xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
+    }
+    else if (frame[0] == MSG_HEADER_STORE_QUERY)
+    {
+        struct column_store_image image = {0};
+        unsigned int index = 0;
+        bool found;
+        if (frame_len >= 9)
+        {
+            image.hash = bt_get(&frame[1], 8);
+            found = column_store_find(image.hash, &image, &index);
+        }
+        else
+        {
+            index = frame_len > 1 ? frame[1] : 0;
+            found = column_store_get(index, &image);
+        }
 
-        break;
-    case ESP_SPP_SRV_STOP_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_SRV_STOP_EVT");
-        break;
-    case ESP_SPP_UNINIT_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_SPP_UNINIT_EVT");
-        break;
-    default:
-        break;
+        struct bt_tx_frame response;
+        bt_frame_start(&response, MSG_HEADER_STORE_ENTRY);
+        bt_frame_put(&response, column_store_count(), 1);
+        bt_frame_put(&response, found ? index : 0xff, 1);
+        bt_frame_put(&response, (uint32_t)image.hash, 4);
+        bt_frame_put(&response, (uint32_t)(image.hash >> 32), 4);
+        bt_frame_put(&response, found ? image.columns : 0, 4);
+        bt_frame_put(&response, found ? image.speed : 0, app_version >= 1 ? 2 : 1);
+        bt_frame_put(&response, found ? image.format : 0, 1);
+        xQueueSend(tx_queue, &response, 0);
+        bt_tx_kick();
+    }
+    else if (frame[0] == MSG_HEADER_PIXEL_END)
+    {
+        if (!streaming)
+        {
+            return;
+        }
+        led_event.type = ANIMATE_END;
+        led_event.animate_end.aborted = frame[1];
+        led_event.animate_end.source = SOURCE_BT;
+        xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
+        streaming = false;
+        column_ring_unclaim(SOURCE_BT);
     }
 }
 
-void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
+/*
+ * Frames are parsed incrementally, straight from the transport's packets:
+ * u32 payload length, header byte, payload. Pixel data is streamed into the
+ * column ring as it arrives, so frames can be of any size and span any
+ * number of packets. Other payloads are short and collected in `control`.
+ */
+
+#define MAX_CONTROL_PAYLOAD 16
+
+enum frame_state
 {
-    char bda_str[18] = {0};
+    FRAME_LENGTH,
+    FRAME_HEADER,
+    FRAME_PAYLOAD
+};
 
-    switch (event)
-    {
-    case ESP_BT_GAP_AUTH_CMPL_EVT:
+static struct
+{
+    enum frame_state state;
+    uint32_t length;
+    uint32_t received;
+    bool skip;                                      // columns of an animation we could not begin
+    unsigned char control[1 + MAX_CONTROL_PAYLOAD]; // header, then payload
+    uint8_t *column;                                // ring slot being filled, NULL while dropping a column
+    unsigned int column_received;
+    uint8_t packed[COLUMN_BYTES];                   // column being received, unless it is RGB888
+} parser;
+
+static void bt_parser_reset(void)
+{
+    parser.state = FRAME_LENGTH;
+    parser.length = 0;
+    parser.received = 0;
+    parser.column_received = 0;
+}
+
+static void bt_pixel_data(const unsigned char *data, unsigned int len)
+{
+    bool rgb888 = pixel_format_get() == PIXEL_FORMAT_RGB888;
+    unsigned int column_bytes = pixel_format_info()->column_bytes;
+
+    while (len > 0)
     {
-        if (param->auth_cmpl.stat == ESP_BT_STATUS_SUCCESS)
+        if (parser.column_received == 0)
         {
-            ESP_LOGI(SPP_TAG, "authentication success: %s bda:[%s]", param->auth_cmpl.device_name,
-                     bda2str(param->auth_cmpl.bda, bda_str, sizeof(bda_str)));
+            // RGB888 columns go straight into the ring, others are expanded once complete
+            parser.column = rgb888 ? column_ring_acquire() : parser.packed;
+            if (parser.column == NULL)
+            {
+                ESP_LOGE(SPP_TAG, "column ring full, column dropped");
+            }
         }
-        else
+
+        unsigned int n = column_bytes - parser.column_received;
+        if (n > len)
         {
-            ESP_LOGE(SPP_TAG, "authentication failed, status:%d", param->auth_cmpl.stat);
+            n = len;
         }
-        break;
-    }
-    case ESP_BT_GAP_PIN_REQ_EVT:
-    {
-        ESP_LOGI(SPP_TAG, "ESP_BT_GAP_PIN_REQ_EVT min_16_digit:%d", param->pin_req.min_16_digit);
-        if (param->pin_req.min_16_digit)
+        if (parser.column)
         {
-            ESP_LOGI(SPP_TAG, "Input pin code: 0000 0000 0000 0000");
-            esp_bt_pin_code_t pin_code = {0};
-            esp_bt_gap_pin_reply(param->pin_req.bda, true, 16, pin_code);
+            memcpy(parser.column + parser.column_received, data, n);
         }
-        else
+        data += n;
+        len -= n;
+        parser.column_received += n;
+
+        if (parser.column_received == column_bytes)
         {
-            ESP_LOGI(SPP_TAG, "Input pin code: 1234");
-            esp_bt_pin_code_t pin_code;
-            pin_code[0] = '1';
-            pin_code[1] = '2';
-            pin_code[2] = '3';
-            pin_code[3] = '4';
-            esp_bt_gap_pin_reply(param->pin_req.bda, true, 4, pin_code);
+            if (!rgb888)
+            {
+                if (!column_ring_push(parser.packed))
+                {
+                    ESP_LOGE(SPP_TAG, "column ring full, column dropped");
+                }
+            }
+            else if (parser.column)
+            {
+                column_ring_commit_rgb();
+            }
+            parser.column_received = 0;
         }
-        break;
     }
+}
 
-#if (CONFIG_BT_SSP_ENABLED == true)
-    case ESP_BT_GAP_CFM_REQ_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_BT_GAP_CFM_REQ_EVT Please compare the numeric value: %d", (int)param->cfm_req.num_val);
-        esp_bt_gap_ssp_confirm_reply(param->cfm_req.bda, true);
-        break;
-    case ESP_BT_GAP_KEY_NOTIF_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_BT_GAP_KEY_NOTIF_EVT passkey:%d", (int)param->key_notif.passkey);
-        break;
-    case ESP_BT_GAP_KEY_REQ_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_BT_GAP_KEY_REQ_EVT Please enter passkey!");
-        break;
-#endif
-
-    case ESP_BT_GAP_MODE_CHG_EVT:
-        ESP_LOGI(SPP_TAG, "ESP_BT_GAP_MODE_CHG_EVT mode:%d bda:[%s]", param->mode_chg.mode,
-                 bda2str(param->mode_chg.bda, bda_str, sizeof(bda_str)));
-        break;
-
-    default:
+static void bt_file_chunk_end(void)
+{
+    if (parser.column)
     {
-        ESP_LOGI(SPP_TAG, "event: %d", event);
-        break;
-    }
+        column_ring_commit();
     }
-    return;
+    parser.column_received = 0;
 }
 
-void bt_init(QueueHandle_t _led_event_queue)
+// Chunks of an uploaded file go into the ring as they are
+static void bt_file_data(const unsigned char *data, unsigned int len)
 {
+    while (len > 0)
+    {
+        if (parser.column_received == 0)
+        {
+            parser.column = column_ring_acquire();
+            if (parser.column == NULL)
+            {
+                ESP_LOGE(SPP_TAG, "column ring full, file chunk dropped");
+            }
+        }
 
-    led_event_queue = _led_event_queue;
+        unsigned int n = COLUMN_BYTES - parser.column_received;
+        if (n > len)
+        {
+            n = len;
+        }
+        if (parser.column)
+        {
+            memcpy(parser.column + parser.column_received, data, n);
+        }
+        data += n;
+        len -= n;
+        parser.column_received += n;
 
-    char bda_str[18] = {0};
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
-    {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
+        if (parser.column_received == COLUMN_BYTES)
+        {
+            bt_file_chunk_end();
+        }
     }
-    ESP_ERROR_CHECK(ret);
+}
 
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
+// Frames putting columns in the ring
+static bool bt_column_frame(unsigned char header)
+{
+    return header == MSG_HEADER_PIXEL_DATA || header == MSG_HEADER_STORE_FILE || header == MSG_HEADER_PIXEL_CODED ||
+           header == MSG_HEADER_PIXEL_LZ || header == MSG_HEADER_PIXEL_CACHED;
+}
 
-    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-    if ((ret = esp_bt_controller_init(&bt_cfg)) != ESP_OK)
+static void bt_frame_end(int bt_handle)
+{
+    if (parser.skip)
     {
-        ESP_LOGE(SPP_TAG, "%s initialize controller failed: %s\n", __func__, esp_err_to_name(ret));
-        return;
+        // Dropped: another transport streams
     }
-
-    if ((ret = esp_bt_controller_enable(ESP_BT_MODE_CLASSIC_BT)) != ESP_OK)
+    else if (parser.control[0] == MSG_HEADER_PIXEL_DATA)
     {
-        ESP_LOGE(SPP_TAG, "%s enable controller failed: %s\n", __func__, esp_err_to_name(ret));
-        return;
+        if (parser.column_received > 0)
+        {
+            ESP_LOGE(SPP_TAG, "short column: %u bytes", parser.column_received);
+        }
     }
-
-    if ((ret = esp_bluedroid_init()) != ESP_OK)
+    else if (parser.control[0] == MSG_HEADER_STORE_FILE)
     {
-        ESP_LOGE(SPP_TAG, "%s initialize bluedroid failed: %s\n", __func__, esp_err_to_name(ret));
-        return;
+        // Only the last chunk of the file is short
+        if (parser.column_received > 0)
+        {
+            bt_file_chunk_end();
+        }
     }
-
-    if ((ret = esp_bluedroid_enable()) != ESP_OK)
+    else if (parser.control[0] == MSG_HEADER_PIXEL_CODED)
     {
-        ESP_LOGE(SPP_TAG, "%s enable bluedroid failed: %s\n", __func__, esp_err_to_name(ret));
-        return;
+        if (!column_decoder_frame_end())
+        {
+            ESP_LOGE(SPP_TAG, "invalid coded frame");
+        }
     }
-
-    if ((ret = esp_bt_gap_register_callback(esp_bt_gap_cb)) != ESP_OK)
+    else if (parser.control[0] == MSG_HEADER_PIXEL_LZ)
     {
-        ESP_LOGE(SPP_TAG, "%s gap register failed: %s\n", __func__, esp_err_to_name(ret));
-        return;
+        if (!lzss_frame_end() || !column_decoder_frame_end())
+        {
+            ESP_LOGE(SPP_TAG, "invalid compressed frame");
+        }
+    }
+    else if (parser.control[0] == MSG_HEADER_PIXEL_CACHED)
+    {
+        if (!column_cache_frame_end())
+        {
+            ESP_LOGE(SPP_TAG, "invalid cached frame");
+        }
+    }
+    else if (parser.control[0] == MSG_HEADER_PIXEL_PALETTE)
+    {
+        ESP_LOGI(SPP_TAG, "palette of %u colours", (unsigned int)parser.length / 3);
+    }
+    else
+    {
+        unsigned int len = parser.length < MAX_CONTROL_PAYLOAD ? parser.length : MAX_CONTROL_PAYLOAD;
+        bt_recv(bt_handle, 1 + len, parser.control);
     }
+    bt_parser_reset();
+}
+
+void bt_handle(int bt_handle, int packet_len, unsigned char *packet)
+{
+    const unsigned char *end = packet + packet_len;
 
-    if ((ret = esp_spp_register_callback(esp_spp_cb)) != ESP_OK)
+    while (packet < end)
     {
-        ESP_LOGE(SPP_TAG, "%s spp register failed: %s\n", __func__, esp_err_to_name(ret));
-        return;
+        switch (parser.state)
+        {
+        case FRAME_LENGTH:
+            parser.length |= (uint32_t)*packet++ << (8 * parser.received);
+            if (++parser.received == 4)
+            {
+                parser.state = FRAME_HEADER;
+                if (parser.length > BT_MAX_FRAME_BYTES)
+                {
+                    // Not a frame boundary; drop the rest of the packet and start over
+                    ESP_LOGE(SPP_TAG, "frame of %u bytes too long", (unsigned int)parser.length);
+                    bt_parser_reset();
+                    return;
+                }
+            }
+            break;
+
+        case FRAME_HEADER:
+            parser.control[0] = *packet++;
+            parser.received = 0;
+            parser.state = FRAME_PAYLOAD;
+            parser.skip = !streaming && bt_column_frame(parser.control[0]);
+            if (parser.control[0] == MSG_HEADER_PIXEL_PALETTE)
+            {
+                pixel_format_palette_begin();
+            }
+            if (parser.length == 0)
+            {
+                bt_frame_end(bt_handle);
+            }
+            break;
+
+        case FRAME_PAYLOAD:
+        {
+            uint32_t n = parser.length - parser.received;
+            if (n > (uint32_t)(end - packet))
+            {
+                n = end - packet;
+            }
+
+            if (parser.skip)
+            {
+                // Dropped: another transport streams
+            }
+            else if (parser.control[0] == MSG_HEADER_PIXEL_DATA)
+            {
+                bt_pixel_data(packet, n);
+            }
+            else if (parser.control[0] == MSG_HEADER_STORE_FILE)
+            {
+                bt_file_data(packet, n);
+            }
+            else if (parser.control[0] == MSG_HEADER_PIXEL_CODED)
+            {
+                column_decoder_feed(packet, n);
+            }
+            else if (parser.control[0] == MSG_HEADER_PIXEL_LZ)
+            {
+                lzss_feed(packet, n);
+            }
+            else if (parser.control[0] == MSG_HEADER_PIXEL_CACHED)
+            {
+                column_cache_feed(packet, n);
+            }
+            else if (parser.control[0] == MSG_HEADER_PIXEL_PALETTE)
+            {
+                pixel_format_palette_feed(packet, n);
+            }
+            else if (parser.received < MAX_CONTROL_PAYLOAD)
+            {
+                uint32_t kept = MAX_CONTROL_PAYLOAD - parser.received;
+                memcpy(&parser.control[1 + parser.received], packet, n < kept ? n : kept);
+            }
+            packet += n;
+            parser.received += n;
+
+            if (parser.received == parser.length)
+            {
+                bt_frame_end(bt_handle);
+            }
+            break;
+        }
+        }
     }
+}
+
+void bt_open(int bt_handle)
+{
+    struct message led_event;
+
+    conn_handle = bt_handle;
+    app_version = 0;
+    bt_parser_reset();
+    column_decoder_reset();
+    lzss_reset(column_decoder_feed);
+    column_cache_reset();
+
+    atomic_store(&ack_pending, 0);
+    xQueueReset(tx_queue);
+    tx_in_flight = false;
+    tx_congested = false;
+    tx_connected = true;
+
+    led_event.type = WIFI_CONNECTED;
+    xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
+}
 
-    if ((ret = esp_spp_init(esp_spp_mode)) != ESP_OK)
+void bt_close(void)
+{
+    struct message led_event;
+
+    tx_connected = false;
+    if (streaming)
     {
-        ESP_LOGE(SPP_TAG, "%s spp init failed: %s\n", __func__, esp_err_to_name(ret));
-        return;
+        streaming = false;
+        column_ring_unclaim(SOURCE_BT);
     }
 
-    /* Set default parameters for Secure Simple Pairing */
-    esp_bt_sp_param_t param_type = ESP_BT_SP_IOCAP_MODE;
-    esp_bt_io_cap_t iocap = ESP_BT_IO_CAP_IO;
-    esp_bt_gap_set_security_param(param_type, &iocap, sizeof(uint8_t));
-
-    /*
-     * Set default parameters for Legacy Pairing
-     * Use variable pin, input pin code when pairing
-     */
-    esp_bt_pin_type_t pin_type = ESP_BT_PIN_TYPE_VARIABLE;
-    esp_bt_pin_code_t pin_code;
-    esp_bt_gap_set_pin(pin_type, 0, pin_code);
-
-    ESP_LOGI(SPP_TAG, "Own address:[%s]", bda2str((uint8_t *)esp_bt_dev_get_address(), bda_str, sizeof(bda_str)));
-}
\ No newline at end of file
+    led_event.type = WIFI_DISCONNECTED;
+    xQueueSend((QueueHandle_t)led_event_queue, &led_event, 100);
+}
+
+void bt_protocol_init(QueueHandle_t _led_event_queue)
+{
+    led_event_queue = _led_event_queue;
+
+    tx_queue = xQueueCreate(TX_QUEUE_LENGTH, sizeof(struct bt_tx_frame));
+    xTaskCreatePinnedToCore(bt_tx_task, "bt_tx", configMINIMAL_STACK_SIZE * 3,
+                            NULL, 6, &tx_task, NET_CORE);
+}
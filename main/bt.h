@@ -3,14 +3,85 @@
 
 #include "common.h"
     
+/*
+ * Frames are a u32 little-endian payload length, a header byte and the payload.
+ * HELLO carries the protocol version of the app; PIXEL_COUNT answers with
+ * the LED count, followed for apps of version 1 or later by the
+ * capabilities of the device (little-endian):
+ *
+ *   u32 LED count
+ *   u8  protocol version
+ *   u8  pixel formats accepted by PIXEL_BEGIN, bit n for format n
+ *   u16 messages accepted, bit n for header n
+ *   u16 columns buffered by the device
+ *   u16 fastest column rate of the strip, per second
+ *   u32 largest frame payload accepted
+ *   u32 columns the device can store (see column_store.h)
+ *
+ * PIXEL_DATA carries any number of whole columns back to back, each LED_COUNT
+ * RGB triplets. PIXEL_ACK carries a column limit: the number of columns of
+ * the animation the app may have sent in total (see flow.h). The first one
+ * is sent in reply to PIXEL_BEGIN, whose payload is the speed, optionally
+ * followed by the pixel format of the columns (see pixel_format.h). Speeds,
+ * in columns per second, are a u16 from apps of version 1 or later and a u8
+ * from older ones, here and in STORE_BEGIN, STORE_PLAY and STORE_ENTRY.
+ *
+ * STORE_BEGIN starts an upload to the library of images kept in flash (see
+ * column_store.h): the columns that follow, in any of the pixel messages,
+ * are written to flash instead of being played, with the same flow control.
+ * PIXEL_END keeps them unless the upload was aborted. Payloads, with any
+ * trailing fields optional:
+ *
+ *   STORE_BEGIN  speed, u8 pixel format, u64 image hash, u32 columns
+ *   STORE_PLAY   speed (0 for the upload's), u64 image hash (else the newest)
+ *   STORE_QUERY  u8 index (0 for the newest), or u64 image hash
+ *
+ * STORE_QUERY is answered by STORE_ENTRY: u8 number of images, u8 index of
+ * the image (0xff when there is none), u64 hash, u32 columns, speed and u8
+ * pixel format of its upload.
+ *
+ * A STORE_BEGIN of format BMP_UPLOAD_FORMAT uploads a BMP file instead (see
+ * bmp.h), sent in STORE_FILE frames: the file is cut in chunks of the size
+ * of a column (3 bytes per LED), each taking one credit like a column, and
+ * a frame only ends within a chunk at the end of the file.
+ */
 #define MSG_HEADER_HELLO 0
 #define MSG_HEADER_PIXEL_COUNT 1
 #define MSG_HEADER_PIXEL_DATA 2
 #define MSG_HEADER_PIXEL_BEGIN 3
 #define MSG_HEADER_PIXEL_ACK 4
 #define MSG_HEADER_PIXEL_END 5
+// Whole columns coded against the previous one (see column_codec.h)
+#define MSG_HEADER_PIXEL_CODED 6
+// The PIXEL_CODED stream, LZSS compressed (see lzss.h)
+#define MSG_HEADER_PIXEL_LZ 7
+// RGB triplets of the palette used by PIXEL_FORMAT_PALETTE8
+#define MSG_HEADER_PIXEL_PALETTE 8
+// Columns replayed from the ring or the dictionary (see column_cache.h)
+#define MSG_HEADER_PIXEL_CACHED 9
+#define MSG_HEADER_STORE_BEGIN 10
+#define MSG_HEADER_STORE_PLAY 11
+#define MSG_HEADER_STORE_QUERY 12
+#define MSG_HEADER_STORE_ENTRY 13
+#define MSG_HEADER_STORE_FILE 14
+
+#define BT_PROTOCOL_VERSION 1
+#define BT_CAPABILITIES_LEN 20
+#define BT_MAX_FRAME_BYTES (64 * 1024)
+
+// Counters of the outbound path, reset by each PIXEL_BEGIN
+struct bt_tx_stats
+{
+    unsigned int acks_requested;  // bt_ack() calls
+    unsigned int acks_sent;       // ACK frames written, the rest were coalesced
+    unsigned int congestions;     // Times the transport reported congestion
+    int64_t total_ack_latency_us; // From the request to the write completing
+    int64_t max_ack_latency_us;
+};
 
 void bt_init(QueueHandle_t led_event_queue);
+// Never blocks: the limit replaces any unsent one and is written by the BT side
 void bt_ack(unsigned int);
+void bt_get_tx_stats(struct bt_tx_stats *stats);
 
 #endif
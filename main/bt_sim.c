@@ -0,0 +1,158 @@
+#include "bt.h"
+#include "bt_transport.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/*
+ * Host stand-in for the SPP server: a TCP socket carrying the same byte
+ * stream as the RFCOMM channel. Sockets are polled without blocking so the
+ * FreeRTOS POSIX port keeps scheduling the LED task.
+ */
+
+#define SPP_TAG "SPP"
+#define SIM_DEFAULT_PORT 4242
+/* Packets are handed to bt_handle() in slices no larger than the SPP MTU */
+#define SIM_SPP_MTU 990
+
+static int client_fd = -1;
+
+void bt_transport_write(int bt_handle, int len, uint8_t *data)
+{
+    int position = 0;
+    bool congested = false;
+
+    // Called from the BT side's sender task, so waiting on a full socket is fine
+    while (position < len)
+    {
+        int ret = send(bt_handle, data + position, len - position, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (!congested)
+                {
+                    congested = true;
+                    bt_congestion(true);
+                }
+                vTaskDelay(1);
+                continue;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ESP_LOGE(SPP_TAG, "send failed: %d", errno);
+            break;
+        }
+        position += ret;
+    }
+
+    if (congested)
+    {
+        bt_congestion(false);
+    }
+    bt_write_done();
+}
+
+static int sim_listen(void)
+{
+    int port = SIM_DEFAULT_PORT;
+    const char *env = getenv("PIXELSTICK_SIM_PORT");
+    if (env)
+    {
+        port = atoi(env);
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        ESP_LOGE(SPP_TAG, "Unable to create socket");
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 1) < 0)
+    {
+        ESP_LOGE(SPP_TAG, "Unable to listen on port %d", port);
+        close(sock);
+        return -1;
+    }
+
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    ESP_LOGI(SPP_TAG, "Simulated SPP server listening on 127.0.0.1:%d", port);
+    return sock;
+}
+
+static void bt_sim_task(void *arg)
+{
+    unsigned char packet[SIM_SPP_MTU];
+    int server_fd = sim_listen();
+
+    if (server_fd < 0)
+    {
+        vTaskDelete(NULL);
+        return;
+    }
+
+    while (true)
+    {
+        if (client_fd < 0)
+        {
+            client_fd = accept(server_fd, NULL, NULL);
+            if (client_fd < 0)
+            {
+                vTaskDelay(1);
+                continue;
+            }
+
+            int one = 1;
+            setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fcntl(client_fd, F_SETFL, O_NONBLOCK);
+            ESP_LOGI(SPP_TAG, "ESP_SPP_SRV_OPEN_EVT handle:%d", client_fd);
+            bt_open(client_fd);
+        }
+
+        int len = recv(client_fd, packet, sizeof(packet), 0);
+
+        if (len > 0)
+        {
+            bt_handle(client_fd, len, packet);
+        }
+        else if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            ESP_LOGI(SPP_TAG, "ESP_SPP_CLOSE_EVT handle:%d", client_fd);
+            close(client_fd);
+            client_fd = -1;
+            bt_close();
+        }
+        else
+        {
+            vTaskDelay(1);
+        }
+    }
+}
+
+void bt_init(QueueHandle_t led_event_queue)
+{
+    bt_protocol_init(led_event_queue);
+
+    xTaskCreatePinnedToCore(bt_sim_task, "bt_sim", configMINIMAL_STACK_SIZE * 5,
+                            NULL, 5, NULL, NET_CORE);
+}
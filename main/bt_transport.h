@@ -0,0 +1,22 @@
+#ifndef __BT_TRANSPORT_H_
+#define __BT_TRANSPORT_H_
+
+#include "common.h"
+#include <stdbool.h>
+
+/*
+ * Implemented by the transport (bt_spp.c on the ESP32, bt_sim.c on the host).
+ * Only one write is outstanding at a time; the transport reports its
+ * completion with bt_write_done().
+ */
+void bt_transport_write(int bt_handle, int len, uint8_t *data);
+
+/* Called by the transport */
+void bt_protocol_init(QueueHandle_t led_event_queue);
+void bt_open(int bt_handle);
+void bt_close(void);
+void bt_handle(int bt_handle, int packet_len, unsigned char *packet);
+void bt_write_done(void);
+void bt_congestion(bool congested);
+
+#endif
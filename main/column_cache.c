@@ -0,0 +1,101 @@
+#include "column_cache.h"
+
+#include <string.h>
+
+// Only used by the transport task
+static uint8_t entries[COLUMN_CACHE_ENTRIES][COLUMN_BYTES]; // GRB
+static struct
+{
+  bool store_started;
+  unsigned int store_entry;
+  bool invalid;
+} cache;
+
+static struct column_cache_stats stats;
+
+void column_cache_reset(void)
+{
+  memset(entries, 0, sizeof(entries));
+  memset(&cache, 0, sizeof(cache));
+  memset(&stats, 0, sizeof(stats));
+}
+
+static void column_cache_push(const uint8_t *column)
+{
+  if (column == NULL)
+  {
+    cache.invalid = true;
+  }
+  else if (column_ring_push_grb(column))
+  {
+    stats.columns++;
+  }
+}
+
+void column_cache_feed(const uint8_t *data, unsigned int len)
+{
+  stats.bytes += len;
+
+  for (const uint8_t *end = data + len; data < end; data++)
+  {
+    uint8_t op = *data;
+    unsigned int argument = op & ~COLUMN_CACHE_OP_MASK;
+
+    if (cache.store_started)
+    {
+      const uint8_t *column = column_ring_recent(op);
+      if (column && cache.store_entry < COLUMN_CACHE_ENTRIES)
+      {
+        memcpy(entries[cache.store_entry], column, COLUMN_BYTES);
+        stats.stored++;
+      }
+      else
+      {
+        cache.invalid = true;
+      }
+      cache.store_started = false;
+      continue;
+    }
+
+    switch (op & COLUMN_CACHE_OP_MASK)
+    {
+    case COLUMN_CACHE_COPY:
+      column_cache_push(column_ring_recent(argument));
+      break;
+
+    case COLUMN_CACHE_PLAY:
+      column_cache_push(argument < COLUMN_CACHE_ENTRIES ? entries[argument] : NULL);
+      break;
+
+    case COLUMN_CACHE_STORE:
+      cache.store_entry = argument;
+      cache.store_started = true;
+      break;
+
+    case COLUMN_CACHE_REPEAT:
+      for (unsigned int i = 0; i <= argument; i++)
+      {
+        column_cache_push(column_ring_recent(0));
+      }
+      break;
+    }
+  }
+}
+
+bool column_cache_frame_end(void)
+{
+  bool valid = !cache.store_started && !cache.invalid;
+
+  if (!valid)
+  {
+    stats.errors++;
+  }
+  cache.store_started = false;
+  cache.invalid = false;
+  return valid;
+}
+
+void column_cache_get_stats(struct column_cache_stats *out)
+{
+  *out = stats;
+}
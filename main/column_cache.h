@@ -0,0 +1,47 @@
+#ifndef __COLUMN_CACHE_H_
+#define __COLUMN_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "column_ring.h"
+
+/*
+ * PIXEL_CACHED frames replay columns the device already has, in a byte or
+ * two per column or run of columns. Ops, where "back" counts from the last
+ * column pushed into the ring (0 is the last one, up to COLUMN_RING_MAX_BACK):
+ *
+ *   00bbbbbb           push a copy of the column b back
+ *   01kkkkkk           push entry k of the dictionary
+ *   10kkkkkk bbbbbbbb  store the column b back into entry k
+ *   11nnnnnn           push n + 1 more copies of the last column
+ *
+ * Every pushed column counts against the flow control limit like any other.
+ * The dictionary is cleared by PIXEL_BEGIN. PIXEL_CODED columns keep being
+ * coded against the previous PIXEL_CODED column, not against cached ones.
+ */
+
+#define COLUMN_CACHE_ENTRIES 16
+
+#define COLUMN_CACHE_COPY 0x00
+#define COLUMN_CACHE_PLAY 0x40
+#define COLUMN_CACHE_STORE 0x80
+#define COLUMN_CACHE_REPEAT 0xc0
+#define COLUMN_CACHE_OP_MASK 0xc0
+#define COLUMN_CACHE_MAX_REPEAT 64
+
+struct column_cache_stats
+{
+  unsigned int columns; // pushed by cache ops
+  unsigned int bytes;
+  unsigned int stored;
+  unsigned int errors;
+};
+
+// Starts a new animation with an empty dictionary
+void column_cache_reset(void);
+void column_cache_feed(const uint8_t *data, unsigned int len);
+// Called at the end of each frame, returns false if it ended mid-op or had invalid ops
+bool column_cache_frame_end(void);
+void column_cache_get_stats(struct column_cache_stats *stats);
+
+#endif
@@ -0,0 +1,155 @@
+#include "column_codec.h"
+
+#include <string.h>
+#include "esp_timer.h"
+#include "pixel_format.h"
+
+enum decoder_state
+{
+  DECODER_OP,
+  DECODER_RUN,
+  DECODER_LITERAL,
+  DECODER_ERROR
+};
+
+// Only used by the transport task
+static struct
+{
+  enum decoder_state state;
+  uint8_t previous[COLUMN_BYTES]; // packed, updated in place into the next column
+  unsigned int column_bytes;
+  unsigned int unit_bytes;
+  unsigned int position;  // byte offset in the column
+  unsigned int remaining; // bytes left to fill by the current op
+  uint8_t unit[3];
+  unsigned int unit_received;
+} decoder;
+
+static struct column_decoder_stats stats;
+
+void column_decoder_reset(void)
+{
+  memset(decoder.previous, 0, sizeof(decoder.previous));
+  decoder.column_bytes = pixel_format_info()->column_bytes;
+  decoder.unit_bytes = pixel_format_info()->unit_bytes;
+  decoder.state = DECODER_OP;
+  decoder.position = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+static void column_decoder_op_end(void)
+{
+  decoder.state = DECODER_OP;
+  if (decoder.position == decoder.column_bytes)
+  {
+    // A full ring drops the column, the reference still moves on
+    if (column_ring_push(decoder.previous))
+    {
+      stats.columns++;
+    }
+    decoder.position = 0;
+  }
+}
+
+void column_decoder_feed(const uint8_t *data, unsigned int len)
+{
+  int64_t t_begin = esp_timer_get_time();
+  const uint8_t *end = data + len;
+
+  stats.bytes += len;
+
+  while (data < end)
+  {
+    switch (decoder.state)
+    {
+    case DECODER_OP:
+    {
+      uint8_t op = *data++;
+      unsigned int bytes = ((op & ~COLUMN_CODEC_OP_MASK) + 1) * decoder.unit_bytes;
+
+      if (bytes > decoder.column_bytes - decoder.position)
+      {
+        decoder.state = DECODER_ERROR;
+        break;
+      }
+
+      decoder.remaining = bytes;
+      switch (op & COLUMN_CODEC_OP_MASK)
+      {
+      case COLUMN_CODEC_SKIP:
+        decoder.position += bytes;
+        column_decoder_op_end();
+        break;
+      case COLUMN_CODEC_RUN:
+        decoder.unit_received = 0;
+        decoder.state = DECODER_RUN;
+        break;
+      case COLUMN_CODEC_LITERAL:
+        decoder.state = DECODER_LITERAL;
+        break;
+      default:
+        decoder.state = DECODER_ERROR;
+        break;
+      }
+      break;
+    }
+
+    case DECODER_RUN:
+      decoder.unit[decoder.unit_received++] = *data++;
+      if (decoder.unit_received == decoder.unit_bytes)
+      {
+        uint8_t *unit = decoder.previous + decoder.position;
+        for (uint8_t *run_end = unit + decoder.remaining; unit < run_end; unit += decoder.unit_bytes)
+        {
+          memcpy(unit, decoder.unit, decoder.unit_bytes);
+        }
+        decoder.position += decoder.remaining;
+        column_decoder_op_end();
+      }
+      break;
+
+    case DECODER_LITERAL:
+    {
+      unsigned int n = decoder.remaining;
+      if (n > (unsigned int)(end - data))
+      {
+        n = end - data;
+      }
+      memcpy(decoder.previous + decoder.position, data, n);
+      data += n;
+      decoder.position += n;
+      decoder.remaining -= n;
+      if (decoder.remaining == 0)
+      {
+        column_decoder_op_end();
+      }
+      break;
+    }
+
+    case DECODER_ERROR:
+      // Skip the rest of the frame
+      data = end;
+      break;
+    }
+  }
+
+  stats.decode_us += esp_timer_get_time() - t_begin;
+}
+
+bool column_decoder_frame_end(void)
+{
+  bool complete = decoder.state == DECODER_OP && decoder.position == 0;
+
+  if (!complete)
+  {
+    stats.errors++;
+  }
+  decoder.state = DECODER_OP;
+  decoder.position = 0;
+  return complete;
+}
+
+void column_decoder_get_stats(struct column_decoder_stats *out)
+{
+  *out = stats;
+}
@@ -0,0 +1,41 @@
+#ifndef __COLUMN_CODEC_H_
+#define __COLUMN_CODEC_H_
+
+#include <stdint.h>
+#include "column_ring.h"
+
+/*
+ * Coded columns (MSG_HEADER_PIXEL_CODED) are a sequence of ops, each covering
+ * 1 to 64 units of the packed column against the previous column of the
+ * animation. A unit is one pixel, or two in RGB444 (see pixel_format.h):
+ *
+ *   00nnnnnn           n + 1 units unchanged
+ *   01nnnnnn unit      n + 1 copies of one unit
+ *   10nnnnnn units...  n + 1 literal units
+ *
+ * Ops never span two columns. The previous column is all zeros at PIXEL_BEGIN.
+ */
+
+#define COLUMN_CODEC_SKIP 0x00
+#define COLUMN_CODEC_RUN 0x40
+#define COLUMN_CODEC_LITERAL 0x80
+#define COLUMN_CODEC_OP_MASK 0xc0
+#define COLUMN_CODEC_MAX_PIXELS 64
+
+struct column_decoder_stats
+{
+  unsigned int columns;
+  unsigned int bytes;
+  unsigned int errors;
+  unsigned int decode_us;
+};
+
+// Starts a new animation, in the current pixel format
+void column_decoder_reset(void);
+// Decodes a slice of a coded frame, pushing complete columns into the ring
+void column_decoder_feed(const uint8_t *data, unsigned int len);
+// Called at the end of each coded frame, returns false if it ended mid-column
+bool column_decoder_frame_end(void);
+void column_decoder_get_stats(struct column_decoder_stats *stats);
+
+#endif
@@ -0,0 +1,171 @@
+#include "column_ring.h"
+#include "pixel_format.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_timer.h"
+
+// Number of the first column; the host tests start a few million columns before the counters wrap around
+#ifndef COLUMN_RING_FIRST_COLUMN
+#define COLUMN_RING_FIRST_COLUMN 0
+#endif
+
+static uint8_t slots[COLUMN_RING_SLOTS][COLUMN_BYTES];
+// Number of the next column to be written, only advanced by the producer
+static atomic_uint head = COLUMN_RING_FIRST_COLUMN;
+// Columns before this one may be overwritten, only advanced by the consumer
+static atomic_uint tail = COLUMN_RING_FIRST_COLUMN;
+
+// Columns published since boot, counting up to the furthest column_ring_recent() looks back;
+// unlike head, it does not wrap around. Only used by the producer.
+static unsigned int history;
+
+static struct column_ring_stats stats;
+
+#define NO_PRODUCER -1
+// Transport allowed to produce, NO_PRODUCER when none
+static atomic_int producer = NO_PRODUCER;
+
+// False while another transport streams; a transport may claim the ring again
+bool column_ring_claim(enum column_source source)
+{
+  int expected = NO_PRODUCER;
+
+  return atomic_compare_exchange_strong(&producer, &expected, (int)source) || expected == (int)source;
+}
+
+// Does nothing unless the ring is claimed by this transport
+void column_ring_unclaim(enum column_source source)
+{
+  int expected = source;
+
+  atomic_compare_exchange_strong(&producer, &expected, NO_PRODUCER);
+}
+
+// Returns the next free slot, or NULL when the consumer still holds all of them
+uint8_t *column_ring_acquire(void)
+{
+  uint8_t *slot = column_ring_reserve(0);
+
+  if (slot == NULL)
+  {
+    stats.dropped++;
+  }
+  return slot;
+}
+
+// Slot of the column `ahead` columns after the next one, for columns that
+// arrive out of order; NULL while the consumer holds it, or when it is the
+// slot of the last published column, which column_ring_recent(0) returns. It
+// is published when the commits reach it, so it must be filled by then.
+uint8_t *column_ring_reserve(unsigned int ahead)
+{
+  unsigned int column = atomic_load_explicit(&head, memory_order_relaxed) + ahead;
+
+  if (ahead > COLUMN_RING_SLOTS - 2 ||
+      column - atomic_load_explicit(&tail, memory_order_acquire) >= COLUMN_RING_SLOTS)
+  {
+    return NULL;
+  }
+  return slots[column % COLUMN_RING_SLOTS];
+}
+
+// Publishes the slot returned by the last column_ring_acquire()
+void column_ring_commit(void)
+{
+  atomic_fetch_add_explicit(&head, 1, memory_order_release);
+  if (history <= COLUMN_RING_MAX_BACK)
+  {
+    history++;
+  }
+  stats.pushed++;
+}
+
+// Same, for a slot filled with RGB pixels: they are put in wire order first
+void column_ring_commit_rgb(void)
+{
+  int64_t t_begin = esp_timer_get_time();
+  uint8_t *column = slots[atomic_load_explicit(&head, memory_order_relaxed) % COLUMN_RING_SLOTS];
+
+  for (uint8_t *end = column + COLUMN_BYTES; column < end; column += 3)
+  {
+    uint8_t red = column[0];
+    column[0] = column[1];
+    column[1] = red;
+  }
+  stats.ingest_us += esp_timer_get_time() - t_begin;
+  column_ring_commit();
+}
+
+// Expands a column packed in the animation's pixel format into the next slot
+bool column_ring_push(const uint8_t *packed)
+{
+  uint8_t *column = column_ring_acquire();
+
+  if (column == NULL)
+  {
+    return false;
+  }
+
+  int64_t t_begin = esp_timer_get_time();
+  pixel_format_expand(packed, column);
+  stats.ingest_us += esp_timer_get_time() - t_begin;
+  column_ring_commit();
+  return true;
+}
+
+// Same, for a column already in wire order
+bool column_ring_push_grb(const uint8_t *grb)
+{
+  uint8_t *column = column_ring_acquire();
+
+  if (column == NULL)
+  {
+    return false;
+  }
+
+  int64_t t_begin = esp_timer_get_time();
+  memcpy(column, grb, COLUMN_BYTES);
+  stats.ingest_us += esp_timer_get_time() - t_begin;
+  column_ring_commit();
+  return true;
+}
+
+// Slot of the column published `back` columns before the last one, as long as
+// the next column_ring_acquire() cannot reuse it; NULL otherwise
+const uint8_t *column_ring_recent(unsigned int back)
+{
+  unsigned int count = atomic_load_explicit(&head, memory_order_relaxed);
+
+  if (back >= history)
+  {
+    return NULL;
+  }
+  return slots[(count - 1 - back) % COLUMN_RING_SLOTS];
+}
+
+// Number of columns published so far
+unsigned int column_ring_count(void)
+{
+  return atomic_load_explicit(&head, memory_order_acquire);
+}
+
+// Slot of a published column that has not been released
+const uint8_t *column_ring_slot(unsigned int column)
+{
+  return slots[column % COLUMN_RING_SLOTS];
+}
+
+// Gives back the slots of all columns before this one
+void column_ring_release(unsigned int column)
+{
+  if ((int)(column - atomic_load_explicit(&tail, memory_order_relaxed)) > 0)
+  {
+    atomic_store_explicit(&tail, column, memory_order_release);
+  }
+}
+
+void column_ring_get_stats(struct column_ring_stats *out)
+{
+  *out = stats;
+}
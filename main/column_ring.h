@@ -0,0 +1,49 @@
+#ifndef __COLUMN_RING_H_
+#define __COLUMN_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "led.h"
+#include "common.h"
+
+/*
+ * Single-producer/single-consumer ring of animation columns, kept in the
+ * strip's wire order (GRB). The transport task writes straight into the
+ * next free slot, the LED task flushes slots in place. Columns are numbered
+ * from boot; the counters only ever grow and wrap around together.
+ *
+ * Only the transport that claimed the ring may produce: it claims it before
+ * its ANIMATE_BEGIN or STORE_BEGIN and gives it back with its ANIMATE_END.
+ */
+
+#define COLUMN_RING_SLOTS 64 // power of two
+#define COLUMN_BYTES (LED_COUNT * 3)
+// Furthest column_ring_recent() can look back
+#define COLUMN_RING_MAX_BACK (COLUMN_RING_SLOTS - 2)
+
+struct column_ring_stats
+{
+  unsigned int pushed;
+  unsigned int dropped;
+  unsigned int ingest_us;
+};
+
+// Producer side
+bool column_ring_claim(enum column_source source);
+void column_ring_unclaim(enum column_source source);
+uint8_t *column_ring_acquire(void);
+uint8_t *column_ring_reserve(unsigned int ahead);
+void column_ring_commit(void);
+void column_ring_commit_rgb(void);
+bool column_ring_push(const uint8_t *packed);
+bool column_ring_push_grb(const uint8_t *grb);
+const uint8_t *column_ring_recent(unsigned int back);
+
+// Consumer side
+unsigned int column_ring_count(void);
+const uint8_t *column_ring_slot(unsigned int column);
+void column_ring_release(unsigned int column);
+
+void column_ring_get_stats(struct column_ring_stats *stats);
+
+#endif
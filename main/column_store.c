@@ -0,0 +1,469 @@
+#include "column_store.h"
+#include "store_flash.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define COLUMN_STORE_MAGIC 0x42494c50 // "PLIB"
+#define COLUMN_STORE_VERSION 3
+// Uploads erase ahead a 64 KB block at a time, which takes far less time per byte than sectors
+#define COLUMN_STORE_ERASE_BLOCK (16 * STORE_FLASH_SECTOR)
+
+// Record states, each reached from the previous one by clearing bits
+#define RECORD_FREE 0xffffffff
+#define RECORD_LIVE 0x4556494c // "LIVE"
+#define RECORD_DROPPED 0
+
+// Slot 0 of the index sector is the header, the others are records
+struct column_store_record
+{
+  uint32_t state;
+  uint32_t sequence; // upload order
+  uint64_t hash;
+  uint32_t offset;
+  uint32_t columns;
+  uint16_t speed;
+  uint8_t format;
+  uint8_t reserved[5];
+};
+
+#define INDEX_SLOTS (COLUMN_STORE_DATA_OFFSET / sizeof(struct column_store_record))
+
+struct column_store_header
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t led_count;
+  uint8_t reserved[sizeof(struct column_store_record) - 8];
+};
+
+// An image of the library and where its record is
+struct column_store_entry
+{
+  struct column_store_image image;
+  size_t offset;
+  unsigned int sequence;
+  unsigned int slot;
+};
+
+static const char *TAG = "pixelstick-store";
+
+static size_t size;
+
+// Newest first. Only changed by the LED task, which bumps the generation
+// before and after, so that lookups from other tasks can retry a torn copy.
+static struct column_store_entry library[COLUMN_STORE_MAX_IMAGES];
+static unsigned int library_count;
+static atomic_uint generation;
+// Next record slot and upload number
+static unsigned int next_slot;
+static unsigned int next_sequence;
+
+// Upload in progress
+static struct column_store_entry upload;
+static unsigned int upload_capacity; // columns reserved for it
+static size_t erased_end;
+// Playback
+static const uint8_t *playing;
+
+static struct column_store_stats stats;
+
+static size_t sector_end(size_t offset)
+{
+  return (offset + STORE_FLASH_SECTOR - 1) / STORE_FLASH_SECTOR * STORE_FLASH_SECTOR;
+}
+
+static size_t image_end(const struct column_store_entry *entry)
+{
+  return sector_end(entry->offset + (size_t)entry->image.columns * COLUMN_BYTES);
+}
+
+static void library_write_begin(void)
+{
+  atomic_fetch_add_explicit(&generation, 1, memory_order_acq_rel);
+}
+
+static void library_write_end(void)
+{
+  atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+}
+
+static void library_remove(unsigned int index)
+{
+  // Clearing the state of a live record needs no erase
+  uint32_t state = RECORD_DROPPED;
+  store_flash_write(library[index].slot * sizeof(struct column_store_record), &state, sizeof(state));
+
+  library_write_begin();
+  memmove(&library[index], &library[index + 1], (library_count - index - 1) * sizeof(library[0]));
+  library_count--;
+  library_write_end();
+}
+
+static bool index_format(void)
+{
+  struct column_store_header header = {
+      .magic = COLUMN_STORE_MAGIC,
+      .version = COLUMN_STORE_VERSION,
+      .led_count = LED_COUNT,
+  };
+
+  next_slot = 1;
+  return store_flash_erase(0, COLUMN_STORE_DATA_OFFSET) && store_flash_write(0, &header, sizeof(header));
+}
+
+static bool index_write(struct column_store_entry *entry)
+{
+  struct column_store_record record = {
+      .state = RECORD_LIVE,
+      .sequence = entry->sequence,
+      .hash = entry->image.hash,
+      .offset = entry->offset,
+      .columns = entry->image.columns,
+      .speed = entry->image.speed,
+      .format = entry->image.format,
+  };
+
+  entry->slot = next_slot++;
+  return store_flash_write(entry->slot * sizeof(record), &record, sizeof(record));
+}
+
+// Rewrites the index with only the live records, oldest first. A reset in
+// between loses the library, not the firmware's ability to start a new one.
+static bool index_compact(void)
+{
+  if (!index_format())
+  {
+    return false;
+  }
+  for (unsigned int i = library_count; i-- > 0;)
+  {
+    if (!index_write(&library[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Loads the live records, or starts an empty library when there is no valid index
+static void index_load(const uint8_t *map)
+{
+  struct column_store_header header;
+  memcpy(&header, map, sizeof(header));
+  if (header.magic != COLUMN_STORE_MAGIC || header.version != COLUMN_STORE_VERSION || header.led_count != LED_COUNT)
+  {
+    ESP_LOGI(TAG, "Starting an empty library");
+    index_format();
+    return;
+  }
+
+  next_slot = 1;
+  for (unsigned int slot = 1; slot < INDEX_SLOTS; slot++)
+  {
+    struct column_store_record record;
+    memcpy(&record, map + slot * sizeof(record), sizeof(record));
+    if (record.state == RECORD_FREE)
+    {
+      break;
+    }
+    next_slot = slot + 1;
+    if (record.state != RECORD_LIVE || record.columns == 0 || record.offset < COLUMN_STORE_DATA_OFFSET ||
+        record.offset + (size_t)record.columns * COLUMN_BYTES > size)
+    {
+      continue;
+    }
+    if (record.sequence >= next_sequence)
+    {
+      next_sequence = record.sequence + 1;
+    }
+
+    // Keep the newest first, up to COLUMN_STORE_MAX_IMAGES
+    unsigned int index = 0;
+    while (index < library_count && library[index].sequence > record.sequence)
+    {
+      index++;
+    }
+    if (index == COLUMN_STORE_MAX_IMAGES)
+    {
+      continue;
+    }
+    if (library_count == COLUMN_STORE_MAX_IMAGES)
+    {
+      library_count--;
+    }
+    memmove(&library[index + 1], &library[index], (library_count - index) * sizeof(library[0]));
+    library[index] = (struct column_store_entry){
+        .image = {
+            .hash = record.hash,
+            .columns = record.columns,
+            .speed = record.speed,
+            .format = record.format,
+        },
+        .offset = record.offset,
+        .sequence = record.sequence,
+        .slot = slot,
+    };
+    library_count++;
+  }
+}
+
+bool column_store_init(void)
+{
+  size = store_flash_init();
+  if (size <= COLUMN_STORE_DATA_OFFSET)
+  {
+    size = 0;
+    return false;
+  }
+
+  const uint8_t *map = store_flash_map();
+  if (map == NULL)
+  {
+    size = 0;
+    return false;
+  }
+  index_load(map);
+  store_flash_unmap();
+
+  for (unsigned int i = 0; i < library_count; i++)
+  {
+    ESP_LOGI(TAG, "Image %016llx: %u columns at %u columns/s",
+             (unsigned long long)library[i].image.hash, library[i].image.columns, library[i].image.speed);
+  }
+  return true;
+}
+
+unsigned int column_store_capacity(void)
+{
+  return size > 0 ? (size - COLUMN_STORE_DATA_OFFSET) / COLUMN_BYTES : 0;
+}
+
+unsigned int column_store_count(void)
+{
+  return library_count;
+}
+
+bool column_store_get(unsigned int index, struct column_store_image *image)
+{
+  unsigned int g;
+  bool found;
+
+  do
+  {
+    g = atomic_load_explicit(&generation, memory_order_acquire);
+    found = index < library_count;
+    if (found)
+    {
+      *image = library[index].image;
+    }
+    atomic_thread_fence(memory_order_acquire);
+  } while ((g & 1) || g != atomic_load_explicit(&generation, memory_order_relaxed));
+  return found;
+}
+
+bool column_store_find(uint64_t hash, struct column_store_image *image, unsigned int *index)
+{
+  unsigned int g;
+  bool found;
+
+  do
+  {
+    g = atomic_load_explicit(&generation, memory_order_acquire);
+    found = false;
+    for (unsigned int i = 0; i < library_count && !found; i++)
+    {
+      if (library[i].image.hash == hash)
+      {
+        *image = library[i].image;
+        *index = i;
+        found = true;
+      }
+    }
+    atomic_thread_fence(memory_order_acquire);
+  } while ((g & 1) || g != atomic_load_explicit(&generation, memory_order_relaxed));
+  return found;
+}
+
+bool column_store_begin(const struct column_store_image *image)
+{
+  memset(&stats, 0, sizeof(stats));
+  if (size == 0)
+  {
+    return false;
+  }
+
+  upload_capacity = image->columns > 0 ? image->columns : column_store_capacity();
+  if (upload_capacity > column_store_capacity())
+  {
+    ESP_LOGE(TAG, "%u columns do not fit in the storage", image->columns);
+    return false;
+  }
+
+  // After the newest image, or from the start when there is no room left
+  upload = (struct column_store_entry){
+      .image = *image,
+      .offset = library_count > 0 ? image_end(&library[0]) : COLUMN_STORE_DATA_OFFSET,
+      .sequence = next_sequence++,
+  };
+  upload.image.columns = upload_capacity;
+  if (upload.offset + (size_t)upload_capacity * COLUMN_BYTES > size)
+  {
+    upload.offset = COLUMN_STORE_DATA_OFFSET;
+  }
+  erased_end = upload.offset;
+
+  // Drop what it replaces, what is in its way and the oldest beyond the limit
+  for (unsigned int i = library_count; i-- > 0;)
+  {
+    if ((image->hash != 0 && library[i].image.hash == image->hash) ||
+        (library[i].offset < image_end(&upload) && upload.offset < image_end(&library[i])) ||
+        i >= COLUMN_STORE_MAX_IMAGES - 1)
+    {
+      library_remove(i);
+      stats.evicted++;
+    }
+  }
+  upload.image.columns = 0;
+  return true;
+}
+
+// Erases ahead of the upload up to the end of the block that end reaches into, within the space reserved
+static bool upload_erase(size_t end)
+{
+  if (end <= erased_end)
+  {
+    return true;
+  }
+
+  int64_t t_begin = esp_timer_get_time();
+  end = (end + COLUMN_STORE_ERASE_BLOCK - 1) / COLUMN_STORE_ERASE_BLOCK * COLUMN_STORE_ERASE_BLOCK;
+  size_t reserved_end = sector_end(upload.offset + (size_t)upload_capacity * COLUMN_BYTES);
+  if (end > reserved_end)
+  {
+    end = reserved_end;
+  }
+  if (!store_flash_erase(erased_end, end - erased_end))
+  {
+    return false;
+  }
+  stats.sectors_erased += (end - erased_end) / STORE_FLASH_SECTOR;
+  stats.erase_us += esp_timer_get_time() - t_begin;
+  erased_end = end;
+  return true;
+}
+
+bool column_store_append(const uint8_t *column)
+{
+  if (upload.image.columns >= upload_capacity)
+  {
+    return false;
+  }
+
+  size_t offset = upload.offset + (size_t)upload.image.columns * COLUMN_BYTES;
+  if (!upload_erase(offset + COLUMN_BYTES))
+  {
+    return false;
+  }
+
+  int64_t t_begin = esp_timer_get_time();
+  if (!store_flash_write(offset, column, COLUMN_BYTES))
+  {
+    return false;
+  }
+  stats.write_us += esp_timer_get_time() - t_begin;
+  stats.columns = ++upload.image.columns;
+  return true;
+}
+
+bool column_store_put(unsigned int column, unsigned int first_pixel, const uint8_t *grb, unsigned int pixels)
+{
+  if (column >= upload_capacity || first_pixel + pixels > LED_COUNT)
+  {
+    return false;
+  }
+
+  // Erased up to the end of the column, so every column before it was erased too
+  size_t offset = upload.offset + (size_t)column * COLUMN_BYTES;
+  if (!upload_erase(offset + COLUMN_BYTES))
+  {
+    return false;
+  }
+
+  int64_t t_begin = esp_timer_get_time();
+  if (!store_flash_write(offset + first_pixel * 3, grb, pixels * 3))
+  {
+    return false;
+  }
+  stats.write_us += esp_timer_get_time() - t_begin;
+  if (column >= upload.image.columns)
+  {
+    stats.columns = upload.image.columns = column + 1;
+  }
+  return true;
+}
+
+bool column_store_commit(void)
+{
+  if (size == 0 || upload.image.columns == 0)
+  {
+    return false;
+  }
+  if (next_slot == INDEX_SLOTS && !index_compact())
+  {
+    return false;
+  }
+  if (!index_write(&upload))
+  {
+    return false;
+  }
+
+  library_write_begin();
+  memmove(&library[1], &library[0], library_count * sizeof(library[0]));
+  library[0] = upload;
+  library_count++;
+  library_write_end();
+  return true;
+}
+
+void column_store_abort(void)
+{
+  upload.image.columns = 0;
+  upload_capacity = 0;
+}
+
+bool column_store_open(const uint64_t *hash, struct column_store_image *image)
+{
+  unsigned int index = 0;
+
+  if (hash != NULL ? !column_store_find(*hash, image, &index) : !column_store_get(0, image))
+  {
+    return false;
+  }
+
+  const uint8_t *map = store_flash_map();
+  if (map == NULL)
+  {
+    return false;
+  }
+  playing = map + library[index].offset;
+  return true;
+}
+
+const uint8_t *column_store_column(unsigned int column)
+{
+  return playing + (size_t)column * COLUMN_BYTES;
+}
+
+void column_store_close(void)
+{
+  store_flash_unmap();
+  playing = NULL;
+}
+
+void column_store_get_stats(struct column_store_stats *s)
+{
+  *s = stats;
+}
@@ -0,0 +1,78 @@
+#ifndef __COLUMN_STORE_H_
+#define __COLUMN_STORE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "column_ring.h"
+
+/*
+ * Library of animations kept in flash, to be played back without the
+ * radio. An image is uploaded once like a streamed one (STORE_BEGIN instead
+ * of PIXEL_BEGIN), and its columns are written in the strip's wire order,
+ * so playback flushes them straight from the memory-mapped storage.
+ *
+ * Images are identified by a 64-bit content hash chosen by the app, and
+ * laid out back to back from COLUMN_STORE_DATA_OFFSET, wrapping around to
+ * the start when the end of the storage is reached. Images in the way of a
+ * new upload are dropped when it begins, so are the oldest beyond
+ * COLUMN_STORE_MAX_IMAGES.
+ *
+ * The first sector is the index: a header, then one record per upload,
+ * written once the upload completes, so an interrupted upload leaves no
+ * image behind. Records are dropped by clearing their state in place; the
+ * sector is only erased and rewritten when it runs out of records.
+ *
+ * The strip driver reads pixels from flash through the cache, so its
+ * interrupt must not be IRAM-safe (CONFIG_RMT_ISR_IRAM_SAFE off, the
+ * default): nothing may write to flash during playback.
+ */
+
+#define COLUMN_STORE_DATA_OFFSET 4096
+#define COLUMN_STORE_MAX_IMAGES 16
+
+struct column_store_image
+{
+  uint64_t hash;
+  unsigned int columns;
+  unsigned int speed;  // columns/s given at upload
+  unsigned int format; // pixel format of the upload, for the app's information
+};
+
+struct column_store_stats
+{
+  unsigned int columns; // written by the last upload
+  unsigned int sectors_erased;
+  unsigned int erase_us;
+  unsigned int write_us;
+  unsigned int evicted; // images dropped to make room for it
+};
+
+// Returns false when there is no storage
+bool column_store_init(void);
+// Number of columns the storage holds
+unsigned int column_store_capacity(void);
+
+// Lookups, safe from any task. Images are numbered from 0, the newest.
+unsigned int column_store_count(void);
+bool column_store_get(unsigned int index, struct column_store_image *image);
+bool column_store_find(uint64_t hash, struct column_store_image *image, unsigned int *index);
+
+// Upload: image->columns may be 0 when unknown, in which case the upload
+// may take the whole storage. Appends columns until committed, or writes
+// them in pieces with column_store_put(), each pixel once.
+bool column_store_begin(const struct column_store_image *image);
+bool column_store_append(const uint8_t *column);
+bool column_store_put(unsigned int column, unsigned int first_pixel, const uint8_t *grb, unsigned int pixels);
+bool column_store_commit(void);
+// Drops the upload in progress: nothing more is written, nothing is committed
+void column_store_abort(void);
+
+// Playback: maps the image of the given hash, or the newest one when hash
+// is NULL; false when there is none
+bool column_store_open(const uint64_t *hash, struct column_store_image *image);
+const uint8_t *column_store_column(unsigned int column);
+void column_store_close(void);
+
+void column_store_get_stats(struct column_store_stats *stats);
+
+#endif
@@ -14,15 +14,50 @@ enum message_type
   WIFI_CONNECTED,
   WIFI_DISCONNECTED,
   STOP,
-  ANIMATE,
   ANIMATE_BEGIN,
-  ANIMATE_END
+  ANIMATE_END,
+  STORE_BEGIN,
+  STORE_PLAY
 };
 
-struct http_animation_block
+// Transport the columns come from, which gets the credits. One streams at a time:
+// the one that claimed the column ring (see column_ring_claim()).
+enum column_source
 {
-  int width;
-  char *buffer;
+  SOURCE_BT,
+  SOURCE_HTTP,
+  SOURCE_UDP
+};
+
+// Columns of a streamed or uploaded animation go through the column ring, numbered from first_column
+struct animate_begin_block
+{
+  int animation_speed;
+  unsigned int first_column;
+  enum column_source source;
+};
+
+// Uploads to the library also carry what identifies the image
+struct store_begin_block
+{
+  struct animate_begin_block begin;
+  uint64_t hash;
+  unsigned int columns; // 0 when unknown
+  unsigned int format;
+};
+
+// Ends what the source began; ignored when another source's animation is on
+struct animate_end_block
+{
+  bool aborted;
+  enum column_source source;
+};
+
+struct store_play_block
+{
+  int animation_speed; // 0 for the speed of the upload
+  bool by_hash;        // else the newest image
+  uint64_t hash;
 };
 
 struct message
@@ -30,9 +65,10 @@ struct message
   enum message_type type;
   union
   {
-    struct http_animation_block http_animation;
-    int animation_speed;
-    bool animate_end_aborted;
+    struct animate_begin_block animate_begin;
+    struct animate_end_block animate_end;
+    struct store_begin_block store_begin;
+    struct store_play_block store_play;
   };
 };
 
@@ -0,0 +1,87 @@
+#include "flow.h"
+
+// Round trip assumed until the first one is measured
+#define FLOW_INITIAL_RTT_US 100000
+// At most this many ACKs per second, and at least FLOW_MIN_BATCH columns each
+#define FLOW_MAX_ACK_RATE 20
+#define FLOW_MIN_BATCH 4
+// When nothing moved for this long plus two round trips, the last limit is advertised again
+#define FLOW_RESEND_US 50000
+// Round trip timing the resends at most: with most ACKs lost, the measured one grows with the
+// time it takes a resend to get through, which would put the resends further and further apart
+#define FLOW_MAX_RESEND_RTT_US 250000
+
+static unsigned int flow_window(struct flow_control *flow)
+{
+  // Two round trips of playback, plus one batch held back before it is returned and one
+  // more so that a lost ACK is made up for by the next one
+  unsigned int window = (unsigned int)(2 * flow->rtt_us * flow->rate / 1000000) + 2 * flow->batch;
+
+  return window < flow->capacity ? window : flow->capacity;
+}
+
+static unsigned int flow_grant(struct flow_control *flow, unsigned int limit, int64_t t_now)
+{
+  if (!flow->probing && limit > flow->granted)
+  {
+    flow->probing = true;
+    flow->probe = flow->granted;
+    flow->t_probe = t_now;
+  }
+  flow->granted = limit;
+  flow->t_granted = t_now;
+  flow->acks++;
+  return limit;
+}
+
+unsigned int flow_begin(struct flow_control *flow, unsigned int capacity, unsigned int rate, int64_t t_now)
+{
+  flow->capacity = capacity;
+  flow->rate = rate;
+  flow->granted = 0;
+  flow->probing = false;
+  flow->rtt_us = FLOW_INITIAL_RTT_US;
+  flow->acks = 0;
+  flow->received = 0;
+  flow->t_received = t_now;
+  flow->batch = rate / FLOW_MAX_ACK_RATE > FLOW_MIN_BATCH ? rate / FLOW_MAX_ACK_RATE : FLOW_MIN_BATCH;
+  if (flow->batch > capacity / 4)
+  {
+    flow->batch = capacity / 4;
+  }
+  flow->window = flow_window(flow);
+  return flow_grant(flow, flow->window, t_now);
+}
+
+unsigned int flow_update(struct flow_control *flow, unsigned int received, unsigned int played, int64_t t_now)
+{
+  if (flow->probing && received > flow->probe)
+  {
+    int64_t sample = t_now - flow->t_probe;
+    flow->rtt_us = (7 * flow->rtt_us + sample) / 8;
+    flow->probing = false;
+    flow->window = flow_window(flow);
+  }
+
+  if (received != flow->received)
+  {
+    flow->received = received;
+    flow->t_received = t_now;
+  }
+
+  unsigned int limit = played + flow->window;
+
+  if (limit >= flow->granted + flow->batch)
+  {
+    return flow_grant(flow, limit, t_now);
+  }
+
+  int64_t t_last = flow->t_received > flow->t_granted ? flow->t_received : flow->t_granted;
+  int64_t rtt_us = flow->rtt_us < FLOW_MAX_RESEND_RTT_US ? flow->rtt_us : FLOW_MAX_RESEND_RTT_US;
+  if (t_now - t_last > 2 * rtt_us + FLOW_RESEND_US)
+  {
+    // Nothing came in since the last ACK: it may be lost
+    return flow_grant(flow, limit > flow->granted ? limit : flow->granted, t_now);
+  }
+  return 0;
+}
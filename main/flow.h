@@ -0,0 +1,37 @@
+#ifndef __FLOW_H_
+#define __FLOW_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Credit window for streamed columns. PIXEL_ACK advertises a column limit:
+ * the number of columns of the animation the app may have sent in total.
+ * Limits only grow, so a lost or late ACK is superseded by the next one.
+ * The window is sized to cover the measured ACK round trip at the playback
+ * rate, within the device's buffer capacity.
+ */
+
+struct flow_control
+{
+  unsigned int capacity; // columns the device can buffer
+  unsigned int rate;     // playback rate, in columns/s
+  unsigned int window;   // columns allowed ahead of playback
+  unsigned int granted;  // limit last advertised
+  int64_t t_granted;
+  bool probing;          // measuring the round trip of an ACK
+  unsigned int probe;    // a column past this one proves that ACK arrived
+  int64_t t_probe;
+  int64_t rtt_us;        // smoothed ACK round trip
+  unsigned int batch;    // columns returned per ACK
+  unsigned int received;
+  int64_t t_received;    // when a column last arrived
+  unsigned int acks;
+};
+
+// Returns the first limit to advertise
+unsigned int flow_begin(struct flow_control *flow, unsigned int capacity, unsigned int rate, int64_t t_now);
+// Returns a new limit to advertise, or 0 when no ACK is due
+unsigned int flow_update(struct flow_control *flow, unsigned int received, unsigned int played, int64_t t_now);
+
+#endif
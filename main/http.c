@@ -1,5 +1,6 @@
 #include "common.h"
 #include "http.h"
+#include "http_stream.h"
 #include "esp_http_server.h"
 
 static const char *TAG = "pixelstick-http";
@@ -58,53 +59,61 @@ esp_err_t default_get_handler(httpd_req_t *req)
 }
 
 
-// static DRAM
-#define MAX_IMG_SIZE 120000
-char image_buffer[MAX_IMG_SIZE];
+// One TCP segment of the body at a time, straight into the column ring
+#define BODY_CHUNK 1460
+static uint8_t body_chunk[BODY_CHUNK];
 
 esp_err_t animate_post_handler(httpd_req_t *req)
 {
-  int sz = req->content_len;
-  
-  if (sz >= MAX_IMG_SIZE) {
-    return httpd_resp_send(req, "TOO BIG", HTTPD_RESP_USE_STRLEN);
+  char query[128] = "";
+  struct http_stream_params params;
+
+  httpd_req_get_url_query_str(req, query, sizeof(query));
+  if (!http_stream_parse_query(query, &params)) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bad parameters");
+  }
+  // The server does not take chunked bodies
+  if (req->content_len == 0) {
+    return httpd_resp_send_err(req, HTTPD_411_LENGTH_REQUIRED, "Content-Length required");
+  }
+  switch (http_stream_begin(&params, req->content_len)) {
+    case HTTP_STREAM_BEGUN:
+      break;
+    case HTTP_STREAM_BUSY:
+      httpd_resp_set_status(req, "503 Service Unavailable");
+      return httpd_resp_send(req, "busy", HTTPD_RESP_USE_STRLEN);
+    default:
+      return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "could not start");
   }
 
-  int position = 0;
-  int ret;
-  
-  do {
-    ret = httpd_req_recv(req, image_buffer + position, sz - position);
+  size_t remaining = req->content_len;
+  bool ok = true;
+
+  while (remaining > 0 && ok) {
+    int ret = httpd_req_recv(req, (char *) body_chunk, remaining < BODY_CHUNK ? remaining : BODY_CHUNK);
 
-    if (ret < 0) {
-      /* Check if timeout occurred */
+    if (ret <= 0) {
       if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
-          /* In case of timeout one can choose to retry calling
-            * httpd_req_recv(), but to keep it simple, here we
-            * respond with an HTTP 408 (Request Timeout) error */
-          httpd_resp_send_408(req);
+        httpd_resp_send_408(req);
       }
-      /* In case of error, returning ESP_FAIL will
-        * ensure that the underlying socket is closed */
-      return ESP_FAIL;
+      ok = false;
+      break;
     }
-    position += ret;
-  } while (ret > 0);
-
-
-  struct message event = {
-    .type = ANIMATE,
-    .http_animation = {
-      .repeat = 1,
-      .buffer = image_buffer
-    }
-  };
-  QueueHandle_t led_event_queue = (QueueHandle_t) req->user_ctx;
-  xQueueSend((QueueHandle_t) led_event_queue, &event, 100);
+    remaining -= ret;
+    /* Waits for credit: meanwhile TCP holds the client back */
+    ok = http_stream_feed(body_chunk, ret);
+  }
 
+  unsigned int columns = http_stream_end(!ok);
+  if (!ok) {
+    /* In case of error, returning ESP_FAIL will
+      * ensure that the underlying socket is closed */
+    return ESP_FAIL;
+  }
 
-  printf("OK\n");
-  return httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+  char resp[32];
+  snprintf(resp, sizeof(resp), "OK %u\n", columns);
+  return httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
 }
 
 /* URI handler structure for GET / */
@@ -128,6 +137,7 @@ void start_webserver(QueueHandle_t led_event_queue) {
   config.uri_match_fn = httpd_uri_match_wildcard;
   httpd_handle_t server = NULL;
 
+  http_stream_init(led_event_queue);
 
   httpd_uri_t uri_animate_post = {
       .uri      = "/animate",
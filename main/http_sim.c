@@ -0,0 +1,243 @@
+#include "http.h"
+#include "http_stream.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_timer.h"
+
+/*
+ * Host stand-in for the web server: POST /animate on localhost, one request
+ * per connection, handled by the same code as on the ESP32 (http_stream.h),
+ * e.g.
+ *
+ *   curl --data-binary @columns.bin 'http://127.0.0.1:8080/animate?speed=60'
+ *
+ * Like the ESP's server, it needs a Content-Length. Sockets are polled
+ * without blocking so the FreeRTOS POSIX port keeps scheduling the LED task.
+ */
+
+#define SIM_DEFAULT_HTTP_PORT 8080
+#define SIM_MAX_HEADERS 2048
+#define SIM_BODY_CHUNK 1460
+#define SIM_RECV_TIMEOUT_MS 5000
+
+static const char *TAG = "pixelstick-http";
+
+static int http_listen(void)
+{
+  int port = SIM_DEFAULT_HTTP_PORT;
+  const char *env = getenv("PIXELSTICK_SIM_HTTP_PORT");
+  if (env)
+  {
+    port = atoi(env);
+  }
+
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0)
+  {
+    ESP_LOGE(TAG, "Unable to create socket");
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(port),
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 1) < 0)
+  {
+    ESP_LOGE(TAG, "Unable to listen on port %d", port);
+    close(sock);
+    return -1;
+  }
+
+  fcntl(sock, F_SETFL, O_NONBLOCK);
+  ESP_LOGI(TAG, "Simulated web server listening on 127.0.0.1:%d", port);
+  return sock;
+}
+
+// Receives up to len bytes, waiting for some; 0 when the client is gone or silent
+static int http_recv(int fd, char *buf, size_t len)
+{
+  for (int waited_ms = 0; waited_ms < SIM_RECV_TIMEOUT_MS;)
+  {
+    int ret = recv(fd, buf, len, 0);
+    if (ret >= 0)
+    {
+      return ret;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+      return 0;
+    }
+    vTaskDelay(1);
+    waited_ms += portTICK_PERIOD_MS;
+  }
+  return 0;
+}
+
+static void http_respond(int fd, const char *status, const char *body)
+{
+  char response[256];
+  int len = snprintf(response, sizeof(response),
+                     "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %u\r\nConnection: close\r\n\r\n%s",
+                     status, (unsigned int)strlen(body), body);
+  send(fd, response, len, MSG_NOSIGNAL);
+}
+
+// Value of a header, NULL when missing; headers end with a blank line
+static const char *http_header(const char *headers, const char *name)
+{
+  size_t name_len = strlen(name);
+
+  for (const char *line = strstr(headers, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n"))
+  {
+    if (strncasecmp(line + 2, name, name_len) == 0 && line[2 + name_len] == ':')
+    {
+      return line + 2 + name_len + 1 + strspn(line + 2 + name_len + 1, " ");
+    }
+  }
+  return NULL;
+}
+
+static void http_handle(int fd)
+{
+  static char request[SIM_MAX_HEADERS + 1];
+  size_t received = 0;
+  char *body;
+
+  // Request line and headers, and maybe the start of the body
+  while (true)
+  {
+    request[received] = '\0';
+    body = strstr(request, "\r\n\r\n");
+    if (body != NULL)
+    {
+      break;
+    }
+    int ret = received < SIM_MAX_HEADERS ? http_recv(fd, request + received, SIM_MAX_HEADERS - received) : 0;
+    if (ret <= 0)
+    {
+      http_respond(fd, "400 Bad Request", "bad request\n");
+      return;
+    }
+    received += ret;
+  }
+  body += 4;
+  size_t body_received = request + received - body;
+  body[-2] = '\0';
+  const char *length = http_header(request, "Content-Length");
+  size_t content_len = length ? strtoul(length, NULL, 10) : 0;
+
+  // POST /animate?query HTTP/1.1
+  char *target = request + strcspn(request, " ");
+  target += *target == ' ';
+  target[strcspn(target, " \r")] = '\0';
+  char *query = strchr(target, '?');
+  if (query != NULL)
+  {
+    *query++ = '\0';
+  }
+  if (strncmp(request, "POST ", 5) != 0 || strcmp(target, "/animate") != 0)
+  {
+    http_respond(fd, "404 Not Found", "not found\n");
+    return;
+  }
+
+  struct http_stream_params params;
+  if (!http_stream_parse_query(query != NULL ? query : "", &params))
+  {
+    http_respond(fd, "400 Bad Request", "bad parameters\n");
+    return;
+  }
+  if (content_len == 0)
+  {
+    http_respond(fd, "411 Length Required", "Content-Length required\n");
+    return;
+  }
+  switch (http_stream_begin(&params, content_len))
+  {
+  case HTTP_STREAM_BEGUN:
+    break;
+  case HTTP_STREAM_BUSY:
+    http_respond(fd, "503 Service Unavailable", "busy\n");
+    return;
+  default:
+    http_respond(fd, "500 Internal Server Error", "could not start\n");
+    return;
+  }
+
+  int64_t t_begin = esp_timer_get_time();
+  bool ok = http_stream_feed((const uint8_t *)body, body_received < content_len ? body_received : content_len);
+  size_t remaining = body_received < content_len ? content_len - body_received : 0;
+  static uint8_t chunk[SIM_BODY_CHUNK];
+
+  while (remaining > 0 && ok)
+  {
+    int ret = http_recv(fd, (char *)chunk, remaining < sizeof(chunk) ? remaining : sizeof(chunk));
+    if (ret <= 0)
+    {
+      ok = false;
+      break;
+    }
+    remaining -= ret;
+    ok = http_stream_feed(chunk, ret);
+  }
+
+  unsigned int columns = http_stream_end(!ok);
+  int64_t elapsed_us = esp_timer_get_time() - t_begin;
+  ESP_LOGI(TAG, "Received %u columns (%u bytes) in %u ms", columns, (unsigned int)(content_len - remaining),
+           (unsigned int)(elapsed_us / 1000));
+  if (ok)
+  {
+    char response[32];
+    snprintf(response, sizeof(response), "OK %u\n", columns);
+    http_respond(fd, "200 OK", response);
+  }
+}
+
+static void http_sim_task(void *arg)
+{
+  int server_fd = http_listen();
+
+  if (server_fd < 0)
+  {
+    vTaskDelete(NULL);
+    return;
+  }
+
+  while (true)
+  {
+    int client_fd = accept(server_fd, NULL, NULL);
+    if (client_fd < 0)
+    {
+      vTaskDelay(1);
+      continue;
+    }
+
+    fcntl(client_fd, F_SETFL, O_NONBLOCK);
+    http_handle(client_fd);
+    close(client_fd);
+  }
+}
+
+void start_webserver(QueueHandle_t led_event_queue)
+{
+  http_stream_init(led_event_queue);
+
+  xTaskCreatePinnedToCore(http_sim_task, "http_sim", configMINIMAL_STACK_SIZE * 5,
+                          NULL, 5, NULL, NET_CORE);
+}
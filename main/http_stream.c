@@ -0,0 +1,283 @@
+#include "http_stream.h"
+#include "column_ring.h"
+#include "bmp.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <freertos/task.h>
+
+// A credit comes at least once per played or stored column
+#define HTTP_STREAM_CREDIT_TIMEOUT_MS 5000
+
+static const char *TAG = "pixelstick-http";
+
+static const struct
+{
+  const char *name;
+  enum pixel_format format;
+} format_names[] = {
+    {"rgb888", PIXEL_FORMAT_RGB888},
+    {"rgb565", PIXEL_FORMAT_RGB565},
+    {"rgb444", PIXEL_FORMAT_RGB444},
+};
+
+static QueueHandle_t led_event_queue;
+// Task waiting for credit, and the column limit last granted
+static TaskHandle_t _Atomic waiter;
+static atomic_uint limit;
+
+static struct
+{
+  bool bmp;
+  bool rgb888;
+  unsigned int column_bytes; // in the body
+  unsigned int sent;         // columns pushed into the ring
+  unsigned int received;     // bytes of the column being received
+  uint8_t *column;           // ring slot or packed column being filled, NULL while dropping one
+  bool failed;
+} stream;
+
+static uint8_t packed[COLUMN_BYTES];
+
+void http_stream_init(QueueHandle_t queue)
+{
+  led_event_queue = queue;
+}
+
+// Value of key in a query string of key=value pairs joined by '&', NULL when missing
+static const char *query_value(const char *query, const char *key, size_t *len)
+{
+  size_t key_len = strlen(key);
+
+  for (const char *p = query; p != NULL && *p != '\0'; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL)
+  {
+    if (strncmp(p, key, key_len) == 0 && p[key_len] == '=')
+    {
+      const char *value = p + key_len + 1;
+      *len = strcspn(value, "&");
+      return value;
+    }
+  }
+  return NULL;
+}
+
+bool http_stream_parse_query(const char *query, struct http_stream_params *params)
+{
+  const char *value;
+  size_t len;
+  char *end;
+
+  *params = (struct http_stream_params){.speed = 30, .format = PIXEL_FORMAT_RGB888};
+
+  if ((value = query_value(query, "speed", &len)) != NULL)
+  {
+    params->speed = strtoul(value, &end, 10);
+    if (end != value + len || params->speed < 1 || params->speed > UINT16_MAX)
+    {
+      return false;
+    }
+  }
+  if ((value = query_value(query, "store", &len)) != NULL)
+  {
+    params->store = len == 1 && value[0] == '1';
+  }
+  if ((value = query_value(query, "hash", &len)) != NULL)
+  {
+    params->hash = strtoull(value, &end, 16);
+    if (end != value + len)
+    {
+      return false;
+    }
+  }
+  if ((value = query_value(query, "format", &len)) != NULL)
+  {
+    // Files are transposed into the library, they cannot be played as they come
+    params->bmp = len == 3 && strncmp(value, "bmp", 3) == 0;
+    if (params->bmp)
+    {
+      return params->store;
+    }
+    for (unsigned int i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++)
+    {
+      if (strlen(format_names[i].name) == len && strncmp(value, format_names[i].name, len) == 0)
+      {
+        params->format = format_names[i].format;
+        return true;
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+enum http_stream_begin_result http_stream_begin(const struct http_stream_params *params, size_t body_bytes)
+{
+  // The pixel format and the ring are the streaming transport's
+  if (!column_ring_claim(SOURCE_HTTP))
+  {
+    ESP_LOGW(TAG, "Another transport is streaming");
+    return HTTP_STREAM_BUSY;
+  }
+
+  memset(&stream, 0, sizeof(stream));
+  stream.bmp = params->bmp;
+  if (stream.bmp)
+  {
+    stream.column_bytes = COLUMN_BYTES;
+  }
+  else
+  {
+    pixel_format_set(params->format);
+    stream.column_bytes = pixel_format_info()->column_bytes;
+    stream.rgb888 = params->format == PIXEL_FORMAT_RGB888;
+  }
+
+  // No credit until the LED task takes the animation
+  atomic_store(&limit, 0);
+  ulTaskNotifyTake(pdTRUE, 0);
+  atomic_store(&waiter, xTaskGetCurrentTaskHandle());
+
+  struct message event;
+  struct animate_begin_block begin = {
+      .animation_speed = params->speed,
+      .first_column = column_ring_count(),
+      .source = SOURCE_HTTP,
+  };
+  if (params->store)
+  {
+    event.type = STORE_BEGIN;
+    event.store_begin.begin = begin;
+    event.store_begin.hash = params->hash;
+    event.store_begin.columns = stream.bmp ? 0 : body_bytes / stream.column_bytes;
+    event.store_begin.format = stream.bmp ? BMP_UPLOAD_FORMAT : params->format;
+  }
+  else
+  {
+    event.type = ANIMATE_BEGIN;
+    event.animate_begin = begin;
+  }
+  if (xQueueSend(led_event_queue, &event, 100) != pdTRUE)
+  {
+    atomic_store(&waiter, NULL);
+    column_ring_unclaim(SOURCE_HTTP);
+    return HTTP_STREAM_FAILED;
+  }
+  ESP_LOGI(TAG, "Streaming %u bytes at %u columns/s", (unsigned int)body_bytes, params->speed);
+  return HTTP_STREAM_BEGUN;
+}
+
+static bool http_stream_wait_credit(void)
+{
+  while (stream.sent >= atomic_load_explicit(&limit, memory_order_acquire))
+  {
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HTTP_STREAM_CREDIT_TIMEOUT_MS)) == 0 &&
+        stream.sent >= atomic_load_explicit(&limit, memory_order_acquire))
+    {
+      ESP_LOGE(TAG, "no credit for column %u", stream.sent);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void http_stream_column_end(void)
+{
+  if (stream.bmp)
+  {
+    if (stream.column)
+    {
+      column_ring_commit();
+    }
+  }
+  else if (!stream.rgb888)
+  {
+    if (!column_ring_push(packed))
+    {
+      ESP_LOGE(TAG, "column ring full, column dropped");
+    }
+  }
+  else if (stream.column)
+  {
+    column_ring_commit_rgb();
+  }
+  stream.received = 0;
+  stream.sent++;
+}
+
+bool http_stream_feed(const uint8_t *data, size_t len)
+{
+  while (len > 0 && !stream.failed)
+  {
+    if (stream.received == 0)
+    {
+      if (!http_stream_wait_credit())
+      {
+        stream.failed = true;
+        break;
+      }
+      // Raw columns and file chunks go straight into the ring, others are expanded once complete
+      stream.column = stream.bmp || stream.rgb888 ? column_ring_acquire() : packed;
+      if (stream.column == NULL)
+      {
+        ESP_LOGE(TAG, "column ring full, column dropped");
+      }
+    }
+
+    size_t n = stream.column_bytes - stream.received;
+    if (n > len)
+    {
+      n = len;
+    }
+    if (stream.column)
+    {
+      memcpy(stream.column + stream.received, data, n);
+    }
+    data += n;
+    len -= n;
+    stream.received += n;
+
+    if (stream.received == stream.column_bytes)
+    {
+      http_stream_column_end();
+    }
+  }
+  return !stream.failed;
+}
+
+unsigned int http_stream_end(bool aborted)
+{
+  if (stream.received > 0)
+  {
+    if (stream.bmp && !aborted)
+    {
+      // The end of the file
+      http_stream_column_end();
+    }
+    else
+    {
+      ESP_LOGE(TAG, "short column: %u bytes", stream.received);
+    }
+  }
+  atomic_store(&waiter, NULL);
+
+  struct message event = {
+      .type = ANIMATE_END,
+      .animate_end = {
+          .aborted = aborted || stream.failed,
+          .source = SOURCE_HTTP,
+      },
+  };
+  xQueueSend(led_event_queue, &event, 100);
+  column_ring_unclaim(SOURCE_HTTP);
+  return stream.sent;
+}
+
+void http_stream_ack(unsigned int v)
+{
+  atomic_store_explicit(&limit, v, memory_order_release);
+  TaskHandle_t task = atomic_load(&waiter);
+  if (task != NULL)
+  {
+    xTaskNotifyGive(task);
+  }
+}
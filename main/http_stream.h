@@ -0,0 +1,55 @@
+#ifndef __HTTP_STREAM_H_
+#define __HTTP_STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "pixel_format.h"
+
+/*
+ * Body of a POST /animate, streamed into the column ring as it arrives:
+ * columns packed in the given pixel format, back to back, or with
+ * format=bmp a BMP file for the library (see bmp.h). Query parameters:
+ *
+ *   speed=1..65535  columns/s, 30 by default
+ *   format=rgb888|rgb565|rgb444|bmp
+ *   store=1         upload to the library instead of playing
+ *   hash=<hex>      name of the image in the library
+ *
+ * Columns take credits like over Bluetooth: the LED task grants them with
+ * http_stream_ack(), and the server's task waits for them before reading
+ * on, so TCP holds the client back while the ring is full.
+ */
+
+struct http_stream_params
+{
+  unsigned int speed;
+  enum pixel_format format;
+  bool bmp;
+  bool store;
+  uint64_t hash;
+};
+
+void http_stream_init(QueueHandle_t led_event_queue);
+// Returns false on an unknown parameter or value
+bool http_stream_parse_query(const char *query, struct http_stream_params *params);
+
+enum http_stream_begin_result
+{
+  HTTP_STREAM_BEGUN,
+  HTTP_STREAM_BUSY, // another transport streams (503)
+  HTTP_STREAM_FAILED
+};
+
+// Called from the server's task; false once the stream failed. Unless
+// http_stream_begin() failed, http_stream_end() must follow.
+enum http_stream_begin_result http_stream_begin(const struct http_stream_params *params, size_t body_bytes);
+bool http_stream_feed(const uint8_t *data, size_t len);
+// Returns the number of columns (or file chunks) streamed
+unsigned int http_stream_end(bool aborted);
+
+// Called from the LED task
+void http_stream_ack(unsigned int limit);
+
+#endif
@@ -4,8 +4,22 @@
 #include <freertos/task.h>
 #include "led_strip.h"
 #include "bt.h"
+#include "http_stream.h"
+#include "udp_stream.h"
+#include "scheduler.h"
+#include "column_ring.h"
+#include "column_codec.h"
+#include "lzss.h"
+#include "column_cache.h"
+#include "column_store.h"
+#include "bmp.h"
+#include "flow.h"
 
 #include "esp_timer.h"
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 static const char *TAG = "pixelstick-led";
 
@@ -16,16 +30,43 @@ enum led_state_kind
   CONNECTED,
   TO_BLACK,
   BLACK,
-  IN_ANIMATION
+  IN_ANIMATION,
+  RECORDING,
+  STORED_PLAYBACK
 };
 
 struct animation_block
 {
   unsigned int step;
   unsigned int max_position;
+  unsigned int first_column;
   unsigned int animation_speed;
   bool streaming_ended;
-  int ack_frame;
+  bool started;
+  enum column_source source;
+  struct flow_control flow;
+  int64_t t_begin;
+  unsigned int underruns;
+};
+
+struct recording_block
+{
+  unsigned int step;
+  unsigned int first_column;
+  bool streaming_ended;
+  bool failed;
+  bool bmp; // the ring holds chunks of a BMP file, not columns
+  enum column_source source;
+  struct flow_control flow;
+  int64_t t_begin;
+};
+
+struct stored_playback_block
+{
+  unsigned int step;
+  unsigned int columns;
+  unsigned int animation_speed;
+  int64_t t_begin;
 };
 
 struct waiting_for_connection_block
@@ -43,19 +84,269 @@ struct led_state
     struct waiting_for_connection_block waiting_for_connection;
     unsigned int connected_step;
     struct animation_block animation;
+    struct recording_block recording;
+    struct stored_playback_block stored_playback;
   };
 };
 
 #define CONFIG_EXAMPLE_RMT_TX_GPIO 5
 #define RMT_TX_CHANNEL 0
 
-#define MAX_COL 64
-#define COLUMN_BYTES (LED_COUNT * 3)
-#define PIXEL_BUFFER_SIZE (MAX_COL * COLUMN_BYTES)
-static char pixel_buffer[PIXEL_BUFFER_SIZE];
+// Data line of each strip segment, in pixel order. Segments are refreshed in parallel,
+// so splitting the stick in N segments divides the refresh time by N.
+static const uint32_t strip_segment_gpios[] = {CONFIG_EXAMPLE_RMT_TX_GPIO};
+#define STRIP_SEGMENT_COUNT (sizeof(strip_segment_gpios) / sizeof(strip_segment_gpios[0]))
+// Drive the segments from the I2S/LCD parallel bus instead of one RMT channel each,
+// which allows up to 16 segments and costs a single DMA transfer per frame
+#define STRIP_USE_LCD_BUS 0
+#define STRIP_LCD_WR_GPIO 18 // word clock, not connected
+#define STRIP_LCD_DC_GPIO 19 // data/command, not connected
+// Clocked APA102/SK9822 strip on SPI instead of WS2812: data on the first segment GPIO.
+// Shifting at 10 MHz refreshes the whole stick in about 1.1 ms.
+#define STRIP_USE_SPI 0
+#define STRIP_SPI_CLK_GPIO 18
+// Feed the RMT from DMA where the chip supports it, so a refresh takes a handful of interrupts instead of one per memory refill
+#if CONFIG_SOC_RMT_SUPPORT_DMA
+#define STRIP_RMT_WITH_DMA true
+#else
+#define STRIP_RMT_WITH_DMA false
+#endif
+
+// Columns are received in the ring's slots and flushed from there without any copy
+#define MAX_COL COLUMN_RING_SLOTS
+// Rate sizing the flow control window of uploads, about what flash writes sustain
+#define STORE_UPLOAD_RATE 200
+
+// Paces the columns of the current animation
+static struct column_scheduler column_scheduler;
+
+#if CONFIG_IDF_TARGET_LINUX
+// Index of the first virtual strip frame of the current animation
+static uint32_t sim_first_frame;
+#endif
+
+// Timing of the columns and what the strip went through, for any playback
+static void playback_report(led_strip_handle_t strip)
+{
+  // Lateness of each column's refresh start against its slot on the grid
+  static const int64_t jitter_bounds[] = SCHEDULER_JITTER_BUCKET_BOUNDS;
+  struct scheduler_stats *jitter = &column_scheduler.stats;
+  char histogram[160];
+  int length = 0;
+  for (int i = 0; i < SCHEDULER_JITTER_BUCKETS; i++)
+  {
+    if (i < SCHEDULER_JITTER_BUCKETS - 1)
+    {
+      length += snprintf(histogram + length, sizeof(histogram) - length, " <=%" PRId64 "us:%u", jitter_bounds[i], jitter->histogram[i]);
+    }
+    else
+    {
+      length += snprintf(histogram + length, sizeof(histogram) - length, " more:%u", jitter->histogram[i]);
+    }
+  }
+  ESP_LOGI(TAG, "Column jitter: mean %" PRId64 " us, max %" PRId64 " us, %u resyncs,%s",
+           jitter->columns > 0 ? jitter->total_jitter_us / jitter->columns : 0,
+           jitter->max_jitter_us,
+           jitter->resyncs,
+           histogram);
+
+#if CONFIG_IDF_TARGET_LINUX
+  led_strip_virtual_stats_t stats;
+  ESP_ERROR_CHECK(led_strip_virtual_get_stats(strip, &stats));
+
+  const char *path = getenv("PIXELSTICK_SIM_PNG");
+  if (path && stats.frames > sim_first_frame &&
+      led_strip_virtual_dump_png(strip, path, sim_first_frame, stats.frames - sim_first_frame) == ESP_OK)
+  {
+    ESP_LOGI(TAG, "Light painting written to %s", path);
+  }
+#elif !STRIP_USE_LCD_BUS && !STRIP_USE_SPI
+  led_strip_rmt_stats_t stats;
+  ESP_ERROR_CHECK(led_strip_rmt_get_stats(strip, &stats));
+  ESP_LOGI(TAG, "RMT encoder: %" PRIu32 " calls/frame (max %" PRIu32 "), %" PRIu32 " cycles encoding/frame, longest call %" PRIu32 " cycles",
+           stats.encoder_calls, stats.max_encoder_calls, stats.encode_cycles, stats.max_encode_cycles);
+#endif
+}
+
+static void animation_report(struct animation_block *animation, led_strip_handle_t strip)
+{
+  int64_t elapsed_us = esp_timer_get_time() - animation->t_begin;
+  struct column_ring_stats ring;
+  column_ring_get_stats(&ring);
+
+  ESP_LOGI(TAG,
+           "Played %u columns in %" PRId64 " ms (%" PRId64 " col/s), %u underruns, %u ns/column ingest, %u dropped",
+           animation->step,
+           elapsed_us / 1000,
+           elapsed_us > 0 ? (int64_t)animation->step * 1000000 / elapsed_us : 0,
+           animation->underruns,
+           ring.pushed > 0 ? ring.ingest_us * 1000 / ring.pushed : 0,
+           ring.dropped);
+
+  ESP_LOGI(TAG, "Flow: %u acks, window %u columns, ACK round trip %" PRId64 " ms",
+           animation->flow.acks,
+           animation->flow.window,
+           animation->flow.rtt_us / 1000);
+
+  struct column_decoder_stats coded;
+  column_decoder_get_stats(&coded);
+  if (coded.columns > 0)
+  {
+    ESP_LOGI(TAG, "Coded: %u columns, %u bytes/column (%u.%02ux), %u ns/column decode, %u errors",
+             coded.columns,
+             coded.bytes / coded.columns,
+             (unsigned int)((uint64_t)coded.columns * COLUMN_BYTES / coded.bytes),
+             (unsigned int)((uint64_t)coded.columns * COLUMN_BYTES * 100 / coded.bytes % 100),
+             (unsigned int)((uint64_t)coded.decode_us * 1000 / coded.columns),
+             coded.errors);
+  }
+
+  struct lzss_stats lz;
+  lzss_get_stats(&lz);
+  if (lz.bytes_in > 0)
+  {
+    ESP_LOGI(TAG, "LZSS: %u -> %u bytes, %u KB/s decode, %u errors",
+             lz.bytes_in,
+             lz.bytes_out,
+             lz.decode_us > 0 ? (unsigned int)((uint64_t)lz.bytes_out * 1000 / lz.decode_us) : 0,
+             lz.errors);
+  }
+
+  struct column_cache_stats cached;
+  column_cache_get_stats(&cached);
+  if (cached.bytes > 0)
+  {
+    ESP_LOGI(TAG, "Cached: %u columns in %u bytes, %u stored, %u errors",
+             cached.columns,
+             cached.bytes,
+             cached.stored,
+             cached.errors);
+  }
+
+  struct bt_tx_stats tx;
+  bt_get_tx_stats(&tx);
+  ESP_LOGI(TAG, "BT: %u acks sent of %u requested, %u congestions, ACK latency mean %" PRId64 " us, max %" PRId64 " us",
+           tx.acks_sent,
+           tx.acks_requested,
+           tx.congestions,
+           tx.acks_sent > 0 ? tx.total_ack_latency_us / tx.acks_sent : 0,
+           tx.max_ack_latency_us);
+
+  playback_report(strip);
+}
+
+static void recording_report(struct recording_block *recording)
+{
+  int64_t elapsed_us = esp_timer_get_time() - recording->t_begin;
+  struct column_store_stats store;
+  column_store_get_stats(&store);
+
+  ESP_LOGI(TAG,
+           "Stored %u columns in %" PRId64 " ms (%" PRId64 " col/s), %u sectors erased in %u ms, %u ms writing, %u acks, %u images dropped",
+           store.columns,
+           elapsed_us / 1000,
+           elapsed_us > 0 ? (int64_t)store.columns * 1000000 / elapsed_us : 0,
+           store.sectors_erased,
+           store.erase_us / 1000,
+           store.write_us / 1000,
+           recording->flow.acks,
+           store.evicted);
+
+  if (recording->bmp)
+  {
+    struct bmp_stats bmp;
+    bmp_get_stats(&bmp);
+    ESP_LOGI(TAG, "BMP: %ux%u pixels, %u bands transposed in %u ms",
+             bmp.width, bmp.height, bmp.bands, bmp.transpose_us / 1000);
+  }
+}
+
+static void stored_playback_report(struct stored_playback_block *playback, led_strip_handle_t strip)
+{
+  int64_t elapsed_us = esp_timer_get_time() - playback->t_begin;
+
+  ESP_LOGI(TAG, "Played %u stored columns in %" PRId64 " ms (%" PRId64 " col/s)",
+           playback->step,
+           elapsed_us / 1000,
+           elapsed_us > 0 ? (int64_t)playback->step * 1000000 / elapsed_us : 0);
+
+  playback_report(strip);
+}
+
+unsigned int led_max_column_rate(void)
+{
+#if STRIP_USE_SPI && !CONFIG_IDF_TARGET_LINUX
+  // Start frame, 4 bytes per pixel, end frame and the extra clocks latching the last pixels, at 10 MHz
+  unsigned int refresh_us = (4 + LED_COUNT * 4 + 4 + (LED_COUNT + 15) / 16) * 8 / 10;
+#else
+  // 30 us per WS2812 pixel in the longest segment, then the 50 us latch
+  unsigned int segment_pixels = (LED_COUNT + STRIP_SEGMENT_COUNT - 1) / STRIP_SEGMENT_COUNT;
+  unsigned int refresh_us = segment_pixels * 30 + 50;
+#endif
+  return 1000000 / refresh_us;
+}
+
+// Grants credit to the transport the columns come from
+static void ack(enum column_source source, unsigned int limit)
+{
+  switch (source)
+  {
+  case SOURCE_HTTP:
+    http_stream_ack(limit);
+    break;
+  case SOURCE_UDP:
+    udp_stream_ack(limit);
+    break;
+  default:
+    bt_ack(limit);
+    break;
+  }
+}
+
+// Gives back the slots of played columns but for the last one shown, which may still be shifting out
+static void animation_release(struct animation_block *animation)
+{
+  if (animation->step > 0)
+  {
+    column_ring_release(animation->first_column + animation->step - 1);
+  }
+}
+
+// Drops what a transport was streaming: columns still in the ring, and the images an upload had made room in
+static void streaming_drop(struct led_state *state)
+{
+  if (state->kind == RECORDING)
+  {
+    column_ring_release(column_ring_count());
+    column_store_abort();
+  }
+  else
+  {
+    animation_release(&state->animation);
+  }
+}
+
+// Leaves a stream the transport has not ended: with credit it can never use up, it sends the rest without
+// waiting, every column of it dropped, and ends
+static void streaming_abandon(struct led_state *state)
+{
+  streaming_drop(state);
+  ack(state->kind == RECORDING ? state->recording.source : state->animation.source, UINT_MAX);
+}
 
-void render(struct led_state *state, led_strip_handle_t strip)
+// Unmaps the stored animation once the strip is done shifting out its last column
+static void stored_playback_close(led_strip_handle_t strip)
 {
+  ESP_ERROR_CHECK(led_strip_wait_refresh_done(strip, -1));
+  column_store_close();
+}
+
+// Returns the wire-order buffer to flush, or NULL to flush the strip's own pixels
+const uint8_t *render(struct led_state *state, led_strip_handle_t strip)
+{
+  // Whole-strip patterns, set with a single call
+  static uint8_t pattern[LED_COUNT * 3];
+  const uint8_t *frame = NULL;
   int index;
 
   // ANIMATION
@@ -92,19 +383,16 @@ void render(struct led_state *state, led_strip_handle_t strip)
   case WAITING_FOR_CONNECTION:
 
     index = state->waiting_for_connection.step;
+    memset(pattern, 0, sizeof(pattern));
     for (int i = 0; i < LED_COUNT; i++)
     {
       if (abs(i * 5 - index) < 50)
       {
         int dist = abs(i * 5 - index);
-        int ofs = 4 * (50 - dist);
-        ESP_ERROR_CHECK(led_strip_set_pixel(strip, i, ofs, 0, 0));
-      }
-      else
-      {
-        ESP_ERROR_CHECK(led_strip_set_pixel(strip, i, 0, 0, 0));
+        pattern[i * 3] = 4 * (50 - dist);
       }
     }
+    ESP_ERROR_CHECK(led_strip_set_pixels(strip, 0, LED_COUNT, pattern, LED_STRIP_COLOR_ORDER_RGB));
 
     if (state->waiting_for_connection.direction_forward)
     {
@@ -153,69 +441,118 @@ void render(struct led_state *state, led_strip_handle_t strip)
     break;
 
   case TO_BLACK:
-    for (int i = 0; i < LED_COUNT; i++)
-    {
-      ESP_ERROR_CHECK(led_strip_set_pixel(strip, i, 0, 0, 0));
-    }
+    memset(pattern, 0, sizeof(pattern));
+    ESP_ERROR_CHECK(led_strip_set_pixels(strip, 0, LED_COUNT, pattern, LED_STRIP_COLOR_ORDER_RGB));
     state->kind = BLACK;
     break;
 
   case IN_ANIMATION:;
-    int column = state->animation.step % MAX_COL;
-    int planned_buffering_delta =
-        (MAX_COL + state->animation.ack_frame - column) % MAX_COL;
+    unsigned int received = column_ring_count() - state->animation.first_column;
+    state->animation.max_position = received;
 
-    int actual_buffering_delta =
-        (MAX_COL + state->animation.max_position - column) % MAX_COL;
-
-    if (actual_buffering_delta < 8 && !state->animation.streaming_ended)
+    if (!state->animation.streaming_ended)
     {
-      // ACK
-      if (planned_buffering_delta < 8)
+      unsigned int limit = flow_update(&state->animation.flow, received, state->animation.step, esp_timer_get_time());
+      if (limit > 0)
       {
-        bt_ack(32 - planned_buffering_delta);
-        state->animation.ack_frame = state->animation.ack_frame + 32 - planned_buffering_delta;
+        ack(state->animation.source, limit);
       }
     }
-    else
-    {
-      int base;
-      char r, g, b;
 
-      if (planned_buffering_delta < 32 - 8 && !state->animation.streaming_ended)
+    if (!state->animation.started)
+    {
+      // Fill the window once before playing, then play as long as a column is buffered
+      if (received < state->animation.flow.window && !state->animation.streaming_ended)
       {
-        // ACK
-        bt_ack(32 - planned_buffering_delta);
-        state->animation.ack_frame = state->animation.ack_frame + 32 - planned_buffering_delta;
+        break;
       }
+      state->animation.started = true;
+      state->animation.t_begin = esp_timer_get_time();
+      scheduler_start(&column_scheduler, 1000000 / state->animation.animation_speed);
+    }
 
-      if (column == state->animation.max_position % MAX_COL)
+    if (state->animation.step == received)
+    {
+      if (state->animation.streaming_ended)
       {
+        animation_report(&state->animation, strip);
+        animation_release(&state->animation);
         state->kind = TO_BLACK;
       }
       else
       {
-        for (int i = 0; i < LED_COUNT; i++)
-        {
-          base = (column * LED_COUNT + i) * 3;
-          r = pixel_buffer[base];
-          g = pixel_buffer[base + 1];
-          b = pixel_buffer[base + 2];
+        state->animation.underruns++;
 
-          ESP_ERROR_CHECK(led_strip_set_pixel(strip, i, r, g, b));
+        // Keep showing the last column while waiting for data
+        if (state->animation.step > 0)
+        {
+          frame = column_ring_slot(state->animation.first_column + state->animation.step - 1);
         }
+      }
+    }
+    else
+    {
+      frame = column_ring_slot(state->animation.first_column + state->animation.step);
+      animation_release(&state->animation);
+
+      state->animation.step++;
+    }
+
+    break;
+
+  case RECORDING:;
+    // Columns go to flash as fast as it takes them, nothing is shown
+    struct recording_block *recording = &state->recording;
+    unsigned int available = column_ring_count() - recording->first_column;
+
+    for (; recording->step < available; recording->step++)
+    {
+      const uint8_t *slot = column_ring_slot(recording->first_column + recording->step);
+      if (!recording->failed && !(recording->bmp ? bmp_reader_feed(slot, COLUMN_BYTES) : column_store_append(slot)))
+      {
+        ESP_LOGE(TAG, "cannot store column %u, the rest of the upload is dropped", recording->step);
+        recording->failed = true;
+      }
+      column_ring_release(recording->first_column + recording->step + 1);
+    }
 
-        state->animation.step++;
+    if (recording->streaming_ended)
+    {
+      recording_report(recording);
+      if (recording->failed || (recording->bmp && !bmp_reader_end()) || !column_store_commit())
+      {
+        ESP_LOGE(TAG, "Upload failed, nothing stored");
+      }
+      state->kind = TO_BLACK;
+    }
+    else
+    {
+      unsigned int limit = flow_update(&recording->flow, available, recording->step, esp_timer_get_time());
+      if (limit > 0)
+      {
+        ack(recording->source, limit);
       }
     }
+    break;
 
+  case STORED_PLAYBACK:
+    if (state->stored_playback.step == state->stored_playback.columns)
+    {
+      stored_playback_report(&state->stored_playback, strip);
+      stored_playback_close(strip);
+      state->kind = TO_BLACK;
+    }
+    else
+    {
+      frame = column_store_column(state->stored_playback.step++);
+    }
     break;
   }
-}
 
-#include "bmp.h"
+  return frame;
+}
 
-#include "rom/ets_sys.h"
+#include "esp_rom_sys.h"
 
 void led_strip(void *arg)
 {
@@ -226,24 +563,58 @@ void led_strip(void *arg)
       .strip_gpio_num = CONFIG_EXAMPLE_RMT_TX_GPIO, // The GPIO that connected to the LED strip's data line
       .max_leds = LED_COUNT,                        // The number of LEDs in the strip,
       .led_pixel_format = LED_PIXEL_FORMAT_GRB,     // Pixel format of your LED strip
+#if STRIP_USE_SPI
+      .led_model = LED_MODEL_APA102,                // LED strip model
+#else
       .led_model = LED_MODEL_WS2812,                // LED strip model
+#endif
       .flags.invert_out = false,                    // whether to invert the output signal (useful when your hardware has a level inverter)
   };
 
+  led_strip_handle_t strip;
+#if CONFIG_IDF_TARGET_LINUX
+  led_strip_virtual_config_t virtual_config = {
+      .max_frames = 16384,                // enough for about 2 minutes of animation at 128 columns/s
+      .segment_count = STRIP_SEGMENT_COUNT,
+      .flags.simulate_timing = true,      // block in refresh like the RMT driver does
+  };
+  ESP_ERROR_CHECK(led_strip_new_virtual_device(&strip_config, &virtual_config, &strip));
+#elif STRIP_USE_LCD_BUS
+  led_strip_lcd_config_t lcd_config = {
+      .lane_count = STRIP_SEGMENT_COUNT,
+      .wr_gpio_num = STRIP_LCD_WR_GPIO,
+      .dc_gpio_num = STRIP_LCD_DC_GPIO,
+  };
+  for (int i = 0; i < STRIP_SEGMENT_COUNT; i++)
+  {
+    lcd_config.data_gpio_nums[i] = strip_segment_gpios[i];
+  }
+  ESP_ERROR_CHECK(led_strip_new_lcd_device(&strip_config, &lcd_config, &strip));
+#elif STRIP_USE_SPI
+  led_strip_spi_config_t spi_config = {
+      .spi_bus = SPI2_HOST,
+      .clk_gpio_num = STRIP_SPI_CLK_GPIO,
+      .clk_speed_hz = 10 * 1000 * 1000, // 10MHz
+      .global_brightness = 31,          // full brightness, colors are scaled by the app
+      .flags.with_dma = true,
+  };
+  ESP_ERROR_CHECK(led_strip_new_spi_device(&strip_config, &spi_config, &strip));
+#else
   led_strip_rmt_config_t rmt_config = {
-      .clk_src = RMT_CLK_SRC_DEFAULT,    // different clock source can lead to different power consumption
-      .resolution_hz = 10 * 1000 * 1000, // 10MHz
-      .flags.with_dma = false,           // whether to enable the DMA feature
+      .clk_src = RMT_CLK_SRC_DEFAULT,       // different clock source can lead to different power consumption
+      .resolution_hz = 10 * 1000 * 1000,    // 10MHz
+      .mem_block_symbols = 0,               // default: equal share of the RMT memory, or 1024 symbols with DMA
+      .flags.with_dma = STRIP_RMT_WITH_DMA, // whether to enable the DMA feature
   };
-
-  led_strip_handle_t strip;
-  ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &strip));
+  ESP_ERROR_CHECK(led_strip_new_rmt_multi_device(&strip_config, &rmt_config, strip_segment_gpios, STRIP_SEGMENT_COUNT, &strip));
+#endif
   if (!strip)
   {
-    ESP_LOGE(TAG, "install WS2812 driver failed");
+    ESP_LOGE(TAG, "install LED strip driver failed");
   }
   // Clear LED strip (turn off all LEDs)
   ESP_ERROR_CHECK(led_strip_clear(strip));
+  column_store_init();
   // Init
   ESP_LOGI(TAG, "Init");
 
@@ -254,13 +625,14 @@ void led_strip(void *arg)
 
   struct message event;
 
-  int64_t t_last = esp_timer_get_time();
+  scheduler_init();
 
   while (true)
   {
     // 1. Render
-    render(&current_state, strip);
-    ESP_ERROR_CHECK(led_strip_refresh(strip));
+    // The strip shifts the frame out while we handle events and prepare the next one
+    const uint8_t *frame = render(&current_state, strip);
+    ESP_ERROR_CHECK(led_strip_refresh_async(strip, frame));
 
     // 2. Events
     int rcv;
@@ -269,28 +641,53 @@ void led_strip(void *arg)
     {
       budget = 1000000 / current_state.animation.animation_speed / 5000;
     }
+    else if (current_state.kind == STORED_PLAYBACK)
+    {
+      budget = 1000000 / current_state.stored_playback.animation_speed / 5000;
+    }
     else
     {
       budget = 1;
     }
-
-    assert(budget > 0);
+    // Above 200 columns/s there is less than 5 ms per column, still take one event
+    if (budget == 0)
+    {
+      budget = 1;
+    }
 
     while (budget > 0 && (rcv = xQueueReceive(led_event_queue, &event, 0)))
     {
       budget--;
+      enum led_state_kind previous_kind = current_state.kind;
       switch (event.type)
       {
       case WIFI_CONNECTED:
+        if (current_state.kind == STORED_PLAYBACK)
+        {
+          break;
+        }
+        if (current_state.kind == RECORDING || current_state.kind == IN_ANIMATION)
+        {
+          streaming_abandon(&current_state);
+        }
         current_state.kind = CONNECTED;
         current_state.connected_step = 0;
         break;
       case WIFI_DISCONNECTED:
+        if (current_state.kind == STORED_PLAYBACK)
+        {
+          // Stored images play to the end without the radio
+          break;
+        }
         current_state.kind = WAITING_FOR_CONNECTION;
         current_state.waiting_for_connection.step = 0;
         current_state.waiting_for_connection.direction_forward = true;
         break;
       case STOP:
+        if (current_state.kind == RECORDING || current_state.kind == IN_ANIMATION)
+        {
+          streaming_abandon(&current_state);
+        }
         current_state.kind = TO_BLACK;
         break;
       case ANIMATE_BEGIN:
@@ -298,36 +695,129 @@ void led_strip(void *arg)
         current_state.kind = IN_ANIMATION;
         current_state.animation.max_position = 0;
         current_state.animation.step = 0;
-        current_state.animation.animation_speed = event.animation_speed; // between 1 and 200
+        // Columns/s, up to 65535 from the app; a BEGIN without one plays at 1
+        current_state.animation.animation_speed =
+            event.animate_begin.animation_speed > 0 ? event.animate_begin.animation_speed : 1;
+        current_state.animation.first_column = event.animate_begin.first_column;
+        column_ring_release(current_state.animation.first_column);
         current_state.animation.streaming_ended = false;
-        current_state.animation.ack_frame = 0;
+        current_state.animation.started = false;
+        current_state.animation.underruns = 0;
+        current_state.animation.source = event.animate_begin.source;
+        // Two slots stay with the strip: the column being shown and the one before it
+        ack(current_state.animation.source, flow_begin(&current_state.animation.flow, COLUMN_RING_SLOTS - 2,
+                                                       current_state.animation.animation_speed, esp_timer_get_time()));
+        // Paces the wait for the first columns, restarted when playback starts
+        scheduler_start(&column_scheduler, 1000000 / current_state.animation.animation_speed);
+#if CONFIG_IDF_TARGET_LINUX
+        led_strip_virtual_stats_t stats;
+        ESP_ERROR_CHECK(led_strip_virtual_get_stats(strip, &stats));
+        sim_first_frame = stats.frames;
+#endif
+        break;
+      case STORE_BEGIN:
+        ESP_LOGI(TAG, "Storing image %016llx", (unsigned long long)event.store_begin.hash);
+        if (previous_kind == STORED_PLAYBACK)
+        {
+          // Nothing may write to flash while it is played from
+          stored_playback_close(strip);
+        }
+        current_state.kind = RECORDING;
+        current_state.recording.step = 0;
+        current_state.recording.first_column = event.store_begin.begin.first_column;
+        column_ring_release(current_state.recording.first_column);
+        current_state.recording.streaming_ended = false;
+        struct column_store_image image = {
+            .hash = event.store_begin.hash,
+            .columns = event.store_begin.columns,
+            .speed = event.store_begin.begin.animation_speed,
+            .format = event.store_begin.format,
+        };
+        // A BMP upload begins in the store once its header is read
+        current_state.recording.bmp = event.store_begin.format == BMP_UPLOAD_FORMAT;
+        if (current_state.recording.bmp)
+        {
+          bmp_reader_begin(&image);
+          current_state.recording.failed = false;
+        }
+        else
+        {
+          current_state.recording.failed = !column_store_begin(&image);
+        }
+        if (current_state.recording.failed)
+        {
+          ESP_LOGE(TAG, "No room for the image, the upload is dropped");
+        }
+        current_state.recording.t_begin = esp_timer_get_time();
+        current_state.recording.source = event.store_begin.begin.source;
+        ack(current_state.recording.source,
+            flow_begin(&current_state.recording.flow, COLUMN_RING_SLOTS - 2, STORE_UPLOAD_RATE, esp_timer_get_time()));
+        break;
+      case STORE_PLAY:;
+        struct column_store_image info;
+        if (previous_kind == RECORDING ||
+            !column_store_open(event.store_play.by_hash ? &event.store_play.hash : NULL, &info))
+        {
+          ESP_LOGE(TAG, "No such stored image");
+          break;
+        }
+        ESP_LOGI(TAG, "Playing stored image %016llx", (unsigned long long)info.hash);
+        current_state.kind = STORED_PLAYBACK;
+        current_state.stored_playback.step = 0;
+        current_state.stored_playback.columns = info.columns;
+        current_state.stored_playback.animation_speed =
+            event.store_play.animation_speed > 0 ? event.store_play.animation_speed : info.speed;
+        if (current_state.stored_playback.animation_speed == 0)
+        {
+          current_state.stored_playback.animation_speed = 1;
+        }
+        current_state.stored_playback.t_begin = esp_timer_get_time();
+        scheduler_start(&column_scheduler, 1000000 / current_state.stored_playback.animation_speed);
+#if CONFIG_IDF_TARGET_LINUX
+        led_strip_virtual_stats_t stored_stats;
+        ESP_ERROR_CHECK(led_strip_virtual_get_stats(strip, &stored_stats));
+        sim_first_frame = stored_stats.frames;
+#endif
         break;
       case ANIMATE_END:
-        ESP_LOGI(TAG, "Ending animation !");
-        if (event.animate_end_aborted)
+        if (current_state.kind == RECORDING && event.animate_end.source == current_state.recording.source)
+        {
+          ESP_LOGI(TAG, "Ending upload !");
+          if (event.animate_end.aborted)
+          {
+            // Columns still in the ring are dropped, so are the images the upload had made room in
+            ESP_LOGI(TAG, "Upload aborted, nothing stored");
+            streaming_drop(&current_state);
+            current_state.kind = TO_BLACK;
+          }
+          else
+          {
+            current_state.recording.streaming_ended = true;
+          }
+        }
+        else if (current_state.kind == IN_ANIMATION && event.animate_end.source == current_state.animation.source)
         {
-          current_state.kind = TO_BLACK;
+          ESP_LOGI(TAG, "Ending animation !");
+          if (event.animate_end.aborted)
+          {
+            streaming_drop(&current_state);
+            current_state.kind = TO_BLACK;
+          }
+          else
+          {
+            current_state.animation.streaming_ended = true;
+          }
         }
         else
         {
-          current_state.animation.streaming_ended = true;
+          // Nothing this transport streamed is on: stored images play to the end without the radio
         }
         break;
-      case ANIMATE:
-        int col_position = current_state.animation.max_position;
-        current_state.animation.max_position = col_position + 1;
-
-        ESP_LOGI(TAG,
-                 "Feed %d (%d) (%d)",
-                 col_position,
-                 current_state.animation.step,
-                 current_state.animation.ack_frame);
-
-        memcpy(&pixel_buffer[(col_position % MAX_COL) * COLUMN_BYTES], event.http_animation.buffer, COLUMN_BYTES);
-
-        free(event.http_animation.buffer);
+      }
 
-        break;
+      if (previous_kind == STORED_PLAYBACK && current_state.kind != STORED_PLAYBACK)
+      {
+        stored_playback_close(strip);
       }
     }
 
@@ -338,31 +828,20 @@ void led_strip(void *arg)
     case WAITING_FOR_CONNECTION:
     case CONNECTED:
     case TO_BLACK:
-      ets_delay_us(100);
+      esp_rom_delay_us(100);
       break;
 
     case BLACK:
       vTaskDelay(200 / portTICK_PERIOD_MS);
       break;
     case IN_ANIMATION:
-      int64_t t_now = esp_timer_get_time();
-      int64_t t_elapsed = t_now - t_last;
-
-      int64_t pause_time_us = 1000000 / current_state.animation.animation_speed - t_elapsed;
-
-      if (pause_time_us >= 10 * 1000 * portTICK_PERIOD_MS)
-      {
-        vTaskDelay(10 * pause_time_us / (10 * 1000 * portTICK_PERIOD_MS));
-        pause_time_us = pause_time_us % (10 * 1000 * portTICK_PERIOD_MS);
-      }
-
-      if (pause_time_us > 0)
-      {
-        ets_delay_us(pause_time_us);
-      }
-
-      t_last = esp_timer_get_time();
-
+    case STORED_PLAYBACK:
+      // Sleep until the next column is due, the refresh starts right after
+      scheduler_wait(&column_scheduler);
+      break;
+    case RECORDING:
+      // Let the transport fill the ring
+      vTaskDelay(1);
       break;
     }
   }
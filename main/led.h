@@ -6,5 +6,7 @@
 #define LED_COUNT 332
 
 void start_led_strip(QueueHandle_t led_event_queue);
+// Fastest column rate the strip can refresh at, in columns per second
+unsigned int led_max_column_rate(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "lzss.h"
+
+#include <string.h>
+#include "esp_timer.h"
+
+#define WINDOW_MASK (LZSS_WINDOW - 1)
+
+// Only used by the transport task
+static struct
+{
+  lzss_output_t output;
+  uint8_t window[LZSS_WINDOW];
+  unsigned int position; // bytes decoded so far, the window holds the last LZSS_WINDOW
+  unsigned int flushed;  // bytes passed to output so far
+  uint8_t flags;
+  unsigned int tokens;   // tokens left in the current group
+  bool match_started;
+  uint8_t match_high;
+} lzss;
+
+static struct lzss_stats stats;
+static int64_t output_us;
+
+void lzss_reset(lzss_output_t output)
+{
+  memset(&lzss, 0, sizeof(lzss));
+  lzss.output = output;
+  memset(&stats, 0, sizeof(stats));
+}
+
+static void lzss_flush(void)
+{
+  if (lzss.position == lzss.flushed)
+  {
+    return;
+  }
+
+  int64_t t_begin = esp_timer_get_time();
+  unsigned int start = lzss.flushed & WINDOW_MASK;
+  unsigned int len = lzss.position - lzss.flushed;
+
+  stats.bytes_out += len;
+  if (start + len > LZSS_WINDOW)
+  {
+    lzss.output(lzss.window + start, LZSS_WINDOW - start);
+    len -= LZSS_WINDOW - start;
+    start = 0;
+  }
+  lzss.output(lzss.window + start, len);
+  lzss.flushed = lzss.position;
+  output_us += esp_timer_get_time() - t_begin;
+}
+
+void lzss_feed(const uint8_t *data, unsigned int len)
+{
+  int64_t t_begin = esp_timer_get_time();
+  const uint8_t *end = data + len;
+
+  output_us = 0;
+  stats.bytes_in += len;
+
+  while (data < end)
+  {
+    if (lzss.tokens == 0)
+    {
+      lzss.flags = *data++;
+      lzss.tokens = 8;
+      continue;
+    }
+
+    // Pass on decoded bytes before the window wraps over them
+    if (lzss.position - lzss.flushed > LZSS_WINDOW - LZSS_MAX_MATCH)
+    {
+      lzss_flush();
+    }
+
+    if ((lzss.flags & 1) == 0)
+    {
+      lzss.window[lzss.position++ & WINDOW_MASK] = *data++;
+    }
+    else if (!lzss.match_started)
+    {
+      lzss.match_high = *data++;
+      lzss.match_started = true;
+      continue;
+    }
+    else
+    {
+      unsigned int token = (unsigned int)lzss.match_high << 8 | *data++;
+      unsigned int from = lzss.position - (token >> LZSS_LENGTH_BITS) - 1;
+      unsigned int length = (token & ((1 << LZSS_LENGTH_BITS) - 1)) + LZSS_MIN_MATCH;
+
+      // Byte by byte: the match may overlap the bytes it produces
+      for (unsigned int i = 0; i < length; i++)
+      {
+        lzss.window[lzss.position++ & WINDOW_MASK] = lzss.window[from++ & WINDOW_MASK];
+      }
+      lzss.match_started = false;
+    }
+
+    lzss.flags >>= 1;
+    lzss.tokens--;
+  }
+
+  lzss_flush();
+  stats.decode_us += esp_timer_get_time() - t_begin - output_us;
+}
+
+bool lzss_frame_end(void)
+{
+  bool complete = !lzss.match_started;
+
+  if (!complete)
+  {
+    stats.errors++;
+  }
+  lzss.tokens = 0;
+  lzss.match_started = false;
+  return complete;
+}
+
+void lzss_get_stats(struct lzss_stats *out)
+{
+  *out = stats;
+}
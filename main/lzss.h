@@ -0,0 +1,42 @@
+#ifndef __LZSS_H_
+#define __LZSS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Streaming LZSS decoder for MSG_HEADER_PIXEL_LZ frames. Tokens come in
+ * groups of up to 8, each group led by a flag byte, LSB first:
+ *
+ *   flag 0   one literal byte
+ *   flag 1   two bytes, big-endian: (distance - 1) << 4 | (length - 3),
+ *            copying 3 to 18 bytes from 1 to 4096 bytes back
+ *
+ * The window is kept across the frames of an animation, but each frame ends
+ * on a whole token; flags left in its last group are ignored.
+ */
+
+#define LZSS_WINDOW_BITS 12
+#define LZSS_LENGTH_BITS 4
+#define LZSS_WINDOW (1 << LZSS_WINDOW_BITS)
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + (1 << LZSS_LENGTH_BITS) - 1)
+
+typedef void (*lzss_output_t)(const uint8_t *data, unsigned int len);
+
+struct lzss_stats
+{
+  unsigned int bytes_in;
+  unsigned int bytes_out;
+  unsigned int errors;
+  unsigned int decode_us; // not counting the output callback
+};
+
+// Starts a new stream, decoded bytes are passed to output in order
+void lzss_reset(lzss_output_t output);
+void lzss_feed(const uint8_t *data, unsigned int len);
+// Called at the end of each frame, returns false if it ended mid-token
+bool lzss_frame_end(void);
+void lzss_get_stats(struct lzss_stats *stats);
+
+#endif
@@ -1,14 +1,17 @@
 #include <stdio.h>
+#include "sdkconfig.h"
 #include "nvs_flash.h"
 #include "common.h"
 #include "wifi.h"
 #include "dns.h"
 #include "led.h"
 #include "http.h"
+#include "udp.h"
 #include "bt.h"
 
 void app_main(void)
 {
+#if !CONFIG_IDF_TARGET_LINUX
   // Initialize NVS
   esp_err_t ret = nvs_flash_init();
   if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
@@ -17,13 +20,20 @@ void app_main(void)
     ret = nvs_flash_init();
   }
   ESP_ERROR_CHECK(ret);
+#endif
 
   QueueHandle_t led_event_queue = xQueueCreate(16, sizeof(struct message));
 
   /* wifi_init_softap(led_event_queue); */
   /* start_webserver(led_event_queue);
+  start_udp_listener(led_event_queue);
   start_mdns(); */
   start_led_strip(led_event_queue);
+#if CONFIG_IDF_TARGET_LINUX
+  // The simulator serves /animate and the UDP columns on localhost, with no Wi-Fi to bring up
+  start_webserver(led_event_queue);
+  start_udp_listener(led_event_queue);
+#endif
   /* start_dns_hijack(); */
 
   bt_init(led_event_queue);
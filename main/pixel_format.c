@@ -0,0 +1,119 @@
+#include "pixel_format.h"
+
+_Static_assert(LED_COUNT % 2 == 0, "RGB444 packs pixels by pairs");
+
+static const struct pixel_format_info infos[PIXEL_FORMAT_COUNT] = {
+  [PIXEL_FORMAT_RGB888] = {3, LED_COUNT * 3},
+  [PIXEL_FORMAT_PALETTE8] = {1, LED_COUNT},
+  [PIXEL_FORMAT_RGB565] = {2, LED_COUNT * 2},
+  [PIXEL_FORMAT_RGB444] = {3, LED_COUNT * 3 / 2},
+};
+
+// Gamma corrected (2.8, as in the app) level of each bit-replicated value
+static const uint8_t level5[32] = {
+  0, 0, 0, 0, 1, 2, 3, 4, 6, 8, 11, 14, 18, 22, 27, 33,
+  40, 48, 56, 64, 75, 86, 98, 110, 126, 140, 156, 173, 193, 213, 233, 255,
+};
+
+static const uint8_t level6[64] = {
+  0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 4, 4,
+  6, 7, 8, 9, 10, 12, 13, 15, 17, 19, 21, 24, 26, 29, 32, 35,
+  39, 42, 46, 50, 54, 58, 62, 67, 72, 77, 82, 87, 93, 99, 105, 112,
+  120, 127, 135, 142, 150, 158, 167, 175, 184, 193, 203, 213, 223, 233, 244, 255,
+};
+
+static const uint8_t level4[16] = {
+  0, 0, 1, 3, 6, 12, 20, 30, 44, 61, 82, 107, 137, 171, 210, 255,
+};
+
+// Only used by the transport task
+static enum pixel_format format;
+static uint8_t palette[PIXEL_PALETTE_SIZE][3]; // GRB
+static unsigned int palette_received;
+
+bool pixel_format_set(enum pixel_format new_format)
+{
+  if (new_format >= PIXEL_FORMAT_COUNT)
+  {
+    format = PIXEL_FORMAT_RGB888;
+    return false;
+  }
+  format = new_format;
+  return true;
+}
+
+enum pixel_format pixel_format_get(void)
+{
+  return format;
+}
+
+const struct pixel_format_info *pixel_format_info(void)
+{
+  return &infos[format];
+}
+
+void pixel_format_palette_begin(void)
+{
+  palette_received = 0;
+}
+
+void pixel_format_palette_feed(const uint8_t *data, unsigned int len)
+{
+  for (; len > 0 && palette_received < sizeof(palette); len--, palette_received++)
+  {
+    // R and G swap places
+    static const uint8_t wire_offset[3] = {1, 0, 2};
+    palette[palette_received / 3][wire_offset[palette_received % 3]] = *data++;
+  }
+}
+
+void pixel_format_expand(const uint8_t *packed, uint8_t *grb)
+{
+  uint8_t *end = grb + LED_COUNT * 3;
+
+  switch (format)
+  {
+  case PIXEL_FORMAT_RGB888:
+    for (; grb < end; grb += 3, packed += 3)
+    {
+      grb[0] = packed[1];
+      grb[1] = packed[0];
+      grb[2] = packed[2];
+    }
+    break;
+
+  case PIXEL_FORMAT_PALETTE8:
+    for (; grb < end; grb += 3)
+    {
+      const uint8_t *colour = palette[*packed++];
+      grb[0] = colour[0];
+      grb[1] = colour[1];
+      grb[2] = colour[2];
+    }
+    break;
+
+  case PIXEL_FORMAT_RGB565:
+    for (; grb < end; grb += 3, packed += 2)
+    {
+      grb[0] = level6[(packed[0] & 0x07) << 3 | packed[1] >> 5];
+      grb[1] = level5[packed[0] >> 3];
+      grb[2] = level5[packed[1] & 0x1f];
+    }
+    break;
+
+  case PIXEL_FORMAT_RGB444:
+    for (; grb < end; grb += 6, packed += 3)
+    {
+      grb[0] = level4[packed[0] & 0x0f];
+      grb[1] = level4[packed[0] >> 4];
+      grb[2] = level4[packed[1] >> 4];
+      grb[3] = level4[packed[2] >> 4];
+      grb[4] = level4[packed[1] & 0x0f];
+      grb[5] = level4[packed[2] & 0x0f];
+    }
+    break;
+
+  default:
+    break;
+  }
+}
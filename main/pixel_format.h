@@ -0,0 +1,47 @@
+#ifndef __PIXEL_FORMAT_H_
+#define __PIXEL_FORMAT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "led.h"
+
+/*
+ * Packing of the columns of an animation, chosen by PIXEL_BEGIN. Every
+ * column message (PIXEL_DATA, PIXEL_CODED, PIXEL_LZ) carries packed columns,
+ * which are expanded to the strip's wire order when they enter the ring.
+ *
+ * RGB888 is gamma corrected by the app. The reduced formats carry levels
+ * before gamma correction, which the expansion tables apply, so their steps
+ * are even to the eye. Palette colours are gamma corrected like RGB888.
+ */
+
+enum pixel_format
+{
+  PIXEL_FORMAT_RGB888,   // R, G, B
+  PIXEL_FORMAT_PALETTE8, // index into the palette of the last PIXEL_PALETTE
+  PIXEL_FORMAT_RGB565,   // big-endian RRRRRGGG GGGBBBBB
+  PIXEL_FORMAT_RGB444,   // two pixels in RRRRGGGG BBBBRRRR GGGGBBBB
+  PIXEL_FORMAT_COUNT
+};
+
+#define PIXEL_PALETTE_SIZE 256
+
+// Ops of the column codec cover whole units: one pixel, or two in RGB444
+struct pixel_format_info
+{
+  unsigned int unit_bytes;
+  unsigned int column_bytes;
+};
+
+bool pixel_format_set(enum pixel_format format);
+enum pixel_format pixel_format_get(void);
+const struct pixel_format_info *pixel_format_info(void);
+
+// PIXEL_PALETTE payload: RGB triplets for entries 0, 1, ... in order
+void pixel_format_palette_begin(void);
+void pixel_format_palette_feed(const uint8_t *data, unsigned int len);
+
+// Expands a packed column into LED_COUNT GRB pixels
+void pixel_format_expand(const uint8_t *packed, uint8_t *grb);
+
+#endif
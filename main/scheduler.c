@@ -0,0 +1,110 @@
+#include "scheduler.h"
+
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+/*
+ * Columns are due on a fixed grid, t_start + n * period, so timer latency
+ * never accumulates. The task sleeps until SCHEDULER_SPIN_US before the
+ * deadline and spins the rest, which absorbs the wake-up latency.
+ */
+
+// Wake-up latency of the esp_timer task, covered by spinning
+#define SCHEDULER_SPIN_US 50
+
+static const int64_t jitter_bounds[] = SCHEDULER_JITTER_BUCKET_BOUNDS;
+
+#if !CONFIG_IDF_TARGET_LINUX
+static esp_timer_handle_t wake_timer;
+
+static void scheduler_wake(void *arg)
+{
+  xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+void scheduler_init(void)
+{
+  esp_timer_create_args_t timer_args = {
+      .callback = scheduler_wake,
+      .arg = xTaskGetCurrentTaskHandle(),
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "column",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &wake_timer));
+}
+
+static void scheduler_sleep(int64_t sleep_us)
+{
+  ESP_ERROR_CHECK(esp_timer_start_once(wake_timer, sleep_us));
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+#else
+// The host has no esp_timer: sleep whole ticks, the spin covers the rest
+void scheduler_init(void)
+{
+}
+
+static void scheduler_sleep(int64_t sleep_us)
+{
+  TickType_t ticks = sleep_us / (1000 * portTICK_PERIOD_MS);
+  if (ticks > 1)
+  {
+    vTaskDelay(ticks - 1);
+  }
+}
+#endif
+
+void scheduler_start(struct column_scheduler *scheduler, int64_t period_us)
+{
+  scheduler->t_start = esp_timer_get_time();
+  scheduler->period_us = period_us;
+  scheduler->column = 0;
+  memset(&scheduler->stats, 0, sizeof(scheduler->stats));
+}
+
+static void scheduler_record(struct scheduler_stats *stats, int64_t jitter_us)
+{
+  int bucket = 0;
+  while (bucket < SCHEDULER_JITTER_BUCKETS - 1 && jitter_us > jitter_bounds[bucket])
+  {
+    bucket++;
+  }
+  stats->histogram[bucket]++;
+  stats->columns++;
+  stats->total_jitter_us += jitter_us;
+  if (jitter_us > stats->max_jitter_us)
+  {
+    stats->max_jitter_us = jitter_us;
+  }
+}
+
+int64_t scheduler_wait(struct column_scheduler *scheduler)
+{
+  scheduler->column++;
+  int64_t deadline = scheduler->t_start + scheduler->column * scheduler->period_us;
+  int64_t t_now = esp_timer_get_time();
+
+  if (t_now > deadline + scheduler->period_us)
+  {
+    // A whole column late: restart the grid from here rather than playing the missed columns back to back
+    scheduler->stats.resyncs++;
+    scheduler->t_start = t_now;
+    scheduler->column = 0;
+    return t_now;
+  }
+
+  if (deadline - t_now > SCHEDULER_SPIN_US)
+  {
+    scheduler_sleep(deadline - t_now - SCHEDULER_SPIN_US);
+  }
+  while ((t_now = esp_timer_get_time()) < deadline)
+  {
+  }
+
+  scheduler_record(&scheduler->stats, t_now - deadline);
+  return t_now;
+}
@@ -0,0 +1,33 @@
+#ifndef __SCHEDULER_H_
+#define __SCHEDULER_H_
+
+#include <stdint.h>
+
+// Upper bounds, in microseconds, of the lateness histogram buckets. The last bucket has no bound.
+#define SCHEDULER_JITTER_BUCKET_BOUNDS {5, 10, 20, 50, 100, 200, 500, 1000}
+#define SCHEDULER_JITTER_BUCKETS 9
+
+struct scheduler_stats
+{
+  unsigned int columns;
+  unsigned int histogram[SCHEDULER_JITTER_BUCKETS];
+  int64_t max_jitter_us;
+  int64_t total_jitter_us;
+  unsigned int resyncs;
+};
+
+struct column_scheduler
+{
+  int64_t t_start;
+  int64_t period_us;
+  unsigned int column;
+  struct scheduler_stats stats;
+};
+
+// Must be called from the task that will wait on the scheduler
+void scheduler_init(void);
+void scheduler_start(struct column_scheduler *scheduler, int64_t period_us);
+// Sleeps until the next column is due and returns when its refresh should start
+int64_t scheduler_wait(struct column_scheduler *scheduler);
+
+#endif
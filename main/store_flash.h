@@ -0,0 +1,25 @@
+#ifndef __STORE_FLASH_H_
+#define __STORE_FLASH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Implemented by the storage (store_partition.c on the ESP32, store_sim.c on
+ * the host). Behaves like NOR flash: erased bytes read 0xff and writes can
+ * only clear bits, so a range must be erased before it is written again.
+ */
+
+#define STORE_FLASH_SECTOR 4096
+
+// Returns the size of the storage in bytes, 0 when there is none
+size_t store_flash_init(void);
+// offset and size are multiples of STORE_FLASH_SECTOR
+bool store_flash_erase(size_t offset, size_t size);
+bool store_flash_write(size_t offset, const void *data, size_t size);
+// Maps the whole storage for reading, NULL on failure
+const uint8_t *store_flash_map(void);
+void store_flash_unmap(void);
+
+#endif
@@ -0,0 +1,61 @@
+#include "store_flash.h"
+
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+
+/*
+ * Stored columns live in their own data partition (see partitions.csv), so
+ * flashing a new firmware leaves them in place.
+ */
+
+#define STORE_PARTITION_LABEL "columns"
+#define STORE_PARTITION_SUBTYPE 0x40
+
+static const char *TAG = "pixelstick-store";
+
+static const esp_partition_t *partition;
+static spi_flash_mmap_handle_t map_handle;
+static const void *map;
+
+size_t store_flash_init(void)
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, STORE_PARTITION_SUBTYPE, STORE_PARTITION_LABEL);
+  if (partition == NULL)
+  {
+    ESP_LOGE(TAG, "no \"%s\" partition, stored animations are disabled", STORE_PARTITION_LABEL);
+    return 0;
+  }
+  ESP_LOGI(TAG, "%" PRIu32 " KB at 0x%" PRIx32 " for stored animations", partition->size / 1024, partition->address);
+  return partition->size;
+}
+
+bool store_flash_erase(size_t offset, size_t size)
+{
+  return esp_partition_erase_range(partition, offset, size) == ESP_OK;
+}
+
+bool store_flash_write(size_t offset, const void *data, size_t size)
+{
+  return esp_partition_write(partition, offset, data, size) == ESP_OK;
+}
+
+const uint8_t *store_flash_map(void)
+{
+  if (map == NULL &&
+      esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &map, &map_handle) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "cannot map the stored animations");
+    map = NULL;
+  }
+  return map;
+}
+
+void store_flash_unmap(void)
+{
+  if (map != NULL)
+  {
+    spi_flash_munmap(map_handle);
+    map = NULL;
+  }
+}
@@ -0,0 +1,117 @@
+#include "store_flash.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "esp_log.h"
+
+/*
+ * Host stand-in for the flash partition: a file of the partition's size,
+ * mapped like esp_partition_mmap() does. Writes AND into the existing bytes
+ * as NOR flash does, so a missing erase shows up as corrupted columns.
+ */
+
+#define STORE_SIM_DEFAULT_PATH "pixelstick_flash.bin"
+// Size of the "columns" partition in partitions.csv
+#define STORE_SIM_SIZE 0x270000
+
+static const char *TAG = "pixelstick-store";
+
+static int fd = -1;
+static const uint8_t *map;
+
+size_t store_flash_init(void)
+{
+  const char *path = getenv("PIXELSTICK_SIM_FLASH");
+  if (path == NULL)
+  {
+    path = STORE_SIM_DEFAULT_PATH;
+  }
+
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+  {
+    ESP_LOGE(TAG, "cannot open %s, stored animations are disabled", path);
+    return 0;
+  }
+  // A new file reads as erased flash
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < STORE_SIM_SIZE)
+  {
+    static uint8_t erased[STORE_FLASH_SECTOR];
+    memset(erased, 0xff, sizeof(erased));
+    for (off_t offset = size - size % STORE_FLASH_SECTOR; offset < STORE_SIM_SIZE; offset += STORE_FLASH_SECTOR)
+    {
+      pwrite(fd, erased, sizeof(erased), offset);
+    }
+  }
+  ESP_LOGI(TAG, "%u KB in %s for stored animations", STORE_SIM_SIZE / 1024, path);
+  return STORE_SIM_SIZE;
+}
+
+bool store_flash_erase(size_t offset, size_t size)
+{
+  static uint8_t erased[STORE_FLASH_SECTOR];
+  memset(erased, 0xff, sizeof(erased));
+
+  for (size_t end = offset + size; offset < end; offset += STORE_FLASH_SECTOR)
+  {
+    if (pwrite(fd, erased, sizeof(erased), offset) != sizeof(erased))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool store_flash_write(size_t offset, const void *data, size_t size)
+{
+  uint8_t current[STORE_FLASH_SECTOR];
+
+  while (size > 0)
+  {
+    size_t n = size < sizeof(current) ? size : sizeof(current);
+    if (pread(fd, current, n, offset) != n)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+      current[i] &= ((const uint8_t *)data)[i];
+    }
+    if (pwrite(fd, current, n, offset) != n)
+    {
+      return false;
+    }
+    data = (const uint8_t *)data + n;
+    offset += n;
+    size -= n;
+  }
+  return true;
+}
+
+const uint8_t *store_flash_map(void)
+{
+  if (map == NULL)
+  {
+    void *p = mmap(NULL, STORE_SIM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+      ESP_LOGE(TAG, "cannot map the stored animations");
+      return NULL;
+    }
+    map = p;
+  }
+  return map;
+}
+
+void store_flash_unmap(void)
+{
+  if (map != NULL)
+  {
+    munmap((void *)map, STORE_SIM_SIZE);
+    map = NULL;
+  }
+}
@@ -0,0 +1,125 @@
+#include "udp.h"
+#include "udp_stream.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <freertos/task.h>
+#include "esp_timer.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#else
+#include "lwip/sockets.h"
+#endif
+
+/*
+ * Listener of the UDP column stream (udp_stream.h), on port 4243 of the
+ * soft-AP, or of localhost in the simulator, e.g. with
+ *
+ *   python3 tools/udp_replay.py capture.pcap --loss 0.02
+ *
+ * Replies go to whoever sent the last datagram. On the ESP32 the socket
+ * blocks for a tick at most so timeouts and credits are looked at; in the
+ * simulator it is polled without blocking so the FreeRTOS POSIX port keeps
+ * scheduling the LED task.
+ */
+
+static const char *TAG = "pixelstick-udp";
+
+static int udp_listen(void)
+{
+  int port = UDP_STREAM_PORT;
+  uint32_t address = INADDR_ANY;
+#if CONFIG_IDF_TARGET_LINUX
+  const char *env = getenv("PIXELSTICK_SIM_UDP_PORT");
+  if (env)
+  {
+    port = atoi(env);
+  }
+  address = INADDR_LOOPBACK;
+#endif
+
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+  if (sock < 0)
+  {
+    ESP_LOGE(TAG, "Unable to create socket");
+    return -1;
+  }
+
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(port),
+      .sin_addr.s_addr = htonl(address),
+  };
+
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    ESP_LOGE(TAG, "Unable to bind port %d", port);
+    close(sock);
+    return -1;
+  }
+
+#if CONFIG_IDF_TARGET_LINUX
+  fcntl(sock, F_SETFL, O_NONBLOCK);
+#else
+  struct timeval timeout = {.tv_usec = portTICK_PERIOD_MS * 1000};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+  ESP_LOGI(TAG, "Listening for columns on UDP port %d", port);
+  return sock;
+}
+
+static void udp_task(void *arg)
+{
+  static uint8_t packet[UDP_STREAM_MAX_PACKET];
+  uint8_t reply[UDP_STREAM_MAX_REPLY];
+  struct sockaddr_in sender = {0};
+  int sock = udp_listen();
+
+  if (sock < 0)
+  {
+    vTaskDelete(NULL);
+    return;
+  }
+
+  while (true)
+  {
+    struct sockaddr_in source;
+    socklen_t source_len = sizeof(source);
+    int len = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&source, &source_len);
+
+    if (len > 0)
+    {
+      sender = source;
+      udp_stream_packet(packet, len, esp_timer_get_time());
+    }
+    else if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+      ESP_LOGE(TAG, "recvfrom failed: %d", errno);
+    }
+
+    size_t reply_len = udp_stream_poll(esp_timer_get_time(), reply);
+    if (reply_len > 0 && sender.sin_family == AF_INET)
+    {
+      sendto(sock, reply, reply_len, 0, (struct sockaddr *)&sender, sizeof(sender));
+    }
+
+#if CONFIG_IDF_TARGET_LINUX
+    if (len <= 0)
+    {
+      vTaskDelay(1);
+    }
+#endif
+  }
+}
+
+void start_udp_listener(QueueHandle_t led_event_queue)
+{
+  udp_stream_init(led_event_queue);
+
+  xTaskCreatePinnedToCore(udp_task, "udp", configMINIMAL_STACK_SIZE * 5,
+                          NULL, 5, NULL, NET_CORE);
+}
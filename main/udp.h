@@ -0,0 +1,8 @@
+#ifndef __UDP_H_
+#define __UDP_H_
+
+#include "common.h"
+
+void start_udp_listener(QueueHandle_t led_event_queue);
+
+#endif
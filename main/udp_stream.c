@@ -0,0 +1,318 @@
+#include "udp_stream.h"
+#include "column_ring.h"
+#include "pixel_format.h"
+
+#include <stdatomic.h>
+
+static const char *TAG = "pixelstick-udp";
+
+static QueueHandle_t led_event_queue;
+// Column limit last granted by the LED task
+static atomic_uint limit;
+
+static struct
+{
+  bool active; // columns of the session are taken
+  bool known;  // session is the last animation's, active or not
+  uint16_t session;
+  unsigned int column_bytes;
+  int64_t reorder_us;   // how long a missing column is waited for
+  unsigned int next;    // index of the next column to publish
+  unsigned int highest; // one past the furthest column received
+  bool ended;
+  unsigned int total; // columns in the animation, once ended
+  // Columns next, next + 1, ... received, by index modulo the ring
+  bool arrived[COLUMN_RING_SLOTS];
+  int64_t gap_since_us; // when the missing column next was first passed, 0 when none
+  int64_t last_packet_us;
+  int64_t first_column_us;
+  int64_t last_column_us;
+  unsigned int acked_limit;
+  bool report_pending;
+} stream;
+
+static struct udp_stream_stats stats;
+
+static uint32_t read_u32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void write_u32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+void udp_stream_init(QueueHandle_t queue)
+{
+  led_event_queue = queue;
+}
+
+static void udp_stream_finish(bool aborted)
+{
+  struct message event = {
+      .type = ANIMATE_END,
+      .animate_end = {
+          .aborted = aborted,
+          .source = SOURCE_UDP,
+      },
+  };
+  xQueueSend(led_event_queue, &event, 100);
+  column_ring_unclaim(SOURCE_UDP);
+
+  stream.active = false;
+  stream.report_pending = !aborted;
+  ESP_LOGI(TAG, "Received %u columns: %u held, %u reordered, %u late, %u dropped",
+           stats.columns, stats.held, stats.reordered, stats.late, stats.dropped);
+}
+
+static void udp_stream_begin(uint16_t session, unsigned int speed, enum pixel_format format, int64_t now_us)
+{
+  if (stream.active)
+  {
+    ESP_LOGW(TAG, "session %u replaces session %u", session, stream.session);
+    udp_stream_finish(true);
+  }
+
+  // Palettes would need a message of their own, which could be lost
+  if (speed < 1 || format >= PIXEL_FORMAT_COUNT || format == PIXEL_FORMAT_PALETTE8)
+  {
+    ESP_LOGE(TAG, "session %u: unsupported speed %u or format %u", session, speed, format);
+    return;
+  }
+  // The pixel format and the ring are the streaming transport's; the sender repeats BEGIN
+  if (!column_ring_claim(SOURCE_UDP))
+  {
+    ESP_LOGW(TAG, "session %u: another transport is streaming", session);
+    return;
+  }
+  pixel_format_set(format);
+
+  memset(&stream, 0, sizeof(stream));
+  memset(&stats, 0, sizeof(stats));
+  stream.known = true;
+  stream.session = session;
+  stream.column_bytes = pixel_format_info()->column_bytes;
+  stream.reorder_us = UDP_REORDER_COLUMNS * 1000000LL / speed;
+  stream.last_packet_us = now_us;
+  atomic_store(&limit, 0);
+
+  struct message event = {
+      .type = ANIMATE_BEGIN,
+      .animate_begin = {
+          .animation_speed = speed,
+          .first_column = column_ring_count(),
+          .source = SOURCE_UDP,
+      },
+  };
+  stream.active = xQueueSend(led_event_queue, &event, 100) == pdTRUE;
+  if (!stream.active)
+  {
+    column_ring_unclaim(SOURCE_UDP);
+    return;
+  }
+  ESP_LOGI(TAG, "Session %u at %u columns/s", session, speed);
+}
+
+// Expands a column into its slot, ahead of the next one if some are missing
+static void udp_stream_place(unsigned int index, const uint8_t *packed, int64_t now_us)
+{
+  unsigned int ahead = index - stream.next;
+
+  if ((int)ahead < 0 || (stream.ended && index >= stream.total) ||
+      (ahead < COLUMN_RING_SLOTS && stream.arrived[index % COLUMN_RING_SLOTS]))
+  {
+    stats.late++;
+    return;
+  }
+
+  // Not as far as the slot of the previous column, which gaps are filled from
+  uint8_t *slot = column_ring_reserve(ahead);
+  if (slot == NULL)
+  {
+    stats.dropped++;
+    return;
+  }
+
+  pixel_format_expand(packed, slot);
+  stream.arrived[index % COLUMN_RING_SLOTS] = true;
+  if (index + 1 < stream.highest)
+  {
+    stats.reordered++;
+  }
+  else
+  {
+    stream.highest = index + 1;
+  }
+  if (stream.first_column_us == 0)
+  {
+    stream.first_column_us = now_us;
+  }
+  stream.last_column_us = now_us;
+}
+
+// Publishes the columns received in order, holding the previous column for
+// those given up on
+static void udp_stream_publish(int64_t now_us)
+{
+  while (!(stream.ended && stream.next == stream.total))
+  {
+    bool *arrived = &stream.arrived[stream.next % COLUMN_RING_SLOTS];
+
+    if (*arrived)
+    {
+      *arrived = false;
+    }
+    else
+    {
+      unsigned int known = stream.ended ? stream.total : stream.highest;
+      if (stream.next >= known)
+      {
+        break;
+      }
+
+      // Later columns came: this one is late or lost
+      if (stream.gap_since_us == 0)
+      {
+        stream.gap_since_us = now_us;
+      }
+      if (known - stream.next - 1 < UDP_REORDER_COLUMNS && now_us - stream.gap_since_us < stream.reorder_us)
+      {
+        break;
+      }
+
+      uint8_t *slot = column_ring_reserve(0);
+      if (slot == NULL)
+      {
+        // The ring is full, until the LED task plays on
+        break;
+      }
+      const uint8_t *previous = stream.next > 0 ? column_ring_recent(0) : NULL;
+      if (previous != NULL)
+      {
+        memcpy(slot, previous, COLUMN_BYTES);
+      }
+      else
+      {
+        memset(slot, 0, COLUMN_BYTES);
+      }
+      stats.held++;
+    }
+
+    column_ring_commit();
+    stream.next++;
+    stream.gap_since_us = 0;
+    stats.columns++;
+  }
+}
+
+void udp_stream_packet(const uint8_t *data, size_t len, int64_t now_us)
+{
+  if (len < UDP_STREAM_HEADER_BYTES || data[0] != UDP_STREAM_MAGIC)
+  {
+    return;
+  }
+
+  uint16_t session = data[2] | data[3] << 8;
+  const uint8_t *payload = data + UDP_STREAM_HEADER_BYTES;
+  len -= UDP_STREAM_HEADER_BYTES;
+
+  if (data[1] == UDP_BEGIN)
+  {
+    if (len >= 2 && !(stream.known && session == stream.session))
+    {
+      udp_stream_begin(session, payload[0], payload[1], now_us);
+    }
+    return;
+  }
+  if (!stream.active || session != stream.session || len < 4)
+  {
+    return;
+  }
+  stream.last_packet_us = now_us;
+
+  switch (data[1])
+  {
+  case UDP_COLUMNS:
+    if ((len - 4) % stream.column_bytes != 0)
+    {
+      ESP_LOGE(TAG, "%u bytes are not whole columns", (unsigned int)(len - 4));
+      break;
+    }
+    for (unsigned int i = 0; i < (len - 4) / stream.column_bytes; i++)
+    {
+      udp_stream_place(read_u32(payload) + i, payload + 4 + i * stream.column_bytes, now_us);
+    }
+    break;
+
+  case UDP_END:
+    if (!stream.ended)
+    {
+      stream.ended = true;
+      stream.total = read_u32(payload);
+      if (stream.total < stream.next)
+      {
+        stream.total = stream.next;
+      }
+    }
+    break;
+  }
+}
+
+size_t udp_stream_poll(int64_t now_us, uint8_t *reply)
+{
+  if (stream.active)
+  {
+    if (!stream.ended && now_us - stream.last_packet_us >= UDP_IDLE_TIMEOUT_MS * 1000LL)
+    {
+      // The sender is gone, or its END was lost
+      ESP_LOGW(TAG, "session %u timed out", stream.session);
+      stream.ended = true;
+      stream.total = stream.highest > stream.next ? stream.highest : stream.next;
+    }
+    udp_stream_publish(now_us);
+    if (stream.ended && stream.next == stream.total)
+    {
+      udp_stream_finish(false);
+    }
+  }
+
+  reply[0] = UDP_STREAM_MAGIC;
+  reply[2] = stream.session;
+  reply[3] = stream.session >> 8;
+
+  if (stream.report_pending)
+  {
+    stream.report_pending = false;
+    reply[1] = UDP_REPORT;
+    write_u32(reply + 4, stats.columns);
+    write_u32(reply + 8, stats.held);
+    write_u32(reply + 12, stats.late);
+    write_u32(reply + 16, stats.dropped);
+    write_u32(reply + 20, (stream.last_column_us - stream.first_column_us) / 1000);
+    return UDP_STREAM_MAX_REPLY;
+  }
+
+  unsigned int granted = atomic_load_explicit(&limit, memory_order_relaxed);
+  if (stream.active && granted != stream.acked_limit)
+  {
+    stream.acked_limit = granted;
+    reply[1] = UDP_ACK;
+    write_u32(reply + 4, granted);
+    return UDP_STREAM_HEADER_BYTES + 4;
+  }
+  return 0;
+}
+
+void udp_stream_get_stats(struct udp_stream_stats *out)
+{
+  *out = stats;
+}
+
+void udp_stream_ack(unsigned int v)
+{
+  atomic_store_explicit(&limit, v, memory_order_relaxed);
+}
@@ -0,0 +1,83 @@
+#ifndef __UDP_STREAM_H_
+#define __UDP_STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Connectionless real-time columns over Wi-Fi, in the spirit of DDP and
+ * E1.31: the sender paces datagrams at the playback rate and nothing is
+ * resent. Every datagram starts with
+ *
+ *   u8  'P'
+ *   u8  type
+ *   u16 session   picked by the sender for each animation
+ *
+ * followed by, little-endian like the Bluetooth frames:
+ *
+ *   UDP_BEGIN    u8 speed, u8 pixel format (not palette8)
+ *   UDP_COLUMNS  u32 index of the first column, then whole packed columns
+ *   UDP_END      u32 number of columns in the animation
+ *
+ * BEGIN and END may be lost too, senders repeat them; repeats are ignored.
+ * BEGIN is also ignored while another transport streams (see
+ * column_ring_claim()), so a repeat may start the animation late.
+ * Columns go into the ring by index, so reordered ones take their place. A
+ * column still missing once UDP_REORDER_COLUMNS later ones arrived, or as
+ * long as it takes to play that many, is given up: the previous column is
+ * held in its place so the rest stays on time. Columns with no free slot,
+ * from a sender running ahead of playback, are dropped.
+ *
+ * The device answers the sender with
+ *
+ *   UDP_ACK      u32 column limit, the credit of the other transports;
+ *                senders may pace themselves with it instead of the clock
+ *   UDP_REPORT   u32 columns, held, late, dropped, then u32 ms from the
+ *                first column received to the last, once the animation
+ *                is over
+ */
+
+#define UDP_STREAM_PORT 4243
+#define UDP_STREAM_MAGIC 'P'
+#define UDP_STREAM_HEADER_BYTES 4
+// Largest datagram taken: one Ethernet MTU
+#define UDP_STREAM_MAX_PACKET 1472
+#define UDP_STREAM_MAX_REPLY 24
+
+#define UDP_REORDER_COLUMNS 4
+// Without any datagram for this long the animation ends with what came
+#define UDP_IDLE_TIMEOUT_MS 2000
+
+enum udp_stream_type
+{
+  UDP_BEGIN,
+  UDP_COLUMNS,
+  UDP_END,
+  UDP_ACK,
+  UDP_REPORT
+};
+
+struct udp_stream_stats
+{
+  unsigned int columns;   // put in the ring, held ones included
+  unsigned int held;      // lost, replaced by the column before
+  unsigned int reordered; // arrived after a later one
+  unsigned int late;      // arrived after being given up, or twice
+  unsigned int dropped;   // no room in the ring
+};
+
+void udp_stream_init(QueueHandle_t led_event_queue);
+
+// Called from the listener's task, for each datagram and whenever it is idle.
+// udp_stream_poll() returns the length of a reply to send back, 0 for none.
+void udp_stream_packet(const uint8_t *data, size_t len, int64_t now_us);
+size_t udp_stream_poll(int64_t now_us, uint8_t *reply);
+
+void udp_stream_get_stats(struct udp_stream_stats *stats);
+
+// Called from the LED task
+void udp_stream_ack(unsigned int limit);
+
+#endif
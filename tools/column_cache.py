@@ -0,0 +1,73 @@
+# Planning of PIXEL_CACHED ops (see main/column_cache.h), mirroring the app:
+# columns the device already has are replayed instead of being sent again.
+COPY = 0x00
+PLAY = 0x40
+STORE = 0x80
+REPEAT = 0xc0
+ENTRIES = 16
+MAX_BACK = 62
+MAX_REPEAT = 64
+
+
+def plan(columns):
+    """How each column gets to the device: ('new', entry to store it in or
+    None), ('repeat',), ('copy', back) or ('play', entry)"""
+    next_seen = [None] * len(columns)
+    last = {}
+    for x in reversed(range(len(columns))):
+        next_seen[x] = last.get(columns[x])
+        last[columns[x]] = x
+
+    seen = {}
+    dictionary = {}
+    owners = [None] * ENTRIES
+    victim = 0
+    steps = []
+    for x, column in enumerate(columns):
+        p = seen.get(column)
+        if x > 0 and column == columns[x - 1]:
+            step = ('repeat',)
+        elif p is not None and x - 1 - p <= MAX_BACK:
+            step = ('copy', x - 1 - p)
+        elif column in dictionary:
+            step = ('play', dictionary[column])
+        else:
+            # Keep it if it comes back too late to be copied from the ring
+            entry = None
+            if next_seen[x] is not None and next_seen[x] - 1 - x > MAX_BACK:
+                entry = victim
+                victim = (victim + 1) % ENTRIES
+                if owners[entry] is not None:
+                    del dictionary[owners[entry]]
+                owners[entry] = column
+                dictionary[column] = entry
+            step = ('new', entry)
+        seen[column] = x
+        steps.append(step)
+    return steps
+
+
+def encode_ops(steps):
+    """PIXEL_CACHED payload replaying a run of columns that are not new"""
+    out = bytearray()
+    i = 0
+    while i < len(steps):
+        if steps[i][0] == 'repeat':
+            n = 1
+            while i + n < len(steps) and steps[i + n][0] == 'repeat' and n < MAX_REPEAT:
+                n += 1
+            out.append(REPEAT | (n - 1))
+            i += n
+            continue
+        out.append((COPY if steps[i][0] == 'copy' else PLAY) | steps[i][1])
+        i += 1
+    return bytes(out)
+
+
+def encode_stores(steps):
+    """PIXEL_CACHED payload storing the new columns just sent, the last of steps being the last column"""
+    out = bytearray()
+    for i, step in enumerate(steps):
+        if step[0] == 'new' and step[1] is not None:
+            out += bytes([STORE | step[1], len(steps) - 1 - i])
+    return bytes(out)
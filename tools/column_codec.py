@@ -0,0 +1,114 @@
+# Column coding of MSG_HEADER_PIXEL_CODED frames (see main/column_codec.h),
+# mirroring the app's encoder. Run on images to compare the compression
+# ratios of the pixel formats and wire formats against 24-bit columns, with
+# deflate as a reference for what a heavier codec would give:
+#
+#   python3 tools/column_codec.py images/*.png
+import itertools
+import sys
+import zlib
+
+import lzss
+
+SKIP = 0x00
+RUN = 0x40
+LITERAL = 0x80
+MAX_PIXELS = 64
+
+
+def encode_column(column, previous, unit=3):
+    """Codes one packed column against the previous one"""
+    pixels = len(column) // unit
+    out = bytearray()
+
+    def pixel(data, i):
+        return data[i * unit:i * unit + unit]
+
+    def same(i):
+        return pixel(column, i) == pixel(previous, i)
+
+    def run_length(i):
+        n = 1
+        while i + n < pixels and n < MAX_PIXELS and pixel(column, i + n) == pixel(column, i):
+            n += 1
+        return n
+
+    i = 0
+    while i < pixels:
+        if same(i):
+            n = 1
+            while i + n < pixels and n < MAX_PIXELS and same(i + n):
+                n += 1
+            out.append(SKIP | (n - 1))
+        elif run_length(i) >= 2:
+            n = run_length(i)
+            out.append(RUN | (n - 1))
+            out += pixel(column, i)
+        else:
+            # Literal pixels until something cheaper starts
+            n = 1
+            while i + n < pixels and n < MAX_PIXELS and not same(i + n) and run_length(i + n) < 2:
+                n += 1
+            out.append(LITERAL | (n - 1))
+            out += column[i * unit:(i + n) * unit]
+        i += n
+    return bytes(out)
+
+
+def encode_columns(columns, unit=3):
+    """Codes an animation's columns, starting from a column of zeros"""
+    previous = bytes(len(columns[0])) if columns else b''
+    for column in columns:
+        yield encode_column(column, previous, unit)
+        previous = column
+
+
+def compress_frames(frames):
+    """LZSS compresses each frame, as sent in MSG_HEADER_PIXEL_LZ frames"""
+    encoder = lzss.Encoder()
+    return [encoder.encode(frame) for frame in frames]
+
+
+def main():
+    from sim_stream import load_columns
+    import column_cache
+    import pixel_format
+
+    columns_per_frame = 8
+    print('%-24s %-9s %8s %8s %8s %8s %8s %8s' %
+          ('', 'format', 'packed', 'coded', 'lz', 'lz+coded', '+cached', 'deflate'))
+    for path in sys.argv[1:]:
+        columns = load_columns(path, 332)
+        raw = sum(len(c) for c in columns)
+        palette = pixel_format.palette_of(columns)
+
+        for name, fmt in pixel_format.NAMES.items():
+            if fmt == pixel_format.PALETTE8 and palette is None:
+                continue
+            packed = pixel_format.pack_columns(columns, fmt, palette)
+            coded = list(encode_columns(packed, pixel_format.UNIT_BYTES[fmt]))
+
+            def frames(payloads):
+                return [b''.join(payloads[x:x + columns_per_frame]) for x in range(0, len(payloads), columns_per_frame)]
+
+            # Only new columns are coded, the others are replayed by cache ops
+            steps = column_cache.plan(packed)
+            new = [c for c, step in zip(packed, steps) if step[0] == 'new']
+            cached = (sum(len(f) for f in compress_frames(frames(list(encode_columns(new, pixel_format.UNIT_BYTES[fmt])))))
+                      + sum(len(column_cache.encode_ops(list(run)))
+                            for is_new, run in itertools.groupby(steps, lambda step: step[0] == 'new') if not is_new)
+                      + 2 * sum(1 for step in steps if step[0] == 'new' and step[1] is not None))
+
+            sizes = [
+                sum(len(c) for c in packed),
+                sum(len(c) for c in coded),
+                sum(len(f) for f in compress_frames(frames(packed))),
+                sum(len(f) for f in compress_frames(frames(coded))),
+                cached,
+                len(zlib.compress(b''.join(coded), 9)),
+            ]
+            print('%-24s %-9s ' % (path, name) + ' '.join('%7.2fx' % (raw / s) for s in sizes))
+
+
+if __name__ == '__main__':
+    main()
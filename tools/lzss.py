@@ -0,0 +1,65 @@
+# LZSS compression of MSG_HEADER_PIXEL_LZ frames (see main/lzss.h),
+# mirroring the app's encoder.
+WINDOW_BITS = 12
+LENGTH_BITS = 4
+WINDOW = 1 << WINDOW_BITS
+MIN_MATCH = 3
+MAX_MATCH = MIN_MATCH + (1 << LENGTH_BITS) - 1
+# Candidates tried per position, most recent first
+MAX_CHAIN = 16
+
+
+class Encoder:
+    """Compresses the frames of one animation, sharing the window between frames"""
+
+    def __init__(self):
+        self.history = bytearray()
+        self.chains = {}
+
+    def _insert(self, i):
+        key = bytes(self.history[i:i + MIN_MATCH])
+        if len(key) == MIN_MATCH:
+            self.chains.setdefault(key, []).append(i)
+
+    def encode(self, data):
+        start = len(self.history)
+        self.history += data
+        history = self.history
+        end = len(history)
+        out = bytearray()
+        flags_at = 0
+        tokens = 8
+
+        # Positions before the frame could not be indexed until now
+        for i in range(max(0, start - MIN_MATCH + 1), start):
+            self._insert(i)
+
+        i = start
+        while i < end:
+            if tokens == 8:
+                flags_at = len(out)
+                out.append(0)
+                tokens = 0
+
+            best, distance = 0, 0
+            for j in reversed(self.chains.get(bytes(history[i:i + MIN_MATCH]), [])[-MAX_CHAIN:]):
+                if i - j > WINDOW:
+                    break
+                n = 0
+                while n < MAX_MATCH and i + n < end and history[j + n] == history[i + n]:
+                    n += 1
+                if n > best:
+                    best, distance = n, i - j
+
+            if best >= MIN_MATCH:
+                out[flags_at] |= 1 << tokens
+                out += (((distance - 1) << LENGTH_BITS) | (best - MIN_MATCH)).to_bytes(2, 'big')
+            else:
+                best = 1
+                out.append(history[i])
+            for k in range(i, i + best):
+                self._insert(k)
+            i += best
+            tokens += 1
+
+        return bytes(out)
@@ -0,0 +1,53 @@
+# Packing of columns in the pixel formats chosen by PIXEL_BEGIN (see
+# main/pixel_format.h), mirroring the app. Columns are RGB before gamma
+# correction: RGB888 and palette colours are gamma corrected here, the
+# reduced formats carry levels that the firmware corrects.
+RGB888 = 0
+PALETTE8 = 1
+RGB565 = 2
+RGB444 = 3
+
+NAMES = {'rgb888': RGB888, 'palette8': PALETTE8, 'rgb565': RGB565, 'rgb444': RGB444}
+# Bytes covered by one op of the column codec
+UNIT_BYTES = {RGB888: 3, PALETTE8: 1, RGB565: 2, RGB444: 3}
+PALETTE_SIZE = 256
+
+GAMMA = bytes(int((v / 255) ** 2.8 * 255 + 0.5) for v in range(256))
+
+
+def _level(v, bits):
+    return (v * ((1 << bits) - 1) + 127) // 255
+
+
+def palette_of(columns):
+    """Gamma corrected colours of the columns, None if there are too many"""
+    colours = set()
+    for column in columns:
+        for i in range(0, len(column), 3):
+            colours.add(bytes(GAMMA[v] for v in column[i:i + 3]))
+            if len(colours) > PALETTE_SIZE:
+                return None
+    return sorted(colours)
+
+
+def pack_columns(columns, fmt, palette=None):
+    packed = []
+    index = {colour: i for i, colour in enumerate(palette or [])}
+    for column in columns:
+        out = bytearray()
+        pixels = [column[i:i + 3] for i in range(0, len(column), 3)]
+        if fmt == RGB888:
+            out = bytearray(GAMMA[v] for v in column)
+        elif fmt == PALETTE8:
+            out = bytearray(index[bytes(GAMMA[v] for v in p)] for p in pixels)
+        elif fmt == RGB565:
+            for r, g, b in pixels:
+                v = _level(r, 5) << 11 | _level(g, 6) << 5 | _level(b, 5)
+                out += v.to_bytes(2, 'big')
+        elif fmt == RGB444:
+            for (r0, g0, b0), (r1, g1, b1) in zip(pixels[0::2], pixels[1::2]):
+                out += bytes([_level(r0, 4) << 4 | _level(g0, 4),
+                              _level(b0, 4) << 4 | _level(r1, 4),
+                              _level(g1, 4) << 4 | _level(b1, 4)])
+        packed.append(bytes(out))
+    return packed
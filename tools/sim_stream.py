@@ -0,0 +1,375 @@
+# Streams an image to the host simulator (or anything speaking the SPP
+# protocol over TCP) the same way the app does, and reports throughput.
+#
+#   python3 tools/sim_stream.py images/gradient.png --speed 90
+#
+# With --store the image is uploaded to the device's library in flash
+# instead, --play replays it (or the newest image) from there without
+# streaming anything, and --list shows the library. Without any of them an
+# image the device already has is played from flash rather than streamed.
+# --store-bmp uploads a BMP file as it is, the device transposes it.
+#
+# With --http the columns are POSTed to /animate instead (port 8080 in the
+# simulator), where TCP back-pressure replaces the ACKs.
+import argparse
+import http.client
+import socket
+import struct
+import time
+
+import png
+
+import column_cache
+import lzss
+import pixel_format
+from column_codec import encode_columns
+
+MSG_HEADER_HELLO = 0
+MSG_HEADER_PIXEL_COUNT = 1
+MSG_HEADER_PIXEL_DATA = 2
+MSG_HEADER_PIXEL_BEGIN = 3
+MSG_HEADER_PIXEL_ACK = 4
+MSG_HEADER_PIXEL_END = 5
+MSG_HEADER_PIXEL_CODED = 6
+MSG_HEADER_PIXEL_LZ = 7
+MSG_HEADER_PIXEL_PALETTE = 8
+MSG_HEADER_PIXEL_CACHED = 9
+MSG_HEADER_STORE_BEGIN = 10
+MSG_HEADER_STORE_PLAY = 11
+MSG_HEADER_STORE_QUERY = 12
+MSG_HEADER_STORE_ENTRY = 13
+MSG_HEADER_STORE_FILE = 14
+
+# STORE_BEGIN format of a BMP file upload
+BMP_UPLOAD_FORMAT = 0x80
+
+PROTOCOL_VERSION = 1
+
+
+def send(sock, header, payload=b''):
+    sock.sendall(struct.pack('<IB', len(payload), header) + payload)
+
+
+def recv_exact(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError('connection closed')
+        data += chunk
+    return data
+
+
+def expect(sock, header):
+    length, got = struct.unpack('<IB', recv_exact(sock, 5))
+    payload = recv_exact(sock, length)
+    assert got == header, 'expected message %d, got %d' % (header, got)
+    return payload
+
+
+def parse_capabilities(payload):
+    """PIXEL_COUNT reply; firmware from before version 1 only sends the LED count"""
+    caps = {'led_count': struct.unpack_from('<I', payload)[0], 'version': 0,
+            'formats': 1 << pixel_format.RGB888,
+            'messages': (1 << MSG_HEADER_HELLO | 1 << MSG_HEADER_PIXEL_DATA |
+                         1 << MSG_HEADER_PIXEL_BEGIN | 1 << MSG_HEADER_PIXEL_END),
+            'ring_columns': 32, 'max_column_rate': 200, 'max_frame_bytes': 1 << 16, 'store_columns': 0}
+    if len(payload) >= 16:
+        (caps['version'], caps['formats'], caps['messages'], caps['ring_columns'],
+         caps['max_column_rate'], caps['max_frame_bytes']) = struct.unpack_from('<BBHHHI', payload, 4)
+    if len(payload) >= 20:
+        caps['store_columns'] = struct.unpack_from('<I', payload, 16)[0]
+    return caps
+
+
+def speed_format(caps):
+    """Speeds are a u16 for devices of version 1 or later, a u8 before"""
+    return 'H' if caps['version'] >= 1 else 'B'
+
+
+def fnv1a64(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+def image_hash(fmt, palette, columns):
+    """64-bit FNV-1a of what the device stores, the app's identifier for an image"""
+    return fnv1a64(b''.join([bytes([fmt])] + (palette or []) + columns))
+
+
+def query(sock, index=0, h=None):
+    """STORE_QUERY by index or hash, None when the device has no such image"""
+    send(sock, MSG_HEADER_STORE_QUERY, struct.pack('<Q', h) if h is not None else bytes([index]))
+    payload = expect(sock, MSG_HEADER_STORE_ENTRY)
+    count, index, h, columns, speed, fmt = struct.unpack('<BBQIHB' if len(payload) == 17 else '<BBQIBB', payload)
+    if index == 0xff:
+        return count, None
+    return count, {'index': index, 'hash': h, 'columns': columns, 'speed': speed, 'format': fmt}
+
+
+def store_bmp(sock, caps, path, speed):
+    """Uploads a BMP file in STORE_FILE chunks of a column each, one credit per chunk"""
+    data = open(path, 'rb').read()
+    width = struct.unpack_from('<i', data, 18)[0]
+    assert len(data) >= 54 and data[:2] == b'BM', 'not a BMP file'
+    assert width <= caps['store_columns'], 'the image does not fit in the storage'
+    chunk_bytes = caps['led_count'] * 3
+    chunks = [data[i:i + chunk_bytes] for i in range(0, len(data), chunk_bytes)]
+    per_frame = max(1, min(8, caps['ring_columns'] // 4, caps['max_frame_bytes'] // chunk_bytes))
+    h = fnv1a64(data)
+
+    send(sock, MSG_HEADER_STORE_BEGIN, struct.pack('<%sBQI' % speed_format(caps), speed, BMP_UPLOAD_FORMAT, h, width))
+    t_begin = time.monotonic()
+    limit = struct.unpack('<I', expect(sock, MSG_HEADER_PIXEL_ACK))[0]
+    x = 0
+    while x < len(chunks):
+        if x >= limit:
+            limit = max(limit, struct.unpack('<I', expect(sock, MSG_HEADER_PIXEL_ACK))[0])
+            continue
+        n = min(per_frame, limit - x, len(chunks) - x)
+        send(sock, MSG_HEADER_STORE_FILE, b''.join(chunks[x:x + n]))
+        x += n
+    send(sock, MSG_HEADER_PIXEL_END, bytes([0]))
+    elapsed = time.monotonic() - t_begin
+    print('sent %s (%d bytes, %d columns) as image %016x in %.2f s' % (path, len(data), width, h, elapsed))
+
+
+def post_animate(args):
+    """Streams the image as one POST /animate body of raw columns, or a BMP file with --store-bmp"""
+    if args.store_bmp:
+        body = open(args.image, 'rb').read()
+        query = 'format=bmp&store=1&hash=%x' % fnv1a64(body)
+    else:
+        fmt = pixel_format.NAMES['rgb565' if args.format == 'auto' else args.format]
+        assert fmt != pixel_format.PALETTE8, 'no palettes over HTTP'
+        columns = pixel_format.pack_columns(load_columns(args.image, args.leds), fmt)
+        body = b''.join(columns)
+        query = 'format=%s' % [n for n, f in pixel_format.NAMES.items() if f == fmt][0]
+        if args.store:
+            query += '&store=1&hash=%x' % image_hash(fmt, None, columns)
+    query += '&speed=%d' % (args.speed or 30)
+
+    conn = http.client.HTTPConnection(args.host, args.port if args.port != 4242 else 8080)
+    t_begin = time.monotonic()
+    conn.request('POST', '/animate?' + query, body=body)
+    response = conn.getresponse()
+    elapsed = time.monotonic() - t_begin
+    print('%d %s %s, %d bytes in %.2f s (%.0f KB/s)' %
+          (response.status, response.reason, response.read().decode().strip(), len(body), elapsed,
+           len(body) / elapsed / 1024))
+
+
+def load_columns(path, pixels):
+    width, height, rows, info = png.Reader(filename=path).asRGBA8()
+    rows = [bytes(r) for r in rows]
+    columns = []
+    for x in range(width):
+        column = bytearray(pixels * 3)
+        for y in range(pixels):
+            src = rows[y * height // pixels]
+            column[y * 3:y * 3 + 3] = src[x * 4:x * 4 + 3]
+        columns.append(bytes(column))
+    return columns
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('image', nargs='?')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=4242)
+    parser.add_argument('--speed', type=int, help="columns per second (1-255 before protocol 1), default 30, or the upload's with --play")
+    parser.add_argument('--columns-per-frame', type=int, help='columns batched in each frame, default from the device')
+    parser.add_argument('--codec', choices=['auto', 'raw', 'coded', 'lz'], default='auto',
+                        help='PIXEL_DATA, PIXEL_CODED or PIXEL_LZ frames, auto picks the best the device takes')
+    parser.add_argument('--format', choices=['auto'] + list(pixel_format.NAMES), default='auto',
+                        help='pixel format, auto picks palette8 for images of up to 256 colours, else rgb565')
+    parser.add_argument('--no-cache', action='store_true', help='send every column, even those the device has')
+    parser.add_argument('--store', action='store_true', help='upload the image to flash instead of playing it')
+    parser.add_argument('--play', action='store_true', help='play the image from flash, the newest without an image')
+    parser.add_argument('--list', action='store_true', help='list the images stored in flash')
+    parser.add_argument('--store-bmp', action='store_true', help='upload a BMP file as it is to flash')
+    parser.add_argument('--http', action='store_true', help='POST the image to /animate instead, on port 8080 by default')
+    parser.add_argument('--leds', type=int, default=332, help='LED count, for --http which has no HELLO')
+    parser.add_argument('--no-library', action='store_true', help='stream the image even when the device has it')
+    parser.add_argument('--protocol', type=int, default=PROTOCOL_VERSION,
+                        help='version sent in HELLO, 0 behaves like an app from before capabilities')
+    args = parser.parse_args()
+
+    if args.http:
+        assert args.image, 'no image given'
+        post_animate(args)
+        return
+
+    sock = socket.create_connection((args.host, args.port))
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    send(sock, MSG_HEADER_HELLO, bytes([args.protocol]) if args.protocol else b'')
+    caps = parse_capabilities(expect(sock, MSG_HEADER_PIXEL_COUNT))
+    pixels = caps['led_count']
+
+    library = caps['messages'] & (1 << MSG_HEADER_STORE_QUERY) != 0
+    if args.store_bmp:
+        assert caps['messages'] & (1 << MSG_HEADER_STORE_FILE), 'the device cannot take BMP files'
+        assert args.image, 'no image given'
+        store_bmp(sock, caps, args.image, args.speed or 30)
+        time.sleep(1)
+        sock.close()
+        return
+    if args.store or args.play or args.list:
+        assert caps['messages'] & (1 << MSG_HEADER_STORE_BEGIN), 'the device cannot store animations'
+    if args.list:
+        assert library, 'the device cannot list its animations'
+        names = {fmt: name for name, fmt in pixel_format.NAMES.items()}
+        names[BMP_UPLOAD_FORMAT] = 'bmp'
+        count, entry = query(sock)
+        for index in range(count):
+            if index:
+                count, entry = query(sock, index)
+            if entry:
+                print('%d: %016x, %d columns at %d columns/s, %s' %
+                      (index, entry['hash'], entry['columns'], entry['speed'],
+                       names.get(entry['format'], entry['format'])))
+        sock.close()
+        return
+    if args.play and not args.image:
+        send(sock, MSG_HEADER_STORE_PLAY, struct.pack('<' + speed_format(caps), args.speed) if args.speed else b'')
+        sock.close()
+        return
+    assert args.image, 'no image given'
+    if args.speed is None:
+        args.speed = 30
+
+    columns = load_columns(args.image, pixels)
+    print('%d pixels, %d columns, protocol %d, formats 0x%02x, messages 0x%04x, %d columns buffered, '
+          'up to %d columns/s, %d columns of storage' %
+          (pixels, len(columns), caps['version'], caps['formats'], caps['messages'],
+           caps['ring_columns'], caps['max_column_rate'], caps['store_columns']))
+    if args.store:
+        assert len(columns) <= caps['store_columns'], 'the image does not fit in the storage'
+
+    def has_message(header):
+        return caps['messages'] & (1 << header) != 0
+
+    def has_format(fmt):
+        return caps['formats'] & (1 << fmt) != 0
+
+    if args.speed > caps['max_column_rate']:
+        print('speed limited to %d columns/s' % caps['max_column_rate'])
+        args.speed = caps['max_column_rate']
+
+    palette = pixel_format.palette_of(columns)
+    if args.format == 'auto':
+        if palette and has_format(pixel_format.PALETTE8) and has_message(MSG_HEADER_PIXEL_PALETTE):
+            fmt = pixel_format.PALETTE8
+        elif has_format(pixel_format.RGB565):
+            fmt = pixel_format.RGB565
+        else:
+            fmt = pixel_format.RGB888
+    else:
+        fmt = pixel_format.NAMES[args.format]
+        assert has_format(fmt), 'format %s not supported by the device' % args.format
+    if args.codec == 'auto':
+        args.codec = ('lz' if has_message(MSG_HEADER_PIXEL_LZ) else
+                      'coded' if has_message(MSG_HEADER_PIXEL_CODED) else 'raw')
+    if not has_message(MSG_HEADER_PIXEL_CACHED):
+        args.no_cache = True
+    column_bytes = pixels * 3 // 2 if fmt == pixel_format.RGB444 else pixels * pixel_format.UNIT_BYTES[fmt]
+    if args.columns_per_frame is None:
+        args.columns_per_frame = max(1, min(8, caps['ring_columns'] // 4, caps['max_frame_bytes'] // column_bytes))
+    if fmt == pixel_format.PALETTE8:
+        assert palette, 'more than %d colours' % pixel_format.PALETTE_SIZE
+    else:
+        palette = None
+    columns = pixel_format.pack_columns(columns, fmt, palette)
+    h = image_hash(fmt, palette, columns)
+
+    # Replay the image from the library when the device already has it
+    if library and not args.store and (args.play or not args.no_library):
+        t_begin = time.monotonic()
+        count, entry = query(sock, h=h)
+        if entry:
+            send(sock, MSG_HEADER_STORE_PLAY, struct.pack('<%sQ' % speed_format(caps), args.speed if args.play and args.speed else 0, h))
+            print('image %016x found in the library, played from flash after %.1f ms' %
+                  (h, (time.monotonic() - t_begin) * 1000))
+            sock.close()
+            return
+        assert not args.play, 'image %016x is not in the library' % h
+        print('image %016x not in the library (%d images), streaming it' % (h, count))
+    elif args.play:
+        send(sock, MSG_HEADER_STORE_PLAY, struct.pack('<%sQ' % speed_format(caps), args.speed if args.speed else 0, h))
+        sock.close()
+        return
+    if palette:
+        send(sock, MSG_HEADER_PIXEL_PALETTE, b''.join(palette))
+
+    # Only new columns are sent, the others are replayed by cache ops
+    steps = [('new', None)] * len(columns) if args.no_cache else column_cache.plan(columns)
+    new = [c for c, step in zip(columns, steps) if step[0] == 'new']
+    if args.codec == 'raw':
+        header, payloads = MSG_HEADER_PIXEL_DATA, new
+    else:
+        header, payloads = MSG_HEADER_PIXEL_CODED, list(encode_columns(new, pixel_format.UNIT_BYTES[fmt]))
+    compressor = lzss.Encoder() if args.codec == 'lz' else None
+
+    # A 1-byte BEGIN means RGB888, which older firmware also understands
+    if args.store:
+        send(sock, MSG_HEADER_STORE_BEGIN, struct.pack('<%sBQI' % speed_format(caps), args.speed, fmt, h, len(columns)))
+    else:
+        speed = struct.pack('<' + speed_format(caps), args.speed)
+        send(sock, MSG_HEADER_PIXEL_BEGIN, speed + bytes([fmt]) if fmt != pixel_format.RGB888 else speed)
+    t_begin = time.monotonic()
+    acks = []
+    # Acks carry the total number of columns we may have sent
+    limit = struct.unpack('<I', expect(sock, MSG_HEADER_PIXEL_ACK))[0]
+    acks.append(limit)
+
+    frames = 0
+    sent = 0
+    x = 0
+    k = 0  # new columns sent
+    while x < len(columns):
+        if x >= limit:
+            limit = max(limit, struct.unpack('<I', expect(sock, MSG_HEADER_PIXEL_ACK))[0])
+            acks.append(limit)
+            continue
+
+        budget = min(limit, len(columns)) - x
+        is_new = steps[x][0] == 'new'
+        n = 1
+        while n < budget and (steps[x + n][0] == 'new') == is_new and (not is_new or n < args.columns_per_frame):
+            n += 1
+
+        if is_new:
+            payload = b''.join(payloads[k:k + n])
+            if compressor:
+                payload = compressor.encode(payload)
+                send(sock, MSG_HEADER_PIXEL_LZ, payload)
+            else:
+                send(sock, header, payload)
+            stores = column_cache.encode_stores(steps[x:x + n])
+            if stores:
+                send(sock, MSG_HEADER_PIXEL_CACHED, stores)
+                frames += 1
+            sent += len(payload) + len(stores)
+            k += n
+        else:
+            payload = column_cache.encode_ops(steps[x:x + n])
+            send(sock, MSG_HEADER_PIXEL_CACHED, payload)
+            sent += len(payload)
+        frames += 1
+        x += n
+
+    send(sock, MSG_HEADER_PIXEL_END, bytes([0]))
+    elapsed = time.monotonic() - t_begin
+    print('sent %d columns (%d bytes) in %d frames in %.2f s (%.1f col/s), %d acks, %.1f columns per ack' %
+          (len(columns), sent, frames, elapsed, len(columns) / elapsed,
+           len(acks), len(columns) / len(acks)))
+    # Leave the device time to play or store the buffered tail before disconnecting
+    time.sleep(1 if args.store else 64 / args.speed + 1)
+    sock.close()
+
+
+if __name__ == '__main__':
+    main()
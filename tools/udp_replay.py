@@ -0,0 +1,235 @@
+# Replays a packet capture of the UDP column stream to the device (port
+# 4243, also in the host simulator) with induced loss and reordering, then
+# reports the column rate the device achieved and the gaps it had to fill.
+#
+#   python3 tools/udp_replay.py stream.pcap --record images/gradient.png --speed 120
+#   python3 tools/udp_replay.py stream.pcap --loss 0.02 --reorder 0.05
+#
+# Captures are pcap files, as written by --record or by tcpdump, e.g.
+# 'tcpdump -i any -w stream.pcap udp port 4243'. Datagrams are sent at the
+# times they were captured; each replay gets a session of its own.
+import argparse
+import random
+import socket
+import struct
+import time
+
+import pixel_format
+from sim_stream import load_columns
+
+UDP_STREAM_PORT = 4243
+UDP_BEGIN = 0
+UDP_COLUMNS = 1
+UDP_END = 2
+UDP_ACK = 3
+UDP_REPORT = 4
+# Largest datagram the device takes
+MAX_PACKET = 1472
+# BEGIN and END are repeated in case they are lost
+REPEATS = 3
+
+LINKTYPE_NULL = 0
+LINKTYPE_ETHERNET = 1
+LINKTYPE_RAW = 101
+LINKTYPE_LINUX_SLL = 113
+
+
+def header(kind, session):
+    return struct.pack('<BBH', ord('P'), kind, session)
+
+
+def stream_packets(columns, fmt, speed, columns_per_packet):
+    """(time, datagram) of an animation sent at its playback rate"""
+    session = random.getrandbits(16)
+    packets = [(0, header(UDP_BEGIN, session) + bytes([speed, fmt]))] * REPEATS
+    for first in range(0, len(columns), columns_per_packet):
+        t = first / speed
+        packets.append((t, header(UDP_COLUMNS, session) + struct.pack('<I', first) +
+                        b''.join(columns[first:first + columns_per_packet])))
+    t = len(columns) / speed
+    packets += [(t, header(UDP_END, session) + struct.pack('<I', len(columns)))] * REPEATS
+    return packets
+
+
+def write_pcap(path, packets, port):
+    """Ethernet/IPv4/UDP frames from 10.0.0.2 to the device at 10.0.0.1, checksums left out"""
+    with open(path, 'wb') as f:
+        f.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535, LINKTYPE_ETHERNET))
+        for t, data in packets:
+            udp = struct.pack('>HHHH', 40000, port, 8 + len(data), 0) + data
+            ip = struct.pack('>BBHHHBBH4s4s', 0x45, 0, 20 + len(udp), 0, 0, 64, 17, 0,
+                             bytes([10, 0, 0, 2]), bytes([10, 0, 0, 1])) + udp
+            frame = b'\xff' * 6 + b'\x02' + b'\x00' * 5 + b'\x08\x00' + ip
+            f.write(struct.pack('<IIII', int(t), int(t % 1 * 1e6), len(frame), len(frame)) + frame)
+
+
+def read_pcap(path, port):
+    """(time, datagram) of the UDP datagrams sent to port, times from the first one"""
+    data = open(path, 'rb').read()
+    magic = struct.unpack_from('<I', data)[0]
+    endian = '<' if magic in (0xa1b2c3d4, 0xa1b23c4d) else '>'
+    fraction = 1e-9 if magic in (0xa1b23c4d, 0x4d3cb2a1) else 1e-6
+    linktype = struct.unpack_from(endian + 'I', data, 20)[0] & 0xffff
+    link_bytes = {LINKTYPE_NULL: 4, LINKTYPE_ETHERNET: 14, LINKTYPE_RAW: 0, LINKTYPE_LINUX_SLL: 16}
+    assert linktype in link_bytes, 'unsupported link type %d' % linktype
+
+    packets = []
+    offset = 24
+    while offset + 16 <= len(data):
+        seconds, fractions, length, _ = struct.unpack_from(endian + 'IIII', data, offset)
+        frame = data[offset + 16:offset + 16 + length]
+        offset += 16 + length
+
+        ip = frame[link_bytes[linktype]:]
+        if len(ip) < 20 or ip[0] >> 4 != 4 or ip[9] != 17:
+            continue
+        udp = ip[(ip[0] & 0x0f) * 4:]
+        if len(udp) < 8 or struct.unpack_from('>H', udp, 2)[0] != port:
+            continue
+        datagram = udp[8:struct.unpack_from('>H', udp, 4)[0]]
+        if datagram[:1] == b'P':
+            packets.append((seconds + fractions * fraction, datagram))
+
+    assert packets, 'no datagrams to port %d in %s' % (port, path)
+    t0 = packets[0][0]
+    return [(t - t0, d) for t, d in packets]
+
+
+def induce(packets, loss, burst, reorder, rng):
+    """Drops column datagrams in runs of burst, swaps others with the next one; returns what was lost"""
+    sent, lost = [], []
+    i = 0
+    while i < len(packets):
+        t, data = packets[i]
+        if data[1] == UDP_COLUMNS and rng.random() < loss:
+            for t, data in packets[i:i + burst]:
+                if data[1] == UDP_COLUMNS:
+                    lost.append(data)
+            i += burst
+            continue
+        sent.append((t, data))
+        i += 1
+    for i in range(len(sent) - 1):
+        if sent[i][1][1] == UDP_COLUMNS and sent[i + 1][1][1] == UDP_COLUMNS and rng.random() < reorder:
+            # The later datagram overtakes, at the earlier one's time
+            (t0, d0), (t1, d1) = sent[i], sent[i + 1]
+            sent[i], sent[i + 1] = (t0, d1), (t1, d0)
+    return sent, lost
+
+
+def column_counts(packets):
+    """Columns in each column datagram by its first column, from where the next one starts"""
+    firsts = sorted(set(struct.unpack_from('<I', d, 4)[0] for t, d in packets if d[1] == UDP_COLUMNS))
+    end = [struct.unpack_from('<I', d, 4)[0] for t, d in packets if d[1] == UDP_END]
+    ends = firsts[1:] + [end[0] if end else firsts[-1] + 1]
+    return {first: end - first for first, end in zip(firsts, ends)}
+
+
+def gaps(lost, counts):
+    """Lengths of the runs of consecutive columns lost"""
+    columns = sorted(set(c for data in lost
+                         for first in [struct.unpack_from('<I', data, 4)[0]]
+                         for c in range(first, first + counts[first])))
+    lengths = []
+    for i, column in enumerate(columns):
+        if i and column == columns[i - 1] + 1:
+            lengths[-1] += 1
+        else:
+            lengths.append(1)
+    return lengths
+
+
+def replay(packets, host, port, time_scale, report_timeout):
+    session = random.getrandbits(16)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setblocking(False)
+    acks = 0
+    limit = 0
+    report = None
+
+    def receive():
+        nonlocal acks, limit, report
+        while True:
+            try:
+                data = sock.recv(64)
+            except BlockingIOError:
+                return
+            if data[:1] != b'P' or struct.unpack_from('<H', data, 2)[0] != session:
+                continue
+            if data[1] == UDP_ACK:
+                acks += 1
+                limit = struct.unpack_from('<I', data, 4)[0]
+            elif data[1] == UDP_REPORT:
+                report = dict(zip(('columns', 'held', 'late', 'dropped', 'ms'), struct.unpack_from('<5I', data, 4)))
+
+    t_begin = time.monotonic()
+    for t, data in packets:
+        delay = t * time_scale - (time.monotonic() - t_begin)
+        if delay > 0:
+            time.sleep(delay)
+        sock.sendto(data[:2] + struct.pack('<H', session) + data[4:], (host, port))
+        receive()
+    elapsed = time.monotonic() - t_begin
+
+    deadline = time.monotonic() + report_timeout
+    while report is None and time.monotonic() < deadline:
+        time.sleep(0.01)
+        receive()
+    return elapsed, acks, limit, report
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('capture', help='pcap file to replay, or to write with --record')
+    parser.add_argument('--record', metavar='IMAGE', help='write a capture of the image streamed at --speed instead')
+    parser.add_argument('--speed', type=int, default=60, help='columns per second when recording')
+    parser.add_argument('--format', choices=['rgb888', 'rgb565', 'rgb444'], default='rgb565',
+                        help='pixel format when recording')
+    parser.add_argument('--leds', type=int, default=332, help='LED count when recording')
+    parser.add_argument('--columns-per-packet', type=int, default=1, help='columns in each datagram when recording')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=UDP_STREAM_PORT,
+                        help='where to send, and the destination port of the datagrams in the capture')
+    parser.add_argument('--loss', type=float, default=0, help='probability of losing a column datagram')
+    parser.add_argument('--burst', type=int, default=1, help='datagrams lost together')
+    parser.add_argument('--reorder', type=float, default=0, help='probability of swapping a datagram with the next')
+    parser.add_argument('--seed', type=int, help='seed of the induced loss and reordering')
+    parser.add_argument('--time-scale', type=float, default=1, help='multiplies the capture times, < 1 sends faster')
+    args = parser.parse_args()
+
+    if args.record:
+        fmt = pixel_format.NAMES[args.format]
+        columns = pixel_format.pack_columns(load_columns(args.record, args.leds), fmt)
+        assert len(columns[0]) * args.columns_per_packet + 8 <= MAX_PACKET, 'datagrams too large'
+        packets = stream_packets(columns, fmt, args.speed, args.columns_per_packet)
+        write_pcap(args.capture, packets, args.port)
+        print('wrote %d datagrams, %d columns at %d columns/s' % (len(packets), len(columns), args.speed))
+        return
+
+    packets = read_pcap(args.capture, args.port)
+    begin = [d for t, d in packets if d[1] == UDP_BEGIN]
+    columns = [d for t, d in packets if d[1] == UDP_COLUMNS]
+    assert begin and columns, 'no BEGIN or no columns in the capture'
+    speed = begin[0][4]
+    counts = column_counts(packets)
+    total = sum(counts.values())
+
+    rng = random.Random(args.seed)
+    sent, lost = induce(packets, args.loss, args.burst, args.reorder, rng)
+    elapsed, acks, limit, report = replay(sent, args.host, args.port, args.time_scale, 5)
+
+    lengths = gaps(lost, counts)
+    print('sent %d of %d column datagrams in %.2f s (%.0f columns/s at %d columns/s), %d ACKs up to column %d' %
+          (len(columns) - len(lost), len(columns), elapsed, total / elapsed, speed, acks, limit))
+    print('lost %d of %d columns in %d gaps (longest %d columns)' %
+          (sum(lengths), total, len(lengths), max(lengths, default=0)))
+    if report is None:
+        print('no report from the device')
+        return
+    rate = report['columns'] * 1000 / report['ms'] if report['ms'] else 0
+    print('device: %d columns in %d ms (%.0f columns/s), %d held, %d late, %d dropped' %
+          (report['columns'], report['ms'], rate, report['held'], report['late'], report['dropped']))
+
+
+if __name__ == '__main__':
+    main()